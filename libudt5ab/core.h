@@ -68,6 +68,7 @@ friend class CSndQueue;
 friend class CRcvQueue;
 friend class CSndUList;
 friend class CRcvUList;
+friend class CUDTBench;       // microbenchmarks, see src/udtbench.cc
 
 private: // constructor and desctructor
    CUDT();
@@ -144,6 +144,7 @@ struct CSNode
 class CSndUList
 {
 friend class CSndQueue;
+friend class CUDTBench;       // microbenchmarks, see src/udtbench.cc
 
 public:
    CSndUList();
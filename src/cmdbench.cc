@@ -0,0 +1,337 @@
+// Check the control protocol parser against the regexes it replaced ("make bench")
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+//
+// The std::regex'es below are the ones that etdc_etdserver.cc used to
+// parse commands and replies with. Every line of a corpus of real
+// commands and replies, and of a (repeatable) lot of mutations of them,
+// goes through both; what matched and what was captured must be the same.
+// Then both are timed on the corpus and on a 100k entry directory
+// listing. Exits with 1 if there was any difference.
+//
+//  Usage: cmdbench [number of mutated lines, default 200000]
+#include <etdc_cmdparse.h>
+
+// C++ headers
+#include <regex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+// Plain-old-C
+#include <stdlib.h>
+
+using namespace std;
+using namespace etdc;
+
+// The regexes from before
+namespace rx {
+    static const std::regex::flag_type flags = (std::regex::ECMAScript | std::regex::icase);
+    static const std::regex  Line("([^\\r\\n]+)[\\r\\n]+");
+    static const std::regex  Reply("^(OK|ERR)(\\s+(\\S.*)?)?$", flags);
+    static const std::regex  XferResultReply("^(OK|ERR)(,([0-9]+),([-0-9\\.\\+eE]+)(,([a-z0-9]+:[0-9a-f]+))?(,wire=([0-9]+))?(,lat=([a-z0-9:/]*))?)?(\\s+\\S.*)?$", flags);
+    static const std::regex  Progress("^PROGRESS\\s+([0-9]+),([-0-9\\.\\+eE]+|inf|nan)$", flags);
+    static const std::regex  UUID("^UUID:(\\S+)$", flags);
+    static const std::regex  AlreadyHave("^AlreadyHave:([0-9]+)$", flags);
+    static const std::regex  Remain("^Remain:(-?[0-9]+)$", flags);
+
+    // In the order ETDServerWrapper::handle() tried them, with the
+    // submatches that it used
+    struct command_rx {
+        command_id           id;
+        std::regex           rx;
+        std::vector<size_t>  groups;
+    };
+    static const std::vector<command_rx> commands{
+        { command_id::List,            std::regex("^list\\s+(\\S.*)$", flags), {1} },
+        { command_id::WriteFile,       std::regex("^write-file-(\\S+)\\s+(\\S.*)$", flags), {1, 2} },
+        { command_id::ReadFile,        std::regex("^read-file\\s+([0-9]+)\\s+(\\S.*)$", flags), {1, 2} },
+        { command_id::SendFile,        std::regex("^send-file\\s+(\\S+)\\s+(\\S+)\\s+([0-9]+)\\s+(\\S+)(\\s+(\\S+))?$", flags), {1, 2, 3, 4, 6} },
+        { command_id::DataChannelAddr, std::regex("^data-channel-addr(-ext)?$", flags), {1} },
+        { command_id::RemoveUUID,      std::regex("^(remove-uuid|cancel)\\s+(\\S+)$", flags), {1, 2} },
+        { command_id::ChecksumRanges,  std::regex("^checksum-ranges\\s+(\\S+)\\s+([0-9]+\\+[0-9]+(,[0-9]+\\+[0-9]+)*)$", flags), {1, 2} },
+        { command_id::Rollback,        std::regex("^rollback\\s+(\\S+)\\s+([0-9]+)$", flags), {1, 2} },
+        { command_id::SetPriority,     std::regex("^set-priority\\s+(\\S+)\\s+(\\S+)$", flags), {1, 2} },
+        { command_id::Status,          std::regex("^status$", flags), {} },
+        { command_id::ProtocolVersion, std::regex("^protocol-version$", flags), {} }
+    };
+    static const std::regex  DataSep("<[^>]+>");
+    static const std::regex  RangeSep("([0-9]+)\\+([0-9]+)");
+
+    // decode_data_addr()'s
+    static const std::string ipv6_lit{ "[:0-9a-zA-Z]+(/[0-9]{1,3})?(%[a-zA-Z0-9]+)?" };
+    static const std::string valid_host( "(([a-zA-Z0-9]|[a-zA-Z0-9][a-zA-Z0-9\\-]{0,61}[a-zA-Z0-9])"
+                                         "(\\.([a-zA-Z0-9]|[a-zA-Z0-9][a-zA-Z0-9\\-]{0,61}[a-zA-Z0-9]))*)");
+    static const std::string keyVal( "[^ \t\v,=>]+=[^ \t\v,>]+" );
+    static const std::string options( "(/("+keyVal+ "(," + keyVal + ")*))?" );
+    static const std::regex  SockName("^<([^/]+)/(\\["+ipv6_lit+"\\]|" + valid_host + "):([0-9]+)" + options + ">$");
+}
+
+// Everything both parsers found in a line, as text, so it can be compared
+static std::string with_regex(std::string const& s) {
+    std::ostringstream  oss;
+    std::smatch         m;
+
+    if( std::regex_match(s, m, rx::Reply) )
+        oss << "reply[" << m[1] << "|" << m[3] << "]";
+    if( std::regex_match(s, m, rx::XferResultReply) )
+        oss << "xfer[" << m[1] << "|" << m[3] << "|" << m[4] << "|" << m[6] << "|" << m[8] << "|" << m[10] << "|" << m[11] << "]";
+    if( std::regex_match(s, m, rx::Progress) )
+        oss << "progress[" << m[1] << "|" << m[2] << "]";
+    if( std::regex_match(s, m, rx::UUID) )
+        oss << "uuid[" << m[1] << "]";
+    if( std::regex_match(s, m, rx::AlreadyHave) )
+        oss << "alreadyhave[" << m[1] << "]";
+    if( std::regex_match(s, m, rx::Remain) )
+        oss << "remain[" << m[1] << "]";
+    for(auto const& c: rx::commands) {
+        if( !std::regex_match(s, m, c.rx) )
+            continue;
+        oss << "command" << (unsigned int)c.id << "[";
+        for(auto g: c.groups)
+            oss << m[g] << "|";
+        oss << "]";
+        if( c.id==command_id::SendFile ) {
+            const std::string  addrs( m[4].str() );
+            for(auto a = std::sregex_iterator(addrs.begin(), addrs.end(), rx::DataSep); a!=std::sregex_iterator(); a++)
+                oss << "addr[" << a->str() << "]";
+        }
+        if( c.id==command_id::ChecksumRanges ) {
+            const std::string  ranges( m[2].str() );
+            for(auto r = std::sregex_iterator(ranges.begin(), ranges.end(), rx::RangeSep); r!=std::sregex_iterator(); r++)
+                oss << "range[" << (*r)[1] << "+" << (*r)[2] << "]";
+        }
+        break;
+    }
+    if( std::regex_match(s, m, rx::SockName) )
+        oss << "sockname[" << m[1] << "|" << m[2] << "|" << m[9] << "|" << m[11] << "|" << m[5].length() << "]";
+    return oss.str();
+}
+
+static std::string with_parser(std::string const& s) {
+    std::ostringstream   oss;
+    const token_type     line( s.data(), s.data() + s.size() );
+    reply_type           reply;
+    xfer_reply_type      xfer;
+    progress_reply_type  progress;
+    token_type           value;
+    command_type         cmd;
+    data_addr_type       addr;
+
+    if( parse_reply(line, reply) )
+        oss << "reply[" << reply.status << "|" << reply.info << "]";
+    if( parse_xfer_reply(line, xfer) )
+        oss << "xfer[" << xfer.status << "|" << xfer.nByte << "|" << xfer.deltaT << "|" << xfer.digest << "|" << xfer.wire << "|"
+            << xfer.latency << "|" << xfer.reason << "]";
+    if( parse_progress(line, progress) )
+        oss << "progress[" << progress.done << "|" << progress.rate << "]";
+    if( parse_tagged(line, "UUID:", value_kind::Word, value) )
+        oss << "uuid[" << value << "]";
+    if( parse_tagged(line, "AlreadyHave:", value_kind::Unsigned, value) )
+        oss << "alreadyhave[" << value << "]";
+    if( parse_tagged(line, "Remain:", value_kind::Signed, value) )
+        oss << "remain[" << value << "]";
+    if( parse_command(line, cmd) ) {
+        static const size_t nArg[] = { 1, 2, 2, 5, 1, 2, 0, 2, 2, 2, 0 };
+
+        oss << "command" << (unsigned int)cmd.id << "[";
+        for(size_t i=0; i<nArg[(unsigned int)cmd.id]; i++)
+            oss << cmd.args[i] << "|";
+        oss << "]";
+        if( cmd.id==command_id::SendFile )
+            for_each_data_addr(cmd.args[3], [&](token_type const& a) { oss << "addr[" << a << "]"; });
+        if( cmd.id==command_id::ChecksumRanges )
+            for_each_range(cmd.args[1], [&](token_type const& o, token_type const& n) { oss << "range[" << o << "+" << n << "]"; });
+    }
+    if( parse_data_addr(line, addr) )
+        oss << "sockname[" << addr.protocol << "|" << addr.host << "|" << addr.port << "|" << addr.options << "|"
+            << (addr.bracketed ? 0 : addr.host.size()) << "]";
+    return oss.str();
+}
+
+// Both ways of cutting a buffer into lines: the lines and where the last one ended
+static std::string lines_regex(std::string const& buf) {
+    std::ostringstream  oss;
+    size_t              endpos{ 0 };
+
+    for(auto l = std::sregex_iterator(buf.begin(), buf.end(), rx::Line); l!=std::sregex_iterator(); l++) {
+        oss << "[" << l->str(1) << "]";
+        endpos = l->position() + l->length();
+    }
+    oss << endpos;
+    return oss.str();
+}
+
+static std::string lines_parser(std::string const& buf) {
+    std::ostringstream  oss;
+    char const*         cur = buf.data();
+    token_type          line;
+
+    while( next_line(cur, buf.data() + buf.size(), line) )
+        oss << "[" << line << "]";
+    oss << (cur - buf.data());
+    return oss.str();
+}
+
+static const std::vector<std::string> corpus{
+    // commands
+    "list /data/vlbi/ec064a/", "list   /path with spaces/*.vdif", "write-file-New /tmp/x", "write-file-OverWrite /a b",
+    "write-file-Resume /data/f.m5a", "read-file 0 /data/scan_0001.vdif", "read-file 123456789 /x",
+    "send-file 7d1ac8d0-uuid-src 9a2f-uuid-dst 1048576 <udt/10.88.0.50:8008/mss=1500,max-bw=0>",
+    "send-file a b 100 <tcp/[::1]:8009>,<udt/[fe80::1%eth0]:8008/max-bw=1Gbps> streams=4,checksum=crc32c,latency=1",
+    "send-file a b 100 <tcp/host.example.org:2620> multipath=1", "data-channel-addr", "data-channel-addr-ext",
+    "remove-uuid 7d1ac8d0", "cancel 7d1ac8d0", "protocol-version", "status",
+    "checksum-ranges abc 0+1048576,1048576+1048576,2097152+17", "rollback abc 1048576", "set-priority abc high",
+    // replies
+    "OK", "ERR", "OK 10", "OK /data/vlbi/ec064a/ec064a_ef_no0001.vdif", "ERR No such file or directory", "ERR File exists",
+    "OK crc32c:0a1b2c3d", "OK <udt/10.88.0.50:8008/mss=1500>", "UUID:7d1ac8d0-1234", "AlreadyHave:0", "AlreadyHave:1048576",
+    "Remain:-1", "Remain:42", "OK,1048576,0.51", "ERR,0,0.00 Connection refused", "OK,100,1.5e-3,crc32c:deadbeef",
+    "OK,100,2,wire=50", "OK,100,2,crc32c:00ff,wire=50,lat=disk_read:1/2/3,net_write:4/5/6", "OK,5,1,lat=",
+    "PROGRESS 1048576,1.25e+08", "PROGRESS 0,inf", "PROGRESS 0,nan",
+    // data channel addresses
+    "<udt/127.0.0.1:8008>", "<tcp6/[::]:4004>", "<udt6/[2001:db8::1/64]:8008/mss=9000>", "<tcp/a-b.c-d.example:1/x=y,z=w=v>"
+};
+
+// Characters that make a difference to one or more of the parsers
+static const std::string  interesting( " \t\v\f\r\n,:/<>[]%=+-.0123456789aeEfOKRLxXnN" );
+
+static std::string mutate(std::string s, uint64_t& state) {
+    const auto rnd = [&](size_t n) {
+                        state = state*6364136223846793005ULL + 1442695040888963407ULL;
+                        return (size_t)((state>>33) % (n ? n : 1));
+                     };
+    const size_t nMut = 1 + rnd(3);
+
+    for(size_t i=0; i<nMut; i++) {
+        const size_t  pos = rnd(s.size() + 1);
+        switch( rnd(7) ) {
+            case 0:
+                if( pos<s.size() )
+                    s[pos] = interesting[rnd(interesting.size())];
+                break;
+            case 1:
+                s.insert(pos, 1, interesting[rnd(interesting.size())]);
+                break;
+            case 2:
+                if( pos<s.size() )
+                    s.erase(pos, 1 + rnd(3));
+                break;
+            case 3:
+                if( pos<s.size() )
+                    s[pos] = (char)(::isupper((unsigned char)s[pos]) ? ::tolower((unsigned char)s[pos]) : ::toupper((unsigned char)s[pos]));
+                break;
+            case 4:
+                s.resize(pos);
+                break;
+            case 5:
+                s.insert(pos, s.substr(rnd(s.size() + 1), rnd(8)));
+                break;
+            default:
+                s.insert(pos, 1 + rnd(2), ' ');
+                break;
+        }
+    }
+    return s;
+}
+
+template <typename F>
+static double timeit(double minTime, size_t& n, F f) {
+    using clock_type = std::chrono::steady_clock;
+    const clock_type::time_point  start( clock_type::now() );
+    double                        dt;
+
+    n = 0;
+    do {
+        f();
+        n++;
+    } while( (dt=std::chrono::duration<double>(clock_type::now() - start).count())<minTime );
+    return dt;
+}
+
+int main(int argc, char const*const*const argv) {
+    const long  nFuzz( argc>1 ? ::atol(argv[1]) : 200000 );
+    size_t      nDiff{ 0 }, nMatch{ 0 };
+    uint64_t    state{ 42 };
+
+    if( nFuzz<0 ) {
+        cerr << "Usage: " << argv[0] << " [number of mutated lines, default 200000]" << endl;
+        return 1;
+    }
+    const auto check = [&](std::string const& what, std::string const& s, std::string const& expect, std::string const& got) {
+                            if( expect==got ) {
+                                nMatch += !expect.empty();
+                                return;
+                            }
+                            if( nDiff++<10 )
+                                cout << what << " '" << s << "'" << endl << "   regex:  " << expect << endl << "   parser: " << got << endl;
+                       };
+
+    // Equivalence
+    for(long i=0; i<(long)corpus.size() + nFuzz; i++) {
+        const std::string s( i<(long)corpus.size() ? corpus[i] : mutate(corpus[(size_t)i % corpus.size()], state) );
+        check("line", s, with_regex(s), with_parser(s));
+    }
+    for(long i=0; i<nFuzz/10; i++) {
+        std::string  buf;
+        for(size_t n = 1 + (size_t)i % 4; n>0; n--)
+            buf += mutate(corpus[(size_t)(i*7 + n) % corpus.size()] + "\r\n", state);
+        check("buffer", buf, lines_regex(buf), lines_parser(buf));
+    }
+    cout << corpus.size() + nFuzz << " lines, " << nFuzz/10 << " buffers: " << nMatch << " matched something, " << nDiff << " differences" << endl;
+
+    // Throughput
+    size_t  nRegex, nParser;
+    double  dtRegex  = timeit(1.0, nRegex, [&]( void ) { for(auto const& s: corpus) (void)with_regex(s); });
+    double  dtParser = timeit(1.0, nParser, [&]( void ) { for(auto const& s: corpus) (void)with_parser(s); });
+
+    cout << fixed << setprecision(0)
+         << "all parsers, corpus:  regex " << setw(10) << nRegex*corpus.size()/dtRegex << " lines/s, parser "
+         << setw(10) << nParser*corpus.size()/dtParser << " lines/s" << endl;
+
+    // What ETDProxy::listPath() does with a big directory
+    std::string  listing;
+    for(unsigned int i=0; i<100000; i++)
+        listing += "OK /data/vlbi/ec064a/ec064a_ef_no" + std::to_string(i) + ".vdif\n";
+    listing += "OK\n";
+
+    size_t       nEntry{ 0 };
+    dtRegex = timeit(1.0, nRegex, [&]( void ) {
+                        for(auto l = std::sregex_iterator(listing.begin(), listing.end(), rx::Line); l!=std::sregex_iterator(); l++) {
+                            std::smatch       m;
+                            const std::string line( l->str(1) );
+                            nEntry += std::regex_match(line, m, rx::Reply) && m[3].length()>0;
+                        }
+                     });
+    dtParser = timeit(1.0, nParser, [&]( void ) {
+                        char const* cur = listing.data();
+                        token_type  line;
+                        reply_type  reply;
+                        while( next_line(cur, listing.data() + listing.size(), line) )
+                            nEntry += parse_reply(line, reply) && !reply.info.empty();
+                     });
+    cout << "100k entry listing:   regex " << setw(10) << nRegex*100001/dtRegex << " lines/s, parser "
+         << setw(10) << nParser*100001/dtParser << " lines/s" << endl;
+    return nDiff ? 1 : 0;
+}
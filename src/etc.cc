@@ -25,18 +25,30 @@
 #include <etdc_stringutil.h>
 #include <etdc_streamutil.h>
 #include <etdc_sciprint.h>
+#include <etdc_bench.h>
 #include <argparse.h>
 
 // C++ standard headers
 #include <map>
+#include <set>
+#include <list>
+#include <mutex>
+#include <atomic>
 #include <chrono>
 #include <thread>
 #include <string>
 #include <vector>
+#include <iomanip>
+#include <fstream>
 #include <iterator>
+#include <sstream>
 #include <iostream>
+#include <exception>
 #include <functional>
 
+// Plain-old-C
+#include <unistd.h>
+
 using namespace std;
 namespace AP = argparse;
 
@@ -69,6 +81,15 @@ static const std::regex rxURL{
     , std::regex_constants::ECMAScript | std::regex_constants::icase
 };
 
+// A daemon by itself is the remote prefix of an URL without the ':'
+static const std::regex rxDaemon{
+    "(((tcp|udt)6?):\\/\\/)?"
+    "(([a-z0-9]+)@)?"
+    "([-a-zA-Z0-9_\\.]+|\\[[:0-9a-fA-F]+(/[0-9]{1,3})?(%[a-zA-Z0-9\\.]+)?\\])"
+    "(#([0-9]+))?"
+    , std::regex_constants::ECMAScript | std::regex_constants::icase
+};
+
 // We convert into this type
 struct url_type {
     // URL components - see the regex above
@@ -108,6 +129,15 @@ struct str2url_type:
     }
 
 };
+// which becomes a remote URL with the root as path
+struct str2daemon_type:
+    public AP::detail::conversion_t {
+
+    void operator()(url_type& url, std::string const& s) const {
+        str2url_type()(url, s + ":/");
+    }
+};
+
 template <class CharT, class Traits>
 std::basic_ostream<CharT, Traits>& operator<<(std::basic_ostream<CharT, Traits>& os, url_type const& url) {
     os << (url.isLocal ? "PATH: " : "URL: ");
@@ -145,10 +175,30 @@ using unique_result   = std::unique_ptr<etdc::result_type>;
 // indicated thread using the KillSignal when done.
 #define KILLMAINSIGNAL SIGUSR1
 
+// Each worker transfers files using its own connection(s) to the daemon(s)
+// - an ETDServer or ETDProxy can only do one transfer at a time. The
+// results hold the uuids of the transfer it is currently working on and
+// are protected by the etd_state's lock, as are tid and running.
+struct worker_type {
+    using xferfn_type = std::function<etdc::xfer_result(etdc::uuid_type const&, etdc::uuid_type&, off_t, etdc::dataaddrlist_type const&)>;
+
+    std::vector<etdc::etd_server_ptr> servers;
+    xferfn_type                       fn;
+    unique_result                     results[2];
+    pthread_t                         tid{};
+    bool                              running{ false };
+    // What was last shown of the transfer in progress; under the output lock
+    struct {
+        std::string                           file;
+        off_t                                 todo{ 0 }, done{ 0 };
+        std::chrono::steady_clock::time_point lastChange{};
+        bool                                  shown{ false };
+    }                                 progress;
+};
+using workerlist_type = std::vector<std::unique_ptr<worker_type>>;
+
 template <int KillSignal>
-static void signal_thread( signallist_type const& sigs, pthread_t tid,
-                           etdc::etd_state& state, std::vector<etdc::etd_server_ptr>& servers,
-                           unique_result (&results)[2] ) {
+static void signal_thread( signallist_type const& sigs, etdc::etd_state& state, workerlist_type& workers ) {
     int       received;
     sigset_t  sset;
 
@@ -177,35 +227,48 @@ static void signal_thread( signallist_type const& sigs, pthread_t tid,
 	for(auto xferptr = std::begin(state.transfers); xferptr!=std::end(state.transfers); xferptr++ ) {
 		if( xferptr->second->data_fd ) {
 			ETDCDEBUG(0, "sigwaiterthread: Closing " << xferptr->second->data_fd->getsockname( xferptr->second->data_fd->__m_fd ) << std::endl);
-			xferptr->second->data_fd->close( xferptr->second->data_fd->__m_fd );
+			etdc::close_shared( *xferptr->second->data_fd );
 		}
+        // Striped transfers have a data connection per stripe
+        etdc::scoped_lock   slk( xferptr->second->stripe_lock );
+        for(auto& sfd: xferptr->second->stripe_fds)
+            etdc::close_shared( *sfd );
 	}
-    // (try to) break down from back to front
+
+    // Collect what needs to be cancelled; we can't hold the lock whilst
+    // doing that because a local ETDServer needs it too
+    using cancel_type = std::pair<etdc::etd_server_ptr, etdc::uuid_type>;
+    std::list<cancel_type>  toCancel;
+    {
+        etdc::scoped_lock   lk( state.lock );
+        for(auto const& w: workers) {
+            // (try to) break down from back to front
+            for(int i: {1, 0})
+                if( w->results[i] )
+                    toCancel.emplace_back(w->servers[i], etdc::get_uuid(*w->results[i]));
+        }
+    }
     // note: we MUST TRY ALL OF THEM
     // so we cannot put them all in a single try-catch;
     // a failure to close the first one does not imply
     // that we cannot close the second one.
     // And since the functions throw on wonky we must catch them separately
-    try {
-        if( results[1]  ) {
-            auto uuid = etdc::get_uuid(*results[1] );
-            ETDCDEBUG(4, "sigwaiterthread: removing DST uuid  " << uuid << std::endl);
-            servers[1]->cancel( uuid );
-        }
-    }
-    catch( ... ) { }
-    try {
-        if( results[0]  ) {
-            auto uuid = etdc::get_uuid(*results[0] );
-            ETDCDEBUG(4, "sigwaiterthread: removing SRC uuid  " << uuid << std::endl);
-            servers[0]->cancel( uuid );
+    for(auto const& c: toCancel) {
+        try {
+            ETDCDEBUG(4, "sigwaiterthread: cancelling uuid  " << c.second << std::endl);
+            c.first->cancel( c.second );
         }
+        catch( ... ) { }
     }
-    catch( ... ) { }
 
-    // Now signal the main thread - blocking functions must be kicked so
+    // Now signal the worker thread(s) - blocking functions must be kicked so
     // they can drop out of themselves with e.g. invalid file descriptor
-    ::pthread_kill(tid, KillSignal);
+    {
+        etdc::scoped_lock   lk( state.lock );
+        for(auto const& w: workers)
+            if( w->running )
+                ::pthread_kill(w->tid, KillSignal);
+    }
     ETDCDEBUG(2, "sigwaiterthread: done." << std::endl);
 }
 
@@ -305,6 +368,46 @@ namespace etc {
         }
         return rv;
     }
+
+    // Features that need both ends to support them depend on their
+    // protocol versions. If one of the servers is older than minVersion
+    // say what we do without the feature in stead and return false
+    static bool all_support(std::vector<etdc::etd_server_ptr> const& servers, etdc::protocolversion_type minVersion,
+                            char const* what, char const* otherwise) {
+        for(const auto &srv: servers) {
+            const auto v = srv->protocolVersion();
+            if( v==etdc::ETDServerInterface::unknownProtocolVersion || v<minVersion ) {
+                ETDCDEBUG(-1, "A server does not support " << what << " (protocol version " << v << "), " << otherwise << std::endl);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The data channels of a daemon at 'host' that we can use: wildcard
+    // addresses replaced by the host and, if the user selected some, only
+    // those
+    static etdc::dataaddrlist_type usable_channels(etdc::dataaddrlist_type dataChannels, etdc::host_type const& host,
+                                                   std::vector<unsigned int> const& channels) {
+        static const std::regex  rxWildCard("^(::|0.0.0.0)$");
+        for(auto ptr=dataChannels.begin(); ptr!=dataChannels.end(); ptr++)
+            update_sockname(*ptr, etdc::host_type(std::regex_replace(get_host(*ptr), rxWildCard, host)));
+
+        if( channels.empty() )
+            return dataChannels;
+
+        unsigned int            idx{ 0 };
+        etdc::dataaddrlist_type selected;
+
+        for(auto const& dc: dataChannels) {
+            ETDCDEBUG(4, "Data channel #" << idx << ": " << dc << std::endl);
+            if( std::find(std::begin(channels), std::end(channels), idx++)!=std::end(channels) )
+                selected.push_back( dc );
+        }
+        ETDCASSERT(selected.size()==std::set<unsigned int>(std::begin(channels), std::end(channels)).size(),
+                   "Not all selected data channels exist, there are only " << dataChannels.size());
+        return selected;
+    }
 }
 
 
@@ -328,12 +431,18 @@ int main(int argc, char const*const*const argv) {
     etdc::etd_state             localState{};
     // Let's set up the command line parsing
     int                          message_level = 0;
-    unsigned int                 maxFileRetry{ 2 }, nFileRetry{ 0 };
+    unsigned int                 maxFileRetry{ 2 }, nParallel{ 1 };
     std::chrono::duration<float> retryDelay{ 10 };
     display_format               display( imperial );
     etdc::openmode_type          mode{ etdc::openmode_type::New };
     etdc::numretry_type          connRetry{ 2 };
     etdc::retrydelay_type        connDelay{ 5 };
+    unsigned int                 nStreams{ 1 };
+    std::vector<unsigned int>    channels;
+    off_t                        verifyTail{ 64*1024*1024 };
+    unsigned int                 verifySamples{ 0 };
+    std::string                  compress;
+    etdc::priority_type          priority{ etdc::priority_type::Normal };
 
     AP::ArgumentParser     cmd( AP::version( buildinfo() ),
                                 AP::docstring("'ftp' like etransfer client program.\n"
@@ -350,11 +459,21 @@ int main(int argc, char const*const*const argv) {
     // The URLs from the command line
     unsigned int           nLocal = 0;
     std::vector<url_type>  urls;
+    // or the daemon to ask for its status
+    std::vector<url_type>  daemons;
+    // or the daemon to benchmark the data channels of, and how
+    std::vector<url_type>           benchDaemons;
+    std::vector<size_t>             benchBuffers;
+    std::vector<etdc::mss_type>     benchMSS;
+    std::vector<etdc::max_bw_type>  benchBW;
+    std::vector<unsigned int>       benchStreams;
+    std::string                     benchSize{ "1GiB" };
+    std::string                     benchJSON{ "etc-bench.json" };
 
     // What does our command line look like?
     //
     // <prog> [-h] [--help] [--version] [--max-retry N] [--retry-delay Y]
-    //        [-m <int>] { [--list SRC] | SRC DST }
+    //        [-m <int>] { [--list SRC] | [--status HOST] | [--bench HOST] | SRC DST }
     //        [--imperial|--continental]
     //
     cmd.add( AP::long_name("help"), AP::print_help(),
@@ -431,7 +550,8 @@ int main(int argc, char const*const*const argv) {
                         AP::at_most(1)),
             AP::option(AP::long_name("mode"), AP::at_most(1), AP::store_into(mode),
                         AP::is_member_of({etdc::openmode_type::New, etdc::openmode_type::OverWrite,
-                                      etdc::openmode_type::Resume, etdc::openmode_type::SkipExisting}),
+                                      etdc::openmode_type::Resume, etdc::openmode_type::SkipExisting,
+                                      etdc::openmode_type::Delta}),
                         AP::docstring(std::string("Set file copy mode, default=")+etdc::repr(mode)),
                         AP::convert([](std::string const& s) { std::istringstream iss(s); etdc::openmode_type om; iss >> om; return om; }))
         );
@@ -449,6 +569,13 @@ int main(int argc, char const*const*const argv) {
         AP::option(AP::long_name("list"), AP::collect_into(urls), AP::match(rxURL), AP::at_most(1), str2url_type(),
                    AP::constrain([](url_type const& url) { return !url.isLocal; }, "Can only list remote URLs"),
                    AP::docstring("Request to list the contents of URL")),
+        AP::option(AP::long_name("status"), AP::collect_into(daemons), AP::match(rxDaemon), AP::at_most(1), str2daemon_type(),
+                   AP::docstring("Show the transfers the daemon at [[tcp|udt][6]://][user@]host[#port] is handling and how they are doing. "
+                                 "The daemon must support protocol version 8 or up")),
+        AP::option(AP::long_name("bench"), AP::collect_into(benchDaemons), AP::match(rxDaemon), AP::at_most(1), str2daemon_type(),
+                   AP::docstring("Measure the throughput to the daemon at [[tcp|udt][6]://][user@]host[#port] by sending /dev/zero to its "
+                                 "/dev/null over each of its data channels (see --channel) for every combination of the --bench-* settings. "
+                                 "Prints a table and writes the results as JSON (see --bench-json)")),
         AP::option(AP::collect_into(urls), AP::exactly(2), str2url_type(), AP::match(rxURL),
                    AP::constrain([&](url_type const& url) { if( url.isLocal ) nLocal++; return nLocal<2; }, "At most one local PATH can be given"),
                    AP::docstring("SRC and DST URL/PATH"))
@@ -470,6 +597,91 @@ int main(int argc, char const*const*const argv) {
     cmd.add( AP::store_into(localState.bufSize), AP::long_name("buffer"),
              AP::docstring(std::string("Set send/receive buffer size in bytes. No kMG suffix supported. Default ")+etdc::repr(localState.bufSize)) );
 
+    cmd.add( AP::store_const_into(true, localState.directIO), AP::long_name("direct-io"), AP::at_most(1),
+             AP::docstring("Read and write local files using O_DIRECT, bypassing the page cache, and thus without sendfile(2)/splice(2). Only affects files on this machine; "
+                           "the daemon(s) decide for themselves. Default: off") );
+
+    cmd.add( AP::store_into(localState.ioWindow), AP::long_name("io-window"), AP::at_most(1),
+             AP::docstring(std::string("Read ahead/write behind window for local files in bytes, 0 = leave it to the kernel. No kMG suffix supported. Default ")+etdc::repr(localState.ioWindow)) );
+
+    cmd.add( AP::store_into(nParallel), AP::long_name("parallel"), AP::at_most(1),
+             AP::constrain([](unsigned int n) { return n>0; }, "number of parallel transfers should be > 0"),
+             AP::docstring(std::string("Transfer this many files concurrently, each with their own connections to the daemon(s). Default ")+etdc::repr(nParallel)) );
+
+    cmd.add( AP::store_into(nStreams), AP::long_name("streams"), AP::at_most(1),
+             AP::constrain([](unsigned int n) { return n>0; }, "number of streams should be > 0"),
+             AP::docstring(std::string("Split each file over this many parallel data connections. Both daemons must support protocol version 2 or up. Default ")+etdc::repr(nStreams)) );
+
+    cmd.add( AP::store_true(), AP::long_name("multipath"), AP::at_most(1),
+             AP::docstring("Use all data channels of the receiving daemon at the same time in stead of the first one that connects, "
+                           "e.g. to use all NICs of a multi-homed machine. Paths that are faster carry more of the file and a path "
+                           "that fails is dropped. With --streams N each path gets N connections. Default: off") );
+
+    cmd.add( AP::store_true(), AP::long_name("progress"), AP::at_most(1),
+             AP::docstring("Show the progress of each transfer every second, as reported by the daemon doing the transfer: "
+                           "bytes done, current rate and the estimated time to go. A transfer that doesn't progress is reported as stalled. "
+                           "Both daemons must support protocol version 9 or up. Default: off") );
+
+    cmd.add( AP::store_true(), AP::long_name("checksum"), AP::at_most(1),
+             AP::docstring("Compute a CRC32C checksum of the bytes on both ends of the data connection(s) whilst transferring and compare "
+                           "them; a file whose checksums differ counts as failed. The checksum of the transferred bytes is printed. "
+                           "Both daemons must support protocol version 3 or up. Default: off") );
+
+    std::ostringstream  codecs;
+    for(auto const& c: etdc::codec_names())
+        codecs << (codecs.tellp()>0 ? ", " : "") << c;
+    cmd.add( AP::store_into(compress), AP::long_name("compress"), AP::at_most(1),
+             AP::constrain([](std::string const& c) { return etdc::find_codec(c)!=nullptr; }, "unsupported compression"),
+             AP::docstring("Compress the data connection(s) with this codec (" + codecs.str() + "). Blocks that don't compress "
+                           "are sent as they are. The number of bytes that went over the network is printed. "
+                           "Both daemons must support protocol version 6 or up. Default: off") );
+
+    cmd.add( AP::store_into(priority), AP::long_name("priority"), AP::at_most(1),
+             AP::convert([](std::string const& s) { std::istringstream iss(s); etdc::priority_type p{};
+                                                    ETDCASSERT(iss >> p, "unknown priority class '" << s << "'");
+                                                    return p; }),
+             AP::docstring("The priority class of the transfer(s): bulk, normal or urgent. Daemons divide their bandwidth limits "
+                           "over concurrent transfers by class and may squeeze lower classes whilst higher ones run (see etd --preempt-bw). "
+                           "Both daemons must support protocol version 7 or up. Default: normal") );
+
+    cmd.add( AP::store_into(verifyTail), AP::long_name("verify-tail"), AP::at_most(1),
+             AP::constrain([](off_t v) { return v>=0; }, "number of bytes to verify should be >= 0"),
+             AP::docstring(std::string("When resuming, compare checksums of this many bytes at the end of the existing destination file "
+                                       "to the same bytes of the source and continue from the first block (1MiB) that differs. "
+                                       "0 = trust the destination's size. No kMG suffix supported. Both daemons must support "
+                                       "protocol version 4 or up. Default ")+etdc::repr(verifyTail)) );
+
+    cmd.add( AP::store_into(verifySamples), AP::long_name("verify-samples"), AP::at_most(1),
+             AP::constrain([](unsigned int n) { return n<=1024; }, "number of samples should be <= 1024"),
+             AP::docstring(std::string("When resuming, also compare this many 1MiB blocks spread evenly over the rest of the existing "
+                                       "destination file. Default ")+etdc::repr(verifySamples)) );
+
+    cmd.add( AP::collect_into(channels), AP::long_name("channel"),
+             AP::docstring("Only use this data channel of the receiving daemon; they are numbered from 0 in the order the daemon "
+                           "advertises them (see -m 4 output). May be given multiple times. Default: all") );
+
+    // What --bench sweeps; without them it uses the single value of the
+    // corresponding transfer setting
+    cmd.add( AP::collect_into(benchBuffers), AP::long_name("bench-buffer"),
+             AP::docstring("Benchmark with this send/receive buffer size in bytes. May be given multiple times. Default: --buffer") );
+    cmd.add( AP::collect_into(benchMSS), AP::long_name("bench-mss"),
+             AP::convert([](std::string const& s) { return mss(s); }),
+             AP::constrain([](etdc::mss_type const& v) { return untag(v)==0 || (untag(v)>=64 && untag(v)<=64*1024); }, "0 (daemon's) or 64 .. 65536"),
+             AP::docstring("Benchmark UDT data channels with this MSS; 0 = the daemon's. The daemon's MSS, if set, caps it. "
+                           "May be given multiple times. Default: --udt-mss") );
+    cmd.add( AP::collect_into(benchBW), AP::long_name("bench-bw"),
+             AP::convert([](std::string const& s) { return s=="0" ? etdc::max_bw_type{0} : max_bw(s); }),
+             AP::docstring("Benchmark UDT data channels with this maximum bandwidth, same format as --udt-bw; 0 = the daemon's. "
+                           "May be given multiple times. Default: --udt-bw") );
+    cmd.add( AP::collect_into(benchStreams), AP::long_name("bench-streams"),
+             AP::constrain([](unsigned int n) { return n>0; }, "number of streams should be > 0"),
+             AP::docstring("Benchmark with this many parallel data connections. May be given multiple times. Default: --streams") );
+    cmd.add( AP::store_into(benchSize), AP::long_name("bench-size"), AP::at_most(1),
+             AP::match("[0-9]+([kMGT]i?B)?"),
+             AP::docstring(std::string("Send this many bytes per benchmark, optionally with a [kMGT]i?B suffix. Default: ")+benchSize) );
+    cmd.add( AP::store_into(benchJSON), AP::long_name("bench-json"), AP::at_most(1),
+             AP::docstring(std::string("Write the benchmark results to this file. Default: ")+benchJSON) );
+
     // Flag wether or not to wait
     //cmd.add(AP::store_true(), AP::short_name('b'), AP::docstring("Do not exit but do a blocking read instead"));
 
@@ -479,6 +691,11 @@ int main(int argc, char const*const*const argv) {
     // Set message level based on command line value (or default)
     etdc::dbglev_fn( message_level );
 
+    // Local transfers get buffers of the size that was asked for. The
+    // client has no business setting aside memory for transfers that
+    // aren't there so no budget.
+    localState.pool.configure(localState.bufSize, 0, etdc::buffer_pool::backing_type::Normal);
+
     // The size of the list of URLs is a proxy wether to list or not; a
     // list of length one is only accepted if '--list URL' was given
     const bool                        verbose = cmd.get<bool>("silent");
@@ -493,10 +710,89 @@ int main(int argc, char const*const*const argv) {
     etdc::install_handler(dummy_signal_handler, {KILLMAINSIGNAL});
 
     // We must transform the URL(s) into ETDServerInterface* 
-    std::transform(std::begin(urls), std::end(urls), std::back_inserter(servers),
-                   [&](url_type const& url) {
-                        return url.isLocal ? ::mk_etdserver(std::ref(localState)) : etc::mk_etdproxy(url.protocol, url.host, url.port, connRetry, connDelay);
-                    });
+    auto const mkServer = [&](url_type const& url) {
+                              return url.isLocal ? ::mk_etdserver(std::ref(localState)) : etc::mk_etdproxy(url.protocol, url.host, url.port, connRetry, connDelay);
+                          };
+    if( !daemons.empty() ) {
+        auto const  daemon( mkServer(daemons[0]) );
+        const auto  v = daemon->protocolVersion();
+
+        ETDCASSERT(v!=etdc::ETDServerInterface::unknownProtocolVersion && v>=8,
+                   "The daemon does not support status requests (protocol version " << v << ")");
+        const std::string status( daemon->status() );
+        if( !status.empty() )
+            std::cout << status << std::endl;
+        return 0;
+    }
+    if( !benchDaemons.empty() ) {
+        url_type const&    daemon( benchDaemons[0] );
+        auto const         remote( mkServer(daemon) );
+        auto const         local( ::mk_etdserver(std::ref(localState)) );
+        const auto         v = remote->protocolVersion();
+        etdc::bench_matrix matrix;
+        workerlist_type    noWorkers;
+
+        matrix.channels = etc::usable_channels(remote->dataChannelAddr(), daemon.host, channels);
+        matrix.bufSizes = (benchBuffers.empty() ? std::vector<size_t>{ localState.bufSize } : benchBuffers);
+        matrix.mss      = (benchMSS.empty() ? std::vector<etdc::mss_type>{ localState.udtMSS } : benchMSS);
+        matrix.maxBW    = (benchBW.empty() ? std::vector<etdc::max_bw_type>{ localState.udtMaxBW } : benchBW);
+        matrix.streams  = (benchStreams.empty() ? std::vector<unsigned int>{ nStreams } : benchStreams);
+        matrix.size     = benchSize;
+        ETDCASSERT(!matrix.channels.empty(), "The daemon has no data channels to benchmark");
+
+        if( v==etdc::ETDServerInterface::unknownProtocolVersion || v<2 ) {
+            if( std::find_if(matrix.streams.begin(), matrix.streams.end(), [](unsigned int n) { return n>1; })!=matrix.streams.end() )
+                ETDCDEBUG(-1, "The daemon does not support multiple streams (protocol version " << v << "), benchmarking 1" << std::endl);
+            matrix.streams = std::vector<unsigned int>{ 1 };
+        }
+
+        // One line per cell, as soon as it's done
+        auto          fmtRate = (display == continental ?
+                                 etdc::mk_formatter<double>("Bps", etdc::thousand(1024), std::fixed, etdc::continental, std::setprecision(2)) :
+                                 etdc::mk_formatter<double>("Bps", etdc::thousand(1024), std::fixed, etdc::imperial, std::setprecision(2)) );
+        std::size_t   chWidth{ 7 };
+        for(auto const& dc: matrix.channels)
+            chWidth = std::max(chWidth, etdc::repr(dc).size());
+
+        std::cout << std::left << std::setw(chWidth) << "channel" << std::right << std::setw(11) << "buffer" << std::setw(7) << "mss"
+                  << std::setw(13) << "max-bw" << std::setw(8) << "streams" << std::setw(16) << "rate" << std::setw(7) << "cpu%"
+                  << std::setw(12) << "sent" << std::setw(10) << "retrans" << std::setw(10) << "lost" << std::endl;
+        const auto    showCell = [&](etdc::bench_cell const& cell) {
+                                    std::ostringstream out;
+                                    const auto         udt = [&](std::string const& txt) { return cell.udt ? txt : std::string("-"); };
+
+                                    out << std::left << std::setw(chWidth) << etdc::repr(cell.channel) << std::right
+                                        << std::setw(11) << cell.bufSize
+                                        << std::setw(7) << udt(cell.mss ? etdc::repr(cell.mss) : "daemon")
+                                        << std::setw(13) << udt(cell.maxBW>0 ? etdc::sciprint((double)cell.maxBW, "Bps", std::setprecision(3)) :
+                                                                               (cell.maxBW<0 ? "unlimited" : "daemon"))
+                                        << std::setw(8) << cell.nStreams;
+                                    if( cell.finished )
+                                        out << std::setw(16) << fmtRate(cell.dt>0 ? (double)cell.nByte/cell.dt : 0.0)
+                                            << std::setw(7) << std::fixed << std::setprecision(1) << cell.cpu
+                                            << std::setw(12) << udt(etdc::repr(cell.pktSent)) << std::setw(10) << udt(etdc::repr(cell.pktRetrans))
+                                            << std::setw(10) << udt(etdc::repr(cell.pktLoss));
+                                    else
+                                        out << "  failed: " << cell.reason;
+                                    std::cout << out.str() << std::endl;
+                                 };
+
+        // ^C stops the sweep
+        etdc::thread(&signal_thread<KILLMAINSIGNAL>, signallist_type{{SIGINT, SIGSEGV, SIGTERM, SIGHUP}},
+                     std::ref(localState), std::ref(noWorkers)).detach();
+
+        const etdc::benchlist_type cells( etdc::run_bench(local, localState, remote, matrix, showCell) );
+        std::ostringstream         name;
+        std::ofstream              json( benchJSON );
+
+        name << daemon.host << "#" << etdc::repr(daemon.port);
+        etdc::bench_json(json, name.str(), matrix, cells);
+        json.close();
+        ETDCASSERT(json, "Failed to write the benchmark results to " << benchJSON);
+        ETDCDEBUG(0, "Wrote " << cells.size() << " result(s) to " << benchJSON << std::endl);
+        return (std::atomic_load(&localState.cancelled) == true ? 1 : 0);
+    }
+    std::transform(std::begin(urls), std::end(urls), std::back_inserter(servers), mkServer);
 
 
     ETDCDEBUG(4, "This client supports protocol version " << etdc::ETDServerInterface::currentProtocolVersion << std::endl);
@@ -549,19 +845,64 @@ int main(int argc, char const*const*const argv) {
         dataChannels = servers[0]->dataChannelAddr();
     }
 
-    // In the data channels, we must replace any of the wildcard IPs with a real host name
-    std::regex  rxWildCard("^(::|0.0.0.0)$");
-    for(auto ptr=dataChannels.begin(); ptr!=dataChannels.end(); ptr++)
-        update_sockname(*ptr, etdc::host_type(std::regex_replace(get_host(*ptr), rxWildCard, dstHost)));
+    // In the data channels, we must replace any of the wildcard IPs with a
+    // real host name. Did the user select which data channels to use?
+    dataChannels = etc::usable_channels(dataChannels, dstHost, channels);
+
+    // Striping a file over >1 data connections requires that whoever
+    // is going to see the "send-file" command understands the options;
+    // older daemons would barf on them so we fall back to one stream
+    etdc::xfer_options      xferOpts;
+
+    xferOpts.nStreams  = nStreams;
+    xferOpts.multiPath = cmd.get<bool>("multipath") && dataChannels.size()>1;
+    xferOpts.checksum  = cmd.get<bool>("checksum");
+    if( xferOpts.checksum && !etc::all_support(servers, 3, "checksums", "transferring without") )
+        xferOpts.checksum = false;
+    if( (nStreams>1 || xferOpts.multiPath) && !etc::all_support(servers, 2, "multiple streams", "falling back to 1") ) {
+        xferOpts.nStreams  = 1;
+        xferOpts.multiPath = false;
+    }
 
-    // Before processing all file(s) we already know if we're going to push or pull
-    std::function<etdc::xfer_result(etdc::uuid_type const&, etdc::uuid_type&, off_t, etdc::dataaddrlist_type const&)> fn;
-    namespace ph = std::placeholders;
-    fn = (push ?
-          std::bind(&etdc::ETDServerInterface::sendFile, servers[0].get(), ph::_1, ph::_2, ph::_3, ph::_4) :
-          std::bind(&etdc::ETDServerInterface::getFile,  servers[1].get(), ph::_1, ph::_2, ph::_3, ph::_4));
+    // Delta transfers need both ends to know how; they go over one data
+    // connection. The result of a whole-file copy is the same, only slower
+    if( mode==etdc::openmode_type::Delta && !etc::all_support(servers, 5, "delta transfers", "overwriting in stead") )
+        mode = etdc::openmode_type::OverWrite;
+    if( mode==etdc::openmode_type::Delta ) {
+        if( xferOpts.nStreams>1 || xferOpts.multiPath )
+            ETDCDEBUG(-1, "Delta transfers use a single data connection, ignoring --streams/--multipath" << std::endl);
+        xferOpts.nStreams  = 1;
+        xferOpts.multiPath = false;
+        xferOpts.delta     = true;
+    }
 
-    // Loop over all files to do ...
+    // Compressing the data is something both ends must agree on; delta
+    // transfers have their own way of not sending what needn't be sent
+    xferOpts.compress = compress;
+    if( !xferOpts.compress.empty() && !etc::all_support(servers, 6, "compression", "transferring without") )
+        xferOpts.compress.clear();
+    if( xferOpts.delta && !xferOpts.compress.empty() ) {
+        ETDCDEBUG(-1, "Delta transfers are not compressed, ignoring --compress" << std::endl);
+        xferOpts.compress.clear();
+    }
+
+    // Only ask for a priority if it differs from what everyone gets anyway
+    bool setPriority = (priority!=etdc::priority_type::Normal);
+    if( setPriority && !etc::all_support(servers, 7, "transfer priorities", "transferring as normal") )
+        setPriority = false;
+
+    // Resuming verifies the existing part of the destination, if both
+    // ends know how to checksum it
+    bool verifyResume = (mode==etdc::openmode_type::Resume && (verifyTail>0 || verifySamples>0));
+    if( verifyResume && !etc::all_support(servers, 4, "verifying resumed files", "going by file size") )
+        verifyResume = false;
+
+    // Progress is reported by whoever executes the send-file
+    bool showProgress = cmd.get<bool>("progress");
+    if( showProgress && !etc::all_support(servers, 9, "progress reports", "transferring without") )
+        showProgress = false;
+
+    // How we show numbers
     auto        fmtByte = (display == continental ? 
                             etdc::mk_to_string<decltype(etdc::xfer_result::__m_BytesTransferred)>(std::fixed, etdc::continental) :
                             etdc::mk_to_string<decltype(etdc::xfer_result::__m_BytesTransferred)>(std::fixed, etdc::imperial) );
@@ -574,115 +915,287 @@ int main(int argc, char const*const*const argv) {
     auto        fmtTime = (display == continental ? 
                             etdc::mk_formatter<double>("s", std::setprecision(4), etdc::continental):
                             etdc::mk_formatter<double>("s", std::setprecision(4), etdc::imperial) );
-    const int 	lvl( verbose ? -1 : 9 );
 
-    // Enable killing by signal ^C
-    unique_result      results[2];
+    // With one transfer on a terminal the progress overwrites itself,
+    // otherwise each report is a line of its own
+    const size_t    nWorker = std::max(size_t(1), std::min(size_t(nParallel), files2do.size()));
+    const bool      inPlace = (nWorker==1 && ::isatty(STDOUT_FILENO));
+    const auto      stallTime = std::chrono::seconds(10);
+    std::mutex      outputLock;
+    workerlist_type workers;
+    namespace ph = std::placeholders;
 
-    etdc::thread(&signal_thread<KILLMAINSIGNAL>, signallist_type{{SIGINT, SIGSEGV, SIGTERM, SIGHUP}}, ::pthread_self(),
-                 std::ref(localState), std::ref(servers), std::ref(results)).detach();
+    // Before processing all file(s) we already know if we're going to push or pull.
+    // An ETDServer or ETDProxy handles only one transfer at a time so each
+    // worker gets its own set of them; worker #0 inherits the ones we already have
+    for(size_t w = 0; w<nWorker; w++) {
+        std::unique_ptr<worker_type> worker( new worker_type() );
+        etdc::xfer_options           wOpts( xferOpts );
+
+        if( w==0 )
+            worker->servers = servers;
+        else
+            std::transform(std::begin(urls), std::end(urls), std::back_inserter(worker->servers), mkServer);
+        if( showProgress ) {
+            worker_type* const wp( worker.get() );
+
+            wOpts.progress   = 1;
+            wOpts.onProgress = [=, &outputLock](off_t done, double rate) {
+                                    auto const                  now( std::chrono::steady_clock::now() );
+                                    auto&                       p( wp->progress );
+                                    std::ostringstream          out;
+                                    std::lock_guard<std::mutex> olk( outputLock );
+
+                                    if( done!=p.done || !p.shown ) {
+                                        p.done       = done;
+                                        p.lastChange = now;
+                                    }
+                                    out << (inPlace ? "\r" : "") << p.file << ": ";
+                                    if( now - p.lastChange>=stallTime ) {
+                                        out << "stalled for " << std::chrono::duration_cast<std::chrono::seconds>(now - p.lastChange).count() << "s";
+                                    } else {
+                                        out << std::fixed << std::setprecision(1) << (p.todo>0 ? 100.0*done/p.todo : 100.0) << "% "
+                                            << fmt1000(done) << " of " << fmt1000(p.todo) << " [" << fmtRate(rate) << "] ETA ";
+                                        if( rate>0 )
+                                            out << fmtTime((p.todo - done)/rate);
+                                        else
+                                            out << "-";
+                                    }
+                                    out << (inPlace ? "\033[K" : "\n");
+                                    p.shown = true;
+                                    std::cout << out.str() << std::flush;
+                               };
+        }
+        worker->fn = (push ?
+                      std::bind(&etdc::ETDServerInterface::sendFile, worker->servers[0].get(), ph::_1, ph::_2, ph::_3, ph::_4, wOpts) :
+                      std::bind(&etdc::ETDServerInterface::getFile,  worker->servers[1].get(), ph::_1, ph::_2, ph::_3, ph::_4, wOpts));
+        workers.emplace_back( std::move(worker) );
+    }
+    ETDCDEBUG(4, "Transferring " << files2do.size() << " file(s) using " << workers.size() << " worker(s)" << std::endl);
 
-    for(auto const& file: files2do) {
-        // Were we cancelled?
-        if( localState.cancelled.load() )
-            break;
+    // Loop over all files to do ...
+    const int 	lvl( verbose ? -1 : 9 );
 
-        // Skip directories
-        if( file[file.size()-1]=='/' )
-            continue;
-
-        // Keep these out of the while loop
-        bool               finished{ false };
-        const unsigned int retryCountAtStart = nFileRetry;
-        std::exception_ptr eptr;
-
-        // Did someone say Cancel? Or did we reach maximum number of retries?
-        while( !std::atomic_load(&localState.cancelled) && !finished && nFileRetry<=maxFileRetry ) {
-            // Just checked that we weren't cancelled and if we're actually
-            // retrying a file we should sleep (new file => don't sleep)
-            // also make sure we reset current exception already
-            if( retryCountAtStart < nFileRetry ) {
-                ETDCDEBUG(4, "Retry #" << nFileRetry+1 << " (#" << (nFileRetry-retryCountAtStart)+1 << " for this file), go to sleep for " <<
-                             retryDelay.count() << "s" << std::endl);
-                std::this_thread::sleep_for( retryDelay );
+    // The workers take files from the front of the list. The retry budget
+    // is shared by all of them, like it was when there was only one. The
+    // first worker to exhaust it leaves its exception in 'fatal' which
+    // stops the others from starting new files. Output is done one
+    // complete message at a time such that lines from different
+    // workers don't get mixed up.
+    std::mutex                queueLock;
+    std::atomic<unsigned int> nFileRetry{ 0 };
+    std::exception_ptr        fatal;
+
+    auto const doTransfers = [&](worker_type& worker) {
+        // We must be able to be kicked out of blocking system calls
+        etdc::UnBlock   ub({KILLMAINSIGNAL});
+        auto&           wServers = worker.servers;
+        auto&           wResults = worker.results;
+        {
+            etdc::scoped_lock lk( localState.lock );
+            worker.tid     = ::pthread_self();
+            worker.running = true;
+        }
+
+        while( true ) {
+            std::string    file;
+            {
+                etdc::scoped_lock lk( queueLock );
+                // Were we cancelled? Did someone else give up?
+                if( files2do.empty() || fatal || localState.cancelled.load() )
+                    break;
+                file = files2do.front();
+                files2do.pop_front();
             }
 
-            try {
-                auto const outputFN = mkOutputPath(file);
-                ETDCDEBUG(lvl, (push ? "PUSH" : "PULL" ) << " " << mode << " " << file << " -> " << outputFN << std::endl);
-                unique_result dstResult( new etdc::result_type(servers[1]->requestFileWrite(outputFN, mode)) );
-                {
-                    etdc::scoped_lock lk( localState.lock );
-                    results[1].reset( dstResult.release() );
+            // Skip directories
+            if( file[file.size()-1]=='/' )
+                continue;
+
+            // Keep these out of the while loop
+            bool               finished{ false };
+            unsigned int       nTry{ 0 };
+            std::exception_ptr eptr;
+
+            // Did someone say Cancel? Or did we reach maximum number of retries?
+            while( !std::atomic_load(&localState.cancelled) && !finished && nFileRetry.load()<=maxFileRetry ) {
+                // Just checked that we weren't cancelled and if we're actually
+                // retrying a file we should sleep (new file => don't sleep)
+                // also make sure we reset current exception already
+                if( nTry++>0 ) {
+                    ETDCDEBUG(4, "Retry #" << nFileRetry.load()+1 << " (#" << nTry << " for " << file << "), go to sleep for " <<
+                                 retryDelay.count() << "s" << std::endl);
+                    std::this_thread::sleep_for( retryDelay );
                 }
-                auto nByte = etdc::get_filepos( *results[1] );
 
-                if( mode!=etdc::openmode_type::SkipExisting || nByte==0 ) {
-                    unique_result srcResult( new etdc::result_type(servers[0]->requestFileRead(file, nByte)) );
+                try {
+                    auto const outputFN = mkOutputPath(file);
+                    ETDCDEBUG(lvl, (push ? "PUSH" : "PULL" ) << " " << mode << " " << file << " -> " << outputFN << std::endl);
+                    unique_result dstResult( new etdc::result_type(wServers[1]->requestFileWrite(outputFN, mode)) );
                     {
                         etdc::scoped_lock lk( localState.lock );
-                        results[0].reset( srcResult.release() );
+                        wResults[1].reset( dstResult.release() );
                     }
-                    auto nByteToGo = etdc::get_filepos( *results[0] );
-
-                    if( nByteToGo>0 ) {
-                        etdc::xfer_result result( fn(etdc::get_uuid(*results[0]), etdc::get_uuid(*results[1]), nByteToGo, dataChannels) );
-                        auto const        dt = result.__m_DeltaT.count();
-                        std::cout << (result.__m_Finished && std::atomic_load(&localState.cancelled)==false ? "" : "Un") << "finished; successfully transferred "
-                                  << fmt1000(result.__m_BytesTransferred)
-                                  << " (" << fmtByte(result.__m_BytesTransferred) << " bytes) in "
-                                  << fmtTime(dt) << " "
-                                  << "[" << fmtRate( dt>0 ? ((double)result.__m_BytesTransferred)/dt : 0.0) << "]"
-                                  << std::endl;
-                        finished = result.__m_Finished;
-                        if( !finished )
-                            std::cout << "--> Reason: " << result.__m_Reason << std::endl;
-                    } else {
-                        ETDCDEBUG(lvl, "Destination is complete or is larger than source file" << std::endl);
-                        finished = true;
+                    auto nByte = etdc::get_filepos( *wResults[1] );
+
+                    if( mode!=etdc::openmode_type::SkipExisting || nByte==0 ) {
+                        unique_result srcResult( new etdc::result_type(wServers[0]->requestFileRead(file, nByte)) );
+                        {
+                            etdc::scoped_lock lk( localState.lock );
+                            wResults[0].reset( srcResult.release() );
+                        }
+                        auto nByteToGo = etdc::get_filepos( *wResults[0] );
+
+                        // Only what both ends have can be verified. If
+                        // verification itself fails we carry on as before
+                        if( verifyResume && nByte>0 && nByteToGo>=0 ) {
+                            off_t  nGood{ nByte };
+                            try {
+                                nGood = etdc::verify_resume(wServers[0], etdc::get_uuid(*wResults[0]),
+                                                            wServers[1], etdc::get_uuid(*wResults[1]), nByte, verifyTail, verifySamples);
+                            }
+                            catch( std::exception const& e ) {
+                                ETDCDEBUG(-1, "Could not verify " << outputFN << ", resuming by file size - " << e.what() << std::endl);
+                            }
+                            if( nGood<nByte ) {
+                                ETDCDEBUG(lvl, "Destination " << outputFN << " differs from source @" << nGood << ", resuming from there" << std::endl);
+                                wServers[1]->rollback(etdc::get_uuid(*wResults[1]), nGood);
+                                // The source's read position must follow
+                                wServers[0]->removeUUID( etdc::get_uuid(*wResults[0]) );
+                                {
+                                    etdc::scoped_lock lk( localState.lock );
+                                    wResults[0].reset( nullptr );
+                                }
+                                unique_result rdResult( new etdc::result_type(wServers[0]->requestFileRead(file, nGood)) );
+                                {
+                                    etdc::scoped_lock lk( localState.lock );
+                                    wResults[0].reset( rdResult.release() );
+                                }
+                                nByte     = nGood;
+                                nByteToGo = etdc::get_filepos( *wResults[0] );
+                            }
+                        }
+
+                        // A delta transfer rebuilds the whole file, even if it's empty
+                        if( nByteToGo>0 || mode==etdc::openmode_type::Delta ) {
+                            if( setPriority ) {
+                                wServers[0]->setPriority(etdc::get_uuid(*wResults[0]), priority);
+                                wServers[1]->setPriority(etdc::get_uuid(*wResults[1]), priority);
+                            }
+                            {
+                                std::lock_guard<std::mutex> olk( outputLock );
+                                worker.progress.file  = outputFN;
+                                worker.progress.todo  = nByteToGo;
+                                worker.progress.shown = false;
+                            }
+                            etdc::xfer_result  result( worker.fn(etdc::get_uuid(*wResults[0]), etdc::get_uuid(*wResults[1]), nByteToGo, dataChannels) );
+                            auto const         dt = result.__m_DeltaT.count();
+                            std::ostringstream out;
+
+                            // With >1 worker the result lines may not directly follow
+                            // the PUSH/PULL line anymore so then we say which file it was
+                            if( workers.size()>1 )
+                                out << outputFN << ": ";
+                            out << (result.__m_Finished && std::atomic_load(&localState.cancelled)==false ? "" : "Un") << "finished; successfully transferred "
+                                << fmt1000(result.__m_BytesTransferred)
+                                << " (" << fmtByte(result.__m_BytesTransferred) << " bytes) in "
+                                << fmtTime(dt) << " "
+                                << "[" << fmtRate( dt>0 ? ((double)result.__m_BytesTransferred)/dt : 0.0) << "]"
+                                << (result.__m_Digest.empty() ? std::string() : " " + result.__m_Digest);
+                            // Compressed: what it took on the wire
+                            if( !xferOpts.compress.empty() ) {
+                                out << ", " << fmtByte(result.__m_WireBytes) << " bytes on the wire";
+                                if( result.__m_WireBytes>0 )
+                                    out << " [" << std::fixed << std::setprecision(2) << (double)result.__m_BytesTransferred/result.__m_WireBytes << "x]";
+                            }
+                            out << std::endl;
+                            finished = result.__m_Finished;
+                            if( !finished )
+                                out << "--> Reason: " << result.__m_Reason << std::endl;
+                            // Where the time went on the end that did the transfer
+                            if( verbose && !result.__m_Latency.empty() )
+                                out << "--> Latency: " << result.__m_Latency << std::endl;
+                            std::lock_guard<std::mutex> olk( outputLock );
+                            // Don't leave half a progress line in front of the result
+                            if( inPlace && worker.progress.shown )
+                                std::cout << "\r\033[K";
+                            std::cout << out.str() << std::flush;
+                        } else {
+                            ETDCDEBUG(lvl, "Destination " << outputFN << " is complete or is larger than source file" << std::endl);
+                            finished = true;
+                        }
                     }
                 }
-            }
-            catch( std::exception const& e ) {
-                ETDCDEBUG(3, "Got exception: " << e.what() << std::endl);
-                eptr = std::current_exception();
-            }
-            catch( etdc::detail::ThrowOnExistThatShouldNotExist const& ) {
-                eptr = std::current_exception();
-                // This one signifies that the file existed on the remote
-                // end and the file-write mode was not any of OverWrite, Resume or SkipExisting
-                // So basically need to tell the user she/he's bein' a DOMBÅS (IKEA cupboard ;-))
-                ETDCDEBUG(-1, "Destination file exists and default file copy mode 'New' prevents overwriting/appending/skipping." << std::endl);
-                // Trigger end-of-program
-                finished   = true;
-                nFileRetry = maxFileRetry;
-            }
-            catch( ... ) {
-                eptr = std::current_exception();
-                ETDCDEBUG(3, "Got unknown exception" << std::endl);
-            } 
-
-            // ..->removeUUID() may throw, but we really must try to do them
-            // both, so even if the first one threw we must still try to remove
-            // the 2nd one as well, and neither should have the program be
-            // terminated
-            try {
-                if( results[1] )
-                    servers[1]->removeUUID( etdc::get_uuid(*results[1]) );
-            }
-            catch( ... ) {}
+                catch( std::exception const& e ) {
+                    ETDCDEBUG(3, "Got exception: " << e.what() << std::endl);
+                    eptr = std::current_exception();
+                }
+                catch( etdc::detail::ThrowOnExistThatShouldNotExist const& ) {
+                    eptr = std::current_exception();
+                    // This one signifies that the file existed on the remote
+                    // end and the file-write mode was not any of OverWrite, Resume or SkipExisting
+                    // So basically need to tell the user she/he's bein' a DOMBÅS (IKEA cupboard ;-))
+                    ETDCDEBUG(-1, "Destination file " << mkOutputPath(file) << " exists and default file copy mode 'New' prevents overwriting/appending/skipping." << std::endl);
+                    // Trigger end-of-program
+                    finished   = true;
+                    nFileRetry = maxFileRetry;
+                }
+                catch( ... ) {
+                    eptr = std::current_exception();
+                    ETDCDEBUG(3, "Got unknown exception" << std::endl);
+                } 
+
+                // ..->removeUUID() may throw, but we really must try to do them
+                // both, so even if the first one threw we must still try to remove
+                // the 2nd one as well, and neither should have the program be
+                // terminated
+                try {
+                    if( wResults[1] )
+                        wServers[1]->removeUUID( etdc::get_uuid(*wResults[1]) );
+                }
+                catch( ... ) {}
 
-            try {
-                if( results[0] )
-                    servers[0]->removeUUID( etdc::get_uuid(*results[0]) );
+                try {
+                    if( wResults[0] )
+                        wServers[0]->removeUUID( etdc::get_uuid(*wResults[0]) );
+                }
+                catch( ... ) {}
+                {
+                    // Nothing left for the signal thread to cancel
+                    etdc::scoped_lock lk( localState.lock );
+                    wResults[0].reset( nullptr );
+                    wResults[1].reset( nullptr );
+                }
+                // If we didn't finish, we must retry
+                if( !finished )
+                    nFileRetry++;
+                if( nFileRetry.load()>maxFileRetry && eptr ) {
+                    etdc::scoped_lock lk( queueLock );
+                    if( !fatal )
+                        fatal = eptr;
+                    break;
+                }
             }
-            catch( ... ) {}
-            // If we didn't finish, we must retry
-            if( !finished )
-                nFileRetry++;
-            if( nFileRetry>maxFileRetry && eptr )
-                std::rethrow_exception( eptr );
         }
+        // Make sure the signal thread doesn't kick a thread that isn't there
+        etdc::scoped_lock lk( localState.lock );
+        worker.running = false;
+    };
+
+    // Enable killing by signal ^C
+    etdc::thread(&signal_thread<KILLMAINSIGNAL>, signallist_type{{SIGINT, SIGSEGV, SIGTERM, SIGHUP}},
+                 std::ref(localState), std::ref(workers)).detach();
+
+    if( workers.size()==1 ) {
+        doTransfers( *workers[0] );
+    } else {
+        std::list<std::thread> threads;
+        for(auto& w: workers)
+            threads.emplace_back( etdc::thread(doTransfers, std::ref(*w)) );
+        for(auto& t: threads)
+            t.join();
     }
+    if( fatal )
+        std::rethrow_exception( fatal );
     return (std::atomic_load(&localState.cancelled) == true ? 1 : 0);
 }
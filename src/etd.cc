@@ -25,14 +25,19 @@
 #include <etdc_assert.h>
 #include <etdc_etd_state.h>
 #include <etdc_etdserver.h>
+#include <etdc_metrics.h>
 #include <etdc_stringutil.h>
 #include <etdc_sciprint.h>
 #include <argparse.h>
 
 #include <map>
+#include <list>
+#include <regex>
+#include <chrono>
 #include <thread>
 #include <string>
 #include <vector>
+#include <sstream>
 #include <future>
 #include <iterator>
 #include <iostream>
@@ -223,6 +228,7 @@ struct string2socket_type_m {
 ////////////////////////////////////////////////////////////////////////////////////
 template <int> void command_server_thread(etdc::etdc_fdptr fd, etdc::etd_state&);
 template <int> void data_server_thread(etdc::etdc_fdptr fd, etdc::etd_state&);
+template <int> void metrics_server_thread(etdc::etdc_fdptr fd, etdc::etd_state&);
 
 // Make sure our zignal handlert has C-linkage
 extern "C" {
@@ -259,6 +265,12 @@ int main(int argc, char const*const*const argv) {
     int                 message_level = 0;
     std::string         logDirectory{}; // Used if daemonizing: empty = use syslog, otherwise create file in dir
     socketoptions_type  sockopts{};
+    size_t              ioWindow{ 64*1024*1024 };
+    size_t              poolSize{ 0 }, poolOverflow{ 0 };
+    etdc::max_bw_type   totalBW{ 0 }, peerBW{ 0 }, preemptBW{ 0 };
+    etdc::buffer_pool::backing_type poolBacking{ etdc::buffer_pool::backing_type::Normal };
+    std::list<std::string> metricsAddrs;
+    std::string         advertise{};
     AP::ArgumentParser  cmd( AP::version( buildinfo() ),
                              AP::docstring("'ftp' like etransfer server daemon, to be used with etransfer client for "
                                            "high speed file/directory transfers."),
@@ -320,10 +332,49 @@ int main(int argc, char const*const*const argv) {
              AP::convert([](std::string const& s) { return max_bw(s); }),
              AP::docstring("Set UDT maximum bandwidth. Without suffix the number is interpreted as bytes per second. A suffix of 'kMG[Bb]i?ps' is supported: Bps = bytes per second, bps = bits per second; i[Bb]ps is base-1024, [Bb]ps is base-1000. Bits per second will be recomputed and rounded to nearest integer bytes per second lower than the value. Not honoured if data channel is TCP or doing remote-to-remote transfers. Default: unlimited.") );
 
+    // and on all of them together, whatever the protocol
+    cmd.add( AP::store_into(totalBW), AP::long_name("max-bw"), AP::at_most(1),
+             AP::convert([](std::string const& s) { return max_bw(s); }),
+             AP::docstring("Limit the bandwidth of all data channels together, TCP and UDT. Accepts the same units as --udt-bw. "
+                           "It is divided over the active transfers; when transfers start or finish it is divided again. Default: unlimited.") );
+    cmd.add( AP::store_into(peerBW), AP::long_name("peer-bw"), AP::at_most(1),
+             AP::convert([](std::string const& s) { return max_bw(s); }),
+             AP::docstring("Limit the bandwidth of all transfers to/from one remote host together. What a limited host can not use "
+                           "goes to the other hosts. Accepts the same units as --udt-bw. Default: unlimited.") );
+    cmd.add( AP::store_into(preemptBW), AP::long_name("preempt-bw"), AP::at_most(1),
+             AP::convert([](std::string const& s) { return max_bw(s); }),
+             AP::docstring("Whilst transfers of a higher priority class (see etc --priority) are running, squeeze those of lower "
+                           "classes together to this bandwidth. They slow down but keep going. Accepts the same units as --udt-bw. "
+                           "Default: no preemption, classes only weigh in dividing --max-bw and --peer-bw.") );
 
     cmd.add( AP::store_into(sockopts.bufSize), AP::long_name("buffer"), AP::at_most(1),
              AP::docstring(std::string("Set send/receive buffer size. Default ")+etdc::repr(sockopts.bufSize)) );
 
+    // Allow server admin to keep the page cache out of it
+    cmd.add( AP::store_true(), AP::long_name("direct-io"), AP::at_most(1),
+             AP::docstring("Read and write regular files using O_DIRECT, bypassing the page cache. Unaligned I/O (e.g. the last block of a file) falls back to normal I/O. Such files never use sendfile(2)/splice(2), which go through the page cache. Default: off") );
+
+    // How much of a file's page cache a single transfer may keep busy
+    cmd.add( AP::store_into(ioWindow), AP::long_name("io-window"), AP::at_most(1),
+             AP::docstring(std::string("Read ahead/write behind window for regular files, in bytes. Files being written are flushed and dropped from the page cache every this many bytes. 0 leaves it all to the kernel. Default ")+etdc::repr(ioWindow)) );
+
+    // All transfers can share a fixed amount of buffer memory
+    cmd.add( AP::store_into(poolSize), AP::long_name("buffer-pool"), AP::at_most(1),
+             AP::docstring("Allocate this many bytes of transfer buffers at startup, to be shared by all transfers. Transfers wait for buffers "
+                           "if the pool is exhausted. 0 means each transfer allocates its own buffers. No kMG suffix supported. Default: 0") );
+    cmd.add( AP::store_into(poolOverflow), AP::long_name("buffer-pool-overflow"), AP::at_most(1),
+             AP::docstring("Transfers that find the buffer pool exhausted for 5 seconds may allocate buffers outside of it, up to this many bytes "
+                           "in total. This helps when transfers wait for each other, e.g. this daemon sending to itself. No kMG suffix supported. "
+                           "Default: 0 (transfers keep waiting)") );
+    cmd.add( AP::store_into(poolBacking), AP::long_name("hugepages"), AP::at_most(1),
+             AP::convert([](std::string const& s) {
+                            std::istringstream              iss(s);
+                            etdc::buffer_pool::backing_type bt;
+                            ETDCASSERT(iss >> bt, "'" << s << "' is not one of normal, thp or hugetlb");
+                            return bt; }),
+             AP::docstring("Back the buffer pool with normal pages, transparent huge pages (thp) or reserved huge pages (hugetlb). "
+                           "If the latter are not available normal pages are used. Default: normal") );
+
     // command servers; we require at least one of 'm
     cmd.add( AP::collect<std::string>(), AP::long_name("command"),
              // Constraints on the number + form of the argument
@@ -338,6 +389,21 @@ int main(int argc, char const*const*const argv) {
              // And some useful info
              AP::docstring("Listen on this(these) address(es) for incoming client data connections") );
 
+    // metrics servers; optional
+    cmd.add( AP::collect_into(metricsAddrs), AP::long_name("metrics"),
+             AP::match(rxURL),
+             AP::constrain([](std::string const& s) { return std::regex_search(s, std::regex("^tcp6?://", std::regex_constants::icase)); },
+                           "metrics are served over tcp"),
+             AP::docstring("Serve counters and histograms of the daemon in OpenMetrics (Prometheus) text format over HTTP on this(these) "
+                           "address(es), e.g. tcp://127.0.0.1:9108. Anyone who can connect can read them. Default port 9108") );
+
+    // Data channels reachable at another address than where we listen,
+    // e.g. behind NAT or a relay such as etdwan
+    cmd.add( AP::store_into(advertise), AP::long_name("advertise"), AP::at_most(1),
+             AP::match("[-a-zA-Z0-9_\\.]+|[:0-9a-fA-F]+"),
+             AP::docstring("Tell clients that the data channels are at this host name or address, in stead of the one they listen on; "
+                           "the port numbers stay the same") );
+
     // Allow setting a log directory
     cmd.add( AP::store_into(logDirectory), AP::long_name("log-directory"), AP::at_most(1),
              AP::docstring("If specified, when daemonizing, create log file in this directory by the name of basename(3) of argv[0] + time-stamp in stead of logging to syslog(3)"),
@@ -408,23 +474,34 @@ int main(int argc, char const*const*const argv) {
     const string2socket_type_m mk_data( port(8008), sockopts );
 
     // Make sure command line options get passed on into the shared state
-    serverState.bufSize = sockopts.bufSize;
+    serverState.bufSize  = sockopts.bufSize;
+    serverState.pool.configure(serverState.bufSize, poolSize, poolBacking, poolOverflow);
+    serverState.directIO = cmd.get<bool>("direct-io");
+    serverState.ioWindow = ioWindow;
     if( sockopts.udtMSS )
         serverState.udtMSS = sockopts.udtMSS;
     if( untag(sockopts.udtBW)>0 )
         serverState.udtMaxBW = untag(sockopts.udtBW);
+    serverState.bandwidth.configure(untag(totalBW), untag(peerBW), untag(preemptBW));
 
     // data servers first such that the command servers know which data ports are available
     for(auto&& datasrv: cmd.get<std::list<std::string>>("data")) {
         auto srv = mk_data( datasrv );
         // Append the data server to the list of possible data servers
-        serverState.dataaddrs.push_back( srv->getsockname(srv->__m_fd) );
+        auto sn  = srv->getsockname(srv->__m_fd);
+        if( !advertise.empty() )
+            etdc::update_sockname(sn, etdc::host_type(advertise));
+        serverState.dataaddrs.push_back( sn );
         serverState.add_thread(&data_server_thread<SIGUSR2>, srv, std::ref(serverState));
     }
 
     for(auto&& cmdsrv: cmd.get<std::list<std::string>>("command"))
         serverState.add_thread(&command_server_thread<SIGUSR1>, mk_cmd(cmdsrv), std::ref(serverState));
 
+    const string2socket_type_m mk_metrics( port(9108), socketoptions_type{} );
+    for(auto&& metricssrv: metricsAddrs)
+        serverState.add_thread(&metrics_server_thread<SIGUSR1>, mk_metrics(metricssrv), std::ref(serverState));
+
     // Now just wait ..
     killSigFuture.wait();
     try {
@@ -489,6 +566,7 @@ void command_server_thread(etdc::etdc_fdptr pServer, etdc::etd_state& shared_sta
             throw std::runtime_error("No incoming command client?!");
 
         // Now we fall through handling the client
+        etdc::metrics::accepted("command");
         auto peernm = pClient->getpeername(pClient->__m_fd);
         ETDCDEBUG(2, "Incoming COMMAND from " << peernm << " [local " << pClient->getsockname(pClient->__m_fd) << "]" << endl);
 
@@ -558,6 +636,7 @@ void data_server_thread(etdc::etdc_fdptr pServer, etdc::etd_state& shared_state)
         if( !pClient )
             throw std::runtime_error("No incoming data client?!");
         // Now we fall through handling the client
+        etdc::metrics::accepted("data");
         auto peernm = pClient->getpeername(pClient->__m_fd);
         ETDCDEBUG(2, "Incoming DATA from " << peernm << " [local " << pClient->getsockname(pClient->__m_fd) << "]" << endl);
 
@@ -594,6 +673,96 @@ void data_server_thread(etdc::etdc_fdptr pServer, etdc::etd_state& shared_state)
     return;
 }
 
+// And for the metrics servers. Each scrape is an HTTP/1.0 request that we
+// answer and then close the connection; that's all Prometheus needs
+template <int KillSignal>
+void metrics_server_thread(etdc::etdc_fdptr pServer, etdc::etd_state& shared_state) {
+    pthread_t                       thisThread = ::pthread_self();
+    etdc::UnBlock                   s({KillSignal});
+    etdc::etdc_fdptr                pClient{ pServer };
+    etdc::cancellist_type::iterator ourCancellation;
+
+    etdc::install_handler(dummy_signal_handler, {KillSignal});
+
+    {
+        etdc::scoped_lock lk(shared_state.lock);
+        ourCancellation = shared_state.cancellations.insert( shared_state.cancellations.end(),
+                [&](void) {
+                    etdc::etdc_fdptr  myFD = std::atomic_load(&pClient);
+
+                    ETDCDEBUG(2, "Cancellation fn/signalling thread for metrics fd=" << myFD->__m_fd << std::endl);
+                    myFD->close(myFD->__m_fd);
+                    ::pthread_kill(thisThread, KillSignal); }
+            );
+    }
+
+    try {
+        if( !std::atomic_load(&shared_state.cancelled) )
+            std::atomic_store(&pClient, pServer->accept(pServer->__m_fd));
+
+        if( !std::atomic_load(&shared_state.cancelled) )
+            shared_state.add_thread(&metrics_server_thread<KillSignal>, pServer, std::ref(shared_state));
+
+        if( !pClient )
+            throw std::runtime_error("No incoming metrics client?!");
+        ETDCDEBUG(4, "Incoming METRICS request from " << pClient->getpeername(pClient->__m_fd) << endl);
+
+        // Read the request header; we only look at the request line.
+        // A client that doesn't send anything (or trickles bytes) must not
+        // hold on to this thread forever: each read times out and the whole
+        // header must be in within a few seconds, and be of sane size
+        static const size_t                     maxRequest = 16*1024;
+        static const std::chrono::seconds       maxWait( 10 );
+        const auto                              deadline = std::chrono::steady_clock::now() + maxWait;
+
+        etdc::setsockopt(pClient->__m_fd, etdc::so_rcvtimeo{ {5, 0} });
+
+        static const std::regex rxGet("^GET\\s+(/|/metrics)(\\?\\S*)?\\s+HTTP/1\\.[01]\r?\n",
+                                      std::regex_constants::ECMAScript | std::regex_constants::icase);
+        std::string             request;
+        char                    buf[1024];
+
+        while( request.find("\r\n\r\n")==std::string::npos && request.find("\n\n")==std::string::npos ) {
+            const ssize_t n = pClient->read(pClient->__m_fd, buf, sizeof(buf));
+            ETDCASSERT(n>0, "metrics: failed to read request - " <<
+                            (n==0 ? std::string("hung up") :
+                             (errno==EAGAIN || errno==EWOULDBLOCK) ? std::string("timed out") : std::string(etdc::strerror(errno))));
+            request.append(buf, (size_t)n);
+            ETDCASSERT(request.size()<=maxRequest, "metrics: request header too long");
+            ETDCASSERT(std::chrono::steady_clock::now()<deadline, "metrics: request took too long");
+        }
+
+        std::ostringstream  reply;
+        if( std::regex_search(request, rxGet) ) {
+            const std::string body( etdc::metrics::exposition(shared_state) );
+            reply << "HTTP/1.0 200 OK\r\n"
+                  << "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                  << "Content-Length: " << body.size() << "\r\n"
+                  << "Connection: close\r\n\r\n"
+                  << body;
+        } else {
+            reply << "HTTP/1.0 404 Not Found\r\n"
+                  << "Content-Length: 0\r\n"
+                  << "Connection: close\r\n\r\n";
+        }
+        const std::string  msg( reply.str() );
+        ETDCASSERT(pClient->write(pClient->__m_fd, msg.data(), msg.size())==(ssize_t)msg.size(),
+                   "metrics: failed to send reply - " << etdc::strerror(errno));
+    }
+    catch( std::exception const& e ) {
+        ETDCDEBUG(1, "metrics server thread got exception: " << e.what() << std::endl);
+    }
+    catch( ... ) {
+        ETDCDEBUG(1, "metrics server thread got unknown exception" << std::endl);
+    }
+    if( !std::atomic_load(&shared_state.cancelled) ) {
+        etdc::scoped_lock  lk(shared_state.lock);
+        shared_state.cancellations.erase( ourCancellation );
+    }
+    ETDCDEBUG(4, "metrics server thread terminated" << endl);
+    return;
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
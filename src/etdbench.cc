@@ -0,0 +1,421 @@
+// In-process loopback benchmark of etd + etc
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+//
+// Runs a daemon - command server, data server and their ETDServerWrapper
+// and ETDDataServer threads, just like etd does - on the loopback
+// interface and, in the same process, talks to it through an ETDProxy like
+// etc does. For each data channel protocol (tcp, udt, over IPv4 and IPv6)
+// and file size class /dev/zero:<size> is pushed to and pulled from the
+// daemon's /dev/null. Every transfer is timed from requesting the files
+// until both were removed, so small files measure the control protocol's
+// round trips and large ones the data path.
+//
+// Each protocol is run in a child process of its own, such that whatever
+// a protocol leaves behind - UDT's library wide state, sockets lingering
+// in the kernel, threads still finishing - can't affect the next one.
+//
+// The results can be kept as a baseline to which later runs are compared;
+// a slowdown of more than the tolerance makes the program exit non-zero.
+#include <version.h>
+#include <etdc_fd.h>
+#include <reentrant.h>
+#include <etdc_debug.h>
+#include <etdc_assert.h>
+#include <etdc_thread.h>
+#include <etdc_signal.h>
+#include <etdc_etd_state.h>
+#include <etdc_etdserver.h>
+#include <etdc_loopback.h>
+#include <etdc_sciprint.h>
+#include <argparse.h>
+
+// C++ standard headers
+#include <map>
+#include <list>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <exception>
+#include <algorithm>
+#include <functional>
+
+// Plain-old-C
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace std;
+namespace AP = argparse;
+
+using signallist_type = std::vector<int>;
+
+// The process running the current protocol, if any
+static std::atomic<pid_t>  benchChild{ 0 };
+
+// ^C et al. In the middle of a transfer there's nothing to save so we
+// just leave, taking the protocol's process with us
+static void signal_thread(signallist_type const& sigs) {
+    int       received;
+    sigset_t  sset;
+
+    sigemptyset(&sset);
+    for(auto s: sigs)
+        sigaddset(&sset, s);
+    ::sigwait(&sset, &received);
+    ETDCDEBUG(-1, "etdbench: terminating because of signal#" << received << endl);
+    if( benchChild.load()>0 )
+        ::kill(benchChild.load(), SIGKILL);
+    ::_exit( 1 );
+}
+
+struct cell_type {
+    std::string  key;           // "<proto> <push|pull> <size>"
+    unsigned int nFile{ 0 };
+    off_t        nByte{ 0 };    // per file
+    double       latency{ 0 };  // median seconds per file
+    std::string  reason{};      // not empty = failed
+};
+
+// Move one file the way etc does and return how long it took
+static double transfer(etdc::etd_server_ptr local, etdc::etd_server_ptr remote, bool push,
+                       std::string const& size, off_t& nByte) {
+    const auto                    start( std::chrono::steady_clock::now() );
+    etdc::etd_server_ptr          src( push ? local : remote ), dst( push ? remote : local );
+    const etdc::dataaddrlist_type channels( remote->dataChannelAddr() );
+    std::unique_ptr<etdc::result_type>  srcResult, dstResult;
+
+    std::exception_ptr  eptr;
+    try {
+        dstResult.reset( new etdc::result_type(dst->requestFileWrite("/dev/null", etdc::openmode_type::OverWrite)) );
+        srcResult.reset( new etdc::result_type(src->requestFileRead("/dev/zero:" + size, 0)) );
+
+        const etdc::xfer_result rv( push ? local->sendFile(etdc::get_uuid(*srcResult), etdc::get_uuid(*dstResult),
+                                                           etdc::get_filepos(*srcResult), channels, etdc::xfer_options{}) :
+                                           local->getFile(etdc::get_uuid(*srcResult), etdc::get_uuid(*dstResult),
+                                                          etdc::get_filepos(*srcResult), channels, etdc::xfer_options{}) );
+        ETDCASSERT(rv.__m_Finished, "transfer failed - " << rv.__m_Reason);
+        nByte = rv.__m_BytesTransferred;
+    }
+    catch( ... ) {
+        eptr = std::current_exception();
+    }
+    if( dstResult )
+        dst->removeUUID( etdc::get_uuid(*dstResult) );
+    if( srcResult )
+        src->removeUUID( etdc::get_uuid(*srcResult) );
+    if( eptr )
+        std::rethrow_exception( eptr );
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Run all sizes over one protocol, printing the results as they come in.
+// Throws if the daemon can't be set up or can't move a single byte, i.e.
+// the protocol can't be benchmarked here
+static std::list<cell_type> run_protocol(std::string const& proto, std::vector<std::string> const& sizes,
+                                         double minTime, size_t bufSize) {
+    const std::string                 host( proto.back()=='6' ? "::1" : "127.0.0.1" );
+    const auto                        fmtRate = etdc::mk_formatter<double>("Bps", etdc::thousand(1024), std::fixed, std::setprecision(2));
+    std::list<cell_type>              cells;
+
+    // The client's own state, as in etc
+    etdc::etd_state  localState;
+    localState.bufSize = bufSize;
+    localState.pool.configure(bufSize, 0, etdc::buffer_pool::backing_type::Normal);
+
+    etdc::loopback_daemon             daemon(proto, host, bufSize);
+    etdc::etd_server_ptr              local( ::mk_etdserver(std::ref(localState)) );
+    etdc::etd_server_ptr              remote( ::mk_etdproxy(etdc::protocol_type(daemon.cmdProto()), etdc::host_type(host), daemon.cmdPort(),
+                                                            etdc::numretry_type{2}, etdc::retrydelay_type{std::chrono::duration<float>(0.1)}) );
+    off_t                             nByte;
+
+    ETDCDEBUG(2, "etdbench: " << proto << " daemon speaks protocol version " << remote->protocolVersion() << std::endl);
+    // Creating the servers may work but the data channel still not, e.g.
+    // UDT over IPv6
+    transfer(local, remote, true, "1", nByte);
+
+    for(auto const& size: sizes) {
+        for(auto push: {true, false}) {
+            cell_type               cell;
+            std::vector<double>     dt;
+            const auto              start( std::chrono::steady_clock::now() );
+            const auto              elapsed = [&](void) {
+                return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            };
+
+            cell.key = proto + (push ? " push " : " pull ") + size;
+            try {
+                // A file that by itself takes longer than minTime is
+                // not repeated
+                do {
+                    dt.push_back( transfer(local, remote, push, size, cell.nByte) );
+                } while( elapsed()<minTime || (dt.size()<3 && dt.back()<minTime) );
+                std::sort(dt.begin(), dt.end());
+                cell.nFile   = (unsigned int)dt.size();
+                cell.latency = dt[ dt.size()/2 ];
+            }
+            catch( std::exception const& e ) {
+                cell.reason = e.what();
+            }
+            std::cout << std::left << std::setw(24) << cell.key << std::right;
+            if( cell.reason.empty() )
+                std::cout << std::setw(8) << cell.nFile << std::setw(14) << etdc::sciprint(cell.latency, "s", std::setprecision(3))
+                          << std::setw(16) << fmtRate((double)cell.nByte/cell.latency) << std::endl;
+            else
+                std::cout << "  failed: " << cell.reason << std::endl;
+            cells.push_back( cell );
+        }
+    }
+    // Hang up before the daemon goes
+    remote.reset();
+    return cells;
+}
+
+// The child reports back to the parent over a pipe, one line per cell:
+//    <nFile> <nByte> <latency> <proto> <push|pull> <size>[ <reason>]
+// or, if the protocol could not be run at all, "skipped <reason>"
+static std::string one_line(std::string s) {
+    std::replace(s.begin(), s.end(), '\n', ' ');
+    return s;
+}
+
+static void write_all(int fd, std::string const& s) {
+    for(size_t done = 0; done<s.size(); ) {
+        const ssize_t n = ::write(fd, s.data() + done, s.size() - done);
+        if( n<0 && errno==EINTR )
+            continue;
+        ETDCSYSCALL(n>0, "failed to write to parent - " << etdc::strerror(errno));
+        done += (size_t)n;
+    }
+}
+
+static std::string read_all(int fd) {
+    char         buf[ 4096 ];
+    std::string  rv;
+    ssize_t      n;
+
+    while( (n = ::read(fd, buf, sizeof(buf)))!=0 ) {
+        if( n<0 && errno==EINTR )
+            continue;
+        ETDCSYSCALL(n>0, "failed to read from benchmark process - " << etdc::strerror(errno));
+        rv.append(buf, (size_t)n);
+    }
+    return rv;
+}
+
+// Runs run_protocol() in a child process and returns the cells it reported
+static std::list<cell_type> fork_protocol(std::string const& proto, std::vector<std::string> const& sizes,
+                                          double minTime, size_t bufSize) {
+    int    fds[2];
+    pid_t  pid;
+
+    ETDCSYSCALL(::pipe(fds)==0, "failed to create pipe - " << etdc::strerror(errno));
+    // whatever's buffered shouldn't be printed twice
+    std::cout.flush();
+    ETDCSYSCALL((pid = ::fork())!=-1, "failed to fork - " << etdc::strerror(errno));
+
+    if( pid==0 ) {
+        std::ostringstream  report;
+
+        ::close(fds[0]);
+        etdc::thread(signal_thread, signallist_type{{SIGHUP, SIGINT, SIGTERM}}).detach();
+        try {
+            for(auto const& c: run_protocol(proto, sizes, minTime, bufSize))
+                report << c.nFile << " " << c.nByte << " " << std::setprecision(17) << c.latency << " " << c.key
+                       << (c.reason.empty() ? std::string() : " " + one_line(c.reason)) << "\n";
+        }
+        catch( std::exception const& e ) {
+            report.str( "skipped " + one_line(e.what()) + "\n" );
+        }
+        std::cout.flush();
+        write_all(fds[1], report.str());
+        ::_exit( 0 );
+    }
+    benchChild.store( pid );
+    ::close(fds[1]);
+
+    std::list<cell_type>  cells;
+    int                   status{ 0 };
+    std::istringstream    iss( read_all(fds[0]) );
+    std::string           line;
+
+    ::close(fds[0]);
+    while( ::waitpid(pid, &status, 0)==-1 && errno==EINTR )
+        ;
+    benchChild.store( 0 );
+
+    while( std::getline(iss, line) ) {
+        std::istringstream  fields( line );
+        std::string         dir, size, rest;
+        cell_type           c;
+
+        if( line.compare(0, 8, "skipped ")==0 ) {
+            std::cout << proto << ": skipped - " << line.substr(8) << std::endl;
+            continue;
+        }
+        ETDCASSERT(fields >> c.nFile >> c.nByte >> c.latency >> c.key >> dir >> size,
+                   "Malformed report from " << proto << " benchmark process: " << line);
+        std::getline(fields >> std::ws, c.reason);
+        c.key += " " + dir + " " + size;
+        cells.push_back( c );
+    }
+    // A process that did not exit normally is a failure, whatever it
+    // managed to report
+    if( !WIFEXITED(status) || WEXITSTATUS(status)!=0 ) {
+        cell_type  c;
+        c.key    = proto;
+        c.reason = "benchmark process " + (WIFSIGNALED(status) ? "killed by signal#" + etdc::repr(WTERMSIG(status)) :
+                                                                 "exited with status " + etdc::repr(WEXITSTATUS(status)));
+        std::cout << std::left << std::setw(24) << c.key << std::right << "  failed: " << c.reason << std::endl;
+        cells.push_back( c );
+    }
+    return cells;
+}
+
+// Baseline file: one line per cell, "<proto> <push|pull> <size> <latency>"
+using baseline_type = std::map<std::string, double>;
+
+static baseline_type read_baseline(std::string const& fn) {
+    std::ifstream  ifs( fn );
+    std::string    line;
+    baseline_type  rv;
+
+    while( std::getline(ifs, line) ) {
+        std::istringstream  iss( line );
+        std::string         proto, dir, size;
+        double              latency;
+
+        if( line.empty() || line[0]=='#' )
+            continue;
+        ETDCASSERT(iss >> proto >> dir >> size >> latency, "Malformed line in baseline " << fn << ": " << line);
+        rv[ proto + " " + dir + " " + size ] = latency;
+    }
+    return rv;
+}
+
+static void write_baseline(std::string const& fn, std::list<cell_type> const& cells) {
+    std::ofstream  ofs( fn );
+
+    ofs << "# etdbench baseline: <protocol> <direction> <size> <median seconds per file>" << std::endl;
+    for(auto const& c: cells)
+        if( c.reason.empty() )
+            ofs << c.key << " " << std::setprecision(6) << c.latency << std::endl;
+    ofs.close();
+    ETDCASSERT(ofs, "Failed to write baseline " << fn);
+}
+
+int main(int argc, char const*const*const argv) {
+    etdc::BlockAll            ba;
+    int                       message_level{ -1 };
+    std::vector<std::string>  protocols, sizes;
+    double                    minTime{ 2 }, tolerance{ 25 };
+    size_t                    bufSize{ 32*1024*1024 };
+    std::string               baseline;
+
+    AP::ArgumentParser     cmd( AP::version( buildinfo() ),
+                                AP::docstring("Loopback benchmark of the etransfer daemon and client in one process. "
+                                              "Pushes /dev/zero:<size> to, and pulls it from, a daemon's /dev/null over each "
+                                              "data channel protocol and reports the throughput and the median time per file."),
+                                AP::docstring("With --baseline the results are compared to those in the file, which is "
+                                              "written if it does not exist yet; a file that got slower by more than "
+                                              "--tolerance percent makes the exit status non-zero.") );
+
+    cmd.add( AP::long_name("help"), AP::print_help(),
+             AP::docstring("Print full help and exit successfully") );
+    cmd.add( AP::short_name('h'), AP::print_usage(),
+             AP::docstring("Print short usage and exit successfully") );
+    cmd.add( AP::long_name("version"), AP::print_version(),
+             AP::docstring("Print version and exit successfully") );
+    cmd.add( AP::store_into(message_level), AP::short_name('m'),
+             AP::maximum_value(5), AP::minimum_value(-1), AP::at_most(1),
+             AP::docstring(std::string("Message level - higher = more output. Default: ")+etdc::repr(message_level)) );
+    cmd.add( AP::collect_into(protocols), AP::long_name("protocol"), AP::match("(tcp|udt)6?"),
+             AP::docstring("Benchmark this data channel protocol (tcp, udt, tcp6 or udt6). May be given multiple times. "
+                           "Default: all four; IPv6 is skipped if ::1 can't be used") );
+    cmd.add( AP::collect_into(sizes), AP::long_name("size"), AP::match("[0-9]+([kMGT]i?B)?"),
+             AP::docstring("File size class, optionally with a [kMGT]i?B suffix. May be given multiple times. "
+                           "Default: 1kB 1MB 100MB 1GB 10GB 100GB") );
+    cmd.add( AP::store_into(minTime), AP::long_name("time"), AP::at_most(1),
+             AP::constrain([](double t) { return t>0; }, "time should be > 0"),
+             AP::docstring(std::string("Repeat each size for at least this many seconds, and at least three times unless one "
+                                         "file takes longer than that. Default: ")+
+                           etdc::repr(minTime)) );
+    cmd.add( AP::store_into(bufSize), AP::long_name("buffer"), AP::at_most(1),
+             AP::docstring(std::string("Send/receive buffer size in bytes of both ends. Default: ")+etdc::repr(bufSize)) );
+    cmd.add( AP::store_into(baseline), AP::long_name("baseline"), AP::at_most(1),
+             AP::docstring("Compare to the results in this file, or write them to it if it does not exist") );
+    cmd.add( AP::store_into(tolerance), AP::long_name("tolerance"), AP::at_most(1),
+             AP::constrain([](double t) { return t>=0; }, "tolerance should be >= 0"),
+             AP::docstring(std::string("How many percent slower than the baseline is a regression. Default: ")+etdc::repr(tolerance)) );
+    cmd.parse(argc, argv);
+
+    etdc::dbglev_fn( message_level );
+    if( protocols.empty() )
+        protocols = { "tcp", "udt", "tcp6", "udt6" };
+    if( sizes.empty() )
+        sizes = { "1kB", "1MB", "100MB", "1GB", "10GB", "100GB" };
+
+    etdc::thread(signal_thread, signallist_type{{SIGHUP, SIGINT, SIGTERM}}).detach();
+
+    // The benchmark processes' main threads run the client, which gets
+    // kicked out of blocking calls by the same signal as the daemon
+    etdc::UnBlock    s({etdc::loopbackKillSignal});
+    etdc::install_handler(etdc::loopback_signal_handler, {etdc::loopbackKillSignal});
+
+    std::list<cell_type>  cells;
+
+    std::cout << std::left << std::setw(24) << "benchmark" << std::right << std::setw(8) << "files"
+              << std::setw(14) << "latency" << std::setw(16) << "rate" << std::endl;
+    for(auto const& proto: protocols)
+        cells.splice(cells.end(), fork_protocol(proto, sizes, minTime, bufSize));
+
+    // Compare or store
+    unsigned int  nBad = std::count_if(cells.begin(), cells.end(), [](cell_type const& c) { return !c.reason.empty(); });
+
+    if( !baseline.empty() ) {
+        if( ::access(baseline.c_str(), F_OK)!=0 ) {
+            write_baseline(baseline, cells);
+            std::cout << "Wrote baseline " << baseline << std::endl;
+        } else {
+            const baseline_type  ref( read_baseline(baseline) );
+
+            for(auto const& c: cells) {
+                auto const  p = ref.find( c.key );
+                if( p==ref.end() || !c.reason.empty() )
+                    continue;
+                const double  slower = 100.0 * (c.latency/p->second - 1.0);
+                if( slower>tolerance ) {
+                    std::cout << "REGRESSION: " << c.key << " " << etdc::sciprint(c.latency, "s", std::setprecision(3)) << " per file, baseline "
+                              << etdc::sciprint(p->second, "s", std::setprecision(3)) << " (" << std::fixed << std::setprecision(1) << slower << "% slower)" << std::endl;
+                    nBad++;
+                }
+            }
+            if( nBad==0 )
+                std::cout << "No regressions compared to " << baseline << " (tolerance " << tolerance << "%)" << std::endl;
+        }
+    }
+    return nBad ? 1 : 0;
+}
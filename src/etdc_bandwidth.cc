@@ -0,0 +1,262 @@
+// Implementation of the daemon-wide bandwidth scheduler
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <etdc_bandwidth.h>
+#include <etdc_sciprint.h>
+#include <etdc_debug.h>
+#include <etdc_assert.h>
+
+// C++ headers
+#include <map>
+#include <cmath>
+#include <thread>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+// Plain-old-C
+#include <errno.h>
+
+namespace etdc {
+
+    namespace detail {
+        // The bucket holds enough for this long at the assigned rate,
+        // but at least this many bytes
+        static const double bw_burst_time = 0.01;
+        static const size_t bw_min_quantum = 64*1024;
+        // Sleep at most this long at a time, such that cancellation or a
+        // new rate is noticed soon enough
+        static const double bw_max_sleep = 0.05;
+    }
+
+    ////////////////////////////////////////////////////////////////////////
+    //                          bandwidth_share
+    ////////////////////////////////////////////////////////////////////////
+    bandwidth_share::bandwidth_share(bandwidth_scheduler* sched, std::string const& peer, double weight, unsigned int rank):
+        __m_scheduler( sched ), __m_peer( peer ), __m_weight( weight ), __m_rank( rank ),
+        __m_rate( std::numeric_limits<double>::infinity() ), __m_tokens( 0 ), __m_last( clock_type::now() )
+    {}
+
+    bandwidth_share::~bandwidth_share() {
+        __m_scheduler->leave( this );
+    }
+
+    size_t bandwidth_share::quantum( void ) const {
+        return std::max(detail::bw_min_quantum, (size_t)(__m_rate * detail::bw_burst_time));
+    }
+
+    size_t bandwidth_share::acquire(size_t n, detail::cancelfn_type const& isCancelled) {
+        std::unique_lock<std::mutex> lk( __m_mutex );
+
+        while( std::isfinite(__m_rate) ) {
+            const clock_type::time_point now( clock_type::now() );
+            const double                 dt( std::chrono::duration<double>(now - __m_last).count() );
+
+            // Tokens don't pile up beyond one quantum so an idle transfer
+            // can't burst. The balance may go negative by at most a
+            // quantum: whoever comes next waits for it
+            __m_last   = now;
+            __m_tokens = std::min(__m_tokens + dt * __m_rate, (double)quantum());
+            if( __m_tokens>=0 ) {
+                const size_t grant( std::min(n, quantum()) );
+                __m_tokens -= (double)grant;
+                return grant;
+            }
+            const double wait( std::min(-__m_tokens / __m_rate, detail::bw_max_sleep) );
+
+            lk.unlock();
+            std::this_thread::sleep_for( std::chrono::duration<double>(wait) );
+            if( isCancelled() )
+                return 0;
+            lk.lock();
+        }
+        return n;
+    }
+
+    void bandwidth_share::refund(size_t n) {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        __m_tokens = std::min(__m_tokens + (double)n, (double)quantum());
+    }
+
+    double bandwidth_share::rate( void ) const {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        return __m_rate;
+    }
+
+    void bandwidth_share::set_rate(double r) {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        __m_rate   = r;
+        __m_tokens = std::min(__m_tokens, (double)quantum());
+    }
+
+    ////////////////////////////////////////////////////////////////////////
+    //                          bandwidth_scheduler
+    ////////////////////////////////////////////////////////////////////////
+    bandwidth_scheduler::bandwidth_scheduler():
+        __m_total( 0 ), __m_perPeer( 0 ), __m_preempt( 0 )
+    {}
+
+    void bandwidth_scheduler::configure(int64_t total, int64_t perPeer, int64_t preempt) {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        __m_total   = total;
+        __m_perPeer = perPeer;
+        __m_preempt = preempt;
+        this->rebalance();
+    }
+
+    bool bandwidth_scheduler::limited( void ) const {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        return __m_total>0 || __m_perPeer>0 || __m_preempt>0;
+    }
+
+    bandwidth_share_ptr bandwidth_scheduler::join(std::string const& peer, double weight, unsigned int rank) {
+        ETDCASSERT(weight>0, "bandwidth_scheduler: a transfer's weight must be > 0, not " << weight);
+
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        if( __m_total<=0 && __m_perPeer<=0 && __m_preempt<=0 )
+            return bandwidth_share_ptr();
+
+        bandwidth_share_ptr rv( new bandwidth_share(this, peer, weight, rank) );
+        __m_shares.push_back( rv.get() );
+        this->rebalance();
+        return rv;
+    }
+
+    void bandwidth_scheduler::leave(bandwidth_share* share) {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        __m_shares.remove( share );
+        this->rebalance();
+    }
+
+    // Divide 'budget' over the shares, by peer first, taking into account
+    // what the peers have left of their cap. Returns how much was handed out
+    double bandwidth_scheduler::distribute(std::list<bandwidth_share*> const& shares, double budget, std::map<std::string, double>& peerLeft) {
+        struct peer_type {
+            double                      weight{ 0 }, cap{ 0 }, rate{ 0 };
+            std::list<bandwidth_share*> shares;
+        };
+        std::map<std::string, peer_type> peers;
+        std::vector<peer_type*>          order;
+        double                           weight{ 0 }, used{ 0 };
+
+        for(auto share: shares) {
+            peer_type& p( peers[share->__m_peer] );
+            p.weight += share->__m_weight;
+            p.shares.push_back( share );
+        }
+        for(auto& p: peers) {
+            p.second.cap = peerLeft[p.first];
+            order.push_back( &p.second );
+            weight += p.second.weight;
+        }
+        // The peers that run into their cap first are served first;
+        // whatever they can't use is divided over the rest
+        std::sort(order.begin(), order.end(), [](peer_type const* l, peer_type const* r) { return l->cap/l->weight<r->cap/r->weight; });
+        for(auto p: order) {
+            p->rate = (std::isinf(budget) ? p->cap : std::min(p->cap, budget * p->weight / weight));
+            used   += p->rate;
+            weight -= p->weight;
+            if( !std::isinf(budget) )
+                budget -= p->rate;
+        }
+        for(auto const& p: peers) {
+            ETDCDEBUG(3, "bandwidth_scheduler/peer " << p.first << ": " << p.second.shares.size() << " transfer(s) share " <<
+                         (std::isinf(p.second.rate) ? std::string("unlimited") : sciprint(p.second.rate, "Bps")) << std::endl);
+            if( !std::isinf(p.second.cap) )
+                peerLeft[p.first] -= p.second.rate;
+            for(auto share: p.second.shares)
+                share->set_rate( p.second.rate * share->__m_weight / p.second.weight );
+        }
+        return used;
+    }
+
+    void bandwidth_scheduler::rebalance( void ) {
+        const double                  inf( std::numeric_limits<double>::infinity() );
+        const double                  total( __m_total>0 ? (double)__m_total : inf );
+        unsigned int                  top{ 0 };
+        std::list<bandwidth_share*>   upper, lower;
+        std::map<std::string, double> peerLeft;
+
+        for(auto share: __m_shares) {
+            top = std::max(top, share->__m_rank);
+            peerLeft[share->__m_peer] = (__m_perPeer>0 ? (double)__m_perPeer : inf);
+        }
+        for(auto share: __m_shares)
+            (__m_preempt>0 && share->__m_rank<top ? lower : upper).push_back( share );
+
+        if( lower.empty() ) {
+            this->distribute(upper, total, peerLeft);
+            return;
+        }
+        // The lower ranks are guaranteed their budget, as far as the
+        // total allows, and get whatever the upper rank can't use
+        const double reserve( std::min((double)__m_preempt, total) );
+        const double used( this->distribute(upper, std::isinf(total) ? inf : total - reserve, peerLeft) );
+
+        ETDCDEBUG(3, "bandwidth_scheduler/" << lower.size() << " transfer(s) preempted by " << upper.size() << " of a higher rank" << std::endl);
+        this->distribute(lower, std::isinf(total) ? reserve : total - used, peerLeft);
+    }
+
+    ////////////////////////////////////////////////////////////////////////
+    //                          throttled_fd
+    ////////////////////////////////////////////////////////////////////////
+    throttled_fd::throttled_fd(etdc_fdptr fd, bandwidth_share_ptr share, detail::cancelfn_type const& isCancelled):
+        __m_fd( fd ), __m_share( share ), __m_read( fd->read ), __m_write( fd->write ), __m_zckind( fd->__m_zckind )
+    {
+        if( !__m_share )
+            return;
+
+        // Only ask for what may go, give back what didn't
+        const read_fn            rd( __m_read );
+        const write_fn           wr( __m_write );
+        const bandwidth_share_ptr s( __m_share );
+
+        __m_fd->__m_zckind = zerocopy_kind::None;
+        __m_fd->read  = [=](int f, void* buf, size_t n) -> ssize_t {
+                            const size_t m( s->acquire(n, isCancelled) );
+                            if( m==0 ) {
+                                errno = ECANCELED;
+                                return -1;
+                            }
+                            const ssize_t r( rd(f, buf, m) );
+                            if( r<(ssize_t)m )
+                                s->refund( m - (size_t)std::max(r, (ssize_t)0) );
+                            return r;
+                        };
+        __m_fd->write = [=](int f, const void* buf, size_t n) -> ssize_t {
+                            const size_t m( s->acquire(n, isCancelled) );
+                            if( m==0 ) {
+                                errno = ECANCELED;
+                                return -1;
+                            }
+                            const ssize_t r( wr(f, buf, m) );
+                            if( r<(ssize_t)m )
+                                s->refund( m - (size_t)std::max(r, (ssize_t)0) );
+                            return r;
+                        };
+    }
+
+    throttled_fd::~throttled_fd() {
+        if( !__m_share )
+            return;
+        __m_fd->read       = __m_read;
+        __m_fd->write      = __m_write;
+        __m_fd->__m_zckind = __m_zckind;
+    }
+}
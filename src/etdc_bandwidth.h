@@ -0,0 +1,139 @@
+// Daemon-wide bandwidth scheduling: token buckets shared by the data loops
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef ETDC_BANDWIDTH_H
+#define ETDC_BANDWIDTH_H
+
+// Own includes
+#include <etdc_fd.h>
+
+// C++ headers
+#include <map>
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+namespace etdc {
+
+    class bandwidth_scheduler;
+
+    // One transfer's share of the bandwidth: a token bucket that fills at
+    // the rate the scheduler assigned to it. All data connections of the
+    // transfer draw from the same share. It leaves the scheduler, which
+    // then redistributes the bandwidth, when the last reference to it goes.
+    class bandwidth_share {
+        public:
+            bandwidth_share(bandwidth_share const&) = delete;
+            bandwidth_share& operator=(bandwidth_share const&) = delete;
+            ~bandwidth_share();
+
+            // Ask permission to move n bytes. Waits until the bucket
+            // allows it and returns how many of them may go now, which
+            // may be fewer, but never fewer than a quantum (or n) such
+            // that small messages are never split. Returns 0 if cancelled
+            // whilst waiting.
+            size_t acquire(size_t n, detail::cancelfn_type const& isCancelled);
+            // Bytes that were acquired but not moved after all
+            void   refund(size_t n);
+
+            // Bytes per second currently assigned to us
+            double rate( void ) const;
+
+        private:
+            friend class bandwidth_scheduler;
+            using clock_type = std::chrono::steady_clock;
+
+            bandwidth_share(bandwidth_scheduler* sched, std::string const& peer, double weight, unsigned int rank);
+
+            // Updated by the scheduler only, under its lock
+            void   set_rate(double r);
+            // The bucket holds at most this many tokens; with __m_mutex held
+            size_t quantum( void ) const;
+
+            bandwidth_scheduler*   __m_scheduler;
+            const std::string      __m_peer;
+            const double           __m_weight;
+            const unsigned int     __m_rank;
+            mutable std::mutex     __m_mutex;
+            double                 __m_rate, __m_tokens;
+            clock_type::time_point __m_last;
+    };
+    using bandwidth_share_ptr = std::shared_ptr<bandwidth_share>;
+
+    // The daemon-wide limit is divided over the active transfers in
+    // proportion to their weights, but no peer (remote host) gets more
+    // than the per-peer limit; what a capped peer can't use goes to the
+    // others (weighted max-min fairness). Within a peer, its transfers
+    // divide the peer's rate by weight again. This is recomputed whenever
+    // a transfer starts or finishes.
+    // Transfers also have a rank. With a preemption budget configured,
+    // whilst transfers of the highest active rank run, all lower ranked
+    // ones together are throttled to that budget - they slow down but
+    // are not stopped - and the highest rank gets the rest. Without it
+    // ranks don't matter, only weights do.
+    // Without any limits configured join() returns an empty pointer and
+    // nothing is throttled.
+    class bandwidth_scheduler {
+        public:
+            bandwidth_scheduler();
+            bandwidth_scheduler(bandwidth_scheduler const&) = delete;
+            bandwidth_scheduler& operator=(bandwidth_scheduler const&) = delete;
+
+            // All in bytes per second, <=0 means no limit resp. no preemption
+            void configure(int64_t total, int64_t perPeer, int64_t preempt = 0);
+            bool limited( void ) const;
+
+            bandwidth_share_ptr join(std::string const& peer, double weight = 1.0, unsigned int rank = 0);
+
+        private:
+            friend class bandwidth_share;
+
+            void leave(bandwidth_share* share);
+            // Divide the bandwidth again; with __m_mutex held
+            void   rebalance( void );
+            double distribute(std::list<bandwidth_share*> const& shares, double budget, std::map<std::string, double>& peerLeft);
+
+            mutable std::mutex          __m_mutex;
+            int64_t                     __m_total, __m_perPeer, __m_preempt;
+            std::list<bandwidth_share*> __m_shares;
+    };
+
+    // For as long as this object lives the reads and writes on fd draw
+    // from the share. Throttled sockets can't do zero-copy: the kernel
+    // would move the bytes without asking. An empty share changes nothing.
+    class throttled_fd {
+        public:
+            throttled_fd(etdc_fdptr fd, bandwidth_share_ptr share, detail::cancelfn_type const& isCancelled);
+            throttled_fd(throttled_fd const&) = delete;
+            throttled_fd& operator=(throttled_fd const&) = delete;
+            ~throttled_fd();
+
+        private:
+            etdc_fdptr          __m_fd;
+            bandwidth_share_ptr __m_share;
+            read_fn             __m_read;
+            write_fn            __m_write;
+            zerocopy_kind       __m_zckind;
+    };
+}
+
+#endif // ETDC_BANDWIDTH_H
@@ -0,0 +1,246 @@
+// Implementation of the data channel benchmark
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <etdc_bench.h>
+#include <etdc_thread.h>
+#include <etdc_debug.h>
+
+// C++ headers
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <sstream>
+#include <condition_variable>
+
+// Plain-old-C
+#include <sys/time.h>
+#include <sys/resource.h>
+
+namespace etdc {
+
+    namespace detail {
+        // How often the UDT counters are looked at whilst a cell runs
+        static const std::chrono::milliseconds bench_sample_interval( 100 );
+
+        static bool is_udt(sockname_type const& sn) {
+            const std::string proto( untag(get_protocol(sn)) );
+            return proto.compare(0, 3, "udt")==0;
+        }
+
+        static double cpu_seconds( void ) {
+            struct rusage ru;
+            ETDCSYSCALL(::getrusage(RUSAGE_SELF, &ru)==0, "getrusage failed");
+            return (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) + (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec)/1e6;
+        }
+
+        // Keeps the last known counters of each UDT data connection of the
+        // transfers in 'state'. Connections come and go during a transfer
+        // (stripes) so we look at them every now and then and remember
+        // what we saw of the ones that are gone
+        class udt_sampler {
+            public:
+                explicit udt_sampler(etd_state& state):
+                    __m_state( state ), __m_stop( false ),
+                    __m_thread( etdc::thread(&udt_sampler::run, this) )
+                {}
+                udt_sampler(udt_sampler const&) = delete;
+                udt_sampler& operator=(udt_sampler const&) = delete;
+
+                ~udt_sampler() {
+                    {
+                        std::lock_guard<std::mutex> lk( __m_mutex );
+                        __m_stop = true;
+                    }
+                    __m_condition.notify_all();
+                    __m_thread.join();
+                }
+
+                // Take one more look and return the sum of what we've seen
+                void totals(bench_cell& cell) {
+                    std::lock_guard<std::mutex> lk( __m_mutex );
+                    this->sample();
+                    for(auto const& s: __m_seen) {
+                        cell.pktSent    += (uint64_t)s.second.pktSentTotal;
+                        cell.pktRetrans += (uint64_t)s.second.pktRetransTotal;
+                        cell.pktLoss    += (uint64_t)(s.second.pktSndLossTotal + s.second.pktRcvLossTotal);
+                    }
+                }
+
+            private:
+                // Must be called with __m_mutex held
+                void sample( void ) {
+                    std::list<etdc_fdptr>         fds;
+                    std::lock_guard<std::mutex>   lk( __m_state.lock );
+
+                    for(auto const& xfer: __m_state.transfers) {
+                        if( xfer.second->data_fd )
+                            fds.push_back( xfer.second->data_fd );
+                        std::lock_guard<std::mutex>  slk( xfer.second->stripe_lock );
+                        fds.insert(fds.end(), xfer.second->stripe_fds.begin(), xfer.second->stripe_fds.end());
+                    }
+                    for(auto const& fd: fds) {
+                        UDT::TRACEINFO  perf;
+                        if( dynamic_cast<etdc_udt*>(fd.get()) && UDT::perfmon(fd->__m_fd, &perf, false)!=UDT::ERROR )
+                            __m_seen[ fd->__m_fd ] = perf;
+                    }
+                }
+
+                void run( void ) {
+                    std::unique_lock<std::mutex> lk( __m_mutex );
+                    while( !__m_condition.wait_for(lk, bench_sample_interval, [this]( void ) { return __m_stop; }) )
+                        this->sample();
+                }
+
+                etd_state&                     __m_state;
+                bool                           __m_stop;
+                std::mutex                     __m_mutex;
+                std::condition_variable        __m_condition;
+                std::map<int, UDT::TRACEINFO>  __m_seen;
+                std::thread                    __m_thread;
+        };
+
+        static void run_cell(etd_server_ptr local, etd_state& state, etd_server_ptr remote, std::string const& src, bench_cell& cell) {
+            std::unique_ptr<result_type> srcResult, dstResult;
+            xfer_options                 opts;
+
+            {
+                std::lock_guard<std::mutex> lk( state.lock );
+                state.bufSize  = cell.bufSize;
+                state.udtMSS   = mss_type{ cell.mss };
+                state.udtMaxBW = max_bw_type{ cell.maxBW };
+            }
+            state.pool.configure(cell.bufSize, 0, buffer_pool::backing_type::Normal);
+            opts.nStreams = cell.nStreams;
+
+            try {
+                dstResult.reset( new result_type(remote->requestFileWrite("/dev/null", openmode_type::OverWrite)) );
+                srcResult.reset( new result_type(local->requestFileRead(src, 0)) );
+
+                udt_sampler     sampler( state );
+                const double    cpu0( cpu_seconds() );
+                const auto      start( std::chrono::steady_clock::now() );
+                const xfer_result rv( local->sendFile(get_uuid(*srcResult), get_uuid(*dstResult), get_filepos(*srcResult),
+                                                      dataaddrlist_type{cell.channel}, opts) );
+                const double    wall( std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() );
+
+                cell.finished = rv.__m_Finished;
+                cell.reason   = rv.__m_Reason;
+                cell.nByte    = rv.__m_BytesTransferred;
+                cell.dt       = rv.__m_DeltaT.count();
+                cell.cpu      = (wall>0 ? 100.0 * (cpu_seconds() - cpu0) / wall : 0.0);
+                if( cell.udt )
+                    sampler.totals( cell );
+            }
+            catch( std::exception const& e ) {
+                cell.finished = false;
+                cell.reason   = e.what();
+            }
+            // Like etc does for files: try to remove both, whatever happens
+            try {
+                if( dstResult )
+                    remote->removeUUID( get_uuid(*dstResult) );
+            }
+            catch( ... ) {}
+            try {
+                if( srcResult )
+                    local->removeUUID( get_uuid(*srcResult) );
+            }
+            catch( ... ) {}
+        }
+
+        static std::string json_string(std::string const& s) {
+            std::ostringstream oss;
+            oss << '"';
+            for(auto c: s) {
+                if( c=='"' || c=='\\' )
+                    oss << '\\' << c;
+                else if( (unsigned char)c<0x20 )
+                    oss << "\\u00" << "0123456789abcdef"[(c>>4) & 0xf] << "0123456789abcdef"[c & 0xf];
+                else
+                    oss << c;
+            }
+            oss << '"';
+            return oss.str();
+        }
+    }
+
+    benchlist_type run_bench(etd_server_ptr local, etd_state& state, etd_server_ptr remote,
+                             bench_matrix const& matrix, benchdone_fn const& done) {
+        const std::string               src( "/dev/zero:" + matrix.size );
+        const std::vector<mss_type>     noMSS{ mss_type{0} };
+        const std::vector<max_bw_type>  noBW{ max_bw_type{0} };
+        benchlist_type                  rv;
+
+        for(auto const& channel: matrix.channels) {
+            const bool  udt( detail::is_udt(channel) );
+
+            for(auto bufSize: matrix.bufSizes)
+                for(auto mss: (udt ? matrix.mss : noMSS))
+                    for(auto bw: (udt ? matrix.maxBW : noBW))
+                        for(auto nStreams: matrix.streams) {
+                            if( state.cancelled.load() )
+                                return rv;
+
+                            bench_cell  cell;
+                            cell.channel  = channel;
+                            cell.udt      = udt;
+                            cell.bufSize  = bufSize;
+                            cell.mss      = untag(mss);
+                            cell.maxBW    = untag(bw);
+                            cell.nStreams = nStreams;
+
+                            ETDCDEBUG(2, "run_bench/" << channel << " buffer=" << bufSize << " mss=" << cell.mss << " max-bw=" << cell.maxBW
+                                         << " streams=" << nStreams << std::endl);
+                            detail::run_cell(local, state, remote, src, cell);
+                            rv.push_back( cell );
+                            if( done )
+                                done( rv.back() );
+                        }
+        }
+        return rv;
+    }
+
+    void bench_json(std::ostream& os, std::string const& daemon, bench_matrix const& matrix, benchlist_type const& cells) {
+        os << "{\n  \"daemon\": " << detail::json_string(daemon) << ",\n"
+           << "  \"size\": " << detail::json_string(matrix.size) << ",\n"
+           << "  \"cells\": [";
+        for(auto p = cells.begin(); p!=cells.end(); p++) {
+            std::ostringstream  channel;
+            channel << p->channel;
+
+            os << (p==cells.begin() ? "\n" : ",\n")
+               << "    { \"channel\": " << detail::json_string(channel.str())
+               << ", \"protocol\": " << detail::json_string(untag(get_protocol(p->channel)))
+               << ", \"buffer\": " << p->bufSize << ", \"mss\": " << p->mss << ", \"max_bw\": " << p->maxBW
+               << ", \"streams\": " << p->nStreams
+               << ", \"finished\": " << (p->finished ? "true" : "false")
+               << ", \"bytes\": " << p->nByte << ", \"seconds\": " << p->dt
+               << ", \"bytes_per_second\": " << (p->dt>0 ? (double)p->nByte/p->dt : 0.0)
+               << ", \"cpu_percent\": " << p->cpu;
+            if( p->udt )
+                os << ", \"udt\": { \"packets_sent\": " << p->pktSent << ", \"retransmitted\": " << p->pktRetrans
+                   << ", \"lost\": " << p->pktLoss << " }";
+            if( !p->finished )
+                os << ", \"reason\": " << detail::json_string(p->reason);
+            os << " }";
+        }
+        os << "\n  ]\n}\n";
+    }
+}
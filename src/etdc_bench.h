@@ -0,0 +1,84 @@
+// Sweep a matrix of data channel settings against a daemon (etc --bench)
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef ETDC_BENCH_H
+#define ETDC_BENCH_H
+
+// Own includes
+#include <etdc_fd.h>
+#include <etdc_etd_state.h>
+#include <etdc_etdserver.h>
+
+// C++ headers
+#include <list>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <functional>
+
+namespace etdc {
+
+    // What to sweep. Every combination is a cell; the MSS and bandwidth
+    // limit only matter to UDT so TCP channels are only swept over the
+    // buffer sizes and streams. An MSS or bandwidth of 0 = leave it to the
+    // daemon. Each cell sends "/dev/zero:<size>" to /dev/null.
+    struct bench_matrix {
+        dataaddrlist_type          channels;
+        std::vector<size_t>        bufSizes;
+        std::vector<mss_type>      mss;
+        std::vector<max_bw_type>   maxBW;
+        std::vector<unsigned int>  streams;
+        std::string                size;
+    };
+
+    // How one cell did.
+    //   cpu:      time this process spent on the CPU, in % of one core
+    //   pkt*:     UDT's packet counters of the data connection(s), summed;
+    //             sampled during the transfer so the last few packets of
+    //             a stripe that closed early may be missing
+    struct bench_cell {
+        sockname_type  channel{};
+        size_t         bufSize{ 0 };
+        int            mss{ 0 };
+        int64_t        maxBW{ 0 };
+        unsigned int   nStreams{ 1 };
+        bool           finished{ false };
+        std::string    reason{};
+        off_t          nByte{ 0 };
+        double         dt{ 0 }, cpu{ 0 };
+        bool           udt{ false };
+        uint64_t       pktSent{ 0 }, pktRetrans{ 0 }, pktLoss{ 0 };
+    };
+    using benchlist_type = std::list<bench_cell>;
+    using benchdone_fn   = std::function<void(bench_cell const&)>;
+
+    // Push each cell from 'local', an ETDServer on 'state', to 'remote'.
+    // The cell's settings are put in 'state' so nothing else should be
+    // using it. 'done' is called after each cell. A cell that fails is
+    // recorded as such and the sweep carries on, unless state.cancelled
+    // was set.
+    benchlist_type run_bench(etd_server_ptr local, etd_state& state, etd_server_ptr remote,
+                             bench_matrix const& matrix, benchdone_fn const& done);
+
+    // All cells as one JSON document
+    void bench_json(std::ostream& os, std::string const& daemon, bench_matrix const& matrix, benchlist_type const& cells);
+}
+
+#endif // ETDC_BENCH_H
@@ -0,0 +1,315 @@
+// Implementation of the transfer buffer pool
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+
+// MAP_HUGETLB and MADV_HUGEPAGE are Linux specific and need _GNU_SOURCE
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <etdc_bufferpool.h>
+#include <etdc_stringutil.h>
+#include <etdc_debug.h>
+#include <etdc_assert.h>
+#include <reentrant.h>
+
+// C++ headers
+#include <map>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+
+// Plain-old-C
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace etdc {
+
+    static const std::map<buffer_pool::backing_type, std::string> backing2string{
+        {buffer_pool::backing_type::Normal, "normal"}, {buffer_pool::backing_type::THP, "thp"},
+        {buffer_pool::backing_type::HugeTLB, "hugetlb"} };
+
+    std::ostream& operator<<(std::ostream& os, buffer_pool::backing_type const& bt) {
+        auto const ptr = backing2string.find( bt );
+        return os << (ptr==std::end(backing2string) ? "<invalid backing_type>" : ptr->second);
+    }
+
+    std::istream& operator>>(std::istream& is, buffer_pool::backing_type& bt) {
+        std::string  bt_s;
+
+        is >> bt_s;
+        auto const ptr = std::find_if(std::begin(backing2string), std::end(backing2string),
+                                      [&](std::pair<const buffer_pool::backing_type, std::string> const& p) { return etdc::stricmp(bt_s, p.second); });
+        if( ptr==std::end(backing2string) )
+            is.setstate( std::ios_base::failbit );
+        else
+            bt = ptr->first;
+        return is;
+    }
+
+    namespace detail {
+        // The default huge page size, from /proc/meminfo
+        static size_t huge_page_size( void ) {
+            size_t        kB{ 2048 };
+            std::string   line;
+            std::ifstream meminfo( "/proc/meminfo" );
+
+            while( std::getline(meminfo, line) )
+                if( line.compare(0, 13, "Hugepagesize:")==0 ) {
+                    kB = std::stoul( line.substr(13) );
+                    break;
+                }
+            return kB * 1024;
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////
+    //                          buffer_lease
+    ////////////////////////////////////////////////////////////////////////
+    buffer_lease::buffer_lease():
+        __m_pool( nullptr ), __m_private( nullptr )
+    {}
+
+    buffer_lease::buffer_lease(buffer_lease&& other):
+        __m_pool( other.__m_pool ), __m_blocks( std::move(other.__m_blocks) ), __m_private( other.__m_private )
+    {
+        other.__m_pool    = nullptr;
+        other.__m_private = nullptr;
+        other.__m_blocks.clear();
+    }
+
+    buffer_lease& buffer_lease::operator=(buffer_lease&& other) {
+        if( this!=&other ) {
+            this->release();
+            std::swap(__m_pool,    other.__m_pool);
+            std::swap(__m_blocks,  other.__m_blocks);
+            std::swap(__m_private, other.__m_private);
+        }
+        return *this;
+    }
+
+    buffer_lease::~buffer_lease() {
+        this->release();
+    }
+
+    void buffer_lease::release( void ) {
+        if( __m_private ) {
+            ::free( __m_private );
+            if( __m_pool )
+                __m_pool->give_back( __m_blocks.size() );
+        } else if( __m_pool && !__m_blocks.empty() )
+            __m_pool->give_back( __m_blocks );
+        __m_pool    = nullptr;
+        __m_private = nullptr;
+        __m_blocks.clear();
+    }
+
+    ////////////////////////////////////////////////////////////////////////
+    //                          buffer_pool
+    ////////////////////////////////////////////////////////////////////////
+    buffer_pool::buffer_pool(size_t blockSz):
+        __m_blockSize( blockSz ), __m_mapSize( 0 ), __m_memory( nullptr ), __m_capacity( 0 ),
+        __m_overflowMax( 0 ), __m_overflowUsed( 0 ), __m_overflowCount( 0 )
+    {}
+
+    buffer_pool::~buffer_pool() {
+        this->unmap();
+    }
+
+    void buffer_pool::unmap( void ) {
+        if( __m_memory )
+            ::munmap(__m_memory, __m_mapSize);
+        __m_memory   = nullptr;
+        __m_mapSize  = 0;
+        __m_capacity = 0;
+        __m_free.clear();
+    }
+
+    void buffer_pool::configure(size_t blockSz, size_t budget, backing_type backing, size_t overflow) {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        ETDCASSERT(__m_free.size()==__m_capacity && __m_overflowUsed==0, "buffer_pool: cannot reconfigure whilst blocks are in use");
+
+        // The blocks must be suitably aligned for O_DIRECT I/O, if any of
+        // the fds want to do that, so we round the block size down to
+        // a multiple of the alignment (if it's big enough to do that)
+        const size_t align( detail::direct_io_alignment );
+        if( blockSz>=align )
+            blockSz -= (blockSz % align);
+        ETDCASSERT(blockSz>0, "buffer_pool: the block size must be > 0");
+
+        this->unmap();
+        __m_blockSize     = blockSz;
+        __m_overflowMax   = overflow;
+        __m_overflowCount = 0;
+        if( budget==0 )
+            return;
+
+        const size_t nBlock = budget / blockSz;
+        ETDCASSERT(nBlock>0, "buffer_pool: a budget of " << budget << " bytes does not even hold one block of " << blockSz << " bytes");
+
+        const size_t mapSz  = nBlock * blockSz;
+        int          mflags = MAP_PRIVATE | MAP_ANONYMOUS;
+        void*        mem    = MAP_FAILED;
+
+#if defined(MAP_HUGETLB)
+        // hugetlbfs mappings are a multiple of the (default) huge page
+        // size, which munmap(2) wants to see back
+        if( backing==backing_type::HugeTLB ) {
+            const size_t pageSz = detail::huge_page_size();
+            const size_t hugeSz = ((mapSz + pageSz - 1) / pageSz) * pageSz;
+            if( (mem=::mmap(nullptr, hugeSz, PROT_READ|PROT_WRITE, mflags|MAP_HUGETLB, -1, 0))==MAP_FAILED ) {
+                ETDCDEBUG(-1, "buffer_pool: no huge pages for " << hugeSz << " bytes (" << etdc::strerror(errno) << "), falling back to normal pages" << std::endl);
+            } else {
+                __m_mapSize = hugeSz;
+            }
+        }
+#endif
+        if( mem==MAP_FAILED ) {
+            ETDCSYSCALL( (mem=::mmap(nullptr, mapSz, PROT_READ|PROT_WRITE, mflags, -1, 0))!=MAP_FAILED,
+                         "buffer_pool: failed to allocate " << mapSz << " bytes - " << etdc::strerror(errno) );
+            __m_mapSize = mapSz;
+#if defined(MADV_HUGEPAGE)
+            if( backing==backing_type::THP && ::madvise(mem, mapSz, MADV_HUGEPAGE)!=0 )
+                ETDCDEBUG(-1, "buffer_pool: madvise(MADV_HUGEPAGE) failed - " << etdc::strerror(errno) << std::endl);
+#endif
+        }
+        __m_memory = mem;
+
+        // Touch every page now rather than in the middle of a transfer
+        const size_t   pageSz( (size_t)::sysconf(_SC_PAGESIZE) );
+        unsigned char* base( reinterpret_cast<unsigned char*>(mem) );
+
+        for(size_t i=0; i<mapSz; i+=pageSz)
+            base[i] = 0;
+        for(size_t i=0; i<nBlock; i++)
+            __m_free.push_back( base + i * blockSz );
+        __m_capacity = nBlock;
+        ETDCDEBUG(2, "buffer_pool: " << nBlock << " blocks of " << blockSz << " bytes, " << backing << " pages" << std::endl);
+    }
+
+    buffer_lease buffer_pool::lease(size_t nBlock, detail::cancelfn_type const& isCancelled, unsigned int priority) {
+        buffer_lease                 rv;
+        std::unique_lock<std::mutex> lk( __m_mutex );
+
+        // No pool? Then this lease gets its own memory
+        const auto private_lease = [&]( void ) {
+            const size_t blockSz( __m_blockSize );
+
+            lk.unlock();
+            ETDCASSERT(::posix_memalign(&rv.__m_private, detail::direct_io_alignment, nBlock * blockSz)==0,
+                       "buffer_pool: failed to allocate " << nBlock << " x " << blockSz << " bytes");
+            for(size_t i=0; i<nBlock; i++)
+                rv.__m_blocks.push_back( reinterpret_cast<unsigned char*>(rv.__m_private) + i * blockSz );
+        };
+
+        nBlock = std::max(nBlock, (size_t)1);
+        if( __m_capacity==0 ) {
+            private_lease();
+            return rv;
+        }
+
+        // Cancellation doesn't notify us so we look at it every now and then.
+        // Both ends of a transfer may be served by the same daemon, in
+        // which case the sending half could be holding the blocks the
+        // receiving half is waiting for, and vice versa. If the
+        // administrator allowed for that we overstep the budget after a
+        // while, by no more than the overflow allowance.
+        const auto giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+        // Whilst we wait, lower priority leases must wait for us. However
+        // we leave, they must be told
+        const auto outranked = [&]( void ) { return !__m_waiting.empty() && *__m_waiting.rbegin()>priority; };
+        const auto me        = __m_waiting.insert( priority );
+        const auto leave     = [&]( void ) {
+            __m_waiting.erase( me );
+            __m_condition.notify_all();
+        };
+        const auto mayOverflow = [&]( void ) {
+            return __m_overflowUsed + nBlock * __m_blockSize<=__m_overflowMax &&
+                   std::chrono::steady_clock::now()>=giveUp && !outranked();
+        };
+
+        nBlock = std::min(nBlock, __m_capacity);
+        while( __m_free.size()<nBlock || outranked() ) {
+            if( isCancelled() ) {
+                leave();
+                return rv;
+            }
+            if( mayOverflow() ) {
+                ETDCDEBUG(-1, "buffer_pool: no " << nBlock << " blocks available after 5s, allocating outside the pool" << std::endl);
+                __m_overflowUsed += nBlock * __m_blockSize;
+                __m_overflowCount++;
+                leave();
+                try {
+                    private_lease();
+                }
+                catch( ... ) {
+                    this->give_back( nBlock );
+                    throw;
+                }
+                rv.__m_pool = this;
+                return rv;
+            }
+            __m_condition.wait_for(lk, std::chrono::milliseconds(100));
+        }
+        leave();
+        rv.__m_pool = this;
+        rv.__m_blocks.assign(__m_free.end() - nBlock, __m_free.end());
+        __m_free.resize( __m_free.size() - nBlock );
+        return rv;
+    }
+
+    void buffer_pool::give_back(std::vector<unsigned char*>& blocks) {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        __m_free.insert(__m_free.end(), blocks.begin(), blocks.end());
+        __m_condition.notify_all();
+    }
+
+    void buffer_pool::give_back(size_t nBlock) {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        __m_overflowUsed -= std::min(__m_overflowUsed, nBlock * __m_blockSize);
+    }
+
+    size_t buffer_pool::blockSize( void ) const {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        return __m_blockSize;
+    }
+
+    size_t buffer_pool::capacity( void ) const {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        return __m_capacity;
+    }
+
+    size_t buffer_pool::available( void ) const {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        return __m_free.size();
+    }
+
+    size_t buffer_pool::overflowBytes( void ) const {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        return __m_overflowUsed;
+    }
+
+    uint64_t buffer_pool::overflowCount( void ) const {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        return __m_overflowCount;
+    }
+}
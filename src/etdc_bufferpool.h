@@ -0,0 +1,134 @@
+// A daemon-wide pool of transfer buffers
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef ETDC_BUFFERPOOL_H
+#define ETDC_BUFFERPOOL_H
+
+// Own includes
+#include <etdc_fd.h>
+
+// C++ headers
+#include <set>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <iostream>
+#include <condition_variable>
+
+namespace etdc {
+
+    class buffer_pool;
+
+    // A number of blocks borrowed from a buffer_pool; they go back to
+    // the pool when the lease goes out of scope. An empty lease (size()==0)
+    // means the wait for blocks was cancelled.
+    class buffer_lease {
+        public:
+            buffer_lease();
+            buffer_lease(buffer_lease&& other);
+            buffer_lease& operator=(buffer_lease&& other);
+            buffer_lease(buffer_lease const&) = delete;
+            buffer_lease& operator=(buffer_lease const&) = delete;
+            ~buffer_lease();
+
+            size_t          size( void ) const                { return __m_blocks.size(); }
+            unsigned char*  operator[](size_t i) const        { return __m_blocks[i]; }
+
+        private:
+            friend class buffer_pool;
+
+            buffer_pool*                __m_pool;
+            std::vector<unsigned char*> __m_blocks;
+            // Not from the pool but allocated for this lease only. If
+            // __m_pool is set as well it counts against the pool's overflow
+            void*                       __m_private;
+
+            void release( void );
+    };
+
+    // The pool hands out blocks of blockSize() bytes, aligned for O_DIRECT
+    // I/O. With a memory budget of 0 there is no pool: each lease allocates
+    // (and frees) its own blocks, like a transfer without a pool would.
+    // Otherwise all of the budget is allocated in one go, when configured,
+    // and every page is touched such that transfers never take the page
+    // faults; the memory may be backed by transparent huge pages or by
+    // hugetlbfs pages (which the administrator must have reserved, if not
+    // we fall back to normal pages).
+    // A transfer that wants more blocks than are free waits until enough
+    // are returned, or it is cancelled. Blocks are handed out all-or-nothing
+    // and never more than the pool holds, so transfers can't deadlock on
+    // each other holding part of what they need. Transfers that depend on
+    // each other to finish can (e.g. the daemon sending to itself); for
+    // those the pool may be configured with an overflow allowance: if
+    // nothing comes free within a few seconds the lease gets its own
+    // memory after all, as long as the total allocated outside the pool
+    // stays within the allowance. Without one it just keeps waiting.
+    // Waiters of a higher priority are served first: as long as one of
+    // them is waiting, lower ones don't get blocks nor give up waiting.
+    class buffer_pool {
+        public:
+            enum class backing_type { Normal, THP, HugeTLB };
+
+            explicit buffer_pool(size_t blockSz);
+            buffer_pool(buffer_pool const&) = delete;
+            buffer_pool& operator=(buffer_pool const&) = delete;
+            ~buffer_pool();
+
+            // Throw away the current pool (if any) and create a new one.
+            // Must not be done whilst blocks are leased out.
+            // At most overflow bytes may be allocated outside of the pool.
+            void configure(size_t blockSz, size_t budget, backing_type backing, size_t overflow = 0);
+
+            // Borrow nBlock blocks; nBlock is clipped to the pool's capacity
+            buffer_lease lease(size_t nBlock, detail::cancelfn_type const& isCancelled, unsigned int priority = 0);
+
+            size_t blockSize( void ) const;
+            // Capacity and free count in blocks; 0 if there isn't a pool
+            size_t capacity( void ) const;
+            size_t available( void ) const;
+            // Bytes currently allocated outside the pool and the number of
+            // leases that had to do so since the pool was configured
+            size_t   overflowBytes( void ) const;
+            uint64_t overflowCount( void ) const;
+
+        private:
+            friend class buffer_lease;
+
+            size_t                      __m_blockSize, __m_mapSize;
+            void*                       __m_memory;
+            std::vector<unsigned char*> __m_free;
+            // The priorities of the leases that are waiting for blocks
+            std::multiset<unsigned int> __m_waiting;
+            size_t                      __m_capacity;
+            size_t                      __m_overflowMax, __m_overflowUsed;
+            uint64_t                    __m_overflowCount;
+            mutable std::mutex          __m_mutex;
+            std::condition_variable     __m_condition;
+
+            void give_back(std::vector<unsigned char*>& blocks);
+            void give_back(size_t overflow);
+            void unmap( void );
+    };
+
+    std::ostream& operator<<(std::ostream& os, buffer_pool::backing_type const& bt);
+    std::istream& operator>>(std::istream& is, buffer_pool::backing_type& bt);
+}
+
+#endif // ETDC_BUFFERPOOL_H
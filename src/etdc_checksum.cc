@@ -0,0 +1,244 @@
+// Implementation of the streaming checksums
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <etdc_checksum.h>
+
+// C++ headers
+#include <cstdio>
+#include <cstring>
+
+// The hardware version follows Mark Adler's crc32c.c (zlib license):
+// https://stackoverflow.com/a/17646775
+namespace etdc {
+
+    namespace detail {
+        // The reflected Castagnoli polynomial
+        static const uint32_t crc32c_poly = 0x82f63b78;
+
+        // The CRC of 'n' zero bytes appended to a CRC is a linear operation
+        // on that CRC, a 32x32 matrix over GF(2)
+        static uint32_t gf2_matrix_times(uint32_t const* mat, uint32_t vec) {
+            uint32_t sum{ 0 };
+
+            while( vec ) {
+                if( vec & 1 )
+                    sum ^= *mat;
+                vec >>= 1;
+                mat++;
+            }
+            return sum;
+        }
+
+        static void gf2_matrix_square(uint32_t* square, uint32_t const* mat) {
+            for(unsigned int n=0; n<32; n++)
+                square[n] = gf2_matrix_times(mat, mat[n]);
+        }
+
+        // Put the operator for one zero bit in odd, two in even and four
+        // in odd again, such that the next square gives one zero byte
+        static void gf2_zero_bits(uint32_t* odd, uint32_t* even) {
+            uint32_t row{ 1 };
+
+            odd[0] = crc32c_poly;
+            for(unsigned int n=1; n<32; n++, row<<=1)
+                odd[n] = row;
+            gf2_matrix_square(even, odd);
+            gf2_matrix_square(odd, even);
+        }
+
+        // The operator for len zero bytes, len a power of two
+        static void crc32c_zeros_op(uint32_t* even, size_t len) {
+            uint32_t odd[32];
+
+            gf2_zero_bits(odd, even);
+            do {
+                gf2_matrix_square(even, odd);
+                len >>= 1;
+                if( len==0 )
+                    return;
+                gf2_matrix_square(odd, even);
+                len >>= 1;
+            } while( len );
+            ::memcpy(even, odd, sizeof(odd));
+        }
+
+        // The operator as tables, one per byte of the CRC
+        struct zeros_type {
+            uint32_t    table[4][256];
+
+            explicit zeros_type(size_t len) {
+                uint32_t op[32];
+
+                crc32c_zeros_op(op, len);
+                for(uint32_t n=0; n<256; n++) {
+                    table[0][n] = gf2_matrix_times(op, n);
+                    table[1][n] = gf2_matrix_times(op, n << 8);
+                    table[2][n] = gf2_matrix_times(op, n << 16);
+                    table[3][n] = gf2_matrix_times(op, n << 24);
+                }
+            }
+
+            uint32_t shift(uint32_t crc) const {
+                return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^ table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+            }
+        };
+
+        // Slicing-by-8 tables for the software version
+        struct slice8_type {
+            uint32_t    table[8][256];
+
+            slice8_type() {
+                for(uint32_t n=0; n<256; n++) {
+                    uint32_t crc{ n };
+                    for(unsigned int k=0; k<8; k++)
+                        crc = (crc & 1) ? (crc >> 1) ^ crc32c_poly : crc >> 1;
+                    table[0][n] = crc;
+                }
+                for(uint32_t n=0; n<256; n++)
+                    for(unsigned int k=1; k<8; k++)
+                        table[k][n] = (table[k-1][n] >> 8) ^ table[0][table[k-1][n] & 0xff];
+            }
+        };
+
+        static uint32_t crc32c_sw(uint32_t crc, unsigned char const* p, size_t n) {
+            static const slice8_type slice8{};
+            auto const&              t( slice8.table );
+
+            crc = ~crc;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+            while( n>=8 ) {
+                uint64_t w;
+
+                ::memcpy(&w, p, sizeof(w));
+                w ^= crc;
+                crc = t[7][w & 0xff] ^ t[6][(w >> 8) & 0xff] ^ t[5][(w >> 16) & 0xff] ^ t[4][(w >> 24) & 0xff] ^
+                      t[3][(w >> 32) & 0xff] ^ t[2][(w >> 40) & 0xff] ^ t[1][(w >> 48) & 0xff] ^ t[0][w >> 56];
+                p += 8;
+                n -= 8;
+            }
+#endif
+            while( n-- )
+                crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+            return ~crc;
+        }
+
+#if defined(__x86_64__) && defined(__GNUC__)
+        // Three streams of LONG bytes at a time, then of SHORT, then the rest
+        static const size_t crc32c_long  = 8192;
+        static const size_t crc32c_short = 256;
+
+        __attribute__((target("sse4.2")))
+        static uint32_t crc32c_hw(uint32_t crc, unsigned char const* p, size_t n) {
+            static const zeros_type zeros_long( crc32c_long ), zeros_short( crc32c_short );
+            uint64_t                crc0{ (uint32_t)~crc }, crc1, crc2, w0, w1, w2;
+
+            while( n && ((uintptr_t)p & 7) ) {
+                crc0 = __builtin_ia32_crc32qi((uint32_t)crc0, *p++);
+                n--;
+            }
+            for(auto blk: {crc32c_long, crc32c_short}) {
+                auto const& zeros( blk==crc32c_long ? zeros_long : zeros_short );
+
+                while( n>=3*blk ) {
+                    unsigned char const* const end = p + blk;
+
+                    crc1 = crc2 = 0;
+                    do {
+                        ::memcpy(&w0, p, 8);
+                        ::memcpy(&w1, p + blk, 8);
+                        ::memcpy(&w2, p + 2*blk, 8);
+                        crc0 = __builtin_ia32_crc32di(crc0, w0);
+                        crc1 = __builtin_ia32_crc32di(crc1, w1);
+                        crc2 = __builtin_ia32_crc32di(crc2, w2);
+                        p += 8;
+                    } while( p<end );
+                    crc0 = zeros.shift( (uint32_t)crc0 ) ^ (uint32_t)crc1;
+                    crc0 = zeros.shift( (uint32_t)crc0 ) ^ (uint32_t)crc2;
+                    p   += 2*blk;
+                    n   -= 3*blk;
+                }
+            }
+            while( n>=8 ) {
+                ::memcpy(&w0, p, 8);
+                crc0 = __builtin_ia32_crc32di(crc0, w0);
+                p += 8;
+                n -= 8;
+            }
+            while( n-- )
+                crc0 = __builtin_ia32_crc32qi((uint32_t)crc0, *p++);
+            return ~(uint32_t)crc0;
+        }
+
+#endif
+
+        using crc32c_fn_type = uint32_t (*)(uint32_t, unsigned char const*, size_t);
+
+        // Decide once which one this CPU can run
+        static crc32c_fn_type crc32c_fn( void ) {
+            static const crc32c_fn_type fn = []( void ) {
+#if defined(__x86_64__) && defined(__GNUC__)
+                __builtin_cpu_init();
+                if( __builtin_cpu_supports("sse4.2") )
+                    return &crc32c_hw;
+#endif
+                return &crc32c_sw;
+            }();
+            return fn;
+        }
+    }
+
+    std::string const crc32c::name{ "crc32c" };
+
+    crc32c::crc32c():
+        __m_crc( 0 )
+    {}
+
+    void crc32c::update(void const* data, size_t n) {
+        __m_crc = detail::crc32c_fn()(__m_crc, reinterpret_cast<unsigned char const*>(data), n);
+    }
+
+    // zlib's crc32_combine(), with our polynomial
+    uint32_t crc32c::combine(uint32_t crcA, uint32_t crcB, off_t lenB) {
+        uint32_t even[32], odd[32];
+
+        if( lenB<=0 )
+            return crcA;
+        detail::gf2_zero_bits(odd, even);
+        do {
+            detail::gf2_matrix_square(even, odd);
+            if( lenB & 1 )
+                crcA = detail::gf2_matrix_times(even, crcA);
+            lenB >>= 1;
+            if( lenB==0 )
+                break;
+            detail::gf2_matrix_square(odd, even);
+            if( lenB & 1 )
+                crcA = detail::gf2_matrix_times(odd, crcA);
+            lenB >>= 1;
+        } while( lenB );
+        return crcA ^ crcB;
+    }
+
+    std::string crc32c_digest(uint32_t crc) {
+        char    buf[9];
+
+        ::snprintf(buf, sizeof(buf), "%08x", crc);
+        return crc32c::name + ":" + buf;
+    }
+}
@@ -0,0 +1,64 @@
+// Streaming checksums of the bytes that go over a data channel
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef ETDC_CHECKSUM_H
+#define ETDC_CHECKSUM_H
+
+// C++ headers
+#include <string>
+#include <cstdint>
+
+// Plain-old-C
+#include <sys/types.h>
+
+namespace etdc {
+
+    // CRC32C (Castagnoli), as used by iSCSI, SCTP and ext4.
+    // On x86-64 CPUs with SSE4.2 the crc32 instruction is used, running
+    // three independent streams to hide its latency; that does several
+    // GB/s per core. Elsewhere a slicing-by-8 table implementation is
+    // used.
+    // Unlike most hashes, CRCs of consecutive pieces of data can be
+    // combined into the CRC of the whole without having to look at the
+    // data again - which is what we need for files that are sent in
+    // stripes or chunks over several connections.
+    class crc32c {
+        public:
+            crc32c();
+
+            // Add n bytes to the checksum
+            void            update(void const* data, size_t n);
+            uint32_t        value( void ) const { return __m_crc; }
+
+            // Given crcA = CRC of A and crcB = CRC of B, which is lenB bytes
+            // long, return the CRC of A followed by B
+            static uint32_t combine(uint32_t crcA, uint32_t crcB, off_t lenB);
+
+            // The name used on the wire and in output
+            static std::string const name;
+
+        private:
+            uint32_t    __m_crc;
+    };
+
+    // "crc32c:0123abcd"
+    std::string crc32c_digest(uint32_t crc);
+}
+
+#endif // ETDC_CHECKSUM_H
@@ -0,0 +1,429 @@
+// Implementation of the control protocol parser
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <etdc_cmdparse.h>
+
+// C++ headers
+#include <algorithm>
+
+// Plain-old-C
+#include <string.h>
+
+namespace etdc {
+
+    namespace detail {
+        static bool is_digit(char c) {
+            return c>='0' && c<='9';
+        }
+        // What [a-z0-9] is with std::regex::icase
+        static bool is_alnum(char c) {
+            return is_digit(c) || (c>='a' && c<='z') || (c>='A' && c<='Z');
+        }
+        static bool is_hex(char c) {
+            return is_digit(c) || (c>='a' && c<='f') || (c>='A' && c<='F');
+        }
+        static char to_lower(char c) {
+            return (c>='A' && c<='Z') ? (char)(c - 'A' + 'a') : c;
+        }
+        // [-0-9\.\+eE]
+        static bool is_float(char c) {
+            return is_digit(c) || c=='-' || c=='.' || c=='+' || c=='e' || c=='E';
+        }
+        static bool is_eol(char c) {
+            return c=='\r' || c=='\n';
+        }
+
+        // Move p past the characters for which pred is true
+        template <typename Pred>
+        static char const* skip(char const* p, char const* end, Pred pred) {
+            while( p!=end && pred(*p) )
+                p++;
+            return p;
+        }
+
+        // Does [p, end) start with s, case insensitive? If so, move p past it
+        static bool iprefix(char const*& p, char const* end, char const* s) {
+            char const* q = p;
+            for( ; *s; s++, q++)
+                if( q==end || to_lower(*q)!=to_lower(*s) )
+                    return false;
+            p = q;
+            return true;
+        }
+
+        // [0-9]+ over all of t
+        static bool all_digits(token_type const& t) {
+            return !t.empty() && skip(t.first, t.last, is_digit)==t.last;
+        }
+
+        // The "(\s+\S.*)?$" at the end of replies: nothing or white space
+        // followed by at least one other character and no end-of-line
+        static bool trailer(char const* p, char const* end) {
+            if( p==end )
+                return true;
+            if( !is_space(*p) )
+                return false;
+            p = skip(p, end, is_space);
+            return p!=end && std::find_if(p, end, is_eol)==end;
+        }
+    }
+
+    std::ostream& operator<<(std::ostream& os, token_type const& t) {
+        return os.write(t.first, (std::streamsize)t.size());
+    }
+
+    bool operator==(token_type const& t, char const* s) {
+        const size_t  n( ::strlen(s) );
+        return t.size()==n && ::memcmp(t.first, s, n)==0;
+    }
+
+    bool iequals(token_type const& t, char const* s) {
+        char const* p = t.first;
+        return detail::iprefix(p, t.last, s) && p==t.last;
+    }
+
+    token_type tokenizer_type::word( void ) {
+        char const* const  f = detail::skip(__m_cur, __m_end, is_space);
+        char const* const  l = detail::skip(f, __m_end, [](char c) { return !is_space(c); });
+
+        if( f==l )
+            return token_type();
+        __m_cur = l;
+        return token_type(f, l);
+    }
+
+    token_type tokenizer_type::rest( void ) {
+        char const* const  f = detail::skip(__m_cur, __m_end, is_space);
+
+        if( f==__m_end || std::find_if(f, __m_end, detail::is_eol)!=__m_end )
+            return token_type();
+        __m_cur = __m_end;
+        return token_type(f, __m_end);
+    }
+
+    bool next_line(char const*& cur, char const* end, token_type& line) {
+        char const* const  f = detail::skip(cur, end, detail::is_eol);
+        char const* const  l = std::find_if(f, end, detail::is_eol);
+
+        // Need at least one character and the end-of-line after it
+        if( f==l || l==end )
+            return false;
+        line = token_type(f, l);
+        cur  = detail::skip(l, end, detail::is_eol);
+        return true;
+    }
+
+    bool parse_reply(token_type const& line, reply_type& reply) {
+        char const* p = line.first;
+
+        if( !detail::iprefix(p, line.last, "OK") && !detail::iprefix(p, line.last, "ERR") )
+            return false;
+        reply.status = token_type(line.first, p);
+        reply.info   = token_type();
+        if( p==line.last )
+            return true;
+        if( !is_space(*p) )
+            return false;
+        p = detail::skip(p, line.last, is_space);
+        if( std::find_if(p, line.last, detail::is_eol)!=line.last )
+            return false;
+        reply.info = token_type(p, line.last);
+        return true;
+    }
+
+    bool parse_tagged(token_type const& line, char const* tag, value_kind kind, token_type& value) {
+        char const* p = line.first;
+
+        if( !detail::iprefix(p, line.last, tag) )
+            return false;
+        value = token_type(p, line.last);
+        switch( kind ) {
+            case value_kind::Word:
+                return !value.empty() && std::find_if(p, line.last, is_space)==line.last;
+            case value_kind::Signed:
+                if( p!=line.last && *p=='-' )
+                    p++;
+                return detail::all_digits(token_type(p, line.last));
+            case value_kind::Unsigned:
+                return detail::all_digits(value);
+        }
+        return false;
+    }
+
+    bool parse_xfer_reply(token_type const& line, xfer_reply_type& reply) {
+        char const* p = line.first;
+        char const* const end = line.last;
+
+        reply = xfer_reply_type();
+        if( !detail::iprefix(p, end, "OK") && !detail::iprefix(p, end, "ERR") )
+            return false;
+        reply.status = token_type(line.first, p);
+
+        // The new style fields come as a whole or not at all
+        if( p!=end && *p==',' ) {
+            char const* const  n = detail::skip(p + 1, end, detail::is_digit);
+            if( n==p + 1 || n==end || *n!=',' )
+                return false;
+            char const* const  t = detail::skip(n + 1, end, detail::is_float);
+            if( t==n + 1 )
+                return false;
+            reply.nByte  = token_type(p + 1, n);
+            reply.deltaT = token_type(n + 1, t);
+            p = t;
+
+            // ,<algorithm>:<hex>
+            if( p!=end && *p==',' ) {
+                char const* const  a = detail::skip(p + 1, end, detail::is_alnum);
+                if( a!=p + 1 && a!=end && *a==':' ) {
+                    char const* const  h = detail::skip(a + 1, end, detail::is_hex);
+                    if( h!=a + 1 ) {
+                        reply.digest = token_type(p + 1, h);
+                        p = h;
+                    }
+                }
+            }
+            // ,wire=<bytes>
+            char const* q = p;
+            if( detail::iprefix(q, end, ",wire=") ) {
+                char const* const  w = detail::skip(q, end, detail::is_digit);
+                if( w!=q ) {
+                    reply.wire = token_type(q, w);
+                    p = w;
+                }
+            }
+            // ,lat=<latencies>, which may be empty
+            q = p;
+            if( detail::iprefix(q, end, ",lat=") ) {
+                char const* const  l = detail::skip(q, end, [](char c) { return detail::is_alnum(c) || c==':' || c=='/'; });
+                reply.latency = token_type(q, l);
+                p = l;
+            }
+        }
+        if( !detail::trailer(p, end) )
+            return false;
+        reply.reason = token_type(p, end);
+        return true;
+    }
+
+    bool parse_progress(token_type const& line, progress_reply_type& progress) {
+        char const* p = line.first;
+        char const* const end = line.last;
+
+        if( !detail::iprefix(p, end, "PROGRESS") || p==end || !is_space(*p) )
+            return false;
+        p = detail::skip(p, end, is_space);
+
+        char const* const  n = detail::skip(p, end, detail::is_digit);
+        if( n==p || n==end || *n!=',' )
+            return false;
+        progress.done = token_type(p, n);
+        progress.rate = token_type(n + 1, end);
+        return (!progress.rate.empty() && detail::skip(n + 1, end, detail::is_float)==end) ||
+               iequals(progress.rate, "inf") || iequals(progress.rate, "nan");
+    }
+
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  Commands. Each has a keyword and a function that checks the
+    //  arguments and puts them in the command
+    //
+    //////////////////////////////////////////////////////////////////////
+    namespace detail {
+        using argparse_fn = bool (*)(token_type const& keyword, tokenizer_type& tok, command_type& cmd);
+
+        struct command_entry {
+            char const*  keyword;
+            command_id   id;
+            argparse_fn  parse;
+        };
+
+        static bool no_args(token_type const&, tokenizer_type& tok, command_type&) {
+            return tok.done();
+        }
+        static bool one_rest(token_type const&, tokenizer_type& tok, command_type& cmd) {
+            return !(cmd.args[0] = tok.rest()).empty();
+        }
+        // "<uuid> <arg2>" with arg2 satisfying pred
+        template <bool (*Pred)(token_type const&)>
+        static bool uuid_arg(token_type const&, tokenizer_type& tok, command_type& cmd) {
+            return !(cmd.args[0] = tok.word()).empty() && !(cmd.args[1] = tok.word()).empty() &&
+                   Pred(cmd.args[1]) && tok.done();
+        }
+        static bool any_word(token_type const&) {
+            return true;
+        }
+        static bool valid_ranges(token_type const& t) {
+            return for_each_range(t, [](token_type const&, token_type const&) {});
+        }
+
+        static bool write_file(token_type const& keyword, tokenizer_type& tok, command_type& cmd) {
+            // The open mode is glued to the keyword
+            cmd.args[0] = keyword;
+            return !(cmd.args[1] = tok.rest()).empty();
+        }
+        static bool read_file(token_type const&, tokenizer_type& tok, command_type& cmd) {
+            return all_digits(cmd.args[0] = tok.word()) && !(cmd.args[1] = tok.rest()).empty();
+        }
+        static bool send_file(token_type const&, tokenizer_type& tok, command_type& cmd) {
+            for(unsigned int i=0; i<4; i++)
+                if( (cmd.args[i] = tok.word()).empty() )
+                    return false;
+            // The options are optional
+            cmd.args[4] = tok.word();
+            return all_digits(cmd.args[2]) && tok.done();
+        }
+        static bool data_channel_addr(token_type const& keyword, tokenizer_type& tok, command_type& cmd) {
+            cmd.args[0] = keyword;
+            return tok.done() && (keyword.empty() || iequals(keyword, "-ext"));
+        }
+        static bool remove_uuid(token_type const& keyword, tokenizer_type& tok, command_type& cmd) {
+            cmd.args[0] = keyword;
+            return !(cmd.args[1] = tok.word()).empty() && tok.done();
+        }
+
+        // Keywords ending in '-' take the rest of the word as argument
+        static const command_entry commands[] = {
+            { "list",               command_id::List,            one_rest },
+            { "write-file-",        command_id::WriteFile,       write_file },
+            { "read-file",          command_id::ReadFile,        read_file },
+            { "send-file",          command_id::SendFile,        send_file },
+            { "data-channel-addr",  command_id::DataChannelAddr, data_channel_addr },
+            { "remove-uuid",        command_id::RemoveUUID,      remove_uuid },
+            { "cancel",             command_id::RemoveUUID,      remove_uuid },
+            { "protocol-version",   command_id::ProtocolVersion, no_args },
+            { "checksum-ranges",    command_id::ChecksumRanges,  uuid_arg<valid_ranges> },
+            { "rollback",           command_id::Rollback,        uuid_arg<all_digits> },
+            { "set-priority",       command_id::SetPriority,     uuid_arg<any_word> },
+            { "status",             command_id::Status,          no_args }
+        };
+    }
+
+    bool parse_command(token_type const& line, command_type& cmd) {
+        // The keyword is at the very start of the line
+        if( line.empty() || is_space(*line.first) )
+            return false;
+
+        tokenizer_type    tok( line );
+        const token_type  word( tok.word() );
+
+        for(auto const& c: detail::commands) {
+            char const* p = word.first;
+
+            if( !detail::iprefix(p, word.last, c.keyword) )
+                continue;
+            // An exact match, unless the keyword may be followed by more
+            // (write-file-<mode>, data-channel-addr[-ext])
+            if( p!=word.last && c.id!=command_id::WriteFile && c.id!=command_id::DataChannelAddr )
+                continue;
+            if( c.id==command_id::WriteFile && p==word.last )
+                continue;
+
+            cmd    = command_type();
+            cmd.id = c.id;
+            // remove-uuid|cancel want the whole keyword
+            const token_type  keyword( c.id==command_id::RemoveUUID ? word : token_type(p, word.last) );
+            return c.parse(keyword, tok, cmd);
+        }
+        return false;
+    }
+
+    bool parse_data_addr(token_type const& s, data_addr_type& addr) {
+        using namespace detail;
+        char const*       p = s.first;
+        char const* const end = s.last;
+
+        addr = data_addr_type();
+        // "<protocol/"
+        if( p==end || *p++!='<' )
+            return false;
+        char const* const  proto = std::find(p, end, '/');
+        if( proto==p || proto==end )
+            return false;
+        addr.protocol = token_type(p, proto);
+        p = proto + 1;
+
+        // "[ipv6]" or a host name
+        if( p!=end && *p=='[' ) {
+            // [:0-9a-zA-Z]+(/[0-9]{1,3})?(%[a-zA-Z0-9]+)?
+            char const* q = skip(p + 1, end, [](char c) { return is_alnum(c) || c==':'; });
+            if( q==p + 1 )
+                return false;
+            if( q!=end && *q=='/' ) {
+                char const* const  d = skip(q + 1, std::min(q + 4, end), is_digit);
+                if( d==q + 1 )
+                    return false;
+                q = d;
+            }
+            if( q!=end && *q=='%' ) {
+                char const* const  z = skip(q + 1, end, is_alnum);
+                if( z==q + 1 )
+                    return false;
+                q = z;
+            }
+            if( q==end || *q!=']' )
+                return false;
+            addr.host      = token_type(p, q + 1);
+            addr.bracketed = true;
+            p = q + 1;
+        } else {
+            // Labels of 1-63 [a-zA-Z0-9-], not starting or ending with
+            // '-', separated by dots
+            char const* const  h = skip(p, end, [](char c) { return is_alnum(c) || c=='-' || c=='.'; });
+            bool               ok{ h!=p };
+
+            for_each_split(token_type(p, h), '.', [&](token_type const& label) {
+                                ok = ok && !label.empty() && label.size()<=63 &&
+                                     *label.first!='-' && *(label.last - 1)!='-';
+                           });
+            if( !ok )
+                return false;
+            addr.host = token_type(p, h);
+            p = h;
+        }
+
+        // ":port"
+        if( p==end || *p++!=':' )
+            return false;
+        char const* const  port = skip(p, end, is_digit);
+        if( port==p )
+            return false;
+        addr.port = token_type(p, port);
+        p = port;
+
+        // "/key=value[,key=value]*"
+        if( p!=end && *p=='/' ) {
+            char const* const  o = std::find(p + 1, end, '>');
+            bool               ok{ true };
+
+            for_each_split(token_type(p + 1, o), ',', [&](token_type const& kv) {
+                                char const* const  k = skip(kv.first, kv.last, [](char c) { return c!='=' && c!=' ' && c!='\t' && c!='\v'; });
+                                char const* const  v = (k==kv.last ? k : k + 1);
+                                ok = ok && k!=kv.first && k!=kv.last && *k=='=' && v!=kv.last &&
+                                     skip(v, kv.last, [](char c) { return c!=' ' && c!='\t' && c!='\v'; })==kv.last;
+                           });
+            if( !ok )
+                return false;
+            addr.options = token_type(p + 1, o);
+            p = o;
+        }
+        // ">" and nothing after it
+        return p!=end && *p=='>' && p + 1==end;
+    }
+}
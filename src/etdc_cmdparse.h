@@ -0,0 +1,225 @@
+// Parse the lines of the etransfer control protocol without std::regex
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+//
+// Commands and replies used to be matched against std::regex'es; with
+// 100k entries in a directory listing or thousands of small files that
+// was most of what the daemon and client did. The functions below
+// accept exactly what those regexes did (see src/cmdbench.cc, which checks
+// that) but work on pointers into the caller's buffer and do not
+// allocate. Like the regexes, keywords are case insensitive.
+#ifndef ETDC_CMDPARSE_H
+#define ETDC_CMDPARSE_H
+
+// C++ headers
+#include <string>
+#include <cstddef>
+#include <iostream>
+
+namespace etdc {
+
+    // A range of characters in someone else's buffer; what C++17 has
+    // std::string_view for
+    struct token_type {
+        char const*  first{ nullptr };
+        char const*  last{ nullptr };
+
+        token_type() = default;
+        token_type(char const* f, char const* l):
+            first( f ), last( l )
+        {}
+
+        size_t      size( void ) const  { return (size_t)(last - first); }
+        bool        empty( void ) const { return first==last; }
+        std::string str( void ) const   { return std::string(first, last); }
+    };
+    std::ostream& operator<<(std::ostream& os, token_type const& t);
+
+    // Exact resp. case insensitive comparison with a C-string
+    bool operator==(token_type const& t, char const* s);
+    bool iequals(token_type const& t, char const* s);
+
+    // White space is what regex' "\s" is in the "C" locale
+    inline bool is_space(char c) {
+        return c==' ' || c=='\t' || c=='\n' || c=='\v' || c=='\f' || c=='\r';
+    }
+
+    // Splits a line into white space separated words
+    class tokenizer_type {
+        public:
+            explicit tokenizer_type(token_type const& s):
+                __m_cur( s.first ), __m_end( s.last )
+            {}
+
+            // The next word, skipping the white space in front of it. If
+            // there is no next word, returns an empty token and consumes
+            // nothing
+            token_type word( void );
+
+            // Everything after the white space that follows the current
+            // position; empty if there's nothing or it contains end-of-line
+            // characters. Like "\s+(\S.*)$".
+            token_type rest( void );
+
+            // Is all of the line consumed?
+            bool done( void ) const {
+                return __m_cur==__m_end;
+            }
+
+        private:
+            char const*       __m_cur;
+            char const* const __m_end;
+    };
+
+    // If there is a complete line in [cur, end) it is returned in 'line'
+    // and cur moves past the line's end-of-line character(s). Empty lines
+    // are skipped. Returns false if there is no (complete) line.
+    // This is what the regex "([^\r\n]+)[\r\n]+" would find.
+    bool next_line(char const*& cur, char const* end, token_type& line);
+
+    // Call f(token_type) for each of the sep separated parts of s; empty
+    // parts included
+    template <typename F>
+    void for_each_split(token_type const& s, char sep, F&& f) {
+        char const* p = s.first;
+        while( true ) {
+            char const* q = p;
+            while( q!=s.last && *q!=sep )
+                q++;
+            f( token_type(p, q) );
+            if( q==s.last )
+                break;
+            p = q + 1;
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  Replies
+    //
+    //////////////////////////////////////////////////////////////////////
+
+    // "OK|ERR[ <info>]"
+    struct reply_type {
+        token_type  status, info;
+    };
+    bool parse_reply(token_type const& line, reply_type& reply);
+
+    // "<tag><value>", e.g. "UUID:<uuid>". The value must be a word, an
+    // unsigned or an optionally signed integer.
+    enum class value_kind { Word, Unsigned, Signed };
+    bool parse_tagged(token_type const& line, char const* tag, value_kind kind, token_type& value);
+
+    // What send-file replies:
+    //   "OK|ERR[,<bytes>,<seconds>[,<digest>][,wire=<bytes>][,lat=<latencies>]][ <reason>]"
+    // The reason includes the white space in front of it
+    struct xfer_reply_type {
+        token_type  status, nByte, deltaT, digest, wire, latency, reason;
+    };
+    bool parse_xfer_reply(token_type const& line, xfer_reply_type& reply);
+
+    // "PROGRESS <bytes>,<rate>"
+    struct progress_reply_type {
+        token_type  done, rate;
+    };
+    bool parse_progress(token_type const& line, progress_reply_type& progress);
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  Commands
+    //
+    //////////////////////////////////////////////////////////////////////
+
+    // The commands a daemon understands and their arguments:
+    //   list <path>                                 path
+    //   write-file-<openmode> <path>                openmode, path
+    //   read-file <already have> <path>             already have, path
+    //   send-file <src> <dst> <todo> <data addrs> [<options>]
+    //   data-channel-addr[-ext]                     "" or "-ext"
+    //   remove-uuid|cancel <uuid>                   command, uuid
+    //   protocol-version
+    //   checksum-ranges <uuid> <o>+<n>[,<o>+<n>]*   uuid, ranges
+    //   rollback <uuid> <size>                      uuid, size
+    //   set-priority <uuid> <class>                 uuid, class
+    //   status
+    enum class command_id : unsigned int {
+        List = 0, WriteFile, ReadFile, SendFile, DataChannelAddr, RemoveUUID,
+        ProtocolVersion, ChecksumRanges, Rollback, SetPriority, Status,
+        NumCommand
+    };
+
+    struct command_type {
+        command_id  id{ command_id::NumCommand };
+        token_type  args[5];
+    };
+    // Returns false for lines that are not a valid command
+    bool parse_command(token_type const& line, command_type& cmd);
+
+    // Call f(offset, length) for each "<offset>+<length>" of the
+    // checksum-ranges argument; returns false (after calling f for the
+    // ones before it) at the first one that is malformed
+    template <typename F>
+    bool for_each_range(token_type const& s, F&& f) {
+        bool  ok{ !s.empty() };
+
+        for_each_split(s, ',', [&](token_type const& range) {
+                            char const* plus = range.first;
+                            while( plus!=range.last && *plus>='0' && *plus<='9' )
+                                plus++;
+                            char const* p = (plus==range.last ? plus : plus + 1);
+                            while( p!=range.last && *p>='0' && *p<='9' )
+                                p++;
+                            if( !ok || plus==range.first || plus==range.last || *plus!='+' || p!=range.last || p==plus+1 ) {
+                                ok = false;
+                                return;
+                            }
+                            f(token_type(range.first, plus), token_type(plus + 1, range.last));
+                       });
+        return ok;
+    }
+
+    // Call f(token_type) for each "<...>" in the send-file data channel
+    // address list
+    template <typename F>
+    void for_each_data_addr(token_type const& s, F&& f) {
+        for(char const* p = s.first; p!=s.last; p++) {
+            if( *p!='<' )
+                continue;
+            char const* q = p + 1;
+            while( q!=s.last && *q!='>' )
+                q++;
+            if( q==s.last )
+                break;
+            if( q==p + 1 )
+                continue;
+            f( token_type(p, q + 1) );
+            p = q;
+        }
+    }
+
+    // "<protocol/host:port[/key=value[,key=value]*]>", host may be
+    // "[ipv6]"; the host token includes the []
+    struct data_addr_type {
+        token_type  protocol, host, port, options;
+        bool        bracketed{ false };
+    };
+    bool parse_data_addr(token_type const& s, data_addr_type& addr);
+}
+
+#endif // ETDC_CMDPARSE_H
@@ -0,0 +1,284 @@
+// Implementation of the data channel codecs
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <etdc_codec.h>
+#include <etdc_assert.h>
+
+// C++ headers
+#include <map>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+namespace etdc {
+
+    namespace detail {
+        // The LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md)
+        // without the library: a series of sequences, each a token with
+        // the number of literals in the high and the match length - 4 in
+        // the low nibble, longer lengths continued in bytes of 255 + rest.
+        // The literals follow, then the little endian 16-bit offset of the
+        // match. The last sequence only has literals.
+        // We compress greedily with a single hash table; like the real
+        // thing, the search takes bigger steps the longer it doesn't find
+        // anything so data that doesn't compress is skipped over quickly.
+        static const size_t   lz4_minmatch   = 4;
+        // The last five bytes are always literals and no match may start
+        // in the last twelve
+        static const size_t   lz4_lastlits   = 5;
+        static const size_t   lz4_mflimit    = 12;
+        static const size_t   lz4_maxoffset  = 65535;
+        static const unsigned lz4_hashlog    = 14;
+        static const unsigned lz4_skiptrigger = 6;
+
+        static uint32_t rd32(unsigned char const* p) {
+            uint32_t v;
+            ::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+        static uint64_t rd64(unsigned char const* p) {
+            uint64_t v;
+            ::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+        static uint32_t lz4_hash(uint32_t v) {
+            return (v * 2654435761U) >> (32 - lz4_hashlog);
+        }
+
+        // The number of bytes from p on that are equal to those from ref
+        // on, not looking at limit and beyond
+        static size_t lz4_count(unsigned char const* p, unsigned char const* ref, unsigned char const* limit) {
+            unsigned char const* const start( p );
+
+            for( ; p + 8<=limit; p+=8, ref+=8) {
+                const uint64_t diff( rd64(p) ^ rd64(ref) );
+                if( diff ) {
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+                    return (size_t)(p - start) + (size_t)(__builtin_ctzll(diff) >> 3);
+#else
+                    break;
+#endif
+                }
+            }
+            for( ; p<limit && *p==*ref; p++, ref++)
+                ;
+            return (size_t)(p - start);
+        }
+
+        static unsigned char* lz4_put_length(unsigned char* op, size_t len) {
+            for( ; len>=255; len-=255)
+                *op++ = 255;
+            *op++ = (unsigned char)len;
+            return op;
+        }
+
+        static size_t lz4_get_length(unsigned char const* src, size_t n, size_t& ip) {
+            size_t        len{ 0 };
+            unsigned char b;
+
+            do {
+                ETDCASSERT(ip<n, "lz4: input truncated in length");
+                b    = src[ip++];
+                len += b;
+            } while( b==255 );
+            return len;
+        }
+
+        class lz4_codec: public codec {
+            public:
+                virtual std::string const& name( void ) const {
+                    static const std::string nm{ "lz4" };
+                    return nm;
+                }
+
+                virtual size_t compress(unsigned char const* src, size_t n, unsigned char* dst, size_t cap) const {
+                    unsigned char*       op( dst );
+                    unsigned char* const oend( dst + cap );
+                    size_t               anchor{ 0 };
+
+                    // One sequence; false if it doesn't fit
+                    const auto emit = [&](size_t nLit, size_t offset, size_t matchLen) {
+                        const size_t need = 1 + nLit/255 + 1 + nLit + (matchLen ? 2 + matchLen/255 + 1 : 0);
+                        if( (size_t)(oend - op)<need )
+                            return false;
+                        unsigned char* token = op++;
+
+                        *token = (unsigned char)(std::min(nLit, (size_t)15) << 4);
+                        if( nLit>=15 )
+                            op = lz4_put_length(op, nLit - 15);
+                        // Short runs are copied as a whole 16 bytes if there's room
+                        if( nLit<=16 && anchor + 16<=n && (size_t)(oend - op)>=16 + (need - 1 - nLit) )
+                            ::memcpy(op, src + anchor, 16);
+                        else
+                            ::memcpy(op, src + anchor, nLit);
+                        op += nLit;
+                        if( matchLen ) {
+                            const size_t ml( matchLen - lz4_minmatch );
+
+                            *op++   = (unsigned char)(offset & 0xff);
+                            *op++   = (unsigned char)(offset >> 8);
+                            *token |= (unsigned char)std::min(ml, (size_t)15);
+                            if( ml>=15 )
+                                op = lz4_put_length(op, ml - 15);
+                        }
+                        return true;
+                    };
+
+                    if( n>lz4_mflimit ) {
+                        const size_t mflimit( n - lz4_mflimit ), matchlimit( n - lz4_lastlits );
+                        uint32_t     table[1 << lz4_hashlog];
+                        size_t       ip{ 1 };
+
+                        ::memset(table, 0, sizeof(table));
+                        while( true ) {
+                            size_t   ref{ 0 }, step{ 1 }, nSearch{ 1u << lz4_skiptrigger };
+                            bool     found{ false };
+
+                            while( ip<=mflimit ) {
+                                const uint32_t seq( rd32(src + ip) );
+                                const uint32_t h( lz4_hash(seq) );
+
+                                ref      = table[h];
+                                table[h] = (uint32_t)ip;
+                                if( ip - ref<=lz4_maxoffset && rd32(src + ref)==seq ) {
+                                    found = true;
+                                    break;
+                                }
+                                ip  += step;
+                                step = (nSearch++) >> lz4_skiptrigger;
+                            }
+                            if( !found )
+                                break;
+
+                            // Grow the match backwards over the pending literals, then forwards
+                            while( ip>anchor && ref>0 && src[ip - 1]==src[ref - 1] ) {
+                                ip--;
+                                ref--;
+                            }
+                            const size_t  len( lz4_minmatch + lz4_count(src + ip + lz4_minmatch, src + ref + lz4_minmatch, src + matchlimit) );
+
+                            if( !emit(ip - anchor, ip - ref, len) )
+                                return 0;
+                            ip    += len;
+                            anchor = ip;
+                            if( ip>mflimit )
+                                break;
+                            table[ lz4_hash(rd32(src + ip - 2)) ] = (uint32_t)(ip - 2);
+                        }
+                    }
+                    if( !emit(n - anchor, 0, 0) )
+                        return 0;
+                    return (size_t)(op - dst);
+                }
+
+                virtual size_t decompress(unsigned char const* src, size_t n, unsigned char* dst, size_t cap) const {
+                    size_t  ip{ 0 }, op{ 0 };
+
+                    while( true ) {
+                        ETDCASSERT(ip<n, "lz4: input truncated");
+                        const unsigned int token( src[ip++] );
+                        size_t             nLit( token >> 4 );
+
+                        if( nLit==15 )
+                            nLit += lz4_get_length(src, n, ip);
+                        ETDCASSERT(nLit<=n - ip && nLit<=cap - op, "lz4: literals run past the end of the block");
+                        if( nLit<=16 && n - ip>=16 && cap - op>=16 )
+                            ::memcpy(dst + op, src + ip, 16);
+                        else
+                            ::memcpy(dst + op, src + ip, nLit);
+                        ip += nLit;
+                        op += nLit;
+                        if( ip==n )
+                            break;
+
+                        ETDCASSERT(n - ip>=2, "lz4: input truncated in offset");
+                        const size_t offset( (size_t)src[ip] | ((size_t)src[ip + 1] << 8) );
+                        size_t       ml( token & 0xf );
+
+                        ip += 2;
+                        ETDCASSERT(offset>0 && offset<=op, "lz4: invalid match offset " << offset);
+                        if( ml==15 )
+                            ml += lz4_get_length(src, n, ip);
+                        ml += lz4_minmatch;
+                        ETDCASSERT(ml<=cap - op, "lz4: match runs past the end of the block");
+
+                        // The match may overlap with what it produces; in
+                        // pieces of at most 'offset' bytes it never does.
+                        // If there's room we copy 8 at a time and let the
+                        // next sequence overwrite whatever went too far
+                        unsigned char*       d( dst + op );
+                        unsigned char* const e( d + ml );
+
+                        if( offset>=8 && cap - op>=ml + 8 ) {
+                            for( ; d<e; d+=8)
+                                ::memcpy(d, d - offset, 8);
+                        } else {
+                            for(size_t left=ml; left; ) {
+                                const size_t m( std::min(left, offset) );
+                                ::memcpy(d, d - offset, m);
+                                d    += m;
+                                left -= m;
+                            }
+                        }
+                        op += ml;
+                    }
+                    return op;
+                }
+        };
+
+        using codecmap_type = std::map<std::string, codec const*>;
+
+        static codecmap_type const& codecs( void ) {
+            static const lz4_codec     lz4{};
+            static const codecmap_type known{ {lz4.name(), &lz4} };
+            return known;
+        }
+    }
+
+    zip_backoff::zip_backoff(unsigned int maxSkip):
+        __m_maxSkip( maxSkip ), __m_nSkip( 0 ), __m_backOff( 0 )
+    {}
+
+    bool zip_backoff::attempt( void ) {
+        std::lock_guard<std::mutex> lk( __m_lock );
+        if( __m_nSkip==0 )
+            return true;
+        __m_nSkip--;
+        return false;
+    }
+
+    void zip_backoff::result(bool packed) {
+        std::lock_guard<std::mutex> lk( __m_lock );
+        __m_backOff = (packed ? 0 : std::min(std::max(2*__m_backOff, 1u), __m_maxSkip));
+        __m_nSkip   = __m_backOff;
+    }
+
+    codec const* find_codec(std::string const& name) {
+        auto const& known( detail::codecs() );
+        auto        ptr = known.find( name );
+        return ptr==known.end() ? nullptr : ptr->second;
+    }
+
+    std::list<std::string> codec_names( void ) {
+        std::list<std::string> rv;
+        for(auto const& c: detail::codecs())
+            rv.push_back( c.first );
+        return rv;
+    }
+}
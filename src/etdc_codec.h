@@ -0,0 +1,76 @@
+// Compression of the bytes that go over a data channel
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef ETDC_CODEC_H
+#define ETDC_CODEC_H
+
+// C++ headers
+#include <list>
+#include <mutex>
+#include <string>
+#include <cstddef>
+
+namespace etdc {
+
+    // A codec compresses independent blocks of data. It holds no state
+    // between calls so one instance can be used by many threads at once.
+    class codec {
+        public:
+            // The name used on the wire and on the command line
+            virtual std::string const& name( void ) const = 0;
+
+            // Compress n bytes from src into dst, which has room for cap
+            // bytes. Returns the compressed size, 0 if it didn't fit; the
+            // caller should then send the block as-is.
+            virtual size_t compress(unsigned char const* src, size_t n, unsigned char* dst, size_t cap) const = 0;
+
+            // Decompress n bytes from src into dst, which has room for cap
+            // bytes. Returns the decompressed size; throws if the input is
+            // corrupt or doesn't fit
+            virtual size_t decompress(unsigned char const* src, size_t n, unsigned char* dst, size_t cap) const = 0;
+
+            virtual ~codec() {}
+    };
+
+    // Whether to try to compress the next block of a stream. After a
+    // block that didn't compress the next 1, 2, 4, .., maxSkip blocks are
+    // not even tried; one that compresses again ends that. Can be used by
+    // many threads at once.
+    class zip_backoff {
+        public:
+            explicit zip_backoff(unsigned int maxSkip);
+
+            // If this returns true, report what became of the block
+            bool attempt( void );
+            void result(bool packed);
+
+        private:
+            const unsigned int  __m_maxSkip;
+            unsigned int        __m_nSkip, __m_backOff;
+            std::mutex          __m_lock;
+    };
+
+    // The codecs we know of, by name. Returns nullptr for an unknown name.
+    // To add a codec, implement the interface above and add an instance
+    // to the table in etdc_codec.cc
+    codec const*           find_codec(std::string const& name);
+    std::list<std::string> codec_names( void );
+}
+
+#endif // ETDC_CODEC_H
@@ -0,0 +1,675 @@
+// Implementation of the rsync-style delta transfers
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <etdc_delta.h>
+#include <etdc_checksum.h>
+#include <etdc_thread.h>
+#include <etdc_assert.h>
+#include <etdc_debug.h>
+#include <reentrant.h>
+
+// C++ headers
+#include <cmath>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+#include <exception>
+
+// Plain-old-C
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace etdc {
+
+    namespace detail {
+        // About the square root of the file size, like rsync, but we're
+        // dealing with large files on fast disks so not too small either
+        static size_t delta_blocksize(off_t basisSz) {
+            const size_t  bs = (((size_t)std::sqrt((double)basisSz) + 1023)/1024) * 1024;
+            return std::min(std::max(bs, (size_t)4096), (size_t)1024*1024);
+        }
+
+        // Don't let a remote end make us allocate silly amounts
+        static const uint64_t delta_maxblocksize = 64*1024*1024;
+        static const uint64_t delta_maxblocks    = 64*1024*1024;
+        // Literal runs are sent in pieces of at most this size
+        static const size_t   delta_maxliteral   = 1024*1024;
+        // I/O size for reading files
+        static const size_t   delta_iosize       = 4*1024*1024;
+
+        static void put_u32(unsigned char* p, uint32_t v) {
+            for(int i=3; i>=0; i--, v>>=8)
+                p[i] = (unsigned char)(v & 0xff);
+        }
+        static void put_u64(unsigned char* p, uint64_t v) {
+            for(int i=7; i>=0; i--, v>>=8)
+                p[i] = (unsigned char)(v & 0xff);
+        }
+        static uint32_t get_u32(unsigned char const* p) {
+            uint32_t  v{ 0 };
+            for(int i=0; i<4; i++)
+                v = (v << 8) | p[i];
+            return v;
+        }
+        static uint64_t get_u64(unsigned char const* p) {
+            uint64_t  v{ 0 };
+            for(int i=0; i<8; i++)
+                v = (v << 8) | p[i];
+            return v;
+        }
+
+        // All I/O goes through the taps such that the daemon's metrics
+        // and the transfer's meter see it, like pipelined_copy() does. The
+        // time spent waiting for the data to arrive resp. leave counts
+        // towards 'wait', if not nullptr
+        using wait_type = std::atomic<uint64_t> xfer_meter::*;
+
+        static void write_all(etdc_fd& fd, void const* data, size_t n, io_tap const& tap, xfer_meter* meter, wait_type wait) {
+            unsigned char const* p( reinterpret_cast<unsigned char const*>(data) );
+
+            while( n ) {
+                const ssize_t r = timed(meter, wait, tap, [&]( void ) { return fd.write(fd.__m_fd, p, n); });
+                ETDCASSERT(r>0, "delta: failed to write - " << (r==0 ? std::string("nothing written") : std::string(etdc::strerror(errno))));
+                p += r;
+                n -= (size_t)r;
+            }
+        }
+
+        // Read n bytes, fewer only if end-of-file
+        static size_t read_all(etdc_fd& fd, void* data, size_t n, io_tap const& tap, xfer_meter* meter, wait_type wait) {
+            unsigned char* p( reinterpret_cast<unsigned char*>(data) );
+            size_t         nRead{ 0 };
+
+            while( nRead<n ) {
+                const ssize_t r = timed(meter, wait, tap, [&]( void ) { return fd.read(fd.__m_fd, p + nRead, n - nRead); });
+                ETDCASSERT(r>=0, "delta: failed to read - " << etdc::strerror(errno));
+                if( r==0 )
+                    break;
+                nRead += (size_t)r;
+            }
+            return nRead;
+        }
+
+        // begin() now, finish() however we leave
+        using advice_guard = std::unique_ptr<io_advisor, void(*)(io_advisor*)>;
+        static advice_guard advise(io_advisor* advice) {
+            if( advice )
+                advice->begin();
+            return advice_guard(advice, [](io_advisor* a) { a->finish(); });
+        }
+
+        static void pread_all(int fd, void* data, size_t n, off_t pos, xfer_meter* meter) {
+            const io_tap   tap( metrics::io_kind::DiskRead );
+            unsigned char* p( reinterpret_cast<unsigned char*>(data) );
+
+            while( n ) {
+                const ssize_t r = timed(meter, nullptr, tap, [&]( void ) { return ::pread(fd, p, n, pos); });
+                ETDCSYSCALL(r>=0, "delta: failed to read basis @" << pos << " - " << etdc::strerror(errno));
+                ETDCASSERT(r>0, "delta: the basis file shrank whilst using it");
+                p   += r;
+                pos += r;
+                n   -= (size_t)r;
+            }
+        }
+
+        // The records are small so we buffer them up; large bits of data
+        // go straight through
+        class wire_writer {
+            public:
+                wire_writer(etdc_fdptr conn, xfer_meter* meter, wait_type wait):
+                    __m_conn( conn ), __m_tap( *conn, false ), __m_meter( meter ), __m_wait( wait ),
+                    __m_buf( new unsigned char[bufSz] ), __m_n( 0 )
+                {}
+
+                void put(void const* data, size_t n) {
+                    if( __m_n + n>bufSz )
+                        this->flush();
+                    if( n>=bufSz ) {
+                        write_all(*__m_conn, data, n, __m_tap, __m_meter, __m_wait);
+                        return;
+                    }
+                    ::memcpy(&__m_buf[__m_n], data, n);
+                    __m_n += n;
+                }
+
+                void flush( void ) {
+                    write_all(*__m_conn, &__m_buf[0], __m_n, __m_tap, __m_meter, __m_wait);
+                    __m_n = 0;
+                }
+
+            private:
+                static const size_t              bufSz = 256*1024;
+                etdc_fdptr                       __m_conn;
+                const io_tap                     __m_tap;
+                xfer_meter* const                __m_meter;
+                const wait_type                  __m_wait;
+                std::unique_ptr<unsigned char[]> __m_buf;
+                size_t                           __m_n;
+        };
+
+        class wire_reader {
+            public:
+                // The nPre bytes at pre were read from conn by someone else,
+                // they're counted here
+                wire_reader(etdc_fdptr conn, char const* pre, size_t nPre, xfer_meter* meter, wait_type wait):
+                    __m_conn( conn ), __m_tap( *conn, true ), __m_meter( meter ), __m_wait( wait ),
+                    __m_buf( new unsigned char[std::max((size_t)bufSz, nPre)] ), __m_pos( 0 ), __m_end( nPre )
+                {
+                    if( nPre )
+                        ::memcpy(&__m_buf[0], pre, nPre);
+                    __m_tap.bytes( (ssize_t)nPre );
+                }
+
+                void get(void* data, size_t n) {
+                    unsigned char* p( reinterpret_cast<unsigned char*>(data) );
+
+                    while( n ) {
+                        if( __m_pos==__m_end ) {
+                            // Big reads don't need to go through our buffer
+                            if( n>=bufSz ) {
+                                ETDCASSERT(read_all(*__m_conn, p, n, __m_tap, __m_meter, __m_wait)==n, "delta: remote end hung up");
+                                return;
+                            }
+                            const ssize_t r = timed(__m_meter, __m_wait, __m_tap,
+                                                    [&]( void ) { return __m_conn->read(__m_conn->__m_fd, &__m_buf[0], bufSz); });
+                            ETDCASSERT(r>0, "delta: failed to read from remote end - " << (r==0 ? std::string("hung up") : std::string(etdc::strerror(errno))));
+                            __m_pos = 0;
+                            __m_end = (size_t)r;
+                        }
+                        const size_t  m = std::min(n, __m_end - __m_pos);
+                        ::memcpy(p, &__m_buf[__m_pos], m);
+                        __m_pos += m;
+                        p       += m;
+                        n       -= m;
+                    }
+                }
+
+            private:
+                static const size_t              bufSz = 256*1024;
+                etdc_fdptr                       __m_conn;
+                const io_tap                     __m_tap;
+                xfer_meter* const                __m_meter;
+                const wait_type                  __m_wait;
+                std::unique_ptr<unsigned char[]> __m_buf;
+                size_t                           __m_pos, __m_end;
+        };
+
+        // rsync's weak checksum: a = sum of the bytes, b = sum of the
+        // bytes weighted n, n-1, ..., 1.
+        // With SSE2 sixteen bytes at a time: per chunk the plain sum comes
+        // from psadbw and the weights 16..1 within the chunk from pmaddwd;
+        // the chunk's position is accounted for by adding the running sum
+        // of the chunks before it, like Adler-32 implementations do.
+        static void weak_sums(unsigned char const* p, size_t n, uint32_t& a, uint32_t& b) {
+            size_t  i{ 0 };
+
+            a = b = 0;
+#if defined(__SSE2__)
+            const size_t nChunk( n/16 );
+            if( nChunk ) {
+                const __m128i zero = _mm_setzero_si128();
+                const __m128i wlo  = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+                const __m128i whi  = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+                __m128i       vs = zero, vp = zero, vw = zero;
+
+                for(size_t c=0; c<nChunk; c++) {
+                    const __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + 16*c));
+
+                    vp = _mm_add_epi32(vp, vs);
+                    vs = _mm_add_epi32(vs, _mm_sad_epu8(v, zero));
+                    vw = _mm_add_epi32(vw, _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), wlo));
+                    vw = _mm_add_epi32(vw, _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), whi));
+                }
+                const auto hsum = [](__m128i v) {
+                    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+                    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+                    return (uint32_t)_mm_cvtsi128_si32(v);
+                };
+                a = hsum(vs);
+                b = 16 * hsum(vp) + hsum(vw);
+                i = 16 * nChunk;
+                // The weights above assumed the block ended here
+                b += (uint32_t)(n - i) * a;
+            }
+#endif
+            for(; i<n; i++) {
+                a += p[i];
+                b += (uint32_t)(n - i) * p[i];
+            }
+        }
+
+        static uint32_t weak_value(uint32_t a, uint32_t b) {
+            return (a & 0xffff) | (b << 16);
+        }
+
+        // The strong checksum is XXH64. It must not be a CRC: the
+        // whole-file CRC32C of a file in which a block was swapped for one
+        // with the same CRC32C is the same, such an error would go unnoticed
+        static const uint64_t xxP1 = 11400714785074694791ULL;
+        static const uint64_t xxP2 = 14029467366897019727ULL;
+        static const uint64_t xxP3 =  1609587929392839161ULL;
+        static const uint64_t xxP4 =  9650029242287828579ULL;
+        static const uint64_t xxP5 =  2870177450012600261ULL;
+
+        static uint64_t xx_rotl(uint64_t x, int r) {
+            return (x << r) | (x >> (64 - r));
+        }
+        // XXH64 is defined on little endian words
+        static uint64_t xx_le64(unsigned char const* p) {
+            uint64_t  v{ 0 };
+            for(int i=7; i>=0; i--)
+                v = (v << 8) | p[i];
+            return v;
+        }
+        static uint64_t xx_le32(unsigned char const* p) {
+            return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24);
+        }
+        static uint64_t xx_round(uint64_t acc, uint64_t in) {
+            return xx_rotl(acc + in * xxP2, 31) * xxP1;
+        }
+        static uint64_t xx_merge(uint64_t acc, uint64_t v) {
+            return (acc ^ xx_round(0, v)) * xxP1 + xxP4;
+        }
+
+        static uint64_t strong_sum(unsigned char const* p, size_t n) {
+            unsigned char const* const e( p + n );
+            uint64_t                   h;
+
+            if( n>=32 ) {
+                uint64_t v1 = xxP1 + xxP2, v2 = xxP2, v3 = 0, v4 = 0 - xxP1;
+
+                do {
+                    v1 = xx_round(v1, xx_le64(p));
+                    v2 = xx_round(v2, xx_le64(p + 8));
+                    v3 = xx_round(v3, xx_le64(p + 16));
+                    v4 = xx_round(v4, xx_le64(p + 24));
+                    p += 32;
+                } while( p + 32<=e );
+                h = xx_rotl(v1, 1) + xx_rotl(v2, 7) + xx_rotl(v3, 12) + xx_rotl(v4, 18);
+                h = xx_merge(h, v1);
+                h = xx_merge(h, v2);
+                h = xx_merge(h, v3);
+                h = xx_merge(h, v4);
+            } else {
+                h = xxP5;
+            }
+            h += (uint64_t)n;
+            for(; p + 8<=e; p+=8)
+                h = xx_rotl(h ^ xx_round(0, xx_le64(p)), 27) * xxP1 + xxP4;
+            if( p + 4<=e ) {
+                h  = xx_rotl(h ^ (xx_le32(p) * xxP1), 23) * xxP2 + xxP3;
+                p += 4;
+            }
+            for(; p<e; p++)
+                h = xx_rotl(h ^ (*p * xxP5), 11) * xxP1;
+            h ^= h >> 33;
+            h *= xxP2;
+            h ^= h >> 29;
+            h *= xxP3;
+            h ^= h >> 32;
+            return h;
+        }
+
+        struct block_sig {
+            uint32_t    weak;
+            uint64_t    strong;
+            uint64_t    idx;
+        };
+        using siglist_type = std::vector<block_sig>;
+
+        // The signatures of all complete blocks of the basis. Threads
+        // each take a consecutive range of blocks and pread(2) them
+        static siglist_type mk_signatures(int basis, uint64_t nBlock, size_t blockSz, cancelfn_type const& isCancelled, xfer_meter* meter) {
+            siglist_type             sigs( nBlock );
+            const unsigned int       nCPU( std::max(std::thread::hardware_concurrency(), 1u) );
+            const uint64_t           nThread( std::max(std::min((uint64_t)std::min(nCPU, 8u), nBlock/64), (uint64_t)1) );
+            std::vector<std::thread> threads;
+            std::mutex               errLock;
+            std::exception_ptr       eptr;
+
+            for(uint64_t t=0; t<nThread; t++) {
+                const uint64_t  first( nBlock * t / nThread ), last( nBlock * (t+1) / nThread );
+
+                threads.emplace_back( etdc::thread([&, first, last]( void ) {
+                    try {
+                        const size_t                     nPer( std::max(delta_iosize/blockSz, (size_t)1) );
+                        std::unique_ptr<unsigned char[]> buf( new unsigned char[nPer * blockSz] );
+
+                        for(uint64_t b=first; b<last && !isCancelled(); b+=nPer) {
+                            const uint64_t n( std::min((uint64_t)nPer, last - b) );
+
+                            pread_all(basis, &buf[0], n * blockSz, (off_t)(b * blockSz), meter);
+                            for(uint64_t i=0; i<n; i++) {
+                                unsigned char const* p( &buf[i * blockSz] );
+                                uint32_t             wa, wb;
+
+                                weak_sums(p, blockSz, wa, wb);
+                                sigs[b + i] = block_sig{ weak_value(wa, wb), strong_sum(p, blockSz), b + i };
+                            }
+                        }
+                    }
+                    catch( ... ) {
+                        std::lock_guard<std::mutex> lk( errLock );
+                        eptr = std::current_exception();
+                    }
+                }) );
+            }
+            for(auto& t: threads)
+                t.join();
+            if( eptr )
+                std::rethrow_exception( eptr );
+            ETDCASSERT(!isCancelled(), "delta: cancelled");
+            return sigs;
+        }
+    }
+
+    uint32_t delta_weak(unsigned char const* p, size_t n) {
+        uint32_t  a, b;
+        detail::weak_sums(p, n, a, b);
+        return detail::weak_value(a, b);
+    }
+
+    ////////////////////////////////////////////////////////////////////////
+    //                      The destination
+    ////////////////////////////////////////////////////////////////////////
+    delta_result delta_receive(etdc_fdptr conn, int basis, etdc_fdptr out, off_t todo,
+                               detail::cancelfn_type const& isCancelled, char const* pre, size_t nPre,
+                               io_advisor* outAdvice, xfer_meter* meter) {
+        struct stat          st;
+        delta_result         rv;
+        off_t                nCopied{ 0 };
+        const off_t          basisSz( (basis>=0 && ::fstat(basis, &st)==0 && S_ISREG(st.st_mode)) ? st.st_size : 0 );
+        const size_t         blockSz( detail::delta_blocksize(basisSz) );
+        const uint64_t       nBlock( (uint64_t)basisSz / blockSz );
+        // The signatures are ours, the instructions the data we wait for
+        detail::wire_writer  wr( conn, meter, nullptr );
+        detail::wire_reader  rd( conn, pre, nPre, meter, &xfer_meter::rdWait );
+        const detail::io_tap outTap( *out, false );
+        unsigned char        rec[16];
+
+        // 1. What we have
+        {
+            auto const  start_tm = std::chrono::high_resolution_clock::now();
+            const auto  sigs     = detail::mk_signatures(basis, nBlock, blockSz, isCancelled, meter);
+            auto const  end_tm   = std::chrono::high_resolution_clock::now();
+
+            ETDCDEBUG(2, "delta_receive/" << nBlock << " signatures of " << blockSz << " byte blocks in " <<
+                         std::chrono::duration<double>(end_tm - start_tm).count() << "s" << std::endl);
+            detail::put_u64(&rec[0], blockSz);
+            detail::put_u64(&rec[8], nBlock);
+            wr.put(rec, 16);
+            for(auto const& s: sigs) {
+                detail::put_u32(&rec[0], s.weak);
+                detail::put_u64(&rec[4], s.strong);
+                wr.put(rec, 12);
+            }
+            wr.flush();
+        }
+
+        // 2. Rebuild the file from what the source tells us
+        const detail::advice_guard       advice( detail::advise(outAdvice) );
+        crc32c                           crc;
+        std::unique_ptr<unsigned char[]> buf( new unsigned char[detail::delta_iosize] );
+        bool                             done{ false };
+
+        while( !done ) {
+            ETDCASSERT(!isCancelled(), "delta: cancelled");
+            rd.get(rec, 1);
+            switch( rec[0] ) {
+                case 'L': {
+                        rd.get(rec, 4);
+                        size_t  n( detail::get_u32(rec) );
+
+                        ETDCASSERT(rv.nDone + (off_t)n<=todo, "delta: the source sends more bytes than the file has");
+                        rv.nLiteral += (off_t)n;
+                        rv.nDone    += (off_t)n;
+                        while( n ) {
+                            const size_t m( std::min(n, detail::delta_iosize) );
+                            rd.get(&buf[0], m);
+                            crc.update(&buf[0], m);
+                            detail::write_all(*out, &buf[0], m, outTap, meter, &xfer_meter::wrWait);
+                            if( outAdvice )
+                                outAdvice->write_done( m );
+                            detail::count(meter, &xfer_meter::nDone, m);
+                            detail::count(meter, &xfer_meter::nWire, m);
+                            n -= m;
+                        }
+                    }
+                    break;
+                case 'C': {
+                        rd.get(rec, 12);
+                        const uint64_t idx( detail::get_u64(rec) );
+                        const uint64_t cnt( detail::get_u32(&rec[8]) );
+                        off_t          pos( (off_t)(idx * blockSz) );
+                        off_t          n( (off_t)(cnt * blockSz) );
+
+                        ETDCASSERT(idx<nBlock && cnt<=nBlock - idx, "delta: the source refers to blocks " << idx << "+" << cnt <<
+                                                                    " but there are only " << nBlock);
+                        ETDCASSERT(rv.nDone + n<=todo, "delta: the source sends more bytes than the file has");
+                        nCopied  += n;
+                        rv.nDone += n;
+                        while( n ) {
+                            const size_t m( (size_t)std::min(n, (off_t)detail::delta_iosize) );
+                            detail::pread_all(basis, &buf[0], m, pos, meter);
+                            crc.update(&buf[0], m);
+                            detail::write_all(*out, &buf[0], m, outTap, meter, &xfer_meter::wrWait);
+                            if( outAdvice )
+                                outAdvice->write_done( m );
+                            detail::count(meter, &xfer_meter::nDone, m);
+                            pos += (off_t)m;
+                            n   -= (off_t)m;
+                        }
+                    }
+                    break;
+                case 'E': {
+                        rd.get(rec, 4);
+                        const char  ack( (rv.nDone==todo && detail::get_u32(rec)==crc.value()) ? 'y' : 'n' );
+
+                        rv.match = (ack=='y');
+                        rv.crc   = crc.value();
+                        wr.put(&ack, 1);
+                        wr.flush();
+                        done = true;
+                    }
+                    break;
+                default:
+                    ETDCASSERT(false, "delta: the source sent an unknown instruction 0x" << std::hex << (unsigned int)rec[0]);
+            }
+        }
+        ETDCDEBUG(2, "delta_receive/" << rv.nDone << " bytes: " << rv.nLiteral << " sent, " << nCopied << " copied from the basis" <<
+                     (rv.match ? "" : " - CHECKSUM MISMATCH") << std::endl);
+        return rv;
+    }
+
+    ////////////////////////////////////////////////////////////////////////
+    //                      The source
+    ////////////////////////////////////////////////////////////////////////
+    delta_result delta_send(etdc_fdptr conn, etdc_fdptr src, off_t todo,
+                            detail::cancelfn_type const& isCancelled, char const* pre, size_t nPre,
+                            io_advisor* srcAdvice, xfer_meter* meter) {
+        // The instructions are the data we send, the signatures are not
+        delta_result         rv;
+        detail::wire_writer  wr( conn, meter, &xfer_meter::wrWait );
+        detail::wire_reader  rd( conn, pre, nPre, meter, nullptr );
+        const detail::io_tap srcTap( *src, true );
+        unsigned char        rec[16];
+
+        // 1. What the destination has
+        rd.get(rec, 16);
+        const uint64_t       blockSz( detail::get_u64(&rec[0]) );
+        const uint64_t       nBlock( detail::get_u64(&rec[8]) );
+
+        ETDCASSERT(blockSz>0 && blockSz<=detail::delta_maxblocksize, "delta: unacceptable block size " << blockSz);
+        ETDCASSERT(nBlock<=detail::delta_maxblocks, "delta: unacceptable number of blocks " << nBlock);
+
+        // Sorted by weak checksum, and a 16-bit filter in front of that
+        // such that most positions don't even need the binary search
+        detail::siglist_type sigs( nBlock );
+        std::vector<bool>    filter( 65536, false );
+        const auto           fIdx = [](uint32_t w) { return (w ^ (w >> 16)) & 0xffff; };
+
+        for(uint64_t i=0; i<nBlock; i++) {
+            rd.get(rec, 12);
+            sigs[i] = detail::block_sig{ detail::get_u32(&rec[0]), detail::get_u64(&rec[4]), i };
+            filter[ fIdx(sigs[i].weak) ] = true;
+        }
+        std::sort(sigs.begin(), sigs.end(), [](detail::block_sig const& l, detail::block_sig const& r) {
+                                                return l.weak<r.weak || (l.weak==r.weak && l.idx<r.idx); });
+
+        // 2. Slide over our version. buf holds [lit, end) of the file,
+        //    bytes from lit up to the window at pos haven't been sent yet
+        const size_t                     B( (size_t)blockSz );
+        const size_t                     cap( detail::delta_maxliteral + B + detail::delta_iosize );
+        std::unique_ptr<unsigned char[]> buf( new unsigned char[cap] );
+        size_t                           lit{ 0 }, pos{ 0 }, end{ 0 };
+        off_t                            nRead{ 0 };
+        uint64_t                         cpIdx{ 0 }, cpCnt{ 0 };
+        uint32_t                         a{ 0 }, b{ 0 };
+        bool                             haveSums{ false };
+        crc32c                           crc;
+        const detail::advice_guard       advice( detail::advise(srcAdvice) );
+
+        // Make sure there are at least n bytes from pos on, if the file has them
+        const auto fill = [&](size_t n) {
+            if( pos + n<=end || nRead==todo )
+                return pos + n<=end;
+            ::memmove(&buf[0], &buf[lit], end - lit);
+            end -= lit;
+            pos -= lit;
+            lit  = 0;
+            while( end<cap && nRead<todo ) {
+                ETDCASSERT(!isCancelled(), "delta: cancelled");
+                const size_t m = detail::read_all(*src, &buf[end], (size_t)std::min((off_t)(cap - end), todo - nRead),
+                                                  srcTap, meter, &xfer_meter::rdWait);
+                ETDCASSERT(m>0, "delta: the source file shrank whilst sending it");
+                if( srcAdvice )
+                    srcAdvice->read_done( m );
+                crc.update(&buf[end], m);
+                end   += m;
+                nRead += (off_t)m;
+            }
+            return pos + n<=end;
+        };
+        const auto flushCopy = [&]( void ) {
+            if( cpCnt==0 )
+                return;
+            rec[0] = 'C';
+            detail::put_u64(&rec[1], cpIdx);
+            detail::put_u32(&rec[9], (uint32_t)cpCnt);
+            wr.put(rec, 13);
+            rv.nDone += (off_t)(cpCnt * B);
+            detail::count(meter, &xfer_meter::nDone, cpCnt * B);
+            cpCnt     = 0;
+        };
+        const auto flushLiteral = [&]( void ) {
+            if( pos==lit )
+                return;
+            flushCopy();
+            rec[0] = 'L';
+            detail::put_u32(&rec[1], (uint32_t)(pos - lit));
+            wr.put(rec, 5);
+            wr.put(&buf[lit], pos - lit);
+            rv.nLiteral += (off_t)(pos - lit);
+            rv.nDone    += (off_t)(pos - lit);
+            detail::count(meter, &xfer_meter::nDone, pos - lit);
+            detail::count(meter, &xfer_meter::nWire, pos - lit);
+            lit          = pos;
+        };
+
+        while( nBlock && fill(B) ) {
+            if( !haveSums ) {
+                ETDCASSERT(!isCancelled(), "delta: cancelled");
+                detail::weak_sums(&buf[pos], B, a, b);
+                haveSums = true;
+            }
+            const uint32_t  weak( detail::weak_value(a, b) );
+
+            if( filter[fIdx(weak)] ) {
+                const detail::block_sig key{ weak, 0, 0 };
+                auto const              range = std::equal_range(sigs.begin(), sigs.end(), key,
+                                                    [](detail::block_sig const& l, detail::block_sig const& r) { return l.weak<r.weak; });
+                if( range.first!=range.second ) {
+                    const uint64_t  strong( detail::strong_sum(&buf[pos], B) );
+
+                    // Prefer the block that continues the current run
+                    auto match = sigs.end();
+                    for(auto s=range.first; s!=range.second; s++) {
+                        if( s->strong!=strong )
+                            continue;
+                        if( match==sigs.end() || (cpCnt && s->idx==cpIdx + cpCnt) )
+                            match = s;
+                    }
+                    if( match!=sigs.end() ) {
+                        flushLiteral();
+                        if( cpCnt==0 || match->idx!=cpIdx + cpCnt || cpCnt==0xffffffff ) {
+                            flushCopy();
+                            cpIdx = match->idx;
+                        }
+                        cpCnt++;
+                        pos     += B;
+                        lit      = pos;
+                        haveSums = false;
+                        continue;
+                    }
+                }
+            }
+            // No match: the byte at pos becomes literal, roll the window
+            if( pos - lit>=detail::delta_maxliteral )
+                flushLiteral();
+            if( !fill(B + 1) )
+                break;
+            const uint32_t  o( buf[pos] ), i( buf[pos + B] );
+            a += i - o;
+            b += a - (uint32_t)B * o;
+            pos++;
+        }
+        // What's left goes literally
+        pos = lit;
+        do {
+            (void)fill(detail::delta_maxliteral);
+            pos = std::min(end, lit + detail::delta_maxliteral);
+            flushLiteral();
+        } while( pos<end || nRead<todo );
+        flushCopy();
+        ETDCASSERT(nRead==todo, "delta: could only read " << nRead << " of " << todo << " bytes from the source file");
+
+        // 3. End + checksum of the whole, and hear what the destination thinks of it
+        char  ack;
+        rec[0] = 'E';
+        detail::put_u32(&rec[1], crc.value());
+        wr.put(rec, 5);
+        wr.flush();
+        ETDCASSERT(detail::read_all(*conn, &ack, 1, detail::io_tap(*conn, true), meter, nullptr)==1, "delta: no verdict from the destination");
+        rv.match = (ack=='y');
+        rv.crc   = crc.value();
+        ETDCDEBUG(2, "delta_send/" << rv.nDone << " bytes: " << rv.nLiteral << " sent, " << rv.nDone - rv.nLiteral << " copied by the destination" <<
+                     (rv.match ? "" : " - CHECKSUM MISMATCH") << std::endl);
+        return rv;
+    }
+}
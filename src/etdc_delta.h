@@ -0,0 +1,101 @@
+// rsync-style delta transfers: only send what the destination doesn't have
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef ETDC_DELTA_H
+#define ETDC_DELTA_H
+
+// Own includes
+#include <etdc_fd.h>
+#include <etdc_ioadvice.h>
+#include <etdc_pipeline.h>
+
+// C++ headers
+#include <cstdint>
+
+// Plain-old-C
+#include <sys/types.h>
+
+namespace etdc {
+
+    // The rsync algorithm, over one data connection:
+    //
+    //  1. the destination cuts the version of the file it already has (the
+    //     'basis') in blocks and sends a weak (rolling) and a strong
+    //     (XXH64) checksum of each of them
+    //  2. the source slides a window of one block over its version of the
+    //     file. Wherever the weak checksum of the window matches one of
+    //     the basis' blocks, and then the strong one too, it tells the
+    //     destination to copy that block from the basis, otherwise the
+    //     bytes go over the wire literally
+    //  3. the source follows that with the CRC32C of the whole file; the
+    //     destination compares that to what it reconstructed and says 'y'
+    //     or 'n'
+    //
+    // The weak checksum only ever selects candidates, a block is only
+    // copied if its 64-bit strong checksum matches too. The whole-file
+    // checksum catches the rest: a basis that changed underneath us or
+    // anything that went wrong on the way.
+    //
+    // Wire format, all integers big endian:
+    //  destination -> source
+    //      u64 block size, u64 number of blocks, then per block
+    //      u32 weak, u64 strong
+    //  source -> destination, a series of
+    //      'L' u32 n <n bytes>           literal bytes
+    //      'C' u64 block u32 count       copy count blocks from the basis
+    //      'E' u32 crc32c                end + checksum of the whole file
+    //  destination -> source
+    //      'y' | 'n'
+    struct delta_result {
+        // Bytes of the file that were (re)constructed, of which nLiteral
+        // went over the wire
+        off_t    nDone{ 0 };
+        off_t    nLiteral{ 0 };
+        // The whole-file checksums agreed, and what it was
+        bool     match{ false };
+        uint32_t crc{ 0 };
+    };
+
+    // The destination's side. 'basis' is an fd open for reading on the
+    // current version of the file, -1 if there is none. The new version
+    // of 'todo' bytes is written to 'out'. Computing the signatures of
+    // the basis is spread over a number of threads.
+    // nPre bytes of the source's instructions may already have been read
+    // from 'conn', they're at 'pre'.
+    // Like pipelined_copy() the advisor, if given, is kept informed of
+    // the writes to 'out' and the progress goes into the meter, if there
+    // is one; the literal bytes count as what went over the wire.
+    delta_result delta_receive(etdc_fdptr conn, int basis, etdc_fdptr out, off_t todo,
+                               detail::cancelfn_type const& isCancelled,
+                               char const* pre = nullptr, size_t nPre = 0,
+                               io_advisor* outAdvice = nullptr, xfer_meter* meter = nullptr);
+
+    // The source's side: 'todo' bytes are read from 'src'. Likewise, nPre
+    // bytes of the signatures may already have been read from 'conn' and
+    // the advisor hears of the reads from 'src'.
+    delta_result delta_send(etdc_fdptr conn, etdc_fdptr src, off_t todo,
+                            detail::cancelfn_type const& isCancelled,
+                            char const* pre = nullptr, size_t nPre = 0,
+                            io_advisor* srcAdvice = nullptr, xfer_meter* meter = nullptr);
+
+    // rsync's weak checksum of n bytes
+    uint32_t delta_weak(unsigned char const* p, size_t n);
+}
+
+#endif // ETDC_DELTA_H
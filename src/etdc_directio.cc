@@ -0,0 +1,81 @@
+// Read/write regular files bypassing the page cache where possible
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+
+// glibc only defines O_DIRECT with _GNU_SOURCE
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <etdc_fd.h>
+
+// Plain-old-C
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace etdc {
+    namespace detail {
+#ifdef O_DIRECT
+        // Switch O_DIRECT on or off for the upcoming I/O request,
+        // depending on wether or not it satisfies the alignment
+        // constraints. We don't keep any state: asking the kernel is
+        // cheap compared to moving megabytes.
+        // If the file system does not support O_DIRECT, fcntl(2) fails and
+        // we silently keep on doing buffered I/O.
+        static void direct_io_for(int fd, void const* buf, size_t n) {
+            const int flags = ::fcntl(fd, F_GETFL);
+
+            if( flags==-1 )
+                return;
+
+            // Where will the I/O take place? With O_APPEND that's always
+            // the end of the file
+            off_t       pos;
+            struct stat st;
+
+            if( (flags & O_APPEND) )
+                pos = (::fstat(fd, &st)==0 ? st.st_size : (off_t)-1);
+            else
+                pos = ::lseek(fd, 0, SEEK_CUR);
+
+            const bool aligned = (pos!=(off_t)-1 &&
+                                  (pos % (off_t)direct_io_alignment)==0 &&
+                                  (n % direct_io_alignment)==0 &&
+                                  (reinterpret_cast<uintptr_t>(buf) % direct_io_alignment)==0);
+
+            if( aligned!=((flags & O_DIRECT)==O_DIRECT) )
+                (void)::fcntl(fd, F_SETFL, (aligned ? (flags | O_DIRECT) : (flags & ~O_DIRECT)));
+        }
+#else
+        static void direct_io_for(int, void const*, size_t) {}
+#endif
+
+        ssize_t direct_read(int fd, void* buf, size_t n) {
+            direct_io_for(fd, buf, n);
+            return ::read(fd, buf, n);
+        }
+
+        ssize_t direct_write(int fd, const void* buf, size_t n) {
+            direct_io_for(fd, buf, n);
+            return ::write(fd, buf, n);
+        }
+    }
+}
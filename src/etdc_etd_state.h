@@ -24,6 +24,10 @@
 #include <etdc_fd.h>
 #include <etdc_uuid.h>
 #include <etdc_thread.h>
+#include <etdc_ioadvice.h>
+#include <etdc_bufferpool.h>
+#include <etdc_bandwidth.h>
+#include <etdc_pipeline.h>
 #include <utilities.h>
 #include <etdc_stringutil.h>
 
@@ -31,6 +35,8 @@
 #include <map>
 #include <list>
 #include <mutex>
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <thread>
 #include <utility>
@@ -56,14 +62,19 @@ namespace etdc {
         // SkipExisting: (bits are complement of Resume) 
         //    creates if not exists, open for appending (which we won't) if
         //    it does
-        SkipExisting = ~(O_WRONLY | O_CREAT | O_APPEND) 
+        SkipExisting = ~(O_WRONLY | O_CREAT | O_APPEND),
+        // Delta: (bits are complement of OverWrite)
+        //    the new version is written to a temporary file, from what
+        //    the source sends and what the existing file already has,
+        //    which replaces the existing file when it's complete
+        Delta        = ~(O_WRONLY | O_TRUNC | O_CREAT)
     };
 
 
     static const std::map<openmode_type, std::string> om2string{ 
         {openmode_type::New,    "New"},    {openmode_type::OverWrite, "OverWrite"},
         {openmode_type::Resume, "Resume"}, {openmode_type::Read,      "Read"},
-        {openmode_type::SkipExisting, "SkipExisting"} };
+        {openmode_type::SkipExisting, "SkipExisting"}, {openmode_type::Delta, "Delta"} };
 
     template <typename... Traits>
     std::basic_ostream<Traits...>& operator<<(std::basic_ostream<Traits...>& os, openmode_type const& om) {
@@ -84,20 +95,105 @@ namespace etdc {
     }
 
 
+    // Transfers of a higher class get bandwidth and buffers first; the
+    // numerical value is the rank, higher = more important
+    enum class priority_type : unsigned int {
+        Bulk   = 0,
+        Normal = 1,
+        Urgent = 2
+    };
+
+    static const std::map<priority_type, std::string> priority2string{
+        {priority_type::Bulk, "bulk"}, {priority_type::Normal, "normal"}, {priority_type::Urgent, "urgent"} };
+
+    template <typename... Traits>
+    std::basic_ostream<Traits...>& operator<<(std::basic_ostream<Traits...>& os, priority_type const& pt) {
+        auto const ptr = priority2string.find( pt );
+        return os << (ptr==std::end(priority2string) ? "<invalid priority_type>" : ptr->second);
+    }
+
+    template <typename... Traits>
+    std::basic_istream<Traits...>& operator>>(std::basic_istream<Traits...>& is, priority_type& pt) {
+        std::string  pt_s;
+
+        is >> pt_s;
+        auto const ptr = std::find_if(std::begin(priority2string), std::end(priority2string),
+                                      [&](std::pair<const priority_type, std::string> const& p) { return etdc::stricmp(pt_s, p.second); });
+        if( ptr==std::end(priority2string) )
+            is.setstate( std::ios::failbit );
+        else
+            pt = ptr->first;
+        return is;
+    }
+
+    // How much bandwidth a transfer of a class gets relative to one of
+    // another class, if they are not preempted (see etdc_bandwidth.h)
+    inline double priority_weight(priority_type pt) {
+        return pt==priority_type::Urgent ? 16.0 : (pt==priority_type::Normal ? 4.0 : 1.0);
+    }
+
     // We keep per-transfer properties in here
     struct transferprops_type {
         std::string                 path;
         etdc::etdc_fdptr            fd, data_fd;
         const openmode_type         openMode;
+        // File position where the transfer starts (alreadyhave). Stripes'
+        // offsets are relative to this. Only a rollback, before any data
+        // has moved, changes it (under xfer_lock)
+        off_t                       start;
         std::mutex                  xfer_lock;
         std::atomic<bool>           cancelled;
+        // Taken into account by data that starts moving after it was set
+        std::atomic<priority_type>  priority;
+        // Page cache policy for fd
+        etdc::io_advisor            advice;
+        // Delta transfers write to this file in stead of path; it is
+        // renamed to path when complete and cleared. If it's still set
+        // when the transfer is removed, it is removed too
+        std::string                 tmpPath;
+
+        // A transfer may be split in stripes, each going over their own
+        // data connection. stripe_fds are the data connections of active
+        // stripes, for cancellation; whoever closes them removes them from
+        // the list. Stripes served by a data server do not hold xfer_lock
+        // so they count themselves in nStripe; the entry can't be removed
+        // before that is back at zero.
+        // stripe_done records, per stripe offset, how many bytes were
+        // written such that holes left by failed stripes can be cut off
+        // when the transfer is removed; a resume must not skip them.
+        // All protected by stripe_lock.
+        std::mutex                  stripe_lock;
+        std::list<etdc::etdc_fdptr> stripe_fds;
+        unsigned int                nStripe{ 0 };
+        std::map<off_t, off_t>      stripe_done;
+        // What the transfer's data connections draw their bandwidth
+        // from; exists only whilst data is moving. Also under stripe_lock
+        std::weak_ptr<bandwidth_share> bw_share;
+        // The data channel the latest data connection uses and the
+        // connection itself, for status(). Also under stripe_lock
+        std::string                    channel;
+        std::weak_ptr<etdc::etdc_fd>   channel_fd;
+
+        // Progress, updated by the data loops without locking.
+        // 'total' is what the data connections announced so far; the
+        // sending end knows it up front, stripes arriving at the
+        // receiving end add theirs when they start. 'started' is when the
+        // first data moved, in steady_clock nanoseconds, 0 if not yet
+        xfer_meter                  meter;
+        std::atomic<uint64_t>       total{ 0 };
+        std::atomic<int64_t>        started{ 0 };
+        // status() remembers where it saw the transfer last, to report
+        // the current rate; under the shared state's lock
+        uint64_t                                 lastDone{ 0 };
+        std::chrono::steady_clock::time_point    lastSeen{};
 
         // we cannot be copied or default constructed! (because of our unique_ptr)
         transferprops_type()                          = delete;
 
-        transferprops_type(etdc::etdc_fdptr efd, std::string const& p, openmode_type om):
-            path(p), fd(efd), openMode(om)
-        { cancelled.store( false ); }
+        transferprops_type(etdc::etdc_fdptr efd, std::string const& p, openmode_type om, off_t st, size_t ioWindow):
+            path(p), fd(efd), openMode(om), start(st),
+            advice(*efd, (om==openmode_type::Read ? io_advisor::direction_type::Read : io_advisor::direction_type::Write), ioWindow, p)
+        { cancelled.store( false ); priority.store( priority_type::Normal ); }
     }; 
 
     using cancel_fn         = std::function<void(void)>;
@@ -110,10 +206,21 @@ namespace etdc {
     // Keep global server state
     struct etd_state {
         size_t                  bufSize{ 32*1024*1024 };
+        // Number of bufSize buffers a data loop may keep in flight
+        size_t                  nBuffer{ 3 };
+        // Where the data loops get those buffers from. Must be
+        // (re)configured when bufSize changes
+        buffer_pool             pool{ 32*1024*1024 };
+        // Bypass the page cache for regular files?
+        bool                    directIO{ false };
+        // Read ahead/write behind window for regular files, 0 = leave it to the kernel
+        size_t                  ioWindow{ 64*1024*1024 };
         std::mutex              lock;
         unsigned int            n_threads;
         etdc::mss_type          udtMSS{ 0/*1500*/ };
         etdc::max_bw_type       udtMaxBW{ 0/*-1*/ };
+        // Daemon-wide and per-peer limits on all data channels, any protocol
+        bandwidth_scheduler     bandwidth;
         cancellist_type         cancellations;
         transfermap_type        transfers;
         std::atomic<bool>       cancelled;
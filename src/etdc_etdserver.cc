@@ -19,24 +19,37 @@
 //          7990 AA Dwingeloo
 #include <utilities.h>
 #include <etdc_etdserver.h>
+#include <etdc_pipeline.h>
+#include <etdc_checksum.h>
+#include <etdc_delta.h>
+#include <etdc_metrics.h>
+#include <etdc_sciprint.h>
 
 // C++ headerts
 //#include <regex>
+#include <list>
 #include <mutex>
+#include <atomic>
 #include <memory>
 #include <thread>
+#include <vector>
 #include <functional>
+#include <condition_variable>
 
 // Plain-old-C
 #include <glob.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 namespace etdc {
 
     sockname2string_fn sockname2str( etdc::protocolversion_type v) {
         if( v==0 || v== ETDServerInterface::unknownProtocolVersion )
             return sockname2str_v0;
-        if( v==1 )
+        // The format of the data channel addresses didn't change after v1
+        if( v>=1 && v<=ETDServerInterface::currentProtocolVersion )
             return sockname2str_v1;
         throw std::runtime_error("sockname2str/request for unsupported protocolversion " + etdc::repr(v));
     }
@@ -51,44 +64,84 @@ namespace etdc {
         o = std::stoll(s);
     }
 
+    // Transfer options <-> "key=value[,key=value]*"
+    std::string options2string(xfer_options const& opts) {
+        std::ostringstream  oss;
+
+        if( opts.nStreams!=1 )
+            oss << "streams=" << opts.nStreams;
+        if( opts.multiPath )
+            oss << (oss.tellp()>0 ? "," : "") << "multipath=1";
+        if( opts.checksum )
+            oss << (oss.tellp()>0 ? "," : "") << "checksum=" << crc32c::name;
+        if( opts.delta )
+            oss << (oss.tellp()>0 ? "," : "") << "delta=1";
+        if( !opts.compress.empty() )
+            oss << (oss.tellp()>0 ? "," : "") << "compress=" << opts.compress;
+        if( opts.progress>0 )
+            oss << (oss.tellp()>0 ? "," : "") << "progress=" << opts.progress;
+        if( opts.latency )
+            oss << (oss.tellp()>0 ? "," : "") << "latency=1";
+        return oss.str();
+    }
+
+    xfer_options string2options(std::string const& s) {
+        xfer_options             opts;
+        std::vector<std::string> keyvalues;
+
+        etdc::string_split(s, ',', std::back_inserter(keyvalues));
+        for( const auto& kv: keyvalues ) {
+            std::string::size_type  equal = kv.find('=');
+            ETDCASSERT(equal!=std::string::npos, "Transfer option '" << kv << "' is not of the form key=value");
+
+            std::string const       key   = kv.substr(0, equal);
+            std::string const       val   = kv.substr(equal+1);
+
+            if( key=="streams" ) {
+                opts.nStreams = (unsigned int)std::stoul(val);
+                ETDCASSERT(opts.nStreams>0, "The number of streams must be > 0");
+            } else if( key=="multipath" )
+                opts.multiPath = (val!="0");
+            else if( key=="checksum" ) {
+                ETDCASSERT(val==crc32c::name, "Unsupported checksum algorithm '" << val << "'");
+                opts.checksum = true;
+            } else if( key=="delta" )
+                opts.delta = (val!="0");
+            else if( key=="compress" ) {
+                ETDCASSERT(find_codec(val)!=nullptr, "Unsupported compression '" << val << "'");
+                opts.compress = val;
+            } else if( key=="progress" ) {
+                opts.progress = std::stod(val);
+                ETDCASSERT(opts.progress>0, "The progress interval must be > 0");
+            } else if( key=="latency" )
+                opts.latency = (val!="0");
+            else
+                ETDCDEBUG(0, "Client sent unsupported transfer option '" << kv << "' - ignoring" << std::endl);
+        }
+        return opts;
+    }
+
     // parse "<proto/host:port[/opt=val[,opt2=val2]*]>" into sockname_type
     sockname_type decode_data_addr(std::string const& s) {
-        static const std::string    ipv6_lit{ "[:0-9a-zA-Z]+(/[0-9]{1,3})?(%[a-zA-Z0-9]+)?" };
-        //                                                  3             4
-        // From: https://stackoverflow.com/a/3824105 
-        // Also - need to check that host name length <= 255
-        static const std::string    valid_host( "(([a-zA-Z0-9]|[a-zA-Z0-9][a-zA-Z0-9\\-]{0,61}[a-zA-Z0-9])"
-        //                                       56
-                                                "(\\.([a-zA-Z0-9]|[a-zA-Z0-9][a-zA-Z0-9\\-]{0,61}[a-zA-Z0-9]))*)");
-        //                                       7   8                
-        static const std::string    keyVal( "[^ \t\v,=>]+=[^ \t\v,>]+" );
-        static const std::string    options( "(/("+keyVal+ "(," + keyVal + ")*))?" );
-        //                                    1011          12
-        static const std::regex     rxSockName("^<([^/]+)/(\\["+ipv6_lit+"\\]|" + valid_host + "):([0-9]+)" + options + ">$");
-                                            //    1       2                                       9 
-                                            //    proto   host                                    port
-
-        std::smatch fields;
-        ETDCASSERT(std::regex_match(s, fields, rxSockName), "The string '" << s << "' is not a valid data address designator");
-        ETDCASSERT(fields[5].length()<=255, "Host names can not be longer than 255 characters (RFC1123)");
-        ETDCDEBUG(4, "decode_data_addr: 1='" << fields[1].str() << "' 2='" << fields[2].str() << "' 9='" << fields[9].str() << "'" <<
-                     " 11='" << fields[11].str() << "'" << std::endl);
+        data_addr_type  addr;
+
+        ETDCASSERT(parse_data_addr(token_type(s.data(), s.data() + s.size()), addr),
+                   "The string '" << s << "' is not a valid data address designator");
+        ETDCASSERT(addr.bracketed || addr.host.size()<=255, "Host names can not be longer than 255 characters (RFC1123)");
+        ETDCDEBUG(4, "decode_data_addr: proto='" << addr.protocol << "' host='" << addr.host << "' port='" << addr.port << "'" <<
+                     " options='" << addr.options << "'" << std::endl);
 
         // Break up the options into key=value pairs and see if there's
         // anything we recognize
-        sockname_type     sn{ mk_sockname(fields[1].str(), unbracket(fields[2].str()), port(fields[9].str())) };
-        std::string const opts{ fields[11].str() };
-
-        if( !opts.empty() ) {
-            std::vector<std::string>    keyvalues;
+        sockname_type     sn{ mk_sockname(addr.protocol.str(), unbracket(addr.host.str()), port(addr.port.str())) };
 
-            etdc::string_split(opts, ',', std::back_inserter(keyvalues));
-            for( const auto& kv: keyvalues ) {
-                // We already know the option matches keyVal (see above)
-                // so this can be done basically blindly
-                std::string::size_type  equal = kv.find('=');
-                std::string const       key   = kv.substr(0, equal);
-                std::string const       val   = kv.substr(equal+1);
+        if( !addr.options.empty() ) {
+            for_each_split(addr.options, ',', [&](token_type const& kv) {
+                // parse_data_addr() already checked the option is
+                // key=value so this can be done basically blindly
+                char const* const  equal = std::find(kv.first, kv.last, '=');
+                const token_type   key( kv.first, equal );
+                std::string const  val( equal + 1, kv.last );
 
                 // *now* we can see if we recognize anything
                 if( key=="mss" )
@@ -100,12 +153,628 @@ namespace etdc {
                         etdc::update_sockname(sn, max_bw(val));
                 } else
                     ETDCDEBUG(0, "Server sent unsupported socket option '" << kv << "' - ignoring" << std::endl);
-            }
+            });
         }
         return sn; 
     }
 
 
+    namespace detail {
+        // Try the data addresses in order until we manage to connect to one
+        // of them. Our own buffer size, MSS and bandwidth limit are merged
+        // with what the remote end advertises.
+        // Returns an empty pointer if cancelled and throws if none of the
+        // addresses could be connected to.
+        static etdc_fdptr connect_data_channel(dataaddrlist_type const& dataAddrs, const size_t bufSz,
+                                               const etdc::mss_type ourMSS, const etdc::max_bw_type ourBW,
+                                               cancelfn_type const& isCancelled, char const* who) {
+            std::ostringstream  tried;
+
+            for(auto addr: dataAddrs) {
+                if( isCancelled() )
+                    return etdc_fdptr();
+                try {
+                    // Whichever way the data flows, the data channel
+                    // needs big buffers
+                    const auto    proto = get_protocol(addr);
+                    auto          clnt  = etdc::detail::client_defaults.find( untag(proto) )->second();
+
+                    // Merge our settings with the default client settings
+                    etdc::detail::update_clnt( clnt, get_host(addr), get_port(addr),
+                                                     etdc::udt_rcvbuf{bufSz}, etdc::udt_sndbuf{bufSz},
+                                                     etdc::so_rcvbuf{bufSz}, etdc::so_sndbuf{bufSz},
+                                                     isCancelled );
+                    // decide on which mss to use
+                    // If set to 0 (default) do not change
+                    using key_type    = std::pair<bool, bool>;
+                    using mssmap_type = std::map<key_type, std::function<etdc::udt_mss(int, int)>>;
+                    static const mssmap_type mss_map{
+                        // If both sides have an MSS setting, use the minimum
+                        {key_type{true, true},   [](int o, int t) { return etdc::udt_mss{ std::min(o, t)}; }},
+                        // either have one set? use that one
+                        {key_type{true, false},  [](int o, int  ) { return etdc::udt_mss{ o }; }},
+                        {key_type{false, true},  [](int  , int t) { return etdc::udt_mss{ t }; }},
+                        // neither have set it, don't set it here either
+                        {key_type{false, false}, [](int  , int  ) { return etdc::udt_mss{ 0 }; }}
+                    };
+
+                    auto       oMSS{ untag(ourMSS) };
+                    auto       tMSS{ untag(get_mss(addr)) };
+                    const auto mss_to_use = mss_map.find( key_type{oMSS>0, tMSS>0} )->second(oMSS, tMSS);
+
+                    ETDCDEBUG(4, "ETDServer::" << who << "/use MSS=" << untag(mss_to_use) << " [ours=" << oMSS << ", "
+                                                                << get_host(addr) << "=" << tMSS << "]" << std::endl);
+                    if( untag(mss_to_use) ) 
+                        etdc::detail::update_clnt( clnt, mss_to_use );
+
+                    // same applies to bandwidth constraints?
+                    auto     oBW{ untag(ourBW) };
+                    auto     tBW{ untag(get_max_bw(addr)) };
+
+                    // If either side has a bw restriction we adapt to that
+                    using maxbwmap_type = std::map<key_type, std::function<etdc::udt_max_bw(int64_t, int64_t)>>;
+                    static const maxbwmap_type maxbw_map{
+                        // both restricted - return minimum
+                        {key_type{true, true},   [](int64_t o, int64_t t) { return etdc::udt_max_bw{ std::min(o, t)}; }},
+                        {key_type{true, false},  [](int64_t o, int64_t  ) { return etdc::udt_max_bw{ o }; }},
+                        {key_type{false, true},  [](int64_t  , int64_t t) { return etdc::udt_max_bw{ t }; }},
+                        {key_type{false, false}, [](int64_t  , int64_t  ) { return etdc::udt_max_bw{ -1 }; }}
+                    };
+
+                    const auto maxbw = maxbw_map.find( key_type{oBW>0, tBW>0} )->second(oBW, tBW);
+
+                    ETDCDEBUG(4, "ETDServer::" << who << "/use MaxBW=" << untag(maxbw) << " [ours=" << oBW << ", "
+                                                                << get_host(addr) << "=" << tBW << "]" << std::endl);
+                        
+                    etdc::detail::update_clnt( clnt, maxbw );
+
+                    etdc_fdptr  rv = mk_client( get_protocol(addr), clnt );
+                    ETDCDEBUG(2, who << "/connected to " << addr << std::endl);
+                    return rv;
+                }
+                catch( std::exception const& e ) {
+                    tried << addr << ": " << e.what() << ", ";
+                    metrics::connect_failed( get_host(addr) );
+                }
+                catch( ... ) {
+                    tried << addr << ": unknown exception" << ", ";
+                    metrics::connect_failed( get_host(addr) );
+                }
+            }
+            ETDCASSERT(isCancelled(), "Failed to connect to any of the data servers: " << tried.str());
+            return etdc_fdptr();
+        }
+
+        // Open another file descriptor on the transfer's file, positioned
+        // at 'offset' bytes from where the transfer started. Each stripe
+        // gets its own such that it can read/write sequentially at its own
+        // position, without disturbing the others (and zero-copy and
+        // O_DIRECT keep working as they do for a single stream).
+        // Note: the file was already opened/created by requestFile{Read,Write}
+        //       so we don't need O_CREAT and certainly not O_TRUNC. And not
+        //       O_APPEND either - that would defeat the purpose.
+        static etdc_fdptr reopen(transferprops_type const& transfer, off_t offset, bool directIO) {
+            int  omode = (transfer.openMode==openmode_type::Read ? O_RDONLY : O_WRONLY);
+#if O_LARGEFILE
+            omode |= O_LARGEFILE;
+#endif
+            if( transfer.path=="/dev/null" || is_devzero(transfer.path) )
+                return mk_fd<devzeronull>(transfer.path, omode);
+
+            etdc_fdptr  fd( directIO ? mk_fd<etdc_file<FailureIsNotAnOption, DirectIO>>(transfer.path, omode) :
+                                       mk_fd<etdc_file<>>(transfer.path, omode) );
+            fd->lseek(fd->__m_fd, transfer.start + offset, SEEK_SET);
+            return fd;
+        }
+
+        // The transfer's share of the daemon's bandwidth, which all of its
+        // data connections draw from. The first connection that asks for it
+        // joins the scheduler on behalf of the host at its other end; the
+        // share goes when the last one is done with it. Empty if there are
+        // no limits
+        static bandwidth_share_ptr bw_share(etd_state& shared_state, transferprops_type& transfer, etdc_fd& conn) {
+            if( !shared_state.bandwidth.limited() )
+                return bandwidth_share_ptr();
+
+            std::lock_guard<std::mutex> lk( transfer.stripe_lock );
+            bandwidth_share_ptr         rv( transfer.bw_share.lock() );
+
+            if( !rv ) {
+                const priority_type prio( transfer.priority.load() );
+
+                rv = shared_state.bandwidth.join(untag(get_host(conn.getpeername(conn.__m_fd))),
+                                                 priority_weight(prio), static_cast<unsigned int>(prio));
+                transfer.bw_share = rv;
+            }
+            return rv;
+        }
+
+        // Remember which data channel the transfer uses now and count the
+        // connection's bytes under its name. The side that accepted the
+        // connection finds it in its own address, the side that connected
+        // in the peer's
+        static void note_channel(transferprops_type& transfer, etdc_fdptr conn, bool accepted) {
+            const sockname_type      sn( accepted ? conn->getsockname(conn->__m_fd) : conn->getpeername(conn->__m_fd) );
+            std::ostringstream       oss;
+
+            oss << get_protocol(sn) << "/" << bracket(get_host(sn)) << ":" << get_port(sn);
+            conn->__m_counters = std::make_shared<metrics::channel_counters>( oss.str() );
+
+            std::lock_guard<std::mutex> lk( transfer.stripe_lock );
+            transfer.channel    = oss.str();
+            transfer.channel_fd = conn;
+        }
+
+        // Whilst this lives, a thread of its own calls opts.onProgress
+        // every opts.progress seconds with the bytes done since it started
+        // and the rate over the last interval. It only looks at the meter
+        // so the data loops don't notice. Nothing happens if no reports
+        // were asked for.
+        class progress_reporter {
+            public:
+                progress_reporter(xfer_meter const& meter, xfer_options const& opts):
+                    __m_stop( false )
+                {
+                    if( opts.progress<=0 || !opts.onProgress )
+                        return;
+
+                    using clock_type = std::chrono::steady_clock;
+                    const uint64_t                          base( meter.nDone.load() );
+                    const std::chrono::duration<double>     interval( opts.progress );
+                    const xfer_options::progress_fn         report( opts.onProgress );
+
+                    __m_thread = etdc::thread([=, &meter]( void ) {
+                            clock_type::time_point       last( clock_type::now() );
+                            uint64_t                     lastDone( base );
+                            std::unique_lock<std::mutex> lk( __m_mutex );
+
+                            while( !__m_condition.wait_for(lk, interval, [this]( void ) { return __m_stop; }) ) {
+                                const clock_type::time_point now( clock_type::now() );
+                                const uint64_t               done( meter.nDone.load(std::memory_order_relaxed) );
+                                const double                 dt( std::chrono::duration<double>(now - last).count() );
+
+                                // Whoever is listening may have gone; the
+                                // transfer itself will find out soon enough
+                                try {
+                                    report((off_t)(done - base), dt>0 ? (double)(done - lastDone)/dt : 0.0);
+                                }
+                                catch( std::exception const& e ) {
+                                    ETDCDEBUG(2, "progress_reporter/failed to report - " << e.what() << std::endl);
+                                    break;
+                                }
+                                last     = now;
+                                lastDone = done;
+                            }
+                        });
+                }
+
+                ~progress_reporter() {
+                    if( !__m_thread.joinable() )
+                        return;
+                    {
+                        std::lock_guard<std::mutex> lk( __m_mutex );
+                        __m_stop = true;
+                        __m_condition.notify_all();
+                    }
+                    __m_thread.join();
+                }
+
+            private:
+                bool                    __m_stop;
+                std::mutex              __m_mutex;
+                std::condition_variable __m_condition;
+                std::thread             __m_thread;
+        };
+
+        // A stripe is 'size' bytes at 'offset' from the start of the transfer
+        struct stripe_type {
+            off_t   offset, size;
+        };
+        using stripelist_type = std::vector<stripe_type>;
+        using stripefn_type   = std::function<pipeline_result(stripe_type const&, etdc_fdptr)>;
+        using connectfn_type  = std::function<etdc_fdptr(void)>;
+
+        // With checksumming on, the sender of the bytes follows them with
+        // its CRC as eight hex digits. The recipient compares that to its
+        // own and in stead of the plain ACK answers 'y' if they match or
+        // 'n' if they don't.
+        static bool digest_ack(etdc_fd& conn, uint32_t crc, std::string& reason) {
+            char    ack, digest[9];
+
+            ::snprintf(digest, sizeof(digest), "%08x", crc);
+            if( conn.write(conn.__m_fd, digest, 8)!=8 ) {
+                reason = "failed to send checksum - " + std::string(etdc::strerror(errno));
+                return false;
+            }
+            if( conn.read(conn.__m_fd, &ack, 1)!=1 ) {
+                reason = "no ACK from recipient";
+                return false;
+            }
+            if( ack!='y' )
+                reason = "checksum mismatch - the recipient got different bytes than were sent";
+            return ack=='y';
+        }
+
+        // The recipient's side of that. Some of the sender's digest may
+        // already have been read, together with the data.
+        static bool check_digest(etdc_fd& conn, uint32_t crc, char const* pre = nullptr, size_t nPre = 0) {
+            char    ours[9], theirs[9];
+            size_t  n = std::min(nPre, (size_t)8);
+
+            ::memcpy(theirs, pre, n);
+            while( n<8 ) {
+                const ssize_t r = conn.read(conn.__m_fd, &theirs[n], 8 - n);
+                ETDCASSERT(r>0, "Failed to read checksum from remote end - " << (r==0 ? std::string("hung up") : std::string(etdc::strerror(errno))));
+                n += (size_t)r;
+            }
+            theirs[8] = '\0';
+            ::snprintf(ours, sizeof(ours), "%08x", crc);
+
+            const bool  match = (::strcmp(ours, theirs)==0);
+            const char  ack{ match ? 'y' : 'n' };
+
+            if( !match )
+                ETDCDEBUG(-1, "check_digest/checksum mismatch: sender " << theirs << " recipient " << ours << std::endl);
+            conn.write(conn.__m_fd, &ack, 1);
+            return match;
+        }
+
+        // The CRCs of the stripes or chunks of a transfer, by offset. Once
+        // they're all in they combine into the CRC of the whole.
+        class stripe_sums {
+            public:
+                void add(stripe_type const& stripe, uint32_t crc) {
+                    std::lock_guard<std::mutex> lk( __m_lock );
+                    __m_sums[ stripe.offset ] = std::make_pair(crc, stripe.size);
+                }
+
+                uint32_t value( void ) const {
+                    uint32_t                    rv{ 0 };
+                    std::lock_guard<std::mutex> lk( __m_lock );
+
+                    for(auto const& s: __m_sums)
+                        rv = crc32c::combine(rv, s.second.first, s.second.second);
+                    return rv;
+                }
+
+            private:
+                mutable std::mutex                          __m_lock;
+                std::map<off_t, std::pair<uint32_t, off_t>> __m_sums;
+        };
+
+        // Split 'todo' in at most nStreams stripes but don't make them
+        // smaller than minSz - a stripe smaller than a buffer isn't worth
+        // a connection. All stripes but the last are a multiple of the
+        // O_DIRECT alignment.
+        static stripelist_type mk_stripes(off_t todo, unsigned int nStreams, size_t minSz) {
+            const off_t     align( (off_t)direct_io_alignment );
+            const off_t     n = std::max((off_t)1, std::min((off_t)nStreams, todo/(off_t)std::max(minSz, (size_t)1)));
+            const off_t     sz = (((todo + n - 1)/n + align - 1)/align) * align;
+            stripelist_type rv;
+
+            for(off_t o=0; o<todo; o+=sz)
+                rv.push_back( stripe_type{o, std::min(sz, todo - o)} );
+            return rv;
+        }
+
+        // Data connections that are closed when the list goes, whichever
+        // way that happens. If a transfer is cancelled, or a connect
+        // fails, halfway through setting up its stripes the connections
+        // that were already made must not keep the other end waiting for
+        // a header.
+        struct connlist_type:
+            public std::vector<etdc_fdptr>
+        {
+            ~connlist_type() {
+                for(auto& conn: *this)
+                    if( conn )
+                        close_shared( *conn );
+            }
+        };
+
+        // Connect a data channel per stripe and execute fn(stripe, connection)
+        // for all of them in parallel. The connections are registered with
+        // the transfer for the duration such that cancel()/removeUUID() can
+        // make them fall out.
+        // Returns the sum of the results; the reason tells which stripe(s)
+        // had problems.
+        static pipeline_result run_stripes(transferprops_type& transfer, stripelist_type const& stripes,
+                                           connectfn_type const& connect, stripefn_type const& fn) {
+            pipeline_result              rv;
+            connlist_type                conns;
+            std::list<std::thread>       threads;
+            std::ostringstream           reasons;
+            std::vector<pipeline_result> results( stripes.size() );
+
+            for(size_t i=0; i<stripes.size(); i++) {
+                conns.push_back( connect() );
+                // Empty pointer means we were cancelled
+                if( !conns.back() ) {
+                    rv.srcOK = rv.dstOK = false;
+                    return rv;
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lk( transfer.stripe_lock );
+                transfer.stripe_fds.insert(transfer.stripe_fds.end(), conns.begin(), conns.end());
+            }
+            for(size_t i=0; i<stripes.size(); i++)
+                threads.emplace_back( etdc::thread([&, i]( void ) {
+                                try {
+                                    results[i] = fn(stripes[i], conns[i]);
+                                }
+                                catch( std::exception const& e ) {
+                                    results[i].dstOK  = false;
+                                    results[i].reason = e.what();
+                                }
+                                catch( ... ) {
+                                    results[i].dstOK  = false;
+                                    results[i].reason = "unknown exception";
+                                }
+                            }) );
+            for(auto& t: threads)
+                t.join();
+            {
+                std::lock_guard<std::mutex> lk( transfer.stripe_lock );
+                for(auto const& conn: conns)
+                    transfer.stripe_fds.remove( conn );
+            }
+
+            for(size_t i=0; i<stripes.size(); i++) {
+                rv.nDone += results[i].nDone;
+                rv.nWire += results[i].nWire;
+                rv.srcOK  = rv.srcOK && results[i].srcOK;
+                rv.dstOK  = rv.dstOK && results[i].dstOK;
+                if( !results[i].reason.empty() )
+                    reasons << (reasons.tellp()>0 ? "; " : "") << "stripe@" << stripes[i].offset << ": " << results[i].reason;
+            }
+            rv.reason = reasons.str();
+            return rv;
+        }
+
+        // Spread a transfer over several network paths (data addresses) at
+        // once, nPerPath connections each. The transfer is cut in chunks
+        // which the connections take from a shared queue as soon as they've
+        // finished the previous one, so each path carries a share
+        // proportional to the throughput it actually delivers.
+        // A path whose connection fails is given up on and its chunk goes
+        // back into the queue for the surviving paths. Only if the file
+        // side fails, or no path is left, the transfer fails. 'pull' tells
+        // wether the network is the source (getFile) or the destination
+        // (sendFile) of fn's copy, to tell those apart.
+        // Only chunks that made it completely count in the returned nDone.
+        using pathconnectfn_type = std::function<etdc_fdptr(sockname_type const&)>;
+
+        static pipeline_result run_multipath(transferprops_type& transfer, off_t todo, size_t chunkSz,
+                                             dataaddrlist_type const& dataAddrs, unsigned int nPerPath, bool pull,
+                                             pathconnectfn_type const& connect, stripefn_type const& fn,
+                                             cancelfn_type const& isCancelled) {
+            struct path_type {
+                sockname_type               addr;
+                connlist_type               conns;
+                std::atomic<off_t>          nDone, nWire;
+                std::atomic<bool>           failed;
+                std::string                 reason;
+
+                explicit path_type(sockname_type const& a): addr(a), nDone(0), nWire(0), failed(false) {}
+            };
+            pipeline_result                         rv;
+            std::mutex                              queueLock;
+            std::list<stripe_type>                  chunks;
+            std::vector<std::unique_ptr<path_type>> paths;
+            std::list<std::thread>                  threads;
+            std::string                             fatal;
+
+            for(off_t o=0; o<todo; o+=(off_t)chunkSz)
+                chunks.push_back( stripe_type{o, std::min((off_t)chunkSz, todo - o)} );
+
+            // Paths we can't connect to at all are just not used
+            for(auto const& addr: dataAddrs) {
+                std::unique_ptr<path_type> path( new path_type(addr) );
+
+                for(unsigned int i=0; i<nPerPath && !isCancelled(); i++) {
+                    try {
+                        etdc_fdptr  conn = connect( addr );
+                        if( conn )
+                            path->conns.push_back( conn );
+                    }
+                    catch( std::exception const& e ) {
+                        ETDCDEBUG(-1, "run_multipath/not using " << addr << " - " << e.what() << std::endl);
+                        break;
+                    }
+                }
+                if( !path->conns.empty() )
+                    paths.emplace_back( std::move(path) );
+            }
+            if( isCancelled() ) {
+                rv.srcOK = rv.dstOK = false;
+                return rv;
+            }
+            ETDCASSERT(!paths.empty(), "Failed to connect to any of the data servers");
+            ETDCDEBUG(2, "run_multipath/" << todo << " bytes in " << chunks.size() << " chunks over " << paths.size() << " path(s)" << std::endl);
+
+            {
+                std::lock_guard<std::mutex> lk( transfer.stripe_lock );
+                for(auto const& path: paths)
+                    transfer.stripe_fds.insert(transfer.stripe_fds.end(), path->conns.begin(), path->conns.end());
+            }
+
+            auto const start_tm = std::chrono::high_resolution_clock::now();
+            for(auto& path: paths) {
+                for(auto conn: path->conns) {
+                    path_type* p = path.get();
+                    threads.emplace_back( etdc::thread([&, p, conn]( void ) {
+                        while( !isCancelled() && !p->failed.load() ) {
+                            stripe_type     chunk;
+                            pipeline_result r;
+                            {
+                                std::lock_guard<std::mutex> lk( queueLock );
+                                if( chunks.empty() || !fatal.empty() )
+                                    return;
+                                chunk = chunks.front();
+                                chunks.pop_front();
+                            }
+                            try {
+                                r = fn(chunk, conn);
+                            }
+                            catch( std::exception const& e ) {
+                                (pull ? r.srcOK : r.dstOK) = false;
+                                r.reason = e.what();
+                            }
+                            catch( ... ) {
+                                (pull ? r.srcOK : r.dstOK) = false;
+                                r.reason = "unknown exception";
+                            }
+                            if( r.srcOK && r.dstOK && r.nDone==chunk.size ) {
+                                p->nDone += chunk.size;
+                                p->nWire += r.nWire;
+                                continue;
+                            }
+                            // Someone else will have to do this chunk
+                            std::lock_guard<std::mutex> lk( queueLock );
+                            chunks.push_front( chunk );
+                            if( isCancelled() )
+                                return;
+                            if( !(pull ? r.dstOK : r.srcOK) ) {
+                                fatal = r.reason;
+                                return;
+                            }
+                            if( !p->failed.exchange(true) ) {
+                                p->reason = r.reason;
+                                ETDCDEBUG(-1, "run_multipath/giving up on path " << p->addr << " - " << r.reason << std::endl);
+                            }
+                            return;
+                        }
+                    }) );
+                }
+            }
+            for(auto& t: threads)
+                t.join();
+
+            auto const         dt = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start_tm).count();
+            std::ostringstream reasons;
+            {
+                std::lock_guard<std::mutex> lk( transfer.stripe_lock );
+                for(auto const& path: paths)
+                    for(auto const& conn: path->conns)
+                        transfer.stripe_fds.remove( conn );
+            }
+            for(auto const& path: paths) {
+                rv.nDone += path->nDone.load();
+                rv.nWire += path->nWire.load();
+                ETDCDEBUG(2, "run_multipath/" << path->addr << ": " << path->nDone.load() << " bytes" <<
+                             (dt>0 ? " [" + sciprint(path->nDone.load()/dt, "Bps") + "]" : std::string()) <<
+                             (path->failed.load() ? " FAILED" : "") << std::endl);
+                if( path->failed.load() )
+                    reasons << (reasons.tellp()>0 ? "; " : "") << path->addr << ": " << path->reason;
+            }
+            if( !fatal.empty() ) {
+                (pull ? rv.dstOK : rv.srcOK) = false;
+                rv.reason = fatal;
+            } else if( rv.nDone<todo && !isCancelled() ) {
+                // Not fatal, but all paths died on us
+                (pull ? rv.srcOK : rv.dstOK) = false;
+                rv.reason = "all data paths failed: " + reasons.str();
+            } else
+                rv.reason = reasons.str();
+            return rv;
+        }
+
+        // Chunks are cut such that every connection gets a number of them
+        // - so there's something to balance - but not so small that the
+        // per-chunk header and ACK round trip start to matter. The lower
+        // limit does not scale with the buffer size: with the default
+        // 32MB buffers files of a few hundred MB would otherwise end up
+        // in one or two chunks on a single path. Chunks are multiples of
+        // the O_DIRECT alignment, like stripes
+        static size_t mk_chunksize(off_t todo, size_t nConn, size_t bufSz) {
+            const size_t align( direct_io_alignment );
+            const size_t minSz( 4*1024*1024 );
+            const size_t sz = std::min(std::max(256*bufSz, minSz), std::max(minSz, (size_t)todo/(16*std::max(nConn, (size_t)1))));
+            return ((sz + align - 1)/align) * align;
+        }
+
+        // The first data of the transfer starts moving, if it hadn't already
+        static void mark_started(transferprops_type& transfer) {
+            int64_t  notYet{ 0 };
+
+            transfer.started.compare_exchange_strong(notYet, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                                std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+
+        // Copy the data of a transfer between file and network, through
+        // the codec if there is one. 'toNetwork' says which of src and dst
+        // is the network. The progress goes into the transfer's meter.
+        static pipeline_result data_copy(etdc_fdptr src, etdc_fdptr dst, off_t todo, bool toNetwork, codec const* zip,
+                                         buffer_pool& pool, size_t nBuf, transferprops_type& transfer, cancelfn_type const& isCancelled,
+                                         io_advisor& advice, crc32c* checksum, char const* prefix = nullptr, size_t nPrefix = 0) {
+            // Higher priority transfers get their buffers first
+            const unsigned int rank( static_cast<unsigned int>(transfer.priority.load()) );
+            xfer_meter* const  meter( &transfer.meter );
+
+            mark_started(transfer);
+            if( zip==nullptr )
+                return pipelined_copy(src, dst, todo, pool, nBuf, isCancelled, (toNetwork ? &advice : nullptr), (toNetwork ? nullptr : &advice),
+                                      prefix, nPrefix, checksum, rank, meter);
+            if( toNetwork )
+                return compressed_copy(src, dst, todo, *zip, pool, nBuf, isCancelled, &advice, checksum, rank, meter);
+            return decompressed_copy(src, dst, todo, *zip, pool, nBuf, isCancelled, &advice, prefix, nPrefix, checksum, rank, meter);
+        }
+
+        // The destination's end of a delta transfer: rebuild the transfer's
+        // file in its tmpPath and if that checks out, put it in place
+        static delta_result delta_into(transferprops_type& transfer, etdc_fdptr conn, off_t todo, cancelfn_type const& isCancelled,
+                                       char const* pre = nullptr, size_t nPre = 0) {
+            // No existing file is fine, then everything is sent literally
+            int                                 basis = ::open(transfer.path.c_str(), O_RDONLY);
+            std::unique_ptr<int, void(*)(int*)> closer(&basis, [](int* pfd) { if( *pfd>=0 ) ::close(*pfd); });
+
+            ETDCSYSCALL(basis>=0 || errno==ENOENT, "delta: cannot open " << transfer.path << " - " << etdc::strerror(errno));
+            mark_started(transfer);
+            const delta_result rv = delta_receive(conn, basis, transfer.fd, todo, isCancelled, pre, nPre, &transfer.advice, &transfer.meter);
+
+            if( rv.match ) {
+                ETDCSYSCALL(::rename(transfer.tmpPath.c_str(), transfer.path.c_str())==0,
+                            "delta: failed to rename " << transfer.tmpPath << " to " << transfer.path << " - " << etdc::strerror(errno));
+                transfer.tmpPath.clear();
+            }
+            return rv;
+        }
+
+        // The source's end: the file is read through a descriptor of its
+        // own, not O_DIRECT for it is read in pieces of all sizes
+        static delta_result delta_from(transferprops_type& transfer, etdc_fdptr conn, off_t todo, cancelfn_type const& isCancelled,
+                                       size_t ioWindow, char const* pre = nullptr, size_t nPre = 0) {
+            etdc_fdptr  src( reopen(transfer, 0, false) );
+            io_advisor  advice(*src, io_advisor::direction_type::Read, ioWindow, transfer.path);
+
+            mark_started(transfer);
+            return delta_send(conn, src, todo, isCancelled, pre, nPre, &advice, &transfer.meter);
+        }
+
+        // If a stripe failed, the file may have a hole in it. Resuming
+        // goes by file size so we cut the file off at the first hole.
+        static void truncate_at_hole(transferprops_type& transfer) {
+            off_t                       end{ 0 };
+            struct stat                 st;
+            std::lock_guard<std::mutex> lk( transfer.stripe_lock );
+
+            if( transfer.stripe_done.empty() )
+                return;
+            for(auto const& sd: transfer.stripe_done) {
+                if( sd.first>end )
+                    break;
+                end = std::max(end, sd.first + sd.second);
+            }
+            if( ::stat(transfer.path.c_str(), &st)!=0 || !S_ISREG(st.st_mode) || st.st_size<=transfer.start + end )
+                return;
+            ETDCDEBUG(2, "truncate_at_hole/" << transfer.path << " has a hole @" << transfer.start + end << ", truncating" << std::endl);
+            if( ::truncate(transfer.path.c_str(), transfer.start + end)!=0 )
+                ETDCDEBUG(-1, "truncate_at_hole/failed to truncate " << transfer.path << " - " << etdc::strerror(errno) << std::endl);
+        }
+    }
+
+
     /////////////////////////////////////////////////////////////////////////////////////////
     //
     //     This is the real ETDServer.
@@ -120,7 +789,7 @@ namespace etdc {
         // The special majick file /dev/zero:[0-9]+([kMGT]i?B)? may be
         // specified which (1) is implemented as not a real file (so what ...)
         // and (2) does not get globbed for it is just one file
-        const bool              isDevZero( std::regex_match(path, etdc::rxDevZero) );
+        const bool              isDevZero( etdc::is_devzero(path) );
 
         if( isDevZero ) 
             return filelist_type{ path };
@@ -166,7 +835,8 @@ namespace etdc {
     //
     //////////////////////////////////////////////////////////////////////////////////////
     result_type ETDServer::requestFileWrite(std::string const& path, openmode_type mode) {
-        static const std::set<openmode_type> allowedModes{openmode_type::New, openmode_type::OverWrite, openmode_type::Resume, openmode_type::SkipExisting};
+        static const std::set<openmode_type> allowedModes{openmode_type::New, openmode_type::OverWrite, openmode_type::Resume, openmode_type::SkipExisting,
+                                                          openmode_type::Delta};
 
         // We must check-and-insert-if-ok into shared state.
         // This has to be atomic, so we'll grab the lock
@@ -200,8 +870,8 @@ namespace etdc {
         // Transform to int argument to open(2) + append some flag(s) if necessary/available
         int  omode = static_cast<int>(mode);
 
-        // Insider trick ... SkipExisting is bitwise complement of the real open flags
-        if( mode==openmode_type::SkipExisting )
+        // Insider trick ... SkipExisting and Delta are bitwise complement of the real open flags
+        if( mode==openmode_type::SkipExisting || mode==openmode_type::Delta )
             omode = ~omode;
 
 #if O_LARGEFILE
@@ -211,14 +881,31 @@ namespace etdc {
 
         // Note: etdc_file(...) c'tor will create the whole directory tree if necessary.
         //       Because it may/may not have to create, we add the file permission bits
+        //       If so configured, regular files bypass the page cache
+        using ThrowOnExist = detail::ThrowOnExistThatShouldNotExist;
+        using DontFail     = detail::FailureIsNotAnOption;
+        // A delta transfer builds the new version next to the existing
+        // one, which it must leave alone until then. Its bytes come in
+        // pieces of all sizes so no O_DIRECT. As the whole file will be
+        // rebuilt there is nothing we already have.
+        const bool        isDelta( mode==openmode_type::Delta );
+        const std::string tmpPath( isDelta ? nPath + ".etd-delta-" + __m_uuid : std::string() );
+        ETDCASSERT(!(isDelta && nPath=="/dev/null"), "requestFileWrite(" << path << ") - delta mode needs a real file");
+
+        const bool      directIO( shared_state.directIO );
         etdc_fdptr      fd( nPath=="/dev/null" ? mk_fd<devzeronull>(nPath, omode) :
-                            (mode==openmode_type::New ? mk_fd<etdc_file<detail::ThrowOnExistThatShouldNotExist>>(nPath, omode, 0644) :
-                                                        mk_fd<etdc_file<>>(nPath, omode, 0644)) );
+                            isDelta ? mk_fd<etdc_file<DontFail>>(tmpPath, omode, 0644) :
+                            mode==openmode_type::New ?
+                                (directIO ? mk_fd<etdc_file<ThrowOnExist, detail::DirectIO>>(nPath, omode, 0644) :
+                                            mk_fd<etdc_file<ThrowOnExist>>(nPath, omode, 0644)) :
+                                (directIO ? mk_fd<etdc_file<DontFail, detail::DirectIO>>(nPath, omode, 0644) :
+                                            mk_fd<etdc_file<DontFail>>(nPath, omode, 0644)) );
         const off_t     fsize{ fd->lseek(fd->__m_fd, 0, SEEK_END) };
         //const uuid_type uuid{ uuid_type::mk() };
 
-        ETDCASSERT(transfers.emplace(__m_uuid, std::unique_ptr<transferprops_type>(new etdc::transferprops_type(fd, nPath, mode))).second,
-                   "Failed to insert new entry, request file write '" << path << "'");
+        auto insres = transfers.emplace(__m_uuid, std::unique_ptr<transferprops_type>(new etdc::transferprops_type(fd, nPath, mode, fsize, shared_state.ioWindow)));
+        ETDCASSERT(insres.second, "Failed to insert new entry, request file write '" << path << "'");
+        insres.first->second->tmpPath = tmpPath;
         // and return the uuid + alreadyhave
         return result_type(__m_uuid, fsize);
     }
@@ -254,7 +941,9 @@ namespace etdc {
         // Note: etdc_file(...) c'tor will create the whole directory tree if necessary.
         // Because openmode is read, then we don't have to pass the file permissions; either it's there or it isn't
         //etdc_fdptr      fd( new etdc_file(nPath, omode) );
-        etdc_fdptr      fd( std::regex_match(nPath, etdc::rxDevZero) ? mk_fd<devzeronull>(nPath, omode) : mk_fd<etdc_file<>>(nPath, omode) );
+        etdc_fdptr      fd( is_devzero(nPath) ? mk_fd<devzeronull>(nPath, omode) :
+                            shared_state.directIO ? mk_fd<etdc_file<detail::FailureIsNotAnOption, detail::DirectIO>>(nPath, omode) :
+                                                    mk_fd<etdc_file<>>(nPath, omode) );
         const off_t     sz{ fd->lseek(fd->__m_fd, 0, SEEK_END) };
         //const uuid_type uuid{ uuid_type::mk() };
 
@@ -262,7 +951,7 @@ namespace etdc {
         ETDCASSERT(fd->lseek(fd->__m_fd, alreadyhave, SEEK_SET)!=static_cast<off_t>(-1),
                    "Cannot seek to position " << alreadyhave << " in file " << path << " - " << etdc::strerror(errno));
 
-        auto insres = transfers.emplace(__m_uuid, std::unique_ptr<transferprops_type>( new etdc::transferprops_type(fd, nPath, openmode_type::Read)));
+        auto insres = transfers.emplace(__m_uuid, std::unique_ptr<transferprops_type>( new etdc::transferprops_type(fd, nPath, openmode_type::Read, alreadyhave, shared_state.ioWindow)));
         ETDCASSERT(insres.second, "Failed to insert new entry, request file read '" << path << "'");
         return result_type(__m_uuid, sz-alreadyhave);
     }
@@ -301,9 +990,9 @@ namespace etdc {
             // If we're doing a transfer, make it fall out of the loop?
             // Note that the lock on the transfer itself is held during
             // the whole transfer
-            ptr->second->fd->close( ptr->second->fd->__m_fd );
+            etdc::close_shared( *ptr->second->fd );
             if( ptr->second->data_fd )
-                ptr->second->data_fd->close( ptr->second->data_fd->__m_fd );
+                etdc::close_shared( *ptr->second->data_fd );
 
             // Now we must do try_lock on the transfer - if that fails we sleep and start from the beginning
             std::unique_lock<std::mutex>     sh( ptr->second->xfer_lock, std::try_to_lock );
@@ -318,6 +1007,26 @@ namespace etdc {
             }
             // Right, we now hold both locks!
 
+            // But stripes served by data servers don't hold the transfer
+            // lock; make them fall out and wait for them to be gone
+            {
+                std::lock_guard<std::mutex>  slk( ptr->second->stripe_lock );
+                for(auto& sfd: ptr->second->stripe_fds)
+                    etdc::close_shared( *sfd );
+                ptr->second->stripe_fds.clear();
+                if( ptr->second->nStripe ) {
+                    ptr->second->cancelled.store( true );
+                    lk.unlock();
+                    sh.unlock();
+                    std::this_thread::sleep_for( std::chrono::microseconds(42) );
+                    continue;
+                }
+            }
+            detail::truncate_at_hole( *ptr->second );
+            // An unfinished delta transfer leaves the existing file as it was
+            if( !ptr->second->tmpPath.empty() && ::unlink(ptr->second->tmpPath.c_str())!=0 )
+                ETDCDEBUG(-1, "removeUUID/failed to remove " << ptr->second->tmpPath << " - " << etdc::strerror(errno) << std::endl);
+
             // We cannot erase the transfer immediately: we hold the lock that is contained in it
             // so what we do is transfer the lock out of the transfer and /then/ erase the entry.
             // And when we finally return, then the lock will be unlocked and the unique pointer
@@ -330,11 +1039,132 @@ namespace etdc {
             shared_state.transfers.erase( ptr );
             break;
         }
+        // Where the time went, if the transfer moved any data
+        const metrics::latency_summary  latency( removed->meter.latency );
+        if( !latency.empty() )
+            ETDCDEBUG(1, "removeUUID/" << removed->path << ": " << latency << std::endl);
         return true;
     }
 
+    // See etdc_etdserver.h
+    off_t verify_resume(etd_server_ptr src, uuid_type const& srcUUID, etd_server_ptr dst, uuid_type const& dstUUID,
+                        off_t have, off_t tail, unsigned int nSample) {
+        static const off_t   blockSz( 1024*1024 );
+        const off_t          tailStart( std::max(have - tail, (off_t)0) );
+        rangelist_type       ranges;
+
+        // Samples are whole blocks, strictly before the tail
+        for(unsigned int i=0; i<nSample && tailStart>=blockSz; i++) {
+            const off_t  pos( (((tailStart - blockSz) / nSample) * i / blockSz) * blockSz );
+            if( ranges.empty() || ranges.back().first!=pos )
+                ranges.emplace_back(pos, blockSz);
+        }
+        for(off_t pos=tailStart; pos<have; pos+=blockSz)
+            ranges.emplace_back(pos, std::min(blockSz, have - pos));
+        if( ranges.empty() )
+            return have;
+
+        const auto srcSums = src->checksumRanges(srcUUID, ranges);
+        const auto dstSums = dst->checksumRanges(dstUUID, ranges);
+
+        for(size_t i=0; i<ranges.size(); i++)
+            if( srcSums[i]!=dstSums[i] )
+                return ranges[i].first;
+        return have;
+    }
+
+    // Checksum byte ranges of the file behind our uuid. We read through
+    // a descriptor of our own such that the transfer's file position
+    // is left alone and ranges can be read whilst it is open for writing
+    checksumlist_type ETDServer::checksumRanges(uuid_type const& uuid, rangelist_type const& ranges) {
+        ETDCASSERT(uuid==__m_uuid, "Cannot checksum someone else's UUID!");
+
+        std::string      path;
+        etdc::etd_state& shared_state( __m_shared_state.get() );
+        {
+            std::lock_guard<std::mutex>      lk( shared_state.lock );
+            etdc::transfermap_type::iterator ptr = shared_state.transfers.find(__m_uuid);
+
+            ETDCASSERT(ptr!=shared_state.transfers.end(), "checksumRanges: this server was not initialized yet");
+            path = ptr->second->path;
+        }
+        struct stat  st;
+        ETDCSYSCALL(::stat(path.c_str(), &st)==0, "checksumRanges: cannot stat " << path << " - " << etdc::strerror(errno));
+        ETDCASSERT(S_ISREG(st.st_mode), "checksumRanges: " << path << " is not a regular file");
+
+        int  fd;
+        ETDCSYSCALL((fd=::open(path.c_str(), O_RDONLY))!=-1, "checksumRanges: cannot open " << path << " - " << etdc::strerror(errno));
+        std::unique_ptr<int, void(*)(int*)>  closer(&fd, [](int* pfd) { ::close(*pfd); });
+
+        // The ranges are small compared to the file, so sequential
+        // read-ahead won't buy us much; read them in modest chunks
+        const size_t             bufSz( 1024*1024 );
+        std::unique_ptr<char[]>  buf( new char[bufSz] );
+        checksumlist_type        rv;
+
+        for(auto const& range: ranges) {
+            crc32c  crc;
+            off_t   pos( range.first ), todo( range.second );
+
+            ETDCASSERT(pos>=0 && todo>=0, "checksumRanges: invalid range " << range.first << "+" << range.second);
+            // Past the end of the file there is nothing to checksum
+            while( todo>0 ) {
+                ssize_t  n;
+                ETDCSYSCALL((n=::pread(fd, &buf[0], (size_t)std::min(todo, (off_t)bufSz), pos))!=-1,
+                            "checksumRanges: failed to read " << path << " @" << pos << " - " << etdc::strerror(errno));
+                if( n==0 )
+                    break;
+                crc.update(&buf[0], (size_t)n);
+                pos  += n;
+                todo -= n;
+            }
+            rv.push_back( crc.value() );
+        }
+        return rv;
+    }
+
+    // Cut the destination file back to 'size' bytes such that the
+    // transfer restarts from there. Only allowed before any bytes have
+    // been written
+    void ETDServer::rollback(uuid_type const& uuid, off_t size) {
+        ETDCASSERT(uuid==__m_uuid, "Cannot roll back someone else's UUID!");
+
+        etdc::etd_state&                 shared_state( __m_shared_state.get() );
+        std::lock_guard<std::mutex>      lk( shared_state.lock );
+        etdc::transfermap_type::iterator ptr = shared_state.transfers.find(__m_uuid);
+
+        ETDCASSERT(ptr!=shared_state.transfers.end(), "rollback: this server was not initialized yet");
+
+        transferprops_type&          transfer( *ptr->second );
+        std::unique_lock<std::mutex> sh( transfer.xfer_lock, std::try_to_lock );
+
+        ETDCASSERT(sh.owns_lock(), "rollback: a transfer is in progress");
+        ETDCASSERT(transfer.openMode!=openmode_type::Read, "rollback: cannot roll back a file that is opened for reading");
+        ETDCASSERT(size>=0 && size<=transfer.start, "rollback: cannot roll " << transfer.path << " back to " << size <<
+                                                    " bytes, the transfer starts @" << transfer.start);
+        if( size==transfer.start )
+            return;
+        ETDCSYSCALL(::ftruncate(transfer.fd->__m_fd, size)==0, "rollback: failed to truncate " << transfer.path << " to " << size <<
+                                                               " bytes - " << etdc::strerror(errno));
+        transfer.fd->lseek(transfer.fd->__m_fd, size, SEEK_SET);
+        ETDCDEBUG(2, "rollback: " << transfer.path << " rolled back from " << transfer.start << " to " << size << " bytes" << std::endl);
+        transfer.start = size;
+    }
+
+    void ETDServer::setPriority(uuid_type const& uuid, priority_type prio) {
+        ETDCASSERT(uuid==__m_uuid, "Cannot set the priority of someone else's UUID!");
+
+        etdc::etd_state&                 shared_state( __m_shared_state.get() );
+        std::lock_guard<std::mutex>      lk( shared_state.lock );
+        etdc::transfermap_type::iterator ptr = shared_state.transfers.find(__m_uuid);
+
+        ETDCASSERT(ptr!=shared_state.transfers.end(), "setPriority: this server was not initialized yet");
+        ptr->second->priority = prio;
+        ETDCDEBUG(2, "setPriority: " << ptr->second->path << " is now " << prio << std::endl);
+    }
+
     xfer_result ETDServer::sendFile(uuid_type const& srcUUID, uuid_type const& dstUUID, 
-                             off_t todo, dataaddrlist_type const& dataAddrs) {
+                             off_t todo, dataaddrlist_type const& dataAddrs, xfer_options const& opts) {
         // 1a. Verify that the srcUUID is our UUID
         ETDCASSERT(srcUUID==__m_uuid, "The srcUUID '" << srcUUID << "' is not our UUID");
 
@@ -373,9 +1203,12 @@ namespace etdc {
             // Copy relevant values from shared state to here whilst we
             // still have the lock
             const size_t            bufSz{ shared_state.bufSize };
+            const size_t            nBuf{ shared_state.nBuffer };
+            buffer_pool&            pool( shared_state.pool );
             const etdc::mss_type    ourMSS{ shared_state.udtMSS };
             const etdc::max_bw_type ourBW{ shared_state.udtMaxBW };
-            std::ostringstream      tried;
+            const bool              directIO{ shared_state.directIO };
+            const size_t            ioWindow{ shared_state.ioWindow };
             // At this point we don't need the shared_state lock anymore - we've found our entry and we've locked it
             // So no-one can remove the entry from under us until we're done
             lk.unlock();
@@ -387,123 +1220,147 @@ namespace etdc {
             // Verify that indeed we are configured for file read
             ETDCASSERT(transfer.openMode==openmode_type::Read, "This server was initialized, but not for reading a file");
 
-            // Great. Now we attempt to connect to the remote end
-
-            for(auto addr: dataAddrs) {
-                if( (cancelled = isCancelled()) ) 
+            // string2options() already verified that we know the codec
+            codec const* const          zip( opts.compress.empty() ? nullptr : find_codec(opts.compress) );
+            const std::string           zipKey( zip ? ", zip:" + zip->name() : std::string() );
+
+            transfer.total = (uint64_t)todo;
+            detail::progress_reporter   progress(transfer.meter, opts);
+
+            // Great. Now we attempt to connect to the remote end.
+            // If the client asked for it - and there is enough to split -
+            // the file goes over multiple data connections in parallel.
+            // Each stripe (or chunk, see below) goes over its own data
+            // connection, from its own file descriptor
+            detail::stripe_sums sums;
+            auto const sendStripe = [&](detail::stripe_type const& stripe, etdc_fdptr conn) {
+                            etdc_fdptr          fd( detail::reopen(transfer, stripe.offset, directIO) );
+                            io_advisor          advice(*fd, io_advisor::direction_type::Read, ioWindow, transfer.path);
+                            throttled_fd        limit(conn, detail::bw_share(shared_state, transfer, *conn), isCancelled);
+                            detail::note_channel(transfer, conn, false);
+                            crc32c              crc;
+                            std::ostringstream  msg_buf;
+
+                            msg_buf << "{ uuid:" << dstUUID << ", sz:" << stripe.size << ", offset:" << stripe.offset
+                                    << (opts.checksum ? ", sum:" + crc32c::name : std::string()) << zipKey << "}";
+                            const std::string     msg( msg_buf.str() );
+                            conn->write(conn->__m_fd, msg.data(), msg.size());
+
+                            pipeline_result r = detail::data_copy(fd, conn, stripe.size, true, zip, pool, nBuf, transfer, isCancelled, advice,
+                                                                  (opts.checksum ? &crc : nullptr));
+                            // Wait for the recipient to have flushed (and verified) it all
+                            if( r.dstOK && !isCancelled() ) {
+                                char    ack;
+                                if( opts.checksum && r.srcOK && r.nDone==stripe.size ) {
+                                    if( (r.dstOK = detail::digest_ack(*conn, crc.value(), r.reason)) )
+                                        sums.add(stripe, crc.value());
+                                } else if( conn->read(conn->__m_fd, &ack, 1)!=1 ) {
+                                    r.dstOK  = false;
+                                    r.reason = "no ACK from recipient";
+                                }
+                            }
+                            return r;
+                        };
+            // Only a complete transfer has a digest
+            auto const digest = [&](off_t left) {
+                            return (opts.checksum && left==0) ? crc32c_digest(sums.value()) : std::string();
+                        };
+
+            // Delta transfers go over one data connection
+            if( opts.delta ) {
+                transfer.data_fd = detail::connect_data_channel(dataAddrs, bufSz, ourMSS, ourBW, isCancelled, "sendFile");
+                if( (cancelled = isCancelled()) )
                     break;
-                try {
-                    // This is 'sendFile' so our data channel will have to
-                    // have a big send buffer
-                    const auto    proto = get_protocol(addr);
-                    auto          clnt  = etdc::detail::client_defaults.find( untag(proto) )->second();
+                throttled_fd        limit(transfer.data_fd, detail::bw_share(shared_state, transfer, *transfer.data_fd), isCancelled);
+                detail::note_channel(transfer, transfer.data_fd, false);
 
-                    // Merge our settings with the default client settings
-                    etdc::detail::update_clnt( clnt, get_host(addr), get_port(addr),
-                                                     etdc::udt_rcvbuf{bufSz}, etdc::udt_sndbuf{bufSz},
-                                                     etdc::so_rcvbuf{bufSz}, etdc::so_sndbuf{bufSz},
-                                                     isCancelled );
-                    // decide on which mss to use
-                    // If set to 0 (default) do not change
-                    using key_type    = std::pair<bool, bool>;
-                    using mssmap_type = std::map<key_type, std::function<etdc::udt_mss(int, int)>>;
-                    static const mssmap_type mss_map{
-                        // If both sides have an MSS setting, use the minimum
-                        {key_type{true, true},   [](int o, int t) { return etdc::udt_mss{ std::min(o, t)}; }},
-                        // either have one set? use that one
-                        {key_type{true, false},  [](int o, int  ) { return etdc::udt_mss{ o }; }},
-                        {key_type{false, true},  [](int  , int t) { return etdc::udt_mss{ t }; }},
-                        // neither have set it, don't set it here either
-                        {key_type{false, false}, [](int  , int  ) { return etdc::udt_mss{ 0 }; }}
-                    };
+                std::ostringstream  msg_buf;
+                msg_buf << "{ uuid:" << dstUUID << ", sz:" << todo << ", delta:1}";
 
-                    auto       oMSS{ untag(ourMSS) };
-                    auto       tMSS{ untag(get_mss(addr)) };
-                    const auto mss_to_use = mss_map.find( key_type{oMSS>0, tMSS>0} )->second(oMSS, tMSS);
+                const std::string   msg( msg_buf.str() );
+                auto const          start_tm = std::chrono::high_resolution_clock::now();
+                delta_result        result;
+                std::string         reason;
 
-                    ETDCDEBUG(4, "ETDServer::sendFile/use MSS=" << untag(mss_to_use) << " [ours=" << oMSS << ", "
-                                                                << get_host(addr) << "=" << tMSS << "]" << std::endl);
-                    if( untag(mss_to_use) ) 
-                        etdc::detail::update_clnt( clnt, mss_to_use );
-
-                    // same applies to bandwidth constraints?
-                    auto     oBW{ untag(ourBW) };
-                    auto     tBW{ untag(get_max_bw(addr)) };
-
-                    // If either side has a bw restriction we adapt to that
-                    using maxbwmap_type = std::map<key_type, std::function<etdc::udt_max_bw(int64_t, int64_t)>>;
-                    static const maxbwmap_type maxbw_map{
-                        // both restricted - return minimum
-                        {key_type{true, true},   [](int64_t o, int64_t t) { return etdc::udt_max_bw{ std::min(o, t)}; }},
-                        {key_type{true, false},  [](int64_t o, int64_t  ) { return etdc::udt_max_bw{ o }; }},
-                        {key_type{false, true},  [](int64_t  , int64_t t) { return etdc::udt_max_bw{ t }; }},
-                        {key_type{false, false}, [](int64_t  , int64_t  ) { return etdc::udt_max_bw{ -1 }; }}
-                    };
-
-                    const auto maxbw = maxbw_map.find( key_type{oBW>0, tBW>0} )->second(oBW, tBW);
-
-                    ETDCDEBUG(4, "ETDServer::sendFile/use MaxBW=" << untag(maxbw) << " [ours=" << oBW << ", "
-                                                                << get_host(addr) << "=" << tBW << "]" << std::endl);
-                        
-                    etdc::detail::update_clnt( clnt, maxbw );
-
-                    transfer.data_fd = mk_client( get_protocol(addr), clnt );
-                    ETDCDEBUG(2, "sendFile/connected to " << addr << std::endl);
-                    break;
+                transfer.data_fd->write(transfer.data_fd->__m_fd, msg.data(), msg.size());
+                try {
+                    result = detail::delta_from(transfer, transfer.data_fd, todo, isCancelled, ioWindow);
+                    if( !result.match )
+                        reason = "checksum mismatch - the destination did not end up with the same file";
                 }
                 catch( std::exception const& e ) {
-                    tried << addr << ": " << e.what() << ", ";
-                }
-                catch( ... ) {
-                    tried << addr << ": unknown exception" << ", ";
+                    reason = e.what();
                 }
+                auto const          end_tm = std::chrono::high_resolution_clock::now();
+
+                cancelled = isCancelled();
+                return cancelled ? xfer_result(false, 0, "Cancelled", xfer_result::duration_type()) :
+                                   xfer_result(result.match, result.match ? nTodo : 0, reason, (end_tm-start_tm),
+                                               (opts.checksum && result.match) ? crc32c_digest(result.crc) : std::string(),
+                                               result.nLiteral, metrics::latency_summary(transfer.meter.latency));
             }
+
+            // Several network paths to the destination and the client
+            // wants them all used at the same time?
+            if( opts.multiPath && dataAddrs.size()>1 ) {
+                const size_t          chunkSz  = detail::mk_chunksize(todo, dataAddrs.size() * opts.nStreams, bufSz);
+                auto const            start_tm = std::chrono::high_resolution_clock::now();
+                const pipeline_result result   = detail::run_multipath(transfer, todo, chunkSz, dataAddrs, opts.nStreams, false,
+                        [&](sockname_type const& addr) {
+                            return detail::connect_data_channel(dataaddrlist_type{addr}, bufSz, ourMSS, ourBW, isCancelled, "sendFile");
+                        }, sendStripe, isCancelled);
+                auto const            end_tm = std::chrono::high_resolution_clock::now();
+
+                todo     -= result.nDone;
+                cancelled = isCancelled();
+                return cancelled ? xfer_result(false, 0, "Cancelled", xfer_result::duration_type()) :
+                                   xfer_result((todo==0), nTodo - todo, result.reason, (end_tm-start_tm), digest(todo), result.nWire,
+                                               metrics::latency_summary(transfer.meter.latency));
+            }
+
+            const detail::stripelist_type stripes( detail::mk_stripes(todo, opts.nStreams, bufSz) );
+
+            if( stripes.size()>1 ) {
+                ETDCDEBUG(4, "ETDServer::sendFile/sending " << todo << " bytes in " << stripes.size() << " stripes" << std::endl);
+                auto const            start_tm = std::chrono::high_resolution_clock::now();
+                const pipeline_result result   = detail::run_stripes(transfer, stripes,
+                        [&]( void ) { return detail::connect_data_channel(dataAddrs, bufSz, ourMSS, ourBW, isCancelled, "sendFile"); },
+                        sendStripe);
+                auto const            end_tm = std::chrono::high_resolution_clock::now();
+
+                todo     -= result.nDone;
+                cancelled = isCancelled();
+                return cancelled ? xfer_result(false, 0, "Cancelled", xfer_result::duration_type()) :
+                                   xfer_result((todo==0), nTodo - todo, result.reason, (end_tm-start_tm), digest(todo), result.nWire,
+                                               metrics::latency_summary(transfer.meter.latency));
+            }
+
+            transfer.data_fd = detail::connect_data_channel(dataAddrs, bufSz, ourMSS, ourBW, isCancelled, "sendFile");
             if( (cancelled = isCancelled()) ) 
                 break;
-
-            ETDCASSERT(transfer.data_fd, "Failed to connect to any of the data servers: " << tried.str());
+            throttled_fd        limit(transfer.data_fd, detail::bw_share(shared_state, transfer, *transfer.data_fd), isCancelled);
+            detail::note_channel(transfer, transfer.data_fd, false);
 
             // Weehee! we're connected!
-            // Need buffer and record the data channel
-            std::unique_ptr<unsigned char[]> buffer(new unsigned char[bufSz]);
-
             // Create message header
             std::ostringstream  msg_buf;
-            msg_buf << "{ uuid:" << dstUUID << ", sz:" << todo << "}";
+            msg_buf << "{ uuid:" << dstUUID << ", sz:" << todo
+                    << (opts.checksum ? ", sum:" + crc32c::name : std::string()) << zipKey << "}";
 
-            bool                remoteOK{ true };
-            std::string         reason;
             const std::string   msg( msg_buf.str() );
             auto const          start_tm = std::chrono::high_resolution_clock::now();
             transfer.data_fd->write(transfer.data_fd->__m_fd, msg.data(), msg.size());
 
-            while( todo>0 && !(cancelled = isCancelled()) ) {
-                size_t const  n = std::min((size_t)todo, bufSz);
-                ssize_t       nWritten{0};
-                const ssize_t nRead = transfer.fd->read(transfer.fd->__m_fd, &buffer[0], n);
-
-                if( nRead<=0 ) {
-                    reason = ((nRead==-1) ? std::string(etdc::strerror(errno)) : std::string("read() returned 0 - hung up"));
-                    break;
-                }
-
-                // Keep on writing untill all bytes that were read are actually written
-                while( nWritten<nRead && !shared_state.cancelled.load() ) {
-                    ssize_t const thisWrite = transfer.data_fd->write(transfer.data_fd->__m_fd, &buffer[nWritten], nRead-nWritten);
+            // Reading from disk happens in a separate thread such that it
+            // overlaps with sending the previous block over the network
+            crc32c                crc;
+            const pipeline_result result = detail::data_copy(transfer.fd, transfer.data_fd, todo, true, zip, pool, nBuf, transfer, isCancelled,
+                                                             transfer.advice, (opts.checksum ? &crc : nullptr));
+            const bool            remoteOK( result.dstOK );
+            std::string           reason( result.reason );
 
-                    if( thisWrite<=0 ) {
-                        reason   = ((thisWrite==-1) ? std::string(etdc::strerror(errno)) : std::string("write should never have returned 0"));
-                        remoteOK = false;
-                        break;
-                    }
-                    nWritten += thisWrite;
-                }
-                if( nWritten<nRead )
-                    break;
-                todo -= (off_t)nWritten;
-                if( (cancelled = isCancelled()) )
-                    break;
-            }
+            todo     -= result.nDone;
+            cancelled = isCancelled();
             // if we make it out of the loop, todo should be <= 0 and terminate the outer loop
             // wait here until the recipient has acknowledged receipt of all bytes
             // But that only makes sense if the destination is still alive!
@@ -512,18 +1369,26 @@ namespace etdc {
                 char    ack;
 
                 ETDCDEBUG(4, "sendFile: waiting for remote ACK ..." << std::endl);
-                transfer.data_fd->read(transfer.data_fd->__m_fd, &ack, 1);
+                if( opts.checksum && todo==0 ) {
+                    // Bytes that arrived different are as good as not sent
+                    if( detail::digest_ack(*transfer.data_fd, crc.value(), reason) )
+                        sums.add(detail::stripe_type{0, nTodo}, crc.value());
+                    else
+                        todo = nTodo;
+                } else
+                    transfer.data_fd->read(transfer.data_fd->__m_fd, &ack, 1);
                 ETDCDEBUG(4, "sendFile: ... got it" << std::endl);
             }
             auto const          end_tm = std::chrono::high_resolution_clock::now();
             return cancelled ? xfer_result(false, 0, "Cancelled", xfer_result::duration_type()) :
-                               xfer_result((todo==0), nTodo - todo, reason, (end_tm-start_tm));
+                               xfer_result((todo==0), nTodo - todo, reason, (end_tm-start_tm), digest(todo), result.nWire,
+                                           metrics::latency_summary(transfer.meter.latency));
         }
         return xfer_result(false, 0, (cancelled  ? "Cancelled" : "Failed to get both locks"), xfer_result::duration_type());
     }
 
     xfer_result ETDServer::getFile(uuid_type const& srcUUID, uuid_type const& dstUUID, 
-                            off_t todo, dataaddrlist_type const& dataAddrs) {
+                            off_t todo, dataaddrlist_type const& dataAddrs, xfer_options const& opts) {
         // 1a. Verify that the dstUUID is our UUID
         ETDCASSERT(dstUUID==__m_uuid, "The dstUUID '" << dstUUID << "' is not our UUID");
 
@@ -547,165 +1412,217 @@ namespace etdc {
                 break;
             
             // Now we must do try_lock on the transfer - if that fails we sleep and start from the beginning
-            std::unique_lock<std::mutex>     sh( ptr->second->xfer_lock, std::try_to_lock );
-            if( !sh ) {
-                // Manually unlock the shared state or else nobody won't be
-                // able to change anything!
-                lk.unlock();
-
-                // *now* we sleep for a bit and then try again
-                std::this_thread::sleep_for( std::chrono::microseconds(23) );
-                continue;
-            }
-            // Right, we now hold both locks!
-            have_both_locks = true;
-
-            // At this point we don't need the shared_state lock anymore - we've found our entry and we've locked it
-            // So no-one can remove the entry from under us until we're done
-            lk.unlock();
-
-            // Verify that indeed we are configured for file write
-            // Note that we do NOT include 'skip existing' in here - the
-            // point is that we don't want to write to such a file!
-            transferprops_type&                        transfer( *ptr->second );
-            etdc::detail::cancelfn_type                isCancelled{ [&]( void ) { return shared_state.cancelled.load() || transfer.cancelled.load(); } };
-            static const std::set<etdc::openmode_type> allowedWriteModes{ openmode_type::OverWrite, openmode_type::New, openmode_type::Resume };
-
-            ETDCASSERT(allowedWriteModes.find(transfer.openMode)!=allowedWriteModes.end(),
-                       "This server was initialized, but not for writing to file");
-
-            // Great. Now we attempt to connect to the remote end
-            const size_t            bufSz( shared_state.bufSize );
-            const etdc::mss_type    ourMSS{ shared_state.udtMSS };
-            const etdc::max_bw_type ourBW{ shared_state.udtMaxBW };
-            std::ostringstream      tried;
-
-            for(auto addr: dataAddrs) {
-                if( (cancelled = isCancelled()) )
-                    break;
-                try {
-                    // This is 'getFile' so our data channel will have to
-                    // have a big read buffer
-                    const auto    proto = get_protocol(addr);
-                    auto          clnt  = etdc::detail::client_defaults.find( untag(proto) )->second();
-
-                    // Update client defaults with ours
-                    etdc::detail::update_clnt( clnt, get_host(addr), get_port(addr), 
-                                                     etdc::udt_rcvbuf{bufSz}, etdc::udt_sndbuf{bufSz},
-                                                     etdc::so_rcvbuf{bufSz}, etdc::so_sndbuf{bufSz},
-                                                     isCancelled );
-
-                    // decide on which mss to use
-                    // If set to 0 (default) do not change
-                    using key_type    = std::pair<bool, bool>;
-                    using mssmap_type = std::map<key_type, std::function<etdc::udt_mss(int, int)>>;
-                    static const mssmap_type mss_map{
-                        // If both sides have an MSS setting, use the minimum
-                        {key_type{true, true},   [](int o, int t) { return etdc::udt_mss{ std::min(o, t)}; }},
-                        // either have one set? use that one
-                        {key_type{true, false},  [](int o, int  ) { return etdc::udt_mss{ o }; }},
-                        {key_type{false, true},  [](int  , int t) { return etdc::udt_mss{ t }; }},
-                        // neither have set it, don't set it here either
-                        {key_type{false, false}, [](int  , int  ) { return etdc::udt_mss{ 0 }; }}
-                    };
+            std::unique_lock<std::mutex>     sh( ptr->second->xfer_lock, std::try_to_lock );
+            if( !sh ) {
+                // Manually unlock the shared state or else nobody won't be
+                // able to change anything!
+                lk.unlock();
 
-                    auto       oMSS{ untag(ourMSS) };
-                    auto       tMSS{ untag(get_mss(addr)) };
-                    const auto mss_to_use = mss_map.find( key_type{oMSS>0, tMSS>0} )->second(oMSS, tMSS);
+                // *now* we sleep for a bit and then try again
+                std::this_thread::sleep_for( std::chrono::microseconds(23) );
+                continue;
+            }
+            // Right, we now hold both locks!
+            have_both_locks = true;
 
-                    ETDCDEBUG(4, "ETDServer::getFile/use MSS=" << untag(mss_to_use) << " [ours=" << oMSS << ", "
-                                                               << get_host(addr) << "=" << tMSS << "]" << std::endl);
-                    if( untag(mss_to_use) ) 
-                        etdc::detail::update_clnt( clnt, mss_to_use );
+            // At this point we don't need the shared_state lock anymore - we've found our entry and we've locked it
+            // So no-one can remove the entry from under us until we're done
+            lk.unlock();
 
-                    // same applies to bandwidth constraints?
-                    auto     oBW{ untag(ourBW) };
-                    auto     tBW{ untag(get_max_bw(addr)) };
+            // Verify that indeed we are configured for file write
+            // Note that we do NOT include 'skip existing' in here - the
+            // point is that we don't want to write to such a file!
+            transferprops_type&                        transfer( *ptr->second );
+            etdc::detail::cancelfn_type                isCancelled{ [&]( void ) { return shared_state.cancelled.load() || transfer.cancelled.load(); } };
+            static const std::set<etdc::openmode_type> allowedWriteModes{ openmode_type::OverWrite, openmode_type::New, openmode_type::Resume,
+                                                                          openmode_type::Delta };
 
-                    // If either side has a bw restriction we adapt to that
-                    using maxbwmap_type = std::map<key_type, std::function<etdc::udt_max_bw(int64_t, int64_t)>>;
-                    static const maxbwmap_type maxbw_map{
-                        // both restricted - return minimum
-                        {key_type{true, true},   [](int64_t o, int64_t t) { return etdc::udt_max_bw{ std::min(o, t)}; }},
-                        {key_type{true, false},  [](int64_t o, int64_t  ) { return etdc::udt_max_bw{ o }; }},
-                        {key_type{false, true},  [](int64_t  , int64_t t) { return etdc::udt_max_bw{ t }; }},
-                        {key_type{false, false}, [](int64_t  , int64_t  ) { return etdc::udt_max_bw{ -1 }; }}
-                    };
+            ETDCASSERT(allowedWriteModes.find(transfer.openMode)!=allowedWriteModes.end(),
+                       "This server was initialized, but not for writing to file");
 
-                    const auto maxbw = maxbw_map.find( key_type{oBW>0, tBW>0} )->second(oBW, tBW);
+            // If the disk can't hold what's coming we'd better know now
+            // rather than after having transferred 97% of it
+            transfer.advice.preallocate( todo );
 
-                    ETDCDEBUG(4, "ETDServer::getFile/use MaxBW=" << untag(maxbw) << " [ours=" << oBW << ", "
-                                                                 << get_host(addr) << "=" << tBW << "]" << std::endl);
+            // Great. Now we attempt to connect to the remote end
+            const size_t            bufSz( shared_state.bufSize );
+            const size_t            nBuf( shared_state.nBuffer );
+            buffer_pool&            pool( shared_state.pool );
+            const etdc::mss_type    ourMSS{ shared_state.udtMSS };
+            const etdc::max_bw_type ourBW{ shared_state.udtMaxBW };
+            const bool              directIO( shared_state.directIO );
+            const size_t            ioWindow( shared_state.ioWindow );
+            codec const* const      zip( opts.compress.empty() ? nullptr : find_codec(opts.compress) );
+            const std::string       zipKey( zip ? ", zip:" + zip->name() : std::string() );
+
+            transfer.total = (uint64_t)todo;
+            detail::progress_reporter   progress(transfer.meter, opts);
+
+            // A delta transfer needs the source's cooperation over a
+            // single data connection
+            if( transfer.openMode==openmode_type::Delta ) {
+                transfer.data_fd = detail::connect_data_channel(dataAddrs, bufSz, ourMSS, ourBW, isCancelled, "getFile");
+                if( (cancelled = isCancelled()) )
+                    break;
+                throttled_fd        limit(transfer.data_fd, detail::bw_share(shared_state, transfer, *transfer.data_fd), isCancelled);
+                detail::note_channel(transfer, transfer.data_fd, false);
 
-                    etdc::detail::update_clnt( clnt, maxbw );
+                std::ostringstream  msg_buf;
+                msg_buf << "{ uuid:" << srcUUID << ", push:1, sz:" << todo << ", delta:1}";
 
+                std::string const   msg( msg_buf.str() );
+                auto const          start_tm = std::chrono::high_resolution_clock::now();
+                delta_result        result;
+                std::string         reason;
 
-                    transfer.data_fd = mk_client( get_protocol(addr), clnt );
-                    ETDCDEBUG(2, "getFile/connected to " << addr << std::endl);
-                    break;
+                transfer.data_fd->write(transfer.data_fd->__m_fd, msg.data(), msg.size());
+                try {
+                    result = detail::delta_into(transfer, transfer.data_fd, todo, isCancelled);
+                    if( !result.match )
+                        reason = "checksum mismatch - did not end up with the same file as the source";
                 }
                 catch( std::exception const& e ) {
-                    tried << addr << ": " << e.what() << ", ";
-                }
-                catch( ... ) {
-                    tried << addr << ": unknown exception" << ", ";
+                    reason = std::string("getFile/problem: ") + e.what();
                 }
+                auto const          end_tm = std::chrono::high_resolution_clock::now();
+
+                cancelled = isCancelled();
+                return cancelled ? xfer_result(false, 0, "Cancelled", xfer_result::duration_type()) :
+                                   xfer_result(result.match, result.match ? nTodo : 0, reason, (end_tm-start_tm),
+                                               (opts.checksum && result.match) ? crc32c_digest(result.crc) : std::string(),
+                                               result.nLiteral, metrics::latency_summary(transfer.meter.latency));
+            }
+
+            // Split over multiple data connections if asked for. The
+            // stripes (or chunks) write into the space we've just reserved
+            detail::stripe_sums sums;
+            auto const recvStripe = [&](detail::stripe_type const& stripe, etdc_fdptr conn) {
+                            etdc_fdptr          fd( detail::reopen(transfer, stripe.offset, directIO) );
+                            io_advisor          advice(*fd, io_advisor::direction_type::Write, ioWindow, transfer.path);
+                            throttled_fd        limit(conn, detail::bw_share(shared_state, transfer, *conn), isCancelled);
+                            detail::note_channel(transfer, conn, false);
+                            crc32c              crc;
+                            std::ostringstream  msg_buf;
+
+                            msg_buf << "{ uuid:" << srcUUID << ", push:1, sz:" << stripe.size << ", offset:" << stripe.offset
+                                    << (opts.checksum ? ", sum:" + crc32c::name : std::string()) << zipKey << "}";
+                            const std::string     msg( msg_buf.str() );
+                            conn->write(conn->__m_fd, msg.data(), msg.size());
+
+                            pipeline_result r = detail::data_copy(conn, fd, stripe.size, false, zip, pool, nBuf, transfer, isCancelled, advice,
+                                                                  (opts.checksum ? &crc : nullptr));
+                            if( r.dstOK && !isCancelled() ) {
+                                const char ack{ 'y' };
+                                if( opts.checksum && r.srcOK && r.nDone==stripe.size ) {
+                                    // Bytes that arrived different are as good as not received
+                                    if( detail::check_digest(*conn, crc.value()) )
+                                        sums.add(stripe, crc.value());
+                                    else {
+                                        r.nDone  = 0;
+                                        r.srcOK  = false;
+                                        r.reason = "checksum mismatch - got different bytes than were sent";
+                                    }
+                                } else
+                                    conn->write(conn->__m_fd, &ack, 1);
+                            }
+                            {
+                                std::lock_guard<std::mutex> slk( transfer.stripe_lock );
+                                transfer.stripe_done[ stripe.offset ] = r.nDone;
+                            }
+                            return r;
+                        };
+            // Only a complete transfer has a digest
+            auto const digest = [&](off_t left) {
+                            return (opts.checksum && left==0) ? crc32c_digest(sums.value()) : std::string();
+                        };
+
+            // Pull over all network paths to the source at once?
+            if( opts.multiPath && dataAddrs.size()>1 ) {
+                const size_t          chunkSz  = detail::mk_chunksize(todo, dataAddrs.size() * opts.nStreams, bufSz);
+                auto const            start_tm = std::chrono::high_resolution_clock::now();
+                const pipeline_result result   = detail::run_multipath(transfer, todo, chunkSz, dataAddrs, opts.nStreams, true,
+                        [&](sockname_type const& addr) {
+                            return detail::connect_data_channel(dataaddrlist_type{addr}, bufSz, ourMSS, ourBW, isCancelled, "getFile");
+                        }, recvStripe, isCancelled);
+                auto const            end_tm = std::chrono::high_resolution_clock::now();
+                const std::string     reason( result.srcOK ? result.reason : std::string("getFile/problem: ") + result.reason );
+
+                todo     -= result.nDone;
+                cancelled = isCancelled();
+                return cancelled ? xfer_result(false, 0, "Cancelled", xfer_result::duration_type()) :
+                                   xfer_result((todo==0), nTodo - todo, reason, (end_tm-start_tm), digest(todo), result.nWire,
+                                               metrics::latency_summary(transfer.meter.latency));
+            }
+
+            const detail::stripelist_type stripes( detail::mk_stripes(todo, opts.nStreams, bufSz) );
+
+            if( stripes.size()>1 ) {
+                ETDCDEBUG(4, "ETDServer::getFile/receiving " << todo << " bytes in " << stripes.size() << " stripes" << std::endl);
+                auto const            start_tm = std::chrono::high_resolution_clock::now();
+                const pipeline_result result   = detail::run_stripes(transfer, stripes,
+                        [&]( void ) { return detail::connect_data_channel(dataAddrs, bufSz, ourMSS, ourBW, isCancelled, "getFile"); },
+                        recvStripe);
+                auto const            end_tm = std::chrono::high_resolution_clock::now();
+                const std::string     reason( result.srcOK ? result.reason : std::string("getFile/problem: ") + result.reason );
+
+                todo     -= result.nDone;
+                cancelled = isCancelled();
+                return cancelled ? xfer_result(false, 0, "Cancelled", xfer_result::duration_type()) :
+                                   xfer_result((todo==0), nTodo - todo, reason, (end_tm-start_tm), digest(todo), result.nWire,
+                                               metrics::latency_summary(transfer.meter.latency));
             }
+
+            transfer.data_fd = detail::connect_data_channel(dataAddrs, bufSz, ourMSS, ourBW, isCancelled, "getFile");
             if( (cancelled = isCancelled()) )
                 break;
-            ETDCASSERT(transfer.data_fd, "Failed to connect to any of the data servers: " << tried.str());
+            throttled_fd        limit(transfer.data_fd, detail::bw_share(shared_state, transfer, *transfer.data_fd), isCancelled);
+            detail::note_channel(transfer, transfer.data_fd, false);
 
             // Weehee! we're connected!
-            std::unique_ptr<unsigned char[]> buffer(new unsigned char[bufSz]);
-
             // Create message header
             std::ostringstream  msg_buf;
-            msg_buf << "{ uuid:" << srcUUID << ", push:1, sz:" << todo << "}";
+            msg_buf << "{ uuid:" << srcUUID << ", push:1, sz:" << todo
+                    << (opts.checksum ? ", sum:" + crc32c::name : std::string()) << zipKey << "}";
 
-            bool              remoteOK{ true };
-            std::string       reason;
             std::string const msg( msg_buf.str() );
             auto const        start_tm = std::chrono::high_resolution_clock::now();
             transfer.data_fd->write(transfer.data_fd->__m_fd, msg.data(), msg.size());
 
-            while( todo>0 && !(cancelled = isCancelled()) ) {
-                // Read at most bufSz bytes
-                // Note: we do blocking I/O so a read of size zero means
-                //       other side hung up
-                ssize_t       nWritten{0};
-                const ssize_t nRead = transfer.data_fd->read(transfer.data_fd->__m_fd, &buffer[0], bufSz);
-
-                if( nRead<=0 ) {
-                    reason = std::string("getFile/problem: ") + (nRead==0 ? std::string("remote side hung up") : etdc::strerror(errno));
-                    break;
-                }
-                while( nWritten<nRead ) {
-                    ssize_t const thisWrite = transfer.fd->write(transfer.fd->__m_fd, &buffer[nWritten], nRead-nWritten);
-
-                    if( thisWrite<=0 ) {
-                        reason   = ((thisWrite==-1) ? std::string(etdc::strerror(errno)) : std::string("write should never have returned 0"));
-                        remoteOK = false;
-                        break;
-                    }
-                    nWritten += thisWrite;
-                }
-                if( nWritten<nRead )
-                    break;
-                todo -= (off_t)nWritten;
-                if( (cancelled = isCancelled()) )
-                    break;
-            }
+            // The socket is drained by a separate thread such that a slow
+            // disk write does not stall the network; they're decoupled by
+            // a bounded queue of buffers
+            crc32c                crc;
+            const pipeline_result result = detail::data_copy(transfer.data_fd, transfer.fd, todo, false, zip, pool, nBuf, transfer, isCancelled,
+                                                             transfer.advice, (opts.checksum ? &crc : nullptr));
+            const bool            remoteOK( result.dstOK );
+            std::string           reason( result.srcOK ? result.reason : std::string("getFile/problem: ") + result.reason );
+
+            todo     -= result.nDone;
+            cancelled = isCancelled();
             // if we make it out of the loop, todo should be <= 0 and terminate the outer loop
             // Send ACK but only if it makes sense
             if( remoteOK && !cancelled ) {
                 const char ack{ 'y' };
                 ETDCDEBUG(4, "ETDServer::getFile/got all bytes, sending ACK ..." << std::endl);
-                transfer.data_fd->write(transfer.data_fd->__m_fd, &ack, 1);
+                if( opts.checksum && todo==0 ) {
+                    // If the bytes aren't what was sent they must not be
+                    // there to resume from either
+                    if( detail::check_digest(*transfer.data_fd, crc.value()) )
+                        sums.add(detail::stripe_type{0, nTodo}, crc.value());
+                    else {
+                        std::lock_guard<std::mutex> slk( transfer.stripe_lock );
+                        transfer.stripe_done[ 0 ] = 0;
+                        todo   = nTodo;
+                        reason = "checksum mismatch - got different bytes than were sent";
+                    }
+                } else
+                    transfer.data_fd->write(transfer.data_fd->__m_fd, &ack, 1);
                 ETDCDEBUG(4, "ETDServer::getFile/... done." << std::endl);
             }
             auto const end_tm = std::chrono::high_resolution_clock::now();
             return cancelled ? xfer_result(false, 0, "Cancelled", xfer_result::duration_type()) :
-                               xfer_result((todo==0), nTodo - todo, reason, (end_tm-start_tm));
+                               xfer_result((todo==0), nTodo - todo, reason, (end_tm-start_tm), digest(todo), result.nWire,
+                                           metrics::latency_summary(transfer.meter.latency));
         }
         return xfer_result(false, 0, cancelled ? "Cancelled" : "Failed to grab both locks", xfer_result::duration_type());
     }
@@ -740,10 +1657,70 @@ namespace etdc {
         // the whole transfer
         ptr->second->cancelled.store( true );
         if( ptr->second->data_fd )
-            ptr->second->data_fd->close( ptr->second->data_fd->__m_fd );
+            etdc::close_shared( *ptr->second->data_fd );
+
+        std::lock_guard<std::mutex>  slk( ptr->second->stripe_lock );
+        for(auto& sfd: ptr->second->stripe_fds)
+            etdc::close_shared( *sfd );
+        ptr->second->stripe_fds.clear();
         return;
     }
 
+    // One line per transfer this daemon knows of. The counters are read
+    // whilst the data keeps moving so the numbers of one transfer need not
+    // be from exactly the same moment. The current rate is since the
+    // previous status request, if that was after the data started moving.
+    std::string ETDServer::status( void ) const {
+        using clock_type = std::chrono::steady_clock;
+        using ns_type    = std::chrono::nanoseconds;
+
+        etdc::etd_state&             shared_state( __m_shared_state.get() );
+        std::lock_guard<std::mutex>  lk( shared_state.lock );
+        const clock_type::time_point now( clock_type::now() );
+        const int64_t                nowNs( std::chrono::duration_cast<ns_type>(now.time_since_epoch()).count() );
+        std::ostringstream           oss;
+
+        for(auto const& entry: shared_state.transfers) {
+            transferprops_type&  transfer( *entry.second );
+            const uint64_t       nDone( transfer.meter.nDone.load(std::memory_order_relaxed) );
+            const uint64_t       nWire( transfer.meter.nWire.load(std::memory_order_relaxed) );
+            const int64_t        started( transfer.started.load() );
+            const double         dt( started ? (double)(nowNs - started)/1e9 : 0.0 );
+            const double         avg( dt>0 ? (double)nDone/dt : 0.0 );
+            const int64_t        lastNs( std::chrono::duration_cast<ns_type>(transfer.lastSeen.time_since_epoch()).count() );
+            const double         dtLast( (double)(nowNs - lastNs)/1e9 );
+            const double         rate( (started && lastNs>started && dtLast>0) ? (double)(nDone - transfer.lastDone)/dtLast : avg );
+            std::string          channel;
+            etdc_fdptr           fd;
+
+            transfer.lastDone = nDone;
+            transfer.lastSeen = now;
+            {
+                std::lock_guard<std::mutex> slk( transfer.stripe_lock );
+                channel = transfer.channel;
+                fd      = transfer.channel_fd.lock();
+            }
+
+            oss << (oss.tellp()>0 ? "\n" : "") << entry.first << " mode:" << transfer.openMode << " priority:" << transfer.priority.load()
+                << " done:" << nDone << " total:" << transfer.total.load() << " rate:" << rate << " avg:" << avg
+                << " channel:" << (channel.empty() ? std::string("none") : channel)
+                << " rd-wait:" << (double)transfer.meter.rdWait.load(std::memory_order_relaxed)/1e9
+                << " wr-wait:" << (double)transfer.meter.wrWait.load(std::memory_order_relaxed)/1e9;
+            if( nWire!=nDone )
+                oss << " wire:" << nWire;
+            // UDT knows a bit more about how the network is doing
+            if( fd && dynamic_cast<etdc_udt*>(fd.get()) ) {
+                UDT::TRACEINFO  perf;
+                if( UDT::perfmon(fd->__m_fd, &perf, false)!=UDT::ERROR )
+                    oss << " rtt:" << perf.msRTT << " loss:" << perf.pktSndLossTotal + perf.pktRcvLossTotal
+                        << " retransmit:" << perf.pktRetransTotal << " send-rate:" << perf.mbpsSendRate;
+            }
+            // The path goes last: it may contain spaces
+            oss << " path:" << transfer.path;
+        }
+        return oss.str();
+    }
+
     protocolversion_type ETDServer::protocolVersion( void ) const {
         return ETDServerInterface::currentProtocolVersion;
     }
@@ -765,36 +1742,19 @@ namespace etdc {
     //     about that
     //
     /////////////////////////////////////////////////////////////////////////////////////////
-    //static std::basic_regex<unsigned char> rxLine;
-    static const std::regex::flag_type etdc_rxFlags = (std::regex::ECMAScript | std::regex::icase);
-    static const std::regex            rxLine("([^\\r\\n]+)[\\r\\n]+");
-    static const std::regex            rxReply("^(OK|ERR)(\\s+(\\S.*)?)?$", etdc_rxFlags);
-                                             //  1       2    3   submatch numbers
-    static const bool                  noMatch = false;
+    // Commands and replies are parsed by the functions in
+    // etdc_cmdparse.h. They used to be matched against std::regex'es,
+    // which cost more CPU than anything else on a big directory listing.
+    //
     // Update Jun 2018: we need sendFile/getFile to return more detail than
     //              OK | ERR <reason>
     //     we need to be able to return #-of-bytes transferred (integer) and a time
     //     span (double, seconds).
     //     to not break backward compatibility they're going to be
     //     comma-separated after OK/ERR. Reason will remain.
-    //     If those fields are missing
-    static const std::regex            rxXferResultReply("^(OK|ERR)(,([0-9]+),([-0-9\\.\\+eE]+))?(\\s+\\S.*)?$", etdc_rxFlags);
-    //                                     submatches:     1       2 3        4                  5
-
-    template <typename InputIter, typename OutputIter,
-              typename RegexIter  = std::regex_iterator<InputIter>,
-              typename RetvalType = typename std::match_results<InputIter>::size_type>
-    static RetvalType getReplies(InputIter f, InputIter l, OutputIter o) {
-        static const RegexIter  rxIterEnd{};
-
-        RetvalType endpos = 0;
-        for(RegexIter line = RegexIter(f, l, rxLine); line!=rxIterEnd; line++) {
-            // Found another line: append just the non-newline stuff to output and update endpos
-            *o++   = line->str(1);
-            endpos = line->position() + line->length();
-        }
-        return endpos;
-    }
+    //     See parse_xfer_reply().
+    static const std::regex::flag_type etdc_rxFlags = (std::regex::ECMAScript | std::regex::icase);
+    static const bool                  noMatch = false;
 
     filelist_type ETDProxy::listPath(std::string const& path, bool) const {
         std::ostringstream   msgBuf;
@@ -822,23 +1782,21 @@ namespace etdc {
             curPos += n;
 
             // Parse the reply so far
-            std::list<std::string> lines;
-            std::smatch::size_type endpos = getReplies(&buffer[0], &buffer[curPos], std::back_inserter(lines));
-            auto                   line = lines.begin();
+            char const*  cur = &buffer[0];
+            token_type   line;
+            reply_type   reply;
 
             // Check what we got back
-            for(; !finished && line!=lines.end(); line++) {
-                std::smatch   fields;
-
-                ETDCDEBUG(4, "listPath/reply from server: '" << *line << "'" << std::endl);
-                ETDCASSERT(std::regex_match(*line, fields, rxReply), "Server replied with an invalid line");
+            while( !finished && next_line(cur, &buffer[curPos], line) ) {
+                ETDCDEBUG(4, "listPath/reply from server: '" << line << "'" << std::endl);
+                ETDCASSERT(parse_reply(line, reply), "Server replied with an invalid line");
                 // error code must be either == current state (all lines starting with OK)
                 // or state.empty && error code = ERR; we cannot have OK, OK, OK, ERR -> it's either ERR or OK, OK, OK, ... OK
-                ETDCASSERT(state.empty() || (state=="OK" && fields[1].str()==state),
+                ETDCASSERT(state.empty() || (state=="OK" && reply.status==state.c_str()),
                            "The server changed its mind about the success of the call in the middle of the reply");
-                state  = fields[1].str();
+                state  = reply.status.str();
 
-                const std::string   info( fields[3].str() ); 
+                const std::string   info( reply.info.str() );
 
                 // Translate error into an exception
                 if( state=="ERR" )
@@ -850,19 +1808,17 @@ namespace etdc {
                 // Otherwise append the entry to the list of paths
                 rv.push_back( info );
             }
-            ETDCASSERT(line==lines.end(), "There are unprocessed lines of reply from the server. This is probably a protocol error.");
+            ETDCASSERT(!next_line(cur, &buffer[curPos], line), "There are unprocessed lines of reply from the server. This is probably a protocol error.");
             // Processed all lines in the reply so far.
             // So we move all processed bytes to begin of buffer
-            ::memmove(&buffer[0], &buffer[endpos], curPos - endpos);
-            curPos -= endpos;
+            curPos -= (size_t)(cur - &buffer[0]);
+            ::memmove(&buffer[0], cur, curPos);
         }
         ETDCASSERT(curPos==0, "listPath: there are " << curPos << " unconsumed bytes left in the input. This is likely a protocol error.");
         return rv;
     }
 
     result_type ETDProxy::requestFileWrite(std::string const& file, openmode_type om) {
-        static const std::regex  rxUUID( "^UUID:(\\S+)$", etdc_rxFlags);
-        static const std::regex  rxAlreadyHave( "^AlreadyHave:([0-9]+)$", etdc_rxFlags);
         std::ostringstream       msgBuf;
 
         msgBuf << "write-file-" << om << " " << file << '\n';
@@ -887,37 +1843,35 @@ namespace etdc {
             // did we read anything?
             ETDCASSERT(n>0, "Failed to read data from remote end");
             curPos += n;
-            std::vector<std::string>  lines;
-            auto                      endpos = getReplies(&buffer[0], &buffer[curPos], std::back_inserter(lines));
-            auto                      line = lines.cbegin();
+            char const*               cur = &buffer[0];
+            token_type                line, value;
+            reply_type                reply;
 
             // Check what we got back
-            for(; !finished && line!=lines.end(); line++) {
-                std::smatch   fields;
-
-                if( std::regex_match(*line, fields, rxUUID) ) {
+            while( !finished && next_line(cur, &buffer[curPos], line) ) {
+                if( parse_tagged(line, "UUID:", value_kind::Word, value) ) {
                     ETDCASSERT(!curUUID, "Server had already sent a UUID");
-                    curUUID = std::unique_ptr<uuid_type>(new uuid_type(fields.str(1)));
-                } else if( std::regex_match(*line, fields, rxAlreadyHave) ) {
+                    curUUID = std::unique_ptr<uuid_type>(new uuid_type(value.str()));
+                } else if( parse_tagged(line, "AlreadyHave:", value_kind::Unsigned, value) ) {
                     ETDCASSERT(!filePos, "Server had already sent file position");
                     filePos = std::unique_ptr<off_t>(new off_t);
-                    string2off_t(fields.str(1), *filePos);
-                } else if( std::regex_match(*line, fields, rxReply) ) {
+                    string2off_t(value.str(), *filePos);
+                } else if( parse_reply(line, reply) ) {
                     // We get OK (optional stuff)
                     // or     ERR (optional error message)
                     // Either will mean end-of-parsing
-                    status_s = fields.str(1);
-                    info     = fields.str(3);
+                    status_s = reply.status.str();
+                    info     = reply.info.str();
                     finished = true;
                 } else {
-                    ETDCASSERT(noMatch, "requestFileWrite: the server sent a reply we did not recognize: '" << *line << "'");
+                    ETDCASSERT(noMatch, "requestFileWrite: the server sent a reply we did not recognize: '" << line << "'");
                 }
             }
-            ETDCASSERT(line==lines.end(), "requestFileWrite: there are unprocessed lines of input left, this means the server sent an erroneous reply.");
+            ETDCASSERT(!next_line(cur, &buffer[curPos], line), "requestFileWrite: there are unprocessed lines of input left, this means the server sent an erroneous reply.");
             // Now we're sure we've processed all lines in the reply so far.
             // So we move all processed bytes to begin of buffer
-            ::memmove(&buffer[0], &buffer[endpos], curPos - endpos);
-            curPos -= endpos;
+            curPos -= (size_t)(cur - &buffer[0]);
+            ::memmove(&buffer[0], cur, curPos);
         }
         // We must have consumed all output from the server
         ETDCASSERT(curPos==0, "requestFileWrite: there are " << curPos << " unconsumed server bytes left in the input. This is likely a protocol error.");
@@ -939,8 +1893,6 @@ namespace etdc {
     }
 
     result_type ETDProxy::requestFileRead(std::string const& file, off_t already_have) {
-        static const std::regex  rxUUID( "^UUID:(\\S+)$", etdc_rxFlags);
-        static const std::regex  rxRemain( "^Remain:(-?[0-9]+)$", etdc_rxFlags);
         std::ostringstream       msgBuf;
 
         msgBuf << "read-file " << already_have << " " << file << '\n';
@@ -966,37 +1918,35 @@ namespace etdc {
             ETDCASSERT(n>0, "Failed to read data from remote end");
             curPos += n;
 
-            std::vector<std::string>  lines{};
-            auto                      endpos = getReplies(&buffer[0], &buffer[curPos], std::back_inserter(lines));
-            auto                      line = lines.cbegin();
+            char const*               cur = &buffer[0];
+            token_type                line, value;
+            reply_type                reply;
 
             // Check what we got back
-            for(; !finished && line!=lines.end(); line++) {
-                std::smatch   fields;
-
-                if( std::regex_match(*line, fields, rxUUID) ) {
+            while( !finished && next_line(cur, &buffer[curPos], line) ) {
+                if( parse_tagged(line, "UUID:", value_kind::Word, value) ) {
                     ETDCASSERT(!curUUID, "Server already sent a UUID");
-                    curUUID = std::unique_ptr<uuid_type>(new uuid_type(fields.str(1)));
-                } else if( std::regex_match(*line, fields, rxRemain) ) {
+                    curUUID = std::unique_ptr<uuid_type>(new uuid_type(value.str()));
+                } else if( parse_tagged(line, "Remain:", value_kind::Signed, value) ) {
                     ETDCASSERT(!remain, "Server already sent a file position");
                     remain = std::unique_ptr<off_t>(new off_t);
-                    string2off_t(fields.str(1), *remain);
-                } else if( std::regex_match(*line, fields, rxReply) ) {
+                    string2off_t(value.str(), *remain);
+                } else if( parse_reply(line, reply) ) {
                     // We get OK (optional stuff)
                     // or     ERR (optional error message)
                     // Either will mean end-of-parsing
-                    status_s = fields.str(1);
-                    info     = fields.str(3); 
+                    status_s = reply.status.str();
+                    info     = reply.info.str();
                     finished = true;
                 } else {
-                    ETDCASSERT(noMatch, "requestFileRead: the server sent a reply we did not recognize: " << *line);
+                    ETDCASSERT(noMatch, "requestFileRead: the server sent a reply we did not recognize: " << line);
                 }
             }
-            ETDCASSERT(line==lines.end(), "requestFileRead: there are unprocessed lines of input left, this means the server sent an erroneous reply.");
+            ETDCASSERT(!next_line(cur, &buffer[curPos], line), "requestFileRead: there are unprocessed lines of input left, this means the server sent an erroneous reply.");
             // Now we're sure we've processed all lines in the reply so far.
             // So we move all processed bytes to begin of buffer
-            ::memmove(&buffer[0], &buffer[endpos], curPos - endpos);
-            curPos -= endpos;
+            curPos -= (size_t)(cur - &buffer[0]);
+            ::memmove(&buffer[0], cur, curPos);
         }
         // We must have consumed all output from the server
         ETDCASSERT(curPos==0, "requestFileRead: there are " << curPos << " unconsumed server bytes left in the input. This is likely a protocol error.");
@@ -1032,23 +1982,21 @@ namespace etdc {
             curPos += n;
 
             // Parse the reply so far
-            std::list<std::string> lines;
-            std::smatch::size_type endpos = getReplies(&buffer[0], &buffer[curPos], std::back_inserter(lines));
-            auto                   line = lines.begin();
+            char const*  cur = &buffer[0];
+            token_type   line;
+            reply_type   reply;
 
             // Check what we got back
-            for(; !finished && line!=lines.end(); line++) {
-                std::smatch   fields;
-
-                ETDCDEBUG(4, "dataChannelAddr/reply from server: '" << *line << "'" << std::endl);
-                ETDCASSERT(std::regex_match(*line, fields, rxReply), "Server replied with an invalid line");
+            while( !finished && next_line(cur, &buffer[curPos], line) ) {
+                ETDCDEBUG(4, "dataChannelAddr/reply from server: '" << line << "'" << std::endl);
+                ETDCASSERT(parse_reply(line, reply), "Server replied with an invalid line");
                 // error code must be either == current state (all lines starting with OK)
                 // or state.empty && error code = ERR; we cannot have OK, OK, OK, ERR -> it's either ERR or OK, OK, OK, ... OK
-                ETDCASSERT(state.empty() || (state=="OK" && fields[1].str()==state),
+                ETDCASSERT(state.empty() || (state=="OK" && reply.status==state.c_str()),
                            "The server changed its mind about the success of the call in the middle of the reply");
-                state  = fields[1].str();
+                state  = reply.status.str();
 
-                const std::string   info( fields[3].str() ); 
+                const std::string   info( reply.info.str() );
 
                 // Translate error into an exception
                 if( state=="ERR" )
@@ -1061,16 +2009,62 @@ namespace etdc {
                 // Otherwise append the entry to the list of paths
                 rv.push_back( decode_data_addr(info) );
             }
-            ETDCASSERT(line==lines.end(), "There are unprocessed lines of reply from the server. This is probably a protocol error.");
+            ETDCASSERT(!next_line(cur, &buffer[curPos], line), "There are unprocessed lines of reply from the server. This is probably a protocol error.");
             // Processed all lines in the reply so far.
             // So we move all processed bytes to begin of buffer
-            ::memmove(&buffer[0], &buffer[endpos], curPos - endpos);
-            curPos -= endpos;
+            curPos -= (size_t)(cur - &buffer[0]);
+            ::memmove(&buffer[0], cur, curPos);
         }
         ETDCASSERT(curPos==0, "dataChannelAddr: there are " << curPos << " unconsumed bytes left in the input. This is likely a protocol error.");
         return rv;
     }
 
+    std::string ETDProxy::status( void ) const {
+        static const std::string msg( "status\n" );
+
+        ETDCDEBUG(4, "ETDProxy::status/sending message '" << msg << "'" << std::endl);
+        ETDCASSERTX(__m_connection->write(__m_connection->__m_fd, msg.data(), msg.size())==(ssize_t)msg.size());
+
+        // Like listPath(): "OK <line>" for each transfer, then a single OK
+        const size_t            bufSz( 16384 );
+        std::unique_ptr<char[]> buffer(new char[bufSz]);
+        bool                    finished{ false };
+        size_t                  curPos{ 0 };
+        std::string             state;
+        std::ostringstream      rv;
+
+        while( !finished && curPos<bufSz ) {
+            const ssize_t n = __m_connection->read(__m_connection->__m_fd, &buffer[curPos], bufSz-curPos);
+
+            ETDCASSERT(n>0, "Failed to read data from remote end");
+            curPos += n;
+
+            char const*  cur = &buffer[0];
+            token_type   line;
+            reply_type   reply;
+
+            while( !finished && next_line(cur, &buffer[curPos], line) ) {
+                ETDCASSERT(parse_reply(line, reply), "Server replied with an invalid line");
+                ETDCASSERT(state.empty() || (state=="OK" && reply.status==state.c_str()),
+                           "The server changed its mind about the success of the call in the middle of the reply");
+                state  = reply.status.str();
+
+                const std::string   info( reply.info.str() );
+
+                if( state=="ERR" )
+                    throw std::runtime_error(std::string("status failed - ") + (info.empty() ? "<unknown reason>" : info));
+                if( (finished=(state=="OK" && info.empty()))==true )
+                    continue;
+                rv << (rv.tellp()>0 ? "\n" : "") << info;
+            }
+            ETDCASSERT(!next_line(cur, &buffer[curPos], line), "There are unprocessed lines of reply from the server. This is probably a protocol error.");
+            curPos -= (size_t)(cur - &buffer[0]);
+            ::memmove(&buffer[0], cur, curPos);
+        }
+        ETDCASSERT(curPos==0, "status: there are " << curPos << " unconsumed bytes left in the input. This is likely a protocol error.");
+        return rv.str();
+    }
+
     bool ETDProxy::removeUUID(uuid_type const& uuid) {
         std::ostringstream       msgBuf;
 
@@ -1093,22 +2087,21 @@ namespace etdc {
             ETDCASSERT(n>0, "Failed to read data from remote end");
             curPos += n;
 
-            std::vector<std::string>  lines;
-            std::smatch               fields;
-
-            // Discard the return value from getReplies - we don't need to remember where we end in the buffer
-            (void)getReplies(&buffer[0], &buffer[curPos], std::back_inserter(lines));
+            // We don't need to remember where we end in the buffer
+            char const*  cur = &buffer[0];
+            token_type   line, extra;
+            reply_type   reply;
 
             // If no line(s) yet, read more bytes
-            if( lines.empty() )
+            if( !next_line(cur, &buffer[curPos], line) )
                 continue;
 
             // If we get >1 line, the client's messin' wiv de heads - we only allow 1 (one) line of reply
-            ETDCASSERT(lines.size()==1, "The client sent wrong number of responses - this is likely a protocol error");
+            ETDCASSERT(!next_line(cur, &buffer[curPos], extra), "The client sent wrong number of responses - this is likely a protocol error");
             // And that line should match our expectations
-            ETDCASSERT(std::regex_match(*lines.begin(), fields, rxReply), "The client sent a non-conforming response");
+            ETDCASSERT(parse_reply(line, reply), "The client sent a non-conforming response");
             // Translate "ERR <Reason>" into an exception
-            ETDCASSERT(fields[1].str()=="OK", "removeUUID failed: " << fields[2].str());
+            ETDCASSERT(reply.status=="OK", "removeUUID failed: " << reply.info);
             // Otherwise we're done
             break;
         }
@@ -1116,6 +2109,139 @@ namespace etdc {
         return true;
     }
 
+    checksumlist_type ETDProxy::checksumRanges(uuid_type const& uuid, rangelist_type const& ranges) {
+        // The remote end won't accept command lines of 2kB or longer so
+        // we ask for the ranges in batches
+        const size_t      batchSz( 32 );
+        checksumlist_type rv;
+
+        for(auto batch = ranges.begin(); batch!=ranges.end(); ) {
+            auto               batchEnd = std::next(batch, std::min(batchSz, (size_t)std::distance(batch, ranges.end())));
+            std::ostringstream msgBuf;
+
+            msgBuf << "checksum-ranges " << uuid << ' ';
+            for(auto range = batch; range!=batchEnd; range++)
+                msgBuf << (range==batch ? "" : ",") << range->first << '+' << range->second;
+            msgBuf << '\n';
+            const std::string  msg( msgBuf.str() );
+            batch = batchEnd;
+
+            ETDCDEBUG(4, "ETDProxy::checksumRanges/sending message '" << msg << "'" << std::endl);
+            ETDCASSERTX(__m_connection->write(__m_connection->__m_fd, msg.data(), msg.size())==(ssize_t)msg.size());
+
+            // The reply is one "OK <algorithm>:<hex>" line per range and a final "OK"
+            const size_t            bufSz( 2048 );
+            std::unique_ptr<char[]> buffer(new char[bufSz]);
+            bool                    finished{ false };
+            size_t                  curPos{ 0 };
+            std::string             state;
+            static const std::string pfx( crc32c::name + ":" );
+
+            while( !finished && curPos<bufSz ) {
+                const ssize_t n = __m_connection->read(__m_connection->__m_fd, &buffer[curPos], bufSz-curPos);
+
+                // did we read anything?
+                ETDCASSERT(n>0, "Failed to read data from remote end");
+                curPos += n;
+
+                // Parse the reply so far
+                char const*  cur = &buffer[0];
+                token_type   line;
+                reply_type   reply;
+
+                while( !finished && next_line(cur, &buffer[curPos], line) ) {
+                    ETDCDEBUG(4, "checksumRanges/reply from server: '" << line << "'" << std::endl);
+                    ETDCASSERT(parse_reply(line, reply), "Server replied with an invalid line");
+                    ETDCASSERT(state.empty() || (state=="OK" && reply.status==state.c_str()),
+                               "The server changed its mind about the success of the call in the middle of the reply");
+                    state  = reply.status.str();
+
+                    const std::string   info( reply.info.str() );
+
+                    // Translate error into an exception
+                    if( state=="ERR" )
+                        throw std::runtime_error(std::string("checksumRanges() failed - ") + (info.empty() ? "<unknown reason>" : info));
+                    if( (finished=(state=="OK" && info.empty()))==true )
+                        continue;
+                    ETDCASSERT(info.compare(0, pfx.size(), pfx)==0, "checksumRanges: the server sent an unsupported checksum '" << info << "'");
+                    rv.push_back( (uint32_t)std::stoul(info.substr(pfx.size()), nullptr, 16) );
+                }
+                ETDCASSERT(!next_line(cur, &buffer[curPos], line), "There are unprocessed lines of reply from the server. This is probably a protocol error.");
+                curPos -= (size_t)(cur - &buffer[0]);
+                ::memmove(&buffer[0], cur, curPos);
+            }
+            ETDCASSERT(finished && curPos==0, "checksumRanges: the reply was incomplete or there were unconsumed bytes left. This is likely a protocol error.");
+        }
+        ETDCASSERT(rv.size()==ranges.size(), "checksumRanges: asked for " << ranges.size() << " checksums but got " << rv.size());
+        return rv;
+    }
+
+    void ETDProxy::rollback(uuid_type const& uuid, off_t size) {
+        std::ostringstream       msgBuf;
+
+        msgBuf << "rollback " << uuid << ' ' << size << '\n';
+        const std::string  msg( msgBuf.str() );
+
+        ETDCDEBUG(4, "ETDProxy::rollback/sending message '" << msg << "'" << std::endl);
+        ETDCASSERTX(__m_connection->write(__m_connection->__m_fd, msg.data(), msg.size())==(ssize_t)msg.size());
+
+        // We only allow "OK" or "ERR <msg>"
+        size_t                     curPos{ 0 };
+        const size_t               bufSz( 2048 );
+        std::unique_ptr<char[]>    buffer(new char[bufSz]);
+
+        while( curPos<bufSz ) {
+            const ssize_t n = __m_connection->read(__m_connection->__m_fd, &buffer[curPos], bufSz-curPos);
+
+            ETDCASSERT(n>0, "Failed to read data from remote end");
+            curPos += n;
+
+            char const*  cur = &buffer[0];
+            token_type   line, extra;
+            reply_type   reply;
+
+            if( !next_line(cur, &buffer[curPos], line) )
+                continue;
+            ETDCASSERT(!next_line(cur, &buffer[curPos], extra), "The server sent wrong number of responses - this is likely a protocol error");
+            ETDCASSERT(parse_reply(line, reply), "The server sent a non-conforming response");
+            ETDCASSERT(reply.status=="OK", "rollback failed: " << reply.info);
+            break;
+        }
+    }
+
+    void ETDProxy::setPriority(uuid_type const& uuid, priority_type prio) {
+        std::ostringstream       msgBuf;
+
+        msgBuf << "set-priority " << uuid << ' ' << prio << '\n';
+        const std::string  msg( msgBuf.str() );
+
+        ETDCDEBUG(4, "ETDProxy::setPriority/sending message '" << msg << "'" << std::endl);
+        ETDCASSERTX(__m_connection->write(__m_connection->__m_fd, msg.data(), msg.size())==(ssize_t)msg.size());
+
+        // We only allow "OK" or "ERR <msg>"
+        size_t                     curPos{ 0 };
+        const size_t               bufSz( 2048 );
+        std::unique_ptr<char[]>    buffer(new char[bufSz]);
+
+        while( curPos<bufSz ) {
+            const ssize_t n = __m_connection->read(__m_connection->__m_fd, &buffer[curPos], bufSz-curPos);
+
+            ETDCASSERT(n>0, "Failed to read data from remote end");
+            curPos += n;
+
+            char const*  cur = &buffer[0];
+            token_type   line, extra;
+            reply_type   reply;
+
+            if( !next_line(cur, &buffer[curPos], line) )
+                continue;
+            ETDCASSERT(!next_line(cur, &buffer[curPos], extra), "The server sent wrong number of responses - this is likely a protocol error");
+            ETDCASSERT(parse_reply(line, reply), "The server sent a non-conforming response");
+            ETDCASSERT(reply.status=="OK", "set-priority failed: " << reply.info);
+            break;
+        }
+    }
+
     protocolversion_type ETDProxy::set_protocolVersion( protocolversion_type pvn ) {
         // unfortunately std::swap() is declared as "void std::swap(...)"
         protocolversion_type const previous = __m_protocolVersion;
@@ -1124,13 +2250,26 @@ namespace etdc {
         return previous;
     }
 
-    xfer_result ETDProxy::sendFile(uuid_type const& srcUUID, uuid_type const& dstUUID, off_t todo, dataaddrlist_type const& dataaddrs) {
+    xfer_result ETDProxy::sendFile(uuid_type const& srcUUID, uuid_type const& dstUUID, off_t todo, dataaddrlist_type const& dataaddrs,
+                                   xfer_options const& opts) {
         sockname2string_fn       f{ sockname2str( __m_protocolVersion ) };
         std::ostringstream       msgBuf;
+        xfer_options             wireOpts( opts );
+
+        // Servers that can tell us how their system calls did, will
+        wireOpts.latency = (__m_protocolVersion>=10 && __m_protocolVersion!=ETDServerInterface::unknownProtocolVersion);
+        const std::string        options( options2string(wireOpts) );
 
         msgBuf << "send-file " << srcUUID << " " << dstUUID << " " << todo << " ";
         for(auto p = dataaddrs.begin(); p!=dataaddrs.end(); p++)
             msgBuf << ((p!=dataaddrs.begin()) ? "," : "") << f( *p );
+        // Older servers don't know about options; in that case the caller
+        // should not have asked for non-default ones
+        if( !options.empty() ) {
+            ETDCASSERT(__m_protocolVersion>=2 && __m_protocolVersion!=ETDServerInterface::unknownProtocolVersion,
+                       "The remote end does not support transfer options (" << options << ")");
+            msgBuf << " " << options;
+        }
         msgBuf << '\n';
         const std::string  msg( msgBuf.str() );
 
@@ -1142,53 +2281,73 @@ namespace etdc {
         off_t                      nbyte_transferred{ 0 }; // provide defaults; older servers don't return this
         double                     delta_t{ 0.0 };         //    id.
         std::string                reason{};
+        std::string                digest{};               // only if a checksum was asked for
+        off_t                      nbyte_wire{ -1 };       // only if compression was asked for
+        metrics::latency_summary   latency{};              // only if the server can (protocol version >= 10)
 
         // And await the reply. Update Jun 2018: accept more elaborate reply
         // if we allow ~2kB for the <msg> that's quite generous I'd say
+        // If we asked for progress reports, those come first
         size_t                     curPos{ 0 };
         const size_t               bufSz( 2048 );
         std::unique_ptr<char[]>    buffer(new char[bufSz]);
+        bool                       finished{ false };
 
-        while( curPos<bufSz ) {
+        while( !finished && curPos<bufSz ) {
             const ssize_t n = __m_connection->read(__m_connection->__m_fd, &buffer[curPos], bufSz-curPos);
 
             // did we read anything?
             ETDCASSERT(n>0, "Failed to read data from remote end");
             curPos += n;
 
-            std::vector<std::string>  lines;
-            std::smatch               fields;
+            char const*          cur = &buffer[0];
+            char const* const    end = &buffer[curPos];
+            token_type           line, extra;
+            progress_reply_type  progress;
+            xfer_reply_type      reply;
+            bool                 haveReply{ false };
 
-            // Discard the return value from getReplies - we don't need to remember where we end in the buffer
-            (void)getReplies(&buffer[0], &buffer[curPos], std::back_inserter(lines));
+            while( (haveReply=next_line(cur, end, line))==true && parse_progress(line, progress) ) {
+                off_t  done;
 
-            // If no line(s) yet, read more bytes
-            if( lines.empty() )
+                string2off_t(progress.done.str(), done);
+                if( opts.onProgress )
+                    opts.onProgress(done, std::stod(progress.rate.str()));
+            }
+            // If no reply yet, only keep what's not a complete line yet and
+            // read more bytes
+            if( !haveReply ) {
+                curPos -= (size_t)(cur - &buffer[0]);
+                ::memmove(&buffer[0], cur, curPos);
                 continue;
+            }
 
             // If we get >1 line, the client's messin' wiv de heads - we only allow 1 (one) line of reply
-            ETDCASSERT(lines.size()==1, "The client sent wrong number of responses - this is likely a protocol error");
+            ETDCASSERT(!next_line(cur, end, extra) && cur==end, "The client sent wrong number of responses - this is likely a protocol error");
             // And that line should match our expectations
-            ETDCASSERT(std::regex_match(*lines.begin(), fields, rxXferResultReply), "The client sent a non-conforming response");
-            //    "^(OK|ERR)(,([0-9]+),([-0-9\\.\\+eE]+))?(\\s+\\S.*)?$"
-            //      1       2 3        4                  5
-            // Field 1 always exists
-            success = (fields[1].str()=="OK");
+            ETDCASSERT(parse_xfer_reply(line, reply), "The client sent a non-conforming response");
+            success = (reply.status=="OK");
 
             // Check optional fields
-            std::string     tmp;
-            if( (tmp = fields[3].str()).empty()==false ) {
+            if( !reply.nByte.empty() ) {
                 // have new-style reply!
-                string2off_t(tmp, nbyte_transferred);
-                // then we also *know* we have field 4!
-                delta_t = std::stod(fields[4].str());
+                string2off_t(reply.nByte.str(), nbyte_transferred);
+                // then we also *know* we have the duration
+                delta_t = std::stod(reply.deltaT.str());
+                // and maybe a digest (protocol version >= 3)
+                digest  = reply.digest.str();
+                // and the bytes on the wire (protocol version >= 6)
+                if( !reply.wire.empty() )
+                    string2off_t(reply.wire.str(), nbyte_wire);
+                // and how the system calls did (protocol version >= 10)
+                latency = metrics::decode(reply.latency.str());
             }
             // Was there a reason?
-            reason = fields[5].str();
+            reason = reply.reason.str();
             // Otherwise we're done
-            break;
+            finished = true;
         }
-        return xfer_result(success, nbyte_transferred, reason, xfer_result::duration_type(delta_t));
+        return xfer_result(success, nbyte_transferred, reason, xfer_result::duration_type(delta_t), digest, nbyte_wire, latency);
     }
 
     // Cancel the current transfer
@@ -1237,25 +2396,24 @@ namespace etdc {
             ETDCASSERT(n>0, "Failed to read data from remote end");
             curPos += n;
 
-            std::vector<std::string>  lines;
-            std::smatch               fields;
-
-            // Discard the return value from getReplies - we don't need to remember where we end in the buffer
-            (void)getReplies(&buffer[0], &buffer[curPos], std::back_inserter(lines));
+            // We don't need to remember where we end in the buffer
+            char const*  cur = &buffer[0];
+            token_type   line, extra;
+            reply_type   reply;
 
             // If no line(s) yet, read more bytes
-            if( lines.empty() )
+            if( !next_line(cur, &buffer[curPos], line) )
                 continue;
 
             // If we get >1 line, the client's messin' wiv de heads - we only allow 1 (one) line of reply
-            ETDCASSERT(lines.size()==1, "The client sent wrong number of responses - this is likely a protocol error");
+            ETDCASSERT(!next_line(cur, &buffer[curPos], extra), "The client sent wrong number of responses - this is likely a protocol error");
             // And that line should match our expectations
-            ETDCASSERT(std::regex_match(*lines.begin(), fields, rxReply), "The client sent a non-conforming response");
+            ETDCASSERT(parse_reply(line, reply), "The client sent a non-conforming response");
             // Translate "ERR <Reason>" into an exception
-            ETDCASSERT(fields[1].str()=="OK", "protocolVersion failed: " << fields[2].str());
+            ETDCASSERT(reply.status=="OK", "protocolVersion failed: " << reply.info);
 
             // The format should be "OK <number>"
-            __m_protocolVersion = std::stoul( fields[3].str() );
+            __m_protocolVersion = std::stoul( reply.info.str() );
 
             // Otherwise we're done
             break;
@@ -1273,6 +2431,15 @@ namespace etdc {
     //////////////////////////////////////////////////////////////////////
 
     void ETDServerWrapper::handle( void ) {
+        // What to do for each command, in the order of command_id
+        static const handler_fn  handlers[] = {
+            &ETDServerWrapper::do_list,            &ETDServerWrapper::do_write_file,       &ETDServerWrapper::do_read_file,
+            &ETDServerWrapper::do_send_file,       &ETDServerWrapper::do_data_channel_addr, &ETDServerWrapper::do_remove_uuid,
+            &ETDServerWrapper::do_protocol_version, &ETDServerWrapper::do_checksum_ranges, &ETDServerWrapper::do_rollback,
+            &ETDServerWrapper::do_set_priority,    &ETDServerWrapper::do_status
+        };
+        static_assert(sizeof(handlers)/sizeof(handlers[0])==(size_t)command_id::NumCommand, "Not all commands have a handler");
+
         // here we enter our while loop, reading commands and (attempt) to
         // interpret them.
         // If we go 2kB w/o seeing an actual command we call it a day
@@ -1282,6 +2449,7 @@ namespace etdc {
 
         bool          terminated = false;
         size_t        curPos = 0;
+        replies_type  replies;
 
         while( !terminated && curPos<bufSz ) {
             ETDCDEBUG(5, "ETDServerWrapper::handle() / start loop, curPos=" << curPos << std::endl);
@@ -1291,147 +2459,23 @@ namespace etdc {
             ETDCASSERT(n>0, "Failed to read data from remote end");
             curPos += n;
 
-            // Parse the reply so far
-            std::list<std::string> lines;
-            std::smatch::size_type endpos = getReplies(&buffer[0], &buffer[curPos], std::back_inserter(lines));
-            auto                   line = lines.begin();
+            // Parse the commands so far
+            char const*   cur = &buffer[0];
+            token_type    line;
+            command_type  cmd;
 
-            for( ; line!=lines.end(); line++ ) {
+            while( next_line(cur, &buffer[curPos], line) ) {
                 // Got a line! Assert that it conforms to our expectation
-                ETDCDEBUG(4, "ETDServerWrapper::handle()/got line: '" << *line << "'" << std::endl);
-
-                // The known commands
-                static const std::regex  rxList("^list\\s+(\\S.*)$", etdc_rxFlags);
-                static const std::regex  rxReqFileWrite("^write-file-(\\S+)\\s+(\\S.*)$", etdc_rxFlags);
-                                                //                   1         2
-                                                //                   openmode  file name
-                static const std::regex  rxReqFileRead("^read-file\\s+([0-9]+)\\s+(\\S.*)$", etdc_rxFlags);
-                                                //                    1           2
-                                                //                    already have
-                                                //                                file name
-                static const std::regex  rxSendFile("^send-file\\s+(\\S+)\\s+(\\S+)\\s+([0-9]+)\\s+(\\S+)$", etdc_rxFlags);
-                                                //                 1         2         3           4
-                                                //                 srcUUID   dstUUID   todo        data-channel
-                static const std::regex  rxDataChannelAddr("^data-channel-addr(-ext)?$", etdc_rxFlags);
-                                                //                            1 extended info?
-                static const std::regex  rxRemoveUUID("^(remove-uuid|cancel)\\s+(\\S+)$", etdc_rxFlags);
-                                                //      1              2
-                                                //      what to do     UUID
-                static const std::regex  rxProtocolVersion("^protocol-version$", etdc_rxFlags);
-
-                // Match it against the known commands
-                std::smatch              fields;
-                std::vector<std::string> replies;
+                ETDCDEBUG(4, "ETDServerWrapper::handle()/got line: '" << line << "'" << std::endl);
 
+                replies.clear();
                 try {
-                    if( std::regex_match(*line, fields, rxList) ) {
-                        // we're a remote ETDServer (seen from the client)
-                        // so we do not support ~ expansion
-                        const auto entries = __m_etdserver.listPath(fields[1].str(), false);
-                        std::transform(std::begin(entries), std::end(entries), std::back_inserter(replies),
-                                       std::bind(std::plus<std::string>(), std::string("OK "), std::placeholders::_1));
-                        // and add a final OK
-                        replies.emplace_back("OK");
-                    } else if( std::regex_match(*line, fields, rxReqFileWrite) ) {
-                        openmode_type      om;
-                        std::istringstream iss( fields[1].str() );
-                        // Transform openmode string to actual openmode enum
-                        iss >> om;
-                        // Do the actual filewrite request
-                        const auto         fwresult = __m_etdserver.requestFileWrite(fields[2].str(), om);
-                        std::ostringstream oss;
-                        // Prepare replies
-                        oss << "AlreadyHave:" << get_filepos(fwresult);
-                        replies.emplace_back(oss.str());
-                        replies.emplace_back("UUID:"+get_uuid(fwresult));
-                        replies.emplace_back("OK");
-                    } else if( std::regex_match(*line, fields, rxReqFileRead) ) {
-                        // Decode the filepos from the sent command into
-                        // local, correctly typed, variable
-                        off_t               already_have;;
-                        string2off_t(fields[1].str(), already_have);
-
-                        // Do the actual fileread request
-                        const auto frresult = __m_etdserver.requestFileRead(fields[2].str(), already_have);
-
-                        // Prepare replies
-                        std::ostringstream  oss;
-                        oss << "Remain:" << get_filepos(frresult);
-                        replies.emplace_back(oss.str());
-                        replies.emplace_back("UUID:"+get_uuid(frresult));
-                        replies.emplace_back("OK");
-                    } else if( std::regex_match(*line, fields, rxSendFile) ) {
-                        // Decode the fields 
-                        off_t                 todo;
-                        const std::string     dataAddrs_s( fields[4].str() );
-                        dataaddrlist_type     dataAddrs;
-                        const etdc::uuid_type src_uuid{ fields[1].str() };
-                        const etdc::uuid_type dst_uuid{ fields[2].str() };
-
-                        string2off_t(fields[3].str(), todo);
-                        // transform data channel addresses into list-of-*
-                        static const std::regex data_sep( "<[^>]+>" );
-                        std::transform( std::sregex_iterator(std::begin(dataAddrs_s), std::end(dataAddrs_s), data_sep),
-                                        std::sregex_iterator(), std::back_inserter(dataAddrs), 
-                                        [](std::smatch const& sm) { return decode_data_addr(sm.str()); });
-
-                        // Execute the sendFile in a separate thread to free up this handler
-                        std::thread( [=]() {
-                                ETDCDEBUG(4, "ETDServerWrapper: thread " << std::this_thread::get_id() << "/executing sendFile()" << std::endl);
-                                std::ostringstream reply_s;
-                                try {
-                                    const xfer_result  rv = __m_etdserver.sendFile(src_uuid, dst_uuid, todo, dataAddrs);
-                                    reply_s << (rv.__m_Finished ? "OK" : "ERR")
-                                            << ',' << rv.__m_BytesTransferred
-                                            // make sure we have seconds as units of duration
-                                            << ',' << rv.__m_DeltaT.count();
-                                    if( !rv.__m_Reason.empty() )
-                                        reply_s << ' ' << rv.__m_Reason;
-                                    reply_s << '\n';
-                                }
-                                catch( std::exception const& e ) {
-                                    reply_s << "ERR,0,0.00 " << e.what() << '\n';
-                                }
-                                catch( ... ) {
-                                    reply_s << "ERR,0,0.00 Unknown exception in sendFile thread\n";
-                                }
-                                std::string const reply{ reply_s.str() };
-                                ETDCDEBUG(4, "ETDServerWrapper: thread " << std::this_thread::get_id() << "/sending sendFile() reply '" << reply << "'" << std::endl);
-                                __m_connection->write(__m_connection->__m_fd, reply.data(), reply.size());
-                            } ).detach();
-                        //replies.emplace_back( rv ? "OK" : "ERR Failed to send file" );
-                    } else if( std::regex_match(*line, fields, rxDataChannelAddr) ) {
-                        // Did client ask for data-channel-addr-ext?
-                        // Note we do not use "sockname2str(protocolVersion)" here because this
-                        // is _us_ answering a query from someone else, we are not the *proxy* for someone else
-                        auto       f       = (fields[1].str().empty() ? sockname2str_v0 : sockname2str_v1);
-                        const auto entries = __m_etdserver.dataChannelAddr();
-
-                        std::transform(std::begin(entries), std::end(entries), std::back_inserter(replies),
-                                       [&](sockname_type const& sn) { std::ostringstream oss; oss << "OK " << f(sn); return oss.str(); });
-                        // and add a final OK
-                        replies.emplace_back("OK");
-                    } else if( std::regex_match(*line, fields, rxRemoveUUID) ) {
-                        // Could be remove | cancel
-                        etdc::uuid_type const  uuid{ fields[2].str() };
-
-                        if( fields[1].str() == "cancel" ) {
-                            ETDCDEBUG(4, "ETDServerWrapper: canelling UUID " << uuid << std::endl);
-                            __m_etdserver.cancel( uuid );
-                            // note: this done does _not_ solicit a return
-                        } else {
-                            const bool removeResult = __m_etdserver.removeUUID( uuid );
-                            ETDCDEBUG(4, "ETDServerWrapper: removeUUID(" << uuid << " yields " << removeResult << std::endl);
-                            replies.emplace_back( removeResult ? "OK" : "ERR Failed to remove UUID" );
-                        }
-                    } else if( std::regex_match(*line, fields, rxProtocolVersion) ) {
-                        // and add a final OK
-                        replies.emplace_back("OK "+repr(__m_etdserver.protocolVersion()));
-                    } else {
-                        ETDCDEBUG(4, "line '" << *line << "' did not match any regex" << std::endl);
-                        __m_connection->close( __m_connection->__m_fd );
+                    if( !parse_command(line, cmd) ) {
+                        ETDCDEBUG(4, "line '" << line << "' is not a command" << std::endl);
+                        etdc::close_shared( *__m_connection );
                         throw std::string("client sent unknown command");
                     }
+                    (this->*handlers[(size_t)cmd.id])(cmd, replies);
                 }
                 catch( std::string const& e ) {
                     ETDCDEBUG(-1, "ETDServerWrapper: terminating because of condition " << e << std::endl);
@@ -1455,15 +2499,192 @@ namespace etdc {
                     __m_connection->write(__m_connection->__m_fd, "\n", 1);
                 }
             } 
-            ETDCASSERT(line==lines.end(), "There were unprocessed lines of input from the client. This is likely a logical error in this server");
             // Processed all lines in the reply so far.
             // So we move all processed bytes to begin of buffer
-            ::memmove(&buffer[0], &buffer[endpos], curPos - endpos);
-            curPos -= endpos;
+            curPos -= (size_t)(cur - &buffer[0]);
+            ::memmove(&buffer[0], cur, curPos);
         }
         ETDCDEBUG(3, "ETDServerWrapper: terminated." << std::endl);
     }
 
+    void ETDServerWrapper::do_list(command_type const& cmd, replies_type& replies) {
+        // we're a remote ETDServer (seen from the client)
+        // so we do not support ~ expansion
+        const auto entries = __m_etdserver.listPath(cmd.args[0].str(), false);
+        std::transform(std::begin(entries), std::end(entries), std::back_inserter(replies),
+                       std::bind(std::plus<std::string>(), std::string("OK "), std::placeholders::_1));
+        // and add a final OK
+        replies.emplace_back("OK");
+    }
+
+    void ETDServerWrapper::do_write_file(command_type const& cmd, replies_type& replies) {
+        openmode_type      om;
+        std::istringstream iss( cmd.args[0].str() );
+        // Transform openmode string to actual openmode enum
+        iss >> om;
+        // Do the actual filewrite request
+        const auto         fwresult = __m_etdserver.requestFileWrite(cmd.args[1].str(), om);
+        std::ostringstream oss;
+        // Prepare replies
+        oss << "AlreadyHave:" << get_filepos(fwresult);
+        replies.emplace_back(oss.str());
+        replies.emplace_back("UUID:"+get_uuid(fwresult));
+        replies.emplace_back("OK");
+    }
+
+    void ETDServerWrapper::do_read_file(command_type const& cmd, replies_type& replies) {
+        // Decode the filepos from the sent command into
+        // local, correctly typed, variable
+        off_t               already_have;
+        string2off_t(cmd.args[0].str(), already_have);
+
+        // Do the actual fileread request
+        const auto frresult = __m_etdserver.requestFileRead(cmd.args[1].str(), already_have);
+
+        // Prepare replies
+        std::ostringstream  oss;
+        oss << "Remain:" << get_filepos(frresult);
+        replies.emplace_back(oss.str());
+        replies.emplace_back("UUID:"+get_uuid(frresult));
+        replies.emplace_back("OK");
+    }
+
+    void ETDServerWrapper::do_send_file(command_type const& cmd, replies_type&) {
+        // Decode the fields 
+        off_t                 todo;
+        dataaddrlist_type     dataAddrs;
+        const etdc::uuid_type src_uuid{ cmd.args[0].str() };
+        const etdc::uuid_type dst_uuid{ cmd.args[1].str() };
+        const xfer_options    opts( string2options(cmd.args[4].str()) );
+
+        string2off_t(cmd.args[2].str(), todo);
+        // transform data channel addresses into list-of-*
+        for_each_data_addr(cmd.args[3], [&](token_type const& addr) { dataAddrs.push_back( decode_data_addr(addr.str()) ); });
+
+        // Execute the sendFile in a separate thread to free up this handler
+        std::thread( [=]() {
+                ETDCDEBUG(4, "ETDServerWrapper: thread " << std::this_thread::get_id() << "/executing sendFile()" << std::endl);
+                std::ostringstream reply_s;
+                xfer_options       xferOpts( opts );
+                etdc_fdptr         conn( __m_connection );
+
+                // The progress goes out on the command connection, ahead of the reply
+                xferOpts.onProgress = [conn](off_t done, double rate) {
+                                            std::ostringstream oss;
+                                            oss << "PROGRESS " << done << "," << rate << '\n';
+                                            const std::string  msg( oss.str() );
+                                            ETDCASSERT(conn->write(conn->__m_fd, msg.data(), msg.size())==(ssize_t)msg.size(),
+                                                       "failed to send progress - " << etdc::strerror(errno));
+                                       };
+                try {
+                    const xfer_result  rv = __m_etdserver.sendFile(src_uuid, dst_uuid, todo, dataAddrs, xferOpts);
+                    reply_s << (rv.__m_Finished ? "OK" : "ERR")
+                            << ',' << rv.__m_BytesTransferred
+                            // make sure we have seconds as units of duration
+                            << ',' << rv.__m_DeltaT.count();
+                    if( !rv.__m_Digest.empty() )
+                        reply_s << ',' << rv.__m_Digest;
+                    // Only a client that asked for compression knows about this
+                    if( !opts.compress.empty() )
+                        reply_s << ",wire=" << rv.__m_WireBytes;
+                    // Idem for the latencies
+                    if( opts.latency )
+                        reply_s << ",lat=" << metrics::encode(rv.__m_Latency);
+                    if( !rv.__m_Reason.empty() )
+                        reply_s << ' ' << rv.__m_Reason;
+                    reply_s << '\n';
+                }
+                catch( std::exception const& e ) {
+                    reply_s << "ERR,0,0.00 " << e.what() << '\n';
+                }
+                catch( ... ) {
+                    reply_s << "ERR,0,0.00 Unknown exception in sendFile thread\n";
+                }
+                std::string const reply{ reply_s.str() };
+                ETDCDEBUG(4, "ETDServerWrapper: thread " << std::this_thread::get_id() << "/sending sendFile() reply '" << reply << "'" << std::endl);
+                __m_connection->write(__m_connection->__m_fd, reply.data(), reply.size());
+            } ).detach();
+        // The reply comes from the thread
+    }
+
+    void ETDServerWrapper::do_data_channel_addr(command_type const& cmd, replies_type& replies) {
+        // Did client ask for data-channel-addr-ext?
+        // Note we do not use "sockname2str(protocolVersion)" here because this
+        // is _us_ answering a query from someone else, we are not the *proxy* for someone else
+        auto       f       = (cmd.args[0].empty() ? sockname2str_v0 : sockname2str_v1);
+        const auto entries = __m_etdserver.dataChannelAddr();
+
+        std::transform(std::begin(entries), std::end(entries), std::back_inserter(replies),
+                       [&](sockname_type const& sn) { std::ostringstream oss; oss << "OK " << f(sn); return oss.str(); });
+        // and add a final OK
+        replies.emplace_back("OK");
+    }
+
+    void ETDServerWrapper::do_remove_uuid(command_type const& cmd, replies_type& replies) {
+        // Could be remove | cancel
+        etdc::uuid_type const  uuid{ cmd.args[1].str() };
+
+        if( cmd.args[0]=="cancel" ) {
+            ETDCDEBUG(4, "ETDServerWrapper: canelling UUID " << uuid << std::endl);
+            __m_etdserver.cancel( uuid );
+            // note: this done does _not_ solicit a return
+        } else {
+            const bool removeResult = __m_etdserver.removeUUID( uuid );
+            ETDCDEBUG(4, "ETDServerWrapper: removeUUID(" << uuid << " yields " << removeResult << std::endl);
+            replies.emplace_back( removeResult ? "OK" : "ERR Failed to remove UUID" );
+        }
+    }
+
+    void ETDServerWrapper::do_protocol_version(command_type const&, replies_type& replies) {
+        replies.emplace_back("OK "+repr(__m_etdserver.protocolVersion()));
+    }
+
+    void ETDServerWrapper::do_checksum_ranges(command_type const& cmd, replies_type& replies) {
+        etdc::uuid_type const  uuid{ cmd.args[0].str() };
+        rangelist_type         ranges;
+
+        // parse_command() already checked the ranges
+        for_each_range(cmd.args[1], [&](token_type const& offset, token_type const& length) {
+                            byterange_type r;
+                            string2off_t(offset.str(), r.first);
+                            string2off_t(length.str(), r.second);
+                            ranges.push_back( r );
+                       });
+        const auto sums = __m_etdserver.checksumRanges(uuid, ranges);
+        std::transform(std::begin(sums), std::end(sums), std::back_inserter(replies),
+                       [](uint32_t crc) { return "OK " + crc32c_digest(crc); });
+        replies.emplace_back("OK");
+    }
+
+    void ETDServerWrapper::do_rollback(command_type const& cmd, replies_type& replies) {
+        etdc::uuid_type const  uuid{ cmd.args[0].str() };
+        off_t                  size;
+
+        string2off_t(cmd.args[1].str(), size);
+        __m_etdserver.rollback(uuid, size);
+        replies.emplace_back("OK");
+    }
+
+    void ETDServerWrapper::do_set_priority(command_type const& cmd, replies_type& replies) {
+        etdc::uuid_type const  uuid{ cmd.args[0].str() };
+        std::istringstream     iss( cmd.args[1].str() );
+        priority_type          prio{ priority_type::Normal };
+
+        iss >> prio;
+        ETDCASSERT(iss, "set-priority: unknown priority class '" << cmd.args[1] << "'");
+        __m_etdserver.setPriority(uuid, prio);
+        replies.emplace_back("OK");
+    }
+
+    void ETDServerWrapper::do_status(command_type const&, replies_type& replies) {
+        std::istringstream  iss( __m_etdserver.status() );
+        std::string         entry;
+
+        while( std::getline(iss, entry) )
+            replies.emplace_back( "OK " + entry );
+        replies.emplace_back("OK");
+    }
+
 
     //////////////////////////////////////////////////////////////////////
     //
@@ -1514,11 +2735,12 @@ namespace etdc {
 
         // here we enter our while loop, reading commands and (attempt) to
         // interpret them.
-        // If we go 2kB w/o seeing an actual command we call it a day
+        // If we go 4kB w/o seeing an actual command we call it a day
         // I mean, our commands are typically *very* small
+        // The transfer buffers come from the shared pool so this one need
+        // only hold the command and whatever raw bytes came with it
         const size_t            maxNoCmdSz( 4*1024 );
-        const size_t            bufSz( 10*1024*1024 );
-        std::unique_ptr<char[]> buffer(new char[bufSz]);
+        std::unique_ptr<char[]> buffer(new char[maxNoCmdSz]);
 
         bool          terminated = false;
         size_t        curPos = 0;
@@ -1570,10 +2792,17 @@ namespace etdc {
             const auto uuidptr = kvpairs.find("uuid");
             const auto szptr   = kvpairs.find("sz");
             const auto pushptr = kvpairs.find("push");
+            const auto sumptr  = kvpairs.find("sum");
+            const auto deltaptr = kvpairs.find("delta");
+            const auto zipptr  = kvpairs.find("zip");
 
             ETDCASSERT(uuidptr!=kvpairs.end(), "No UUID was sent");
             ETDCASSERT(szptr!=kvpairs.end(), "No amount was sent");
             ETDCASSERT(pushptr==kvpairs.end() || pushptr->second=="1", "push keyword may only take one specific value");
+            ETDCASSERT(sumptr==kvpairs.end() || sumptr->second==crc32c::name, "Unsupported checksum '" << sumptr->second << "'");
+            ETDCASSERT(deltaptr==kvpairs.end() || deltaptr->second=="1", "delta keyword may only take one specific value");
+            ETDCASSERT(zipptr==kvpairs.end() || find_codec(zipptr->second)!=nullptr, "Unsupported compression '" << zipptr->second << "'");
+            ETDCASSERT(zipptr==kvpairs.end() || deltaptr==kvpairs.end(), "Delta transfers cannot be compressed");
             // The size must be an off_t value
             string2off_t(szptr->second, sz);
 
@@ -1581,9 +2810,28 @@ namespace etdc {
             // Now we must grab a lock on the transfer (if there is one)
             // and do our thang
             const bool                       push = (pushptr!=kvpairs.end());
+            const bool                       checksum = (sumptr!=kvpairs.end());
+            const bool                       delta = (deltaptr!=kvpairs.end());
+            codec const* const               zip = (zipptr!=kvpairs.end() ? find_codec(zipptr->second) : nullptr);
             etdc::etd_state&                 shared_state( __m_shared_state.get() );
+            size_t                           nBuf{ 1 }, ioWindow{ 0 };
             std::unique_lock<std::mutex>     transfer_lock;
             etdc::transfermap_type::iterator xfer_ptr;
+            const auto                       offptr = kvpairs.find("offset");
+
+            // A stripe of a transfer? Those only register with the
+            // transfer, they can't hold on to its lock for the duration or
+            // else the stripes would be done one after the other
+            if( offptr!=kvpairs.end() ) {
+                off_t  offset;
+
+                ETDCASSERT(!delta, "Delta transfers cannot be striped");
+                string2off_t(offptr->second, offset);
+                this->handle_stripe(uuid_type(uuidptr->second), push, sz, offset,
+                                    command.position() + command.length(), curPos, buffer, checksum, zip);
+                curPos = 0;
+                continue;
+            }
 
             // Loop until we've got the lock acquired
             while( !transfer_lock.owns_lock() /*true*/ ) {
@@ -1615,9 +2863,15 @@ namespace etdc {
                 // and over again until we actually managed to lock the
                 // transfer, which sounds a bit wasteful.
                 // So now we test it once, after we've acquired the lock
-                ETDCASSERT( (push ? allowedReadModes.find(xfer_ptr->second->openMode)!=allowedReadModes.end() :
-                                    allowedWriteModes.find(xfer_ptr->second->openMode)!=allowedWriteModes.end()),
+                ETDCASSERT( (push  ? allowedReadModes.find(xfer_ptr->second->openMode)!=allowedReadModes.end() :
+                             delta ? xfer_ptr->second->openMode==openmode_type::Delta :
+                                     allowedWriteModes.find(xfer_ptr->second->openMode)!=allowedWriteModes.end()),
                             "The referred-to transfer's open mode (" << xfer_ptr->second->openMode << ") is not compatible with the current data request");
+                // Copy relevant values from shared state whilst we still
+                // have the lock
+                nBuf     = shared_state.nBuffer;
+                ioWindow = shared_state.ioWindow;
+
                 // move the transfer lock out of this loop;
                 // breaking out of the loop will unlock the shared state
                 transfer_lock = std::move( sh );
@@ -1631,88 +2885,191 @@ namespace etdc {
             // We found a valid command in the buffer, there may be raw bytes left following that command.
             // Therefore we initialize our read position to the end of the command we found.
             const size_t  rdPos( command.position() + command.length() ); 
+            etdc::detail::cancelfn_type isCancelled{ [&]( void ) { return shared_state.cancelled.load() || xfer_ptr->second->cancelled.load(); } };
+            throttled_fd                limit(__m_connection, detail::bw_share(shared_state, *xfer_ptr->second, *__m_connection), isCancelled);
+            detail::note_channel(*xfer_ptr->second, __m_connection, true);
+            xfer_ptr->second->total += (uint64_t)sz;
+
+            // A delta transfer talks back and forth; any raw bytes that
+            // came with the command are the start of that conversation
+            if( delta ) {
+                transferprops_type&  transfer( *xfer_ptr->second );
+                const delta_result   result = (push ? detail::delta_from(transfer, __m_connection, sz, isCancelled, ioWindow,
+                                                                         &buffer[rdPos], curPos - rdPos) :
+                                                      detail::delta_into(transfer, __m_connection, sz, isCancelled, &buffer[rdPos], curPos - rdPos));
+                ETDCASSERT(result.match, "Delta transfer failed - checksum mismatch");
+                curPos = 0;
+                continue;
+            }
             if( push )
-                ETDDataServer::push_n(sz, xfer_ptr->second->fd, __m_connection, rdPos, curPos, bufSz, buffer);
-            else
-                ETDDataServer::pull_n(sz, __m_connection, xfer_ptr->second->fd, rdPos, curPos, bufSz, buffer);
+                ETDDataServer::push_n(sz, xfer_ptr->second->fd, __m_connection, rdPos, curPos, buffer, shared_state.pool, nBuf, *xfer_ptr->second, xfer_ptr->second->advice,
+                                      [&]( void ) { return shared_state.cancelled.load() || xfer_ptr->second->cancelled.load(); }, checksum, zip);
+            else {
+                off_t   nDone{ 0 };
+                try {
+                    ETDDataServer::pull_n(sz, __m_connection, xfer_ptr->second->fd, rdPos, curPos, buffer, shared_state.pool, nBuf, *xfer_ptr->second, xfer_ptr->second->advice,
+                                          [&]( void ) { return shared_state.cancelled.load() || xfer_ptr->second->cancelled.load(); }, checksum, zip, nDone);
+                }
+                catch( ... ) {
+                    // Bytes that failed the checksum must not be resumed from
+                    if( checksum ) {
+                        std::lock_guard<std::mutex> slk( xfer_ptr->second->stripe_lock );
+                        xfer_ptr->second->stripe_done[ 0 ] = nDone;
+                    }
+                    throw;
+                }
+            }
             // This command has been served, ready to accept next
             curPos = 0;
         }
         ETDCDEBUG(4, "ETDDataServer::handle() / terminated" << std::endl);
     }
 
-    // PUSH n bytes src to dst, using buffer of size bufSz.
+    void ETDDataServer::handle_stripe(etdc::uuid_type const& uuid, bool push, off_t sz, off_t offset,
+                                      size_t rdPos, const size_t endPos, std::unique_ptr<char[]>& buf, const bool checksum,
+                                      codec const* zip) {
+        static const std::set<openmode_type> allowedWriteModes{openmode_type::New, openmode_type::OverWrite, openmode_type::Resume};
+
+        etdc::etd_state&    shared_state( __m_shared_state.get() );
+        transferprops_type* xfer{ nullptr };
+        size_t              nBuf, ioWindow;
+        bool                directIO;
+
+        ETDCASSERT(offset>=0, "Stripe offset " << offset << " is negative");
+
+        // Register as active stripe. That only requires the shared state
+        // lock; the transfer cannot be removed until we've unregistered
+        {
+            std::lock_guard<std::mutex>  lk( shared_state.lock );
+            auto                         ptr = shared_state.transfers.find( uuid );
+
+            ETDCASSERT(ptr!=shared_state.transfers.end(), "No transfer associated with the UUID");
+            ETDCASSERT( (push ? ptr->second->openMode==openmode_type::Read :
+                                allowedWriteModes.find(ptr->second->openMode)!=allowedWriteModes.end()),
+                        "The referred-to transfer's open mode (" << ptr->second->openMode << ") is not compatible with the current data request");
+            xfer     = ptr->second.get();
+            nBuf     = shared_state.nBuffer;
+            ioWindow = shared_state.ioWindow;
+            directIO = shared_state.directIO;
+
+            std::lock_guard<std::mutex>  slk( xfer->stripe_lock );
+            xfer->stripe_fds.push_back( __m_connection );
+            xfer->nStripe++;
+        }
+
+        // Whatever happens, we must unregister
+        off_t              nDone{ 0 };
+        std::exception_ptr eptr;
+
+        try {
+            etdc_fdptr                  fd( detail::reopen(*xfer, offset, directIO) );
+            io_advisor                  advice(*fd, (push ? io_advisor::direction_type::Read : io_advisor::direction_type::Write), ioWindow, xfer->path);
+            etdc::detail::cancelfn_type isCancelled{ [&]( void ) { return shared_state.cancelled.load() || xfer->cancelled.load(); } };
+            throttled_fd                limit(__m_connection, detail::bw_share(shared_state, *xfer, *__m_connection), isCancelled);
+            detail::note_channel(*xfer, __m_connection, true);
+            xfer->total += (uint64_t)sz;
+
+            ETDCDEBUG(4, "ETDDataServer::handle_stripe/" << (push ? "push " : "pull ") << sz << " bytes @" << offset << std::endl);
+            if( push )
+                ETDDataServer::push_n(sz, fd, __m_connection, rdPos, endPos, buf, shared_state.pool, nBuf, *xfer, advice, isCancelled, checksum, zip);
+            else
+                ETDDataServer::pull_n(sz, __m_connection, fd, rdPos, endPos, buf, shared_state.pool, nBuf, *xfer, advice, isCancelled, checksum, zip, nDone);
+        }
+        catch( ... ) {
+            eptr = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex>  slk( xfer->stripe_lock );
+            if( !push )
+                xfer->stripe_done[ offset ] = nDone;
+            xfer->stripe_fds.remove( __m_connection );
+            xfer->nStripe--;
+        }
+        if( eptr )
+            std::rethrow_exception( eptr );
+    }
+
+    // PUSH n bytes src to dst, using buffers from the pool.
     // the bytes between endPos and rdPos is are what was read from the
     // client, following the command. But since we're pushing we're going to 
     // ignore any extra bytes sent by the client and overwrite everything in
     // the buffer
     void ETDDataServer::push_n(size_t n, etdc::etdc_fdptr src, etdc::etdc_fdptr dst,
-                               size_t /*rdPos*/, const size_t /*endPos*/, const size_t bufSz, std::unique_ptr<char[]>& buf) {
-        while( n>0 ) {
-            // Amount of bytes to process in this iteration
-            const ssize_t nRead = std::min(n, bufSz);
-            ssize_t       aRead, nWritten{ 0 };
-
-            ETDCDEBUG(5, "ETDDataServer::push_n/pushing " << n << " bytes" << std::endl);
-
-            ETDCASSERT((aRead=src->read(src->__m_fd, &buf[0], nRead))>0,
-                       ((aRead==-1) ? std::string(etdc::strerror(errno)) : std::string("read() returned 0 - hung up?!")));
-
-            // Keep on writing untill all bytes that were read are actually written
-            while( aRead>0 ) {
-                ssize_t thisWrite;
-                ETDCASSERT((thisWrite=dst->write(dst->__m_fd, &buf[nWritten], aRead))>0,
-                           ((thisWrite==-1) ? std::string(etdc::strerror(errno)) : std::string("write should never have returned 0?!")) );
-                aRead    -= thisWrite;
-                nWritten += thisWrite;
-            }
-            n -= (size_t)nWritten;
+                               size_t /*rdPos*/, const size_t /*endPos*/, std::unique_ptr<char[]>& /*buf*/, etdc::buffer_pool& pool,
+                               const size_t nBuf, etdc::transferprops_type& transfer, etdc::io_advisor& advice,
+                               etdc::detail::cancelfn_type const& isCancelled,
+                               const bool checksum, etdc::codec const* zip) {
+        ETDCDEBUG(5, "ETDDataServer::push_n/pushing " << n << " bytes" << std::endl);
+
+        // Reading from disk overlaps with writing to the network (or the
+        // kernel does it all if it can)
+        crc32c                crc;
+        const pipeline_result result = detail::data_copy(src, dst, (off_t)n, true, zip, pool, nBuf, transfer, isCancelled, advice,
+                                                         (checksum ? &crc : nullptr));
+
+        ETDCASSERT(result.srcOK, "Failed to read bytes from source - " << result.reason);
+        ETDCASSERT(result.dstOK, "Failed to write bytes to client - " << result.reason);
+        ETDCASSERT(result.nDone==(off_t)n, "Transfer was cancelled with " << (off_t)n - result.nDone << " bytes to go");
+
+        // The client checks our digest in stead of just ACKing
+        if( checksum ) {
+            std::string reason;
+            ETDCDEBUG(5, "ETDDataServer::push_n/sending checksum, waiting for verdict " << std::endl);
+            ETDCASSERT(detail::digest_ack(*dst, crc.value(), reason), reason);
+            return;
         }
+
         // Do a read from the destination such that we know it is finished
         char ack;
         ETDCDEBUG(5, "ETDDataServer::push_n/waiting for ACK " << std::endl);
         dst->read(dst->__m_fd, &ack, 1);
         ETDCDEBUG(5, "ETDDataServer::push_n/done." << std::endl);
     }
-    // PULL n bytes from rc to dst, using buffer of size bufSz
+    // PULL n bytes from rc to dst, using buffers from the pool
     // the bytes between endPos and rdPos are what was read from the client,
-    // raw bytes immediately following the command. We flush those to the
-    // file first and then we can use the whole buffer for reading bytes.
+    // raw bytes immediately following the command. Those are the first
+    // bytes to go to the file (or the first frames, if compressed).
     void ETDDataServer::pull_n(size_t n, etdc::etdc_fdptr src, etdc::etdc_fdptr dst,
-                               size_t rdPos, const size_t endPos, const size_t bufSz, std::unique_ptr<char[]>& buf) {
+                               size_t rdPos, const size_t endPos, std::unique_ptr<char[]>& buf, etdc::buffer_pool& pool,
+                               const size_t nBuf, etdc::transferprops_type& transfer, etdc::io_advisor& advice,
+                               etdc::detail::cancelfn_type const& isCancelled,
+                               const bool checksum, etdc::codec const* zip, off_t& nDone) {
         // rdPos:  current start of read area in buf
         // endPos: passed in from above; this is where the initial command
         //         reader left off
-        // wrPos:  current end of read aread in buf
-        // bufSz:  size of buf
-        size_t  wrEnd( endPos );
-
-        while( n>0 ) {
-            // Attempt read as many bytes into our buffer as we can; there
-            // should be room for bufSz - wrEnd bytes. Amount of bytes still/already in buf = wrEnd - rdPos
-            // (thus: "n - (wrEnd - rdPos)" amount still to be read, if any; and "n - (wrEnd - rdPos)" == "n + rdPos - wrEnd"
-            ssize_t       aRead;
-            const ssize_t nRead = std::min(n + rdPos - wrEnd, bufSz - wrEnd);
-
-            ETDCDEBUG(5, "ETDDataServer::pull_n/pulling " << n << " bytes" << std::endl);
-        
-            // Attempt to read bytes. <0 is an error
-            ETDCASSERT((aRead = src->read(src->__m_fd, &buf[wrEnd], nRead))>=0, "Failed to read bytes from client - " << etdc::strerror(errno));
-            // Now we can bump wrEnd by that amount [at this point aRead might still be zero]
-            wrEnd += aRead;
-
-            // If there are no bytes to write to file that means that 0
-            // bytes were read and no bytes still left in buffer == error
-            ETDCASSERT((wrEnd - rdPos)>0, "No bytes read from client and no more bytes still left in buffer");
-
-            // Now flush the amount of available bytes to the destination
-            ETDCASSERTX(dst->write(dst->__m_fd, &buf[rdPos], wrEnd-rdPos)==ssize_t(wrEnd-rdPos));
-            n -= (wrEnd - rdPos);
-
-            // Now we are sure we can use the whole buffer for reading bytes
-            // from the client
-            wrEnd = rdPos = 0;
+        // The bytes that came in with the command go out first, the rest is
+        // read from the client by a separate thread such that the socket
+        // gets drained continuously, even when the disk is slow
+        ETDCDEBUG(5, "ETDDataServer::pull_n/pulling " << n << " bytes" << std::endl);
+        advice.preallocate( (off_t)n );
+        crc32c                crc;
+        const pipeline_result result = detail::data_copy(src, dst, (off_t)n, false, zip, pool, nBuf, transfer, isCancelled, advice,
+                                                         (checksum ? &crc : nullptr), &buf[rdPos], endPos - rdPos);
+
+        nDone = result.nDone;
+
+        // The data that came in with the command was read by handle(), not
+        // by the pipeline, so the connection's counters haven't seen it yet
+        if( src->__m_counters )
+            src->__m_counters->add(metrics::io_kind::NetRead, std::min(endPos - rdPos, (size_t)result.nWire));
+
+        ETDCASSERT(result.srcOK, "Failed to read bytes from client - " << result.reason);
+        ETDCASSERT(result.dstOK, "Failed to write bytes to destination - " << result.reason);
+        ETDCASSERT(result.nDone==(off_t)n, "Transfer was cancelled with " << (off_t)n - result.nDone << " bytes to go");
+
+        // The client's digest follows the data; if the data was short
+        // enough it came in with the command
+        if( checksum ) {
+            const size_t nCmd( endPos - rdPos );
+            const size_t nPre( nCmd>(size_t)result.nWire ? nCmd - (size_t)result.nWire : 0 );
+
+            ETDCDEBUG(5, "ETDDataServer::pull_n/got all bytes, checking checksum " << std::endl);
+            if( !detail::check_digest(*src, crc.value(), (nPre ? buf.get() + rdPos + result.nWire : nullptr), nPre) )
+                nDone = 0;
+            ETDCASSERT(nDone==(off_t)n, "Checksum mismatch - got different bytes than were sent");
+            return;
         }
+
         const char ack{ 'y' };
         ETDCDEBUG(5, "ETDDataServer::pull_n/got all bytes, sending ACK " << std::endl);
         src->write(src->__m_fd, &ack, 1);
@@ -25,18 +25,29 @@
 #include <etdc_uuid.h>
 #include <etdc_assert.h>
 #include <etdc_etd_state.h>
+#include <etdc_codec.h>
+#include <etdc_metrics.h>
+#include <etdc_cmdparse.h>
 
 // C++ headers
 #include <list>
 #include <regex>
 #include <string>
+#include <vector>
 #include <memory>
+#include <utility>
+#include <functional>
+#include <cstdint>
 #include <type_traits>
 
 namespace etdc {
     using filelist_type        = std::list<std::string>;
     using result_type          = std::tuple<etdc::uuid_type, off_t>;
     using protocolversion_type = unsigned long int;
+    // (offset, length) byte ranges of a file and their checksums
+    using byterange_type       = std::pair<off_t, off_t>;
+    using rangelist_type       = std::vector<byterange_type>;
+    using checksumlist_type    = std::vector<uint32_t>;
 
     // return the appropropritate sockname conversion function based on
     // actual protocol version (taking into account "unknownProtocolVersion")
@@ -52,18 +63,59 @@ namespace etdc {
         off_t const            __m_BytesTransferred;
         std::string const      __m_Reason; // may contain error message
         duration_type const    __m_DeltaT;
+        std::string const      __m_Digest; // "<algorithm>:<hex>" if the client asked for a checksum
+        off_t const            __m_WireBytes; // what __m_BytesTransferred took on the network, if compressed
+        metrics::latency_summary const __m_Latency; // of the system calls on the end that did the transfer; may be empty
 
         // no default objects
         xfer_result() = delete;
 
         // can only be initialized from an actual duration. we convert to
-        // "double seconds"
+        // "double seconds". Without wire bytes they're the file's bytes
         template <typename Rep, typename Period>
-        xfer_result(bool success, off_t nb, std::string const& r, std::chrono::duration<Rep, Period> const& dt):
-            __m_Finished(success), __m_BytesTransferred(nb), __m_Reason(r), __m_DeltaT(std::chrono::duration_cast<duration_type>(dt))
+        xfer_result(bool success, off_t nb, std::string const& r, std::chrono::duration<Rep, Period> const& dt,
+                    std::string const& digest = std::string(), off_t wire = -1,
+                    metrics::latency_summary const& latency = metrics::latency_summary()):
+            __m_Finished(success), __m_BytesTransferred(nb), __m_Reason(r), __m_DeltaT(std::chrono::duration_cast<duration_type>(dt)),
+            __m_Digest(digest), __m_WireBytes(wire<0 ? nb : wire), __m_Latency(latency)
         {}
     };
 
+    // Per-transfer settings the client may ask for.
+    // These travel along with the send-file command as comma separated
+    // "key=value" pairs (protocol version >= 2); only values that differ
+    // from the default are sent.
+    struct xfer_options {
+        // Split the transfer over (at most) this many data connections
+        unsigned int   nStreams{ 1 };
+        // Use all of the given data addresses at the same time in stead
+        // of the first one that connects; nStreams is then per address
+        bool           multiPath{ false };
+        // Checksum (CRC32C) the bytes on both ends of the data channel(s)
+        // and compare; the transfer fails if they differ
+        bool           checksum{ false };
+        // Only send what the destination does not already have (rsync);
+        // the destination must have been opened in Delta mode
+        bool           delta{ false };
+        // Compress the data channel(s) with this codec (see etdc_codec.h);
+        // empty = don't
+        std::string    compress{};
+        // Report the progress every this many seconds, 0 = don't. The
+        // reports go to onProgress - bytes done, current rate in bytes per
+        // second - possibly from another thread than the one doing the transfer.
+        // A remote server sends them as "PROGRESS <bytes>,<rate>" lines
+        // which the proxy hands to its own onProgress.
+        using progress_fn = std::function<void(off_t, double)>;
+        double         progress{ 0 };
+        progress_fn    onProgress{};
+        // Put the system call latency summary in the send-file reply.
+        // The proxy asks for it by itself if the remote end can do it
+        bool           latency{ false };
+    };
+
+    std::string  options2string(xfer_options const& opts);
+    xfer_options string2options(std::string const& s);
+
     // On some systems off_t is an 'alias' for long long int, on others for
     // long int. So when converting between string and off_t we must choose
     // between std::stoll or std::stol.
@@ -109,17 +161,38 @@ namespace etdc {
             //      dstUUID == UUID of the requestFileWrite on the the destination
             //  Then we attempt to connect from here to 'remote' and push 
             virtual xfer_result   sendFile(uuid_type const& /*srcUUID*/, uuid_type const& /*dstUUID*/,
-                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/) = 0;
+                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/, xfer_options const& /*opts*/) = 0;
             // In the getFile canned sequence, we are the remote end, thus:
             //      srcUUID == remote UUID [assume: requestFileRead() was issued to that instance]
             //      dstUUID == own UUID of the requestFileWrite
             //  Then we attempt to connect from here to 'remote' and ask them to push
             virtual xfer_result   getFile (uuid_type const& /*srcUUID*/, uuid_type const& /*dstUUID*/,
-                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/) = 0;
+                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/, xfer_options const& /*opts*/) = 0;
 
             virtual bool          removeUUID(etdc::uuid_type const&) = 0;
+            // One line per transfer the daemon knows of:
+            //   <uuid> key:value ... path:<path>
+            // with mode, priority, done, total (bytes), rate, avg (bytes/s),
+            // channel, rd-wait, wr-wait (seconds), wire (bytes, if
+            // different from done) and for UDT rtt (ms), loss, retransmit
+            // (packets) and send-rate (Mbps). The path goes last
             virtual std::string   status( void ) const = 0;
 
+            // Verifying what a resumed transfer builds on:
+            //   checksumRanges: CRC32C of each of the byte ranges of the
+            //                   file behind the uuid; offsets are from the
+            //                   beginning of the file
+            //   rollback:       truncate the destination file behind the
+            //                   uuid to this size, such that the transfer
+            //                   continues from there
+            virtual checksumlist_type checksumRanges(uuid_type const& /*uuid*/, rangelist_type const& /*ranges*/) = 0;
+            virtual void              rollback(uuid_type const& /*uuid*/, off_t /*size*/) = 0;
+
+            // The priority class of the transfer behind the uuid. Decides
+            // its share of the bandwidth and buffers; takes effect for
+            // data connections that start after this
+            virtual void          setPriority(uuid_type const& /*uuid*/, priority_type /*prio*/) = 0;
+
             // Cancel any transfer
             virtual void          cancel( etdc::uuid_type const& ) = 0;
 
@@ -128,7 +201,17 @@ namespace etdc {
             virtual protocolversion_type  set_protocolVersion( protocolversion_type ) = 0;
 
             // The version of the protocol this code understands
-            static const protocolversion_type currentProtocolVersion = 1;
+            //   1: cancel, extended data channel addresses, detailed send-file reply
+            //   2: send-file options, 'offset:' in data channel header (stripes)
+            //   3: 'sum:' in data channel header + digest exchange, digest in send-file reply
+            //   4: checksum-ranges, rollback
+            //   5: write-file-Delta, send-file option delta, 'delta:' in data channel header
+            //   6: send-file option compress, 'zip:' in data channel header, wire bytes in send-file reply
+            //   7: set-priority
+            //   8: status
+            //   9: send-file option progress, PROGRESS lines before the send-file reply
+            //  10: send-file option latency, 'lat=' in send-file reply
+            static const protocolversion_type currentProtocolVersion = 10;
             static const protocolversion_type unknownProtocolVersion = ~((protocolversion_type)0);
 
             virtual ~ETDServerInterface() {}
@@ -137,6 +220,15 @@ namespace etdc {
     // We can use refcounted pointers to serverinterfaces if we want to
     using etd_server_ptr = std::shared_ptr<ETDServerInterface>;
 
+    // A resumed transfer trusts that the first 'have' bytes of the
+    // destination are the same as those of the source. Checksum the last
+    // 'tail' bytes and 'nSample' blocks spread over the rest on both ends
+    // to see if that is true; return the length of the destination that
+    // can be kept, i.e. the start of the first block that differs or
+    // 'have' if they all match.
+    off_t verify_resume(etd_server_ptr src, uuid_type const& srcUUID, etd_server_ptr dst, uuid_type const& dstUUID,
+                        off_t have, off_t tail, unsigned int nSample);
+
 
     //////////////////////////////////////////////////////////////////////
     //
@@ -157,12 +249,17 @@ namespace etdc {
 
             // Canned sequence?
             virtual xfer_result   sendFile(uuid_type const& /*srcUUID*/, uuid_type const& /*dstUUID*/,
-                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/);
+                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/, xfer_options const& /*opts*/);
             virtual xfer_result   getFile (uuid_type const& /*srcUUID*/, uuid_type const& /*dstUUID*/,
-                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/);
+                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/, xfer_options const& /*opts*/);
 
             virtual bool          removeUUID(etdc::uuid_type const&);
-            virtual std::string   status( void ) const NOTIMPLEMENTED;
+            virtual std::string   status( void ) const;
+
+            virtual checksumlist_type checksumRanges(uuid_type const&, rangelist_type const&);
+            virtual void              rollback(uuid_type const&, off_t);
+
+            virtual void          setPriority(uuid_type const&, priority_type);
 
             virtual void          cancel( etdc::uuid_type const&  );
 
@@ -197,12 +294,17 @@ namespace etdc {
 
             // Canned sequence?
             virtual xfer_result   sendFile(uuid_type const& /*srcUUID*/, uuid_type const& /*dstUUID*/,
-                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/);
+                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/, xfer_options const& /*opts*/);
             virtual xfer_result   getFile (uuid_type const& /*srcUUID*/, uuid_type const& /*dstUUID*/,
-                                          off_t /*todo*/, dataaddrlist_type const& /*remote*/) NOTIMPLEMENTED;
+                                          off_t /*todo*/, dataaddrlist_type const& /*remote*/, xfer_options const& /*opts*/) NOTIMPLEMENTED;
 
             virtual bool          removeUUID(etdc::uuid_type const&);
-            virtual std::string   status( void ) const NOTIMPLEMENTED;
+            virtual std::string   status( void ) const;
+
+            virtual checksumlist_type checksumRanges(uuid_type const&, rangelist_type const&);
+            virtual void              rollback(uuid_type const&, off_t);
+
+            virtual void          setPriority(uuid_type const&, priority_type);
 
             virtual void          cancel( etdc::uuid_type const& );
 
@@ -252,6 +354,23 @@ namespace etdc {
 
             // Sucks the connection empty for commands
             void handle( void );
+
+            // One member per command; handle() dispatches to them by
+            // command_id
+            using replies_type = std::vector<std::string>;
+            using handler_fn   = void (ETDServerWrapper::*)(command_type const&, replies_type&);
+
+            void do_list(command_type const& cmd, replies_type& replies);
+            void do_write_file(command_type const& cmd, replies_type& replies);
+            void do_read_file(command_type const& cmd, replies_type& replies);
+            void do_send_file(command_type const& cmd, replies_type& replies);
+            void do_data_channel_addr(command_type const& cmd, replies_type& replies);
+            void do_remove_uuid(command_type const& cmd, replies_type& replies);
+            void do_protocol_version(command_type const& cmd, replies_type& replies);
+            void do_checksum_ranges(command_type const& cmd, replies_type& replies);
+            void do_rollback(command_type const& cmd, replies_type& replies);
+            void do_set_priority(command_type const& cmd, replies_type& replies);
+            void do_status(command_type const& cmd, replies_type& replies);
     };
 
     //////////////////////////////////////////////////////////////////////
@@ -272,11 +391,26 @@ namespace etdc {
             std::reference_wrapper<etdc::etd_state> __m_shared_state;
 
             void handle( void );
-
+            // Serve one stripe of a transfer: 'offset' bytes from the
+            // start of it
+            void handle_stripe(etdc::uuid_type const& uuid, bool push, off_t sz, off_t offset,
+                               size_t rdPos, const size_t endPos, std::unique_ptr<char[]>& buf, const bool checksum,
+                               etdc::codec const* zip);
+
+            // nDone = amount of bytes written to dst, also when things fail;
+            //         0 if checksumming was asked for and the sums differ
+            // zip   = if not nullptr, the client's side of the data goes
+            //         through this codec
             static void pull_n(size_t n, etdc::etdc_fdptr src, etdc::etdc_fdptr dst,
-                               size_t rdPos, const size_t endPos, const size_t bufSz, std::unique_ptr<char[]>& buf);
+                               size_t rdPos, const size_t endPos, std::unique_ptr<char[]>& buf, etdc::buffer_pool& pool,
+                               const size_t nBuf, etdc::transferprops_type& transfer, etdc::io_advisor& advice,
+                               etdc::detail::cancelfn_type const& isCancelled,
+                               const bool checksum, etdc::codec const* zip, off_t& nDone);
             static void push_n(size_t n, etdc::etdc_fdptr src, etdc::etdc_fdptr dst,
-                               size_t rdPos, const size_t endPos, const size_t bufSz, std::unique_ptr<char[]>& buf);
+                               size_t rdPos, const size_t endPos, std::unique_ptr<char[]>& buf, etdc::buffer_pool& pool,
+                               const size_t nBuf, etdc::transferprops_type& transfer, etdc::io_advisor& advice,
+                               etdc::detail::cancelfn_type const& isCancelled,
+                               const bool checksum, etdc::codec const* zip);
 
     };
 } // namespace etdc
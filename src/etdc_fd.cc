@@ -202,6 +202,15 @@ namespace etdc {
         __m_fd = -1;
     }
 
+    void close_shared(etdc_fd& fd) {
+        const int f = fd.__m_fd;
+
+        if( f==-1 )
+            return;
+        fd.__m_fd = -1;
+        fd.close( f );
+    }
+
     ////////////////////////////////////////////////////////////////////////
     //                        TCP/IPv4 sockets
     ////////////////////////////////////////////////////////////////////////
@@ -219,6 +228,7 @@ namespace etdc {
     }
 
     void etdc_tcp::setup_basic_fns( void ) {
+        __m_zckind = zerocopy_kind::Socket;
         // Update basic read/write/close functions
         etdc::update_fd(*this, read_fn(&::read), write_fn(&::write), close_fn(&::close),
                                getsockname_fn( [](int fd) {
@@ -234,15 +244,26 @@ namespace etdc {
     ////////////////////////////////////////////////////////////////////////
     //                        TCP/IPv6 sockets
     ////////////////////////////////////////////////////////////////////////
-    etdc_tcp6::etdc_tcp6() {
-        ETDCSYSCALL( (__m_fd=::socket(PF_INET6, SOCK_STREAM, etdc::getprotobyname("tcp").p_proto))!=-1,
-                     "failed to create TCP6 socket - " << etdc::strerror(errno) );
+    namespace detail {
+        static int tcp6_socket( void ) {
+            int  fd;
+            ETDCSYSCALL( (fd=::socket(PF_INET6, SOCK_STREAM, etdc::getprotobyname("tcp").p_proto))!=-1,
+                         "failed to create TCP6 socket - " << etdc::strerror(errno) );
+            return fd;
+        }
+    }
+
+    // Hand the socket to etdc_tcp(int) - its default c'tor would create
+    // an IPv4 socket that we'd then leak
+    etdc_tcp6::etdc_tcp6():
+        etdc_tcp( detail::tcp6_socket() )
+    {
         // Update basic read/write/close functions
         setup_basic_fns();
     }
-    etdc_tcp6::etdc_tcp6(int fd) {
-        ETDCASSERT(fd>=0, "constructing TCP6 file descriptor from invalid fd#" << fd);
-        __m_fd = fd;
+    etdc_tcp6::etdc_tcp6(int fd):
+        etdc_tcp( fd )
+    {
         // Update basic read/write/close functions
         setup_basic_fns();
     }
@@ -416,17 +437,25 @@ namespace etdc {
     etdc_udt::~etdc_udt() {}
 
     // UDT over IPv6
-    etdc_udt6::etdc_udt6() {
-        auto proto = etdc::getprotobyname("tcp");
-        if( (__m_fd=UDT::socket(PF_INET6, SOCK_STREAM, proto.p_proto))==-1 )
-            throw std::runtime_error( "etdc_udt6: " + etdc::strerror(errno) );
+    namespace detail {
+        static int udt6_socket( void ) {
+            auto proto = etdc::getprotobyname("tcp");
+            int  fd;
+            if( (fd=UDT::socket(PF_INET6, SOCK_STREAM, proto.p_proto))==-1 )
+                throw std::runtime_error( "etdc_udt6: " + etdc::strerror(errno) );
+            return fd;
+        }
+    }
 
+    // Like etdc_tcp6, don't let etdc_udt() create a socket for nothing
+    etdc_udt6::etdc_udt6():
+        etdc_udt( detail::udt6_socket() )
+    {
         setup_basic_fns();
     }
-    etdc_udt6::etdc_udt6(int fd) {
-        std::cout << "etdc_udt6::etdc_udt6(int " << fd << ")" << std::endl;
-        ETDCASSERT(fd>=0, "constructing UDT6 file descriptor from invalid fd#" << fd);
-        __m_fd = fd;
+    etdc_udt6::etdc_udt6(int fd):
+        etdc_udt( fd )
+    {
         // Update basic read/write/close functions
         setup_basic_fns();
     }
@@ -581,6 +610,38 @@ namespace etdc {
     ////////////////////////////////////////////////////////////////
     //   I/O to a non-existant file; /dev/null or /dev/zero
     ////////////////////////////////////////////////////////////////
+    bool is_devzero(std::string const& path, std::size_t* sz) {
+        static const std::string   prefix( "/dev/zero:" );
+        static const std::string   units( "kMGT" );
+
+        if( path.compare(0, prefix.size(), prefix)!=0 )
+            return false;
+
+        // at least one digit
+        auto const  digits = prefix.size();
+        auto        p      = std::min(path.find_first_not_of("0123456789", digits), path.size());
+
+        if( p==digits )
+            return false;
+
+        // optional [kMGT][i]B
+        std::size_t unit = 1;
+
+        if( p<path.size() ) {
+            const auto  u = units.find( path[p] );
+            const bool  isi( p+1<path.size() && path[p+1]=='i' );
+
+            if( u==std::string::npos )
+                return false;
+            if( path.compare(p+1+isi, std::string::npos, "B")!=0 )
+                return false;
+            unit = detail::ipow( (isi ? 1000 : 1024), (int)u+1 );
+        }
+        if( sz )
+            *sz = std::stoull(path.substr(digits, p-digits)) * unit;
+        return true;
+    }
+
     void devzeronull::setup_basic_fns( void ) {
         // Because this a pure memory file w/ no backing storage or file
         // system or O/S behind it, we must emulate the read, write, seek
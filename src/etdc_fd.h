@@ -168,6 +168,7 @@ namespace etdc {
     // Forward declare
     struct etdc_fd;
     using etdc_fdptr     = std::shared_ptr<etdc_fd>;
+    namespace metrics { class channel_counters; }
 
     namespace detail {
         struct connect_tag  {};
@@ -197,13 +198,21 @@ namespace etdc {
     using getpeername_fn = etdc::tagged<std::function<sockname_type(int)>, detail::peername_tag>;
     using setblocking_fn = std::function<void(int, bool)>;
 
+    // Some kernel objects can exchange data without it being copied
+    // through user space first. The derived classes tell what they are
+    // such that we can decide wether that's possible
+    enum class zerocopy_kind { None, File, Socket };
+
     // A wrapped file descriptor - the actual systemcalls travel with the fd
     // such that we can write functions that can call the appropriate
     // methods to their own liking (e.g. writing a big block in smaller
     // chunks or whatever
     struct etdc_fd {
 
-        int __m_fd {};
+        int           __m_fd {};
+        zerocopy_kind __m_zckind { zerocopy_kind::None };
+        // Data connections of the daemon count their bytes in here (see etdc_metrics.h)
+        std::shared_ptr<metrics::channel_counters> __m_counters {};
 
         // We pretend to be just an interface
         explicit etdc_fd();
@@ -227,6 +236,20 @@ namespace etdc {
                                                      &etdc_fd::getsockname, &etdc_fd::getpeername, &etdc_fd::setblocking,
                                                      &etdc_fd::lseek );
 
+    // Close an fd that another thread may be blocked on, such that it falls
+    // out of its system call. The fd is marked closed first: neither doing
+    // this twice nor the destructor may close the same number again - by
+    // then it could've been handed out for someone else's file or socket
+    void close_shared(etdc_fd& fd);
+
+    // Zero-copy data movement: file -> TCP socket using sendfile(2) and
+    // TCP socket -> file using splice(2) through a pipe.
+    // can_zerocopy() tells wether the combination src, dst supports it
+    // zerocopy() moves at most n bytes from src to dst and returns the
+    // amount moved, or -1 on error (errno set), like read(2)/write(2)
+    bool    can_zerocopy(etdc_fd const& src, etdc_fd const& dst);
+    ssize_t zerocopy(etdc_fd& src, etdc_fd& dst, size_t n);
+
     //////////////////////////////////////////////////////////////////
     //
     //                  Concrete derived classes
@@ -323,7 +346,34 @@ namespace etdc {
         };
     }
 
-    template <typename OpenFilePolicy = detail::FailureIsNotAnOption>
+    namespace detail {
+        // How I/O on a regular file is done:
+        //  BufferedIO = through the page cache (read(2), write(2))
+        //  DirectIO   = around the page cache (O_DIRECT) whenever the
+        //               request allows for it, i.e. buffer address,
+        //               size and file offset are all multiples of
+        //               direct_io_alignment. Anything else - typically
+        //               the last, partial, block of a file - is done
+        //               through the page cache.
+        struct BufferedIO {};
+        struct DirectIO   {};
+
+        constexpr size_t direct_io_alignment = 4096;
+
+        ssize_t direct_read(int fd, void* buf, size_t n);
+        ssize_t direct_write(int fd, const void* buf, size_t n);
+
+        inline read_fn  file_read_fn(BufferedIO const&)  { return read_fn(&::read);   }
+        inline write_fn file_write_fn(BufferedIO const&) { return write_fn(&::write); }
+        inline read_fn  file_read_fn(DirectIO const&)    { return read_fn(&direct_read);   }
+        inline write_fn file_write_fn(DirectIO const&)   { return write_fn(&direct_write); }
+        // sendfile(2) and splice(2) always go through the page cache so
+        // only buffered files can do zero-copy
+        inline zerocopy_kind file_zerocopy_kind(BufferedIO const&) { return zerocopy_kind::File; }
+        inline zerocopy_kind file_zerocopy_kind(DirectIO const&)   { return zerocopy_kind::None; }
+    }
+
+    template <typename OpenFilePolicy = detail::FailureIsNotAnOption, typename IOPolicy = detail::BufferedIO>
     struct etdc_file:
         public etdc_fd
     {
@@ -342,9 +392,10 @@ namespace etdc {
             //   I/O to a regular file
             ////////////////////////////////////////////////////////////////
             void setup_basic_fns( void ) {
+                __m_zckind = detail::file_zerocopy_kind(IOPolicy{});
                 // Update basic read/write/close functions
                 // and on files seek() makes sense!
-                etdc::update_fd(*this, read_fn(&::read), write_fn(&::write), close_fn(&::close),
+                etdc::update_fd(*this, detail::file_read_fn(IOPolicy{}), detail::file_write_fn(IOPolicy{}), close_fn(&::close),
                                        setblocking_fn(&setfdblockingmode),
                                        // we wrap the ::lseek() inna error check'n lambda dat does error check'n
                                        lseek_fn([](int fd, off_t offset, int whence) { 
@@ -361,13 +412,14 @@ namespace etdc {
               return exp < 1 ? result : ipow(base*base, exp/2, (exp % 2) ? result*base : result);
         }
     }
-    // the pattern for /dev/zero:<size>[unit]
+    // recognize /dev/zero:<size>[unit]
     // unit can be empty              [base 1]
     //             kB,  MB,  GB,  TB  [base 1024]
     //             kiB, MiB, GiB, TiB [base 1000]
-    // numbers below the regex identify submatch indices
-    static const std::regex rxDevZero("^/dev/zero:([0-9]+)(([kMGT])(i?)B)?$");
-    //                                            1       23       4
+    // if it is, and sz is not nullptr, the size in bytes is stored there.
+    // This gets asked for every file that is opened, so it does not use
+    // a std::regex
+    bool is_devzero(std::string const& path, std::size_t* sz = nullptr);
 
     // the fake file for speed testing
     // can be used for reading from ("/dev/zero:size") or writing to ("/dev/null")
@@ -384,20 +436,9 @@ namespace etdc {
             // blocking/non-blocking is completely ignored
             template <typename... Args>
             devzeronull(std::string const& path, int omode, Args...): __m_closed(false), __m_mode(omode), __m_fSize(0), __m_fPointer(0) {
-                // base and power lookups
-                static const std::map<std::string, int> exponents{ {"", 0}, {"k", 1}, {"M", 2}, {"G", 3}, {"T", 4} };
-                std::smatch             fields;
-                const bool              isDevZero( std::regex_match(path, fields, rxDevZero) );
-                ETDCASSERT(path=="/dev/null" || isDevZero,
+                // if it's /dev/zero this parses out the file size
+                ETDCASSERT(path=="/dev/null" || is_devzero(path, &__m_fSize),
                            std::string("Invalid path '") + path + "' [expect /dev/null or /dev/zero:<size>]");
-
-                // if isDevZero we must parse out the file size
-                if( isDevZero )
-                    __m_fSize = std::stoull(fields[1].str()) * /* size */
-                                (fields[2].str().empty() ?     /* any unit following? */
-                                  1 : /* nope */
-                                  detail::ipow( (fields[4].str().empty() ? 1024 : 1000), /* yes, base**exp */
-                                                etdc::get(exponents, fields[3].str(), 1) /*exponents[ fields[3].str() ]*/ /*exp*/)  );
                 setup_basic_fns();
             }
         private:
@@ -0,0 +1,187 @@
+// Implementation of the page cache advisor
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+
+// readahead(2), sync_file_range(2) and fallocate(2) are Linux specific and need _GNU_SOURCE
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <etdc_ioadvice.h>
+#include <etdc_debug.h>
+#include <etdc_assert.h>
+#include <reentrant.h>
+
+// C++ headers
+#include <algorithm>
+
+// Plain-old-C
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace etdc {
+
+    io_advisor::io_advisor(etdc_fd const& fd, direction_type dir, size_t window, std::string const& label):
+        __m_fd( fd.__m_fd ), __m_direction( dir ), __m_window( (off_t)window ), __m_label( label ),
+        __m_regular( false ), __m_enabled( false ), __m_pos( 0 ), __m_mark( 0 ), __m_flushed( 0 ), __m_eof( 0 ),
+        __m_nReadAhead( 0 ), __m_nDropped( 0 )
+    {
+        struct stat st;
+        // Only regular files have a page cache worth managing, and not if
+        // they're opened for direct I/O (those can't do zero-copy). They
+        // can still be preallocated.
+        __m_regular = (::fstat(__m_fd, &st)==0 && S_ISREG(st.st_mode));
+        __m_enabled = (__m_regular && fd.__m_zckind==zerocopy_kind::File && __m_window>0);
+    }
+
+    void io_advisor::preallocate(off_t n) {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        if( !__m_regular || n<=0 )
+            return;
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+        // Appending writes go to the end, others to the current position
+        struct stat st;
+        const int   flags = ::fcntl(__m_fd, F_GETFL);
+        const off_t pos   = ((flags!=-1 && (flags & O_APPEND)) ? (::fstat(__m_fd, &st)==0 ? st.st_size : (off_t)-1)
+                                                               : ::lseek(__m_fd, 0, SEEK_CUR));
+        if( pos==(off_t)-1 )
+            return;
+
+        // KEEP_SIZE: if the transfer fails halfway, the file size must
+        // still reflect what was actually written, or else resuming would
+        // think the file is complete
+        if( ::fallocate(__m_fd, FALLOC_FL_KEEP_SIZE, pos, n)==0 ) {
+            ETDCDEBUG(4, "io_advisor[" << __m_label << "]: preallocated " << n << " bytes at " << pos << std::endl);
+            return;
+        }
+        ETDCASSERT(errno!=ENOSPC && errno!=EDQUOT && errno!=EFBIG,
+                   "Cannot reserve " << n << " bytes for " << __m_label << " - " << etdc::strerror(errno));
+        ETDCDEBUG(4, "io_advisor[" << __m_label << "]: not preallocating - " << etdc::strerror(errno) << std::endl);
+#endif
+    }
+
+    void io_advisor::begin( void ) {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        if( !__m_enabled )
+            return;
+
+        // With O_APPEND the writes always go at the end
+        struct stat st;
+        const int   flags = ::fcntl(__m_fd, F_GETFL);
+
+        if( flags==-1 || ::fstat(__m_fd, &st)!=0 ) {
+            __m_enabled = false;
+            return;
+        }
+        __m_pos     = ((flags & O_APPEND) ? st.st_size : ::lseek(__m_fd, 0, SEEK_CUR));
+        __m_mark    = __m_flushed = __m_pos;
+        __m_eof     = st.st_size;
+
+        if( __m_direction==direction_type::Read ) {
+            (void)::posix_fadvise(__m_fd, __m_pos, 0, POSIX_FADV_SEQUENTIAL);
+            this->read_ahead();
+        }
+    }
+
+    void io_advisor::read_done(size_t n) {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        if( !__m_enabled )
+            return;
+        __m_pos += (off_t)n;
+        this->read_ahead();
+    }
+
+    void io_advisor::write_done(size_t n) {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        if( !__m_enabled )
+            return;
+        __m_pos += (off_t)n;
+        if( __m_pos - __m_mark < __m_window )
+            return;
+#ifdef __linux__
+        // Start writing back this window but don't wait for it
+        (void)::sync_file_range(__m_fd, __m_mark, __m_pos - __m_mark, SYNC_FILE_RANGE_WRITE);
+#endif
+        // The previous window has had a whole window's worth of time to
+        // make it to disk so waiting for it shouldn't take long
+        this->drop_until( __m_mark );
+        __m_mark = __m_pos;
+    }
+
+    void io_advisor::finish( void ) {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        if( !__m_enabled )
+            return;
+        if( __m_direction==direction_type::Write ) {
+            this->drop_until( __m_pos );
+            __m_mark = __m_pos;
+        }
+        if( __m_direction==direction_type::Read ) {
+            ETDCDEBUG(2, "io_advisor[" << __m_label << "]: requested read ahead of " << __m_nReadAhead << " bytes" << std::endl);
+        } else {
+            ETDCDEBUG(2, "io_advisor[" << __m_label << "]: dropped " << __m_nDropped << " bytes from the page cache" << std::endl);
+        }
+    }
+
+    uint64_t io_advisor::readahead( void ) const {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        return __m_nReadAhead;
+    }
+
+    uint64_t io_advisor::dropped( void ) const {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        return __m_nDropped;
+    }
+
+    // Request the next window once the reader has consumed half of the
+    // current one. Lock must be held.
+    void io_advisor::read_ahead( void ) {
+        __m_mark = std::max(__m_mark, __m_pos);
+        if( __m_mark>=__m_eof || (__m_mark - __m_pos)>=__m_window/2 )
+            return;
+
+        const off_t n = std::min(__m_window, __m_eof - __m_mark);
+#ifdef __linux__
+        (void)::readahead(__m_fd, __m_mark, (size_t)n);
+#else
+        (void)::posix_fadvise(__m_fd, __m_mark, n, POSIX_FADV_WILLNEED);
+#endif
+        __m_mark       += n;
+        __m_nReadAhead += (uint64_t)n;
+    }
+
+    // Make sure all bytes up to 'end' are on disk and then tell the kernel
+    // it may forget about them. Lock must be held.
+    void io_advisor::drop_until(off_t end) {
+        if( end<=__m_flushed )
+            return;
+        const off_t n = end - __m_flushed;
+#ifdef __linux__
+        (void)::sync_file_range(__m_fd, __m_flushed, n,
+                                SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+        (void)::fdatasync(__m_fd);
+#endif
+        (void)::posix_fadvise(__m_fd, __m_flushed, n, POSIX_FADV_DONTNEED);
+        __m_flushed   = end;
+        __m_nDropped += (uint64_t)n;
+    }
+}
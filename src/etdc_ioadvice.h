@@ -0,0 +1,103 @@
+// Tell the kernel how we're going to use a file's page cache
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef ETDC_IOADVICE_H
+#define ETDC_IOADVICE_H
+
+// Own includes
+#include <etdc_fd.h>
+
+// C++ headers
+#include <mutex>
+#include <string>
+#include <cstdint>
+
+// Plain-old-C
+#include <sys/types.h>
+
+namespace etdc {
+
+    // Per-transfer page cache policy for a regular file.
+    //
+    // Reading: the file is marked as being read sequentially and we
+    //          explicitly ask the kernel to read 'window' bytes ahead of
+    //          the read pointer, such that the disk is kept busy whilst
+    //          we're waiting for the network.
+    // Writing: every 'window' bytes the kernel is asked to start writing
+    //          the dirty pages back to disk. The window before that one is
+    //          waited for and then dropped from the page cache. At most
+    //          2 x window bytes are dirty or in flight at any time, in stead
+    //          of whatever the VM thinks is a good idea - which, for a TB
+    //          sized file, means huge stalls when it finally starts flushing.
+    //
+    // Objects that aren't regular files (sockets, /dev/zero:..., /dev/null)
+    // or a window of 0 make the advisor do nothing at all - except for
+    // preallocate(), which only cares about the former.
+    // The read_done()/write_done() functions should be called after each
+    // successful read/write of n bytes at the file's current position;
+    // begin() and finish() around each series of those.
+    class io_advisor {
+        public:
+            enum class direction_type { Read, Write };
+
+            io_advisor() = delete;
+            io_advisor(io_advisor const&) = delete;
+            io_advisor& operator=(io_advisor const&) = delete;
+
+            io_advisor(etdc_fd const& fd, direction_type dir, size_t window, std::string const& label);
+
+            // (Re)start at the file's current position
+            void begin( void );
+            void read_done(size_t n);
+            void write_done(size_t n);
+            // Writes back + drops whatever is left and logs what we've done
+            void finish( void );
+
+            // Reserve disk space for n more bytes at the write position
+            // without changing the file's size, such that the file system
+            // can allocate contiguous extents for it. Throws if there is
+            // no room for it; file systems that don't support it are
+            // silently ignored.
+            void preallocate(off_t n);
+
+            // The statistics
+            uint64_t readahead( void ) const;
+            uint64_t dropped( void ) const;
+
+        private:
+            const int            __m_fd;
+            const direction_type __m_direction;
+            const off_t          __m_window;
+            const std::string    __m_label;
+            bool                 __m_regular, __m_enabled;
+            // pos     = where the next read/write will happen
+            // mark    = reading: read ahead was requested up to here
+            //           writing: write back was requested up to here
+            // flushed = writing: everything before this has been dropped
+            // eof     = reading: no point in reading ahead beyond this
+            off_t                __m_pos, __m_mark, __m_flushed, __m_eof;
+            uint64_t             __m_nReadAhead, __m_nDropped;
+            mutable std::mutex   __m_mutex;
+
+            void read_ahead( void );
+            void drop_until(off_t end);
+    };
+}
+
+#endif // ETDC_IOADVICE_H
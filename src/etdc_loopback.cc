@@ -0,0 +1,126 @@
+// Implementation of the in-process loopback daemon
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <etdc_loopback.h>
+#include <etdc_debug.h>
+#include <etdc_thread.h>
+#include <etdc_signal.h>
+#include <etdc_etdserver.h>
+
+// C++ headers
+#include <memory>
+#include <vector>
+#include <exception>
+#include <stdexcept>
+#include <functional>
+
+// Plain-old-C
+#include <pthread.h>
+
+namespace etdc {
+
+    using handler_fn = std::function<void(etdc::etdc_fdptr, etdc::etd_state&)>;
+
+    void loopback_signal_handler(int) { }
+
+    // Accept a client on pServer and hand it to 'handle', after starting the
+    // next acceptor. This is etd's command_server_thread/data_server_thread,
+    // including the way they get cancelled
+    static void server_thread(etdc::etdc_fdptr pServer, etdc::etd_state& shared_state, handler_fn handle) {
+        pthread_t                       thisThread = ::pthread_self();
+        etdc::UnBlock                   s({loopbackKillSignal});
+        etdc::etdc_fdptr                pClient{ pServer };
+        etdc::cancellist_type::iterator ourCancellation;
+
+        etdc::install_handler(loopback_signal_handler, {loopbackKillSignal});
+        {
+            etdc::scoped_lock lk(shared_state.lock);
+            ourCancellation = shared_state.cancellations.insert( shared_state.cancellations.end(),
+                    [&](void) {
+                        etdc::etdc_fdptr  myFD = std::atomic_load(&pClient);
+                        myFD->close(myFD->__m_fd);
+                        ::pthread_kill(thisThread, loopbackKillSignal); }
+                );
+        }
+
+        try {
+            if( !std::atomic_load(&shared_state.cancelled) )
+                std::atomic_store(&pClient, pServer->accept(pServer->__m_fd));
+            if( !std::atomic_load(&shared_state.cancelled) )
+                shared_state.add_thread(&server_thread, pServer, std::ref(shared_state), handle);
+            if( !pClient )
+                throw std::runtime_error("No incoming client?!");
+            if( get_protocol(pClient->getpeername(pClient->__m_fd)).find("tcp")!=std::string::npos )
+                etdc::setsockopt(pClient->__m_fd, etdc::tcp_nodelay{true});
+            handle(pClient, shared_state);
+        }
+        catch( std::exception const& e ) {
+            ETDCDEBUG(1, "server thread got exception: " << e.what() << std::endl);
+        }
+        catch( ... ) {
+            ETDCDEBUG(1, "server thread got unknown exception" << std::endl);
+        }
+        if( !std::atomic_load(&shared_state.cancelled) ) {
+            etdc::scoped_lock  lk(shared_state.lock);
+            shared_state.cancellations.erase( ourCancellation );
+        }
+    }
+
+    static etdc::etdc_fdptr mk_listener(std::string const& proto, std::string const& host, size_t bufSize) {
+        auto  srvr = etdc::detail::server_defaults.find( proto )->second();
+
+        etdc::detail::update_srv( srvr, etdc::host_type(host), etdc::any_port,
+                                  etdc::so_rcvbuf{ bufSize }, etdc::so_sndbuf{ bufSize },
+                                  etdc::udt_rcvbuf{ 32*1024*1024 }, etdc::blocking_type{ true } );
+        return mk_server(proto, srvr);
+    }
+
+    loopback_daemon::loopback_daemon(std::string const& dataProto, std::string const& host, size_t bufSize, size_t nData):
+        __m_cmdProto( dataProto.back()=='6' ? "tcp6" : "tcp" )
+    {
+        __m_state.bufSize = bufSize;
+        __m_state.pool.configure(bufSize, 0, etdc::buffer_pool::backing_type::Normal);
+
+        std::vector<etdc::etdc_fdptr>  data;
+        for(size_t i=0; i<nData; i++)
+            data.push_back( mk_listener(dataProto, host, bufSize) );
+        auto  cmd  = mk_listener(__m_cmdProto, host, bufSize);
+
+        for(auto const& d: data)
+            __m_state.dataaddrs.push_back( d->getsockname(d->__m_fd) );
+        __m_cmdPort = get_port( cmd->getsockname(cmd->__m_fd) );
+
+        for(auto const& d: data)
+            __m_state.add_thread(&server_thread, d, std::ref(__m_state),
+                                 handler_fn([](etdc::etdc_fdptr fd, etdc::etd_state& st) { etdc::ETDDataServer(fd, std::ref(st)); }));
+        __m_state.add_thread(&server_thread, cmd, std::ref(__m_state),
+                             handler_fn([](etdc::etdc_fdptr fd, etdc::etd_state& st) { etdc::ETDServerWrapper(fd, std::ref(st)); }));
+    }
+
+    // The state's destructor waits for all threads to be gone. Unlike
+    // in etd, threads may still be finishing (a command thread whose
+    // client just hung up) so hold the lock such that they can't take
+    // themselves off the list whilst we go through it
+    loopback_daemon::~loopback_daemon() {
+        etdc::scoped_lock  lk( __m_state.lock );
+        std::atomic_store(&__m_state.cancelled, true);
+        for(auto& cancel: __m_state.cancellations)
+            cancel();
+    }
+}
@@ -0,0 +1,74 @@
+// A daemon on the loopback interface, inside the calling process
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+//
+// The command server, data server and their ETDServerWrapper and
+// ETDDataServer threads, just like etd runs them, for programs that want
+// to talk to a daemon through an ETDProxy without needing one on the
+// network (etdbench, etdtest).
+#ifndef ETDC_LOOPBACK_H
+#define ETDC_LOOPBACK_H
+
+// Own includes
+#include <etdc_fd.h>
+#include <etdc_etd_state.h>
+
+// C++ headers
+#include <string>
+
+// Plain-old-C
+#include <signal.h>
+
+namespace etdc {
+
+    // The servers' threads get kicked out of blocking calls with this
+    // one. A program using loopback_daemon must have a handler installed
+    // for it (see loopback_signal_handler) and, in the thread that talks
+    // to the daemon, have it unblocked.
+    constexpr int loopbackKillSignal = SIGUSR1;
+
+    void loopback_signal_handler(int);
+
+    // A daemon with one command and nData data servers on 'host'. The
+    // command channel is TCP over the same address family as the data
+    // channels
+    class loopback_daemon {
+        public:
+            loopback_daemon(std::string const& dataProto, std::string const& host, size_t bufSize, size_t nData = 1);
+            loopback_daemon(loopback_daemon const&) = delete;
+            loopback_daemon& operator=(loopback_daemon const&) = delete;
+
+            // Cancels all servers and waits for their threads to be gone
+            ~loopback_daemon();
+
+            std::string const& cmdProto( void ) const { return __m_cmdProto; }
+            etdc::port_type    cmdPort( void ) const  { return __m_cmdPort; }
+
+            // Settings like directIO can be changed before the first
+            // transfer
+            etdc::etd_state&   state( void )          { return __m_state; }
+
+        private:
+            const std::string  __m_cmdProto;
+            etdc::port_type    __m_cmdPort;
+            etdc::etd_state    __m_state;
+    };
+}
+
+#endif // ETDC_LOOPBACK_H
@@ -0,0 +1,339 @@
+// Implementation of the daemon's counters and their OpenMetrics exposition
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <etdc_metrics.h>
+#include <etdc_etd_state.h>
+#include <etdc_sciprint.h>
+#include <etdc_assert.h>
+
+// C++ headers
+#include <set>
+#include <map>
+#include <mutex>
+#include <limits>
+#include <utility>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+namespace etdc { namespace metrics {
+
+    namespace detail {
+        static char const* const io_kind_name[nIOKind]  = { "disk_read", "disk_write", "net_read", "net_write" };
+        static char const* const io_kind_human[nIOKind] = { "disk read", "disk write", "net read", "net write" };
+        static char const* const io_kind_code[nIOKind]  = { "dr", "dw", "nr", "nw" };
+
+        // What a thread has done, written by that thread only
+        struct thread_block {
+            std::atomic<uint64_t>  calls{ 0 }, bytes{ 0 }, nsec{ 0 };
+            std::atomic<uint64_t>  bucket[nBucket] = {};
+        };
+        // The same, summed over threads
+        struct io_totals {
+            uint64_t  calls{ 0 }, bytes{ 0 }, nsec{ 0 };
+            uint64_t  bucket[nBucket] = {};
+
+            void add(thread_block const& tb) {
+                calls += tb.calls.load( std::memory_order_relaxed );
+                bytes += tb.bytes.load( std::memory_order_relaxed );
+                nsec  += tb.nsec.load( std::memory_order_relaxed );
+                for(unsigned int b=0; b<nBucket; b++)
+                    bucket[b] += tb.bucket[b].load( std::memory_order_relaxed );
+            }
+        };
+        using inout_type = std::pair<uint64_t, uint64_t>;
+
+        // Everybody registers here. What's gone is added to the totals
+        struct registry_type {
+            std::mutex                            lock;
+            std::set<thread_block const*>         threads[nIOKind];
+            io_totals                             retired[nIOKind];
+            std::map<std::string, inout_type>     channels;
+            std::set<channel_counters const*>     connections;
+            std::map<std::string, uint64_t>       accepted, failed;
+        };
+
+        // Never destroyed: threads may exit after main() has returned
+        static registry_type& registry( void ) {
+            static registry_type* const r = new registry_type();
+            return *r;
+        }
+
+        // A thread's blocks come and go with the thread
+        struct thread_slot {
+            thread_block  block[nIOKind];
+
+            thread_slot() {
+                registry_type&              r( registry() );
+                std::lock_guard<std::mutex> lk( r.lock );
+                for(unsigned int k=0; k<nIOKind; k++)
+                    r.threads[k].insert( &block[k] );
+            }
+            ~thread_slot() {
+                registry_type&              r( registry() );
+                std::lock_guard<std::mutex> lk( r.lock );
+                for(unsigned int k=0; k<nIOKind; k++) {
+                    r.retired[k].add( block[k] );
+                    r.threads[k].erase( &block[k] );
+                }
+            }
+        };
+
+        static thread_block& local(io_kind kind) {
+            static thread_local thread_slot slot;
+            return slot.block[ (unsigned int)kind ];
+        }
+
+        // Label values may contain anything but these three must be escaped
+        static std::string escape(std::string const& s) {
+            std::string rv;
+            for(auto c: s) {
+                if( c=='\\' || c=='"' )
+                    rv.push_back( '\\' );
+                if( c=='\n' )
+                    rv.append( "\\n" );
+                else
+                    rv.push_back( c );
+            }
+            return rv;
+        }
+
+        static void family(std::ostream& os, char const* name, char const* type, char const* help) {
+            os << "# TYPE " << name << " " << type << "\n"
+               << "# HELP " << name << " " << help << "\n";
+        }
+    }
+
+    io_kind kind_of(etdc_fd const& fd, bool reading) {
+        const bool net( dynamic_cast<etdc_tcp const*>(&fd)!=nullptr || dynamic_cast<etdc_udt const*>(&fd)!=nullptr );
+        return net ? (reading ? io_kind::NetRead : io_kind::NetWrite) : (reading ? io_kind::DiskRead : io_kind::DiskWrite);
+    }
+
+    double upper_bound(unsigned int b) {
+        return b<nBucket-1 ? (double)(uint64_t(1) << b) * 1e-6 : std::numeric_limits<double>::infinity();
+    }
+
+    void record(io_kind kind, uint64_t nsec, ssize_t n) {
+        detail::thread_block& tb( detail::local(kind) );
+
+        tb.calls.fetch_add( 1, std::memory_order_relaxed );
+        tb.nsec.fetch_add( nsec, std::memory_order_relaxed );
+        tb.bucket[ bucket_of(nsec) ].fetch_add( 1, std::memory_order_relaxed );
+        if( n>0 )
+            tb.bytes.fetch_add( (uint64_t)n, std::memory_order_relaxed );
+    }
+
+    latency_summary::latency_summary(io_histogram const& h) {
+        for(unsigned int k=0; k<nIOKind; k++) {
+            uint64_t     counts[nBucket], cumulative{ 0 };
+            entry_type&  e( entry[k] );
+
+            for(unsigned int b=0; b<nBucket; b++)
+                e.calls += (counts[b] = h.bucket[k][b].load(std::memory_order_relaxed));
+            // The smallest bucket that has at least that fraction of the calls
+            for(unsigned int b=0; b<nBucket; b++) {
+                cumulative += counts[b];
+                if( counts[b] )
+                    e.max = b;
+                if( cumulative*2<e.calls )
+                    e.p50 = b + 1;
+                if( cumulative*100<e.calls*99 )
+                    e.p99 = b + 1;
+            }
+        }
+    }
+
+    bool latency_summary::empty( void ) const {
+        for(auto const& e: entry)
+            if( e.calls )
+                return false;
+        return true;
+    }
+
+    std::ostream& operator<<(std::ostream& os, latency_summary const& ls) {
+        const auto  fmt = [](unsigned int b) {
+            return b<nBucket-1 ? sciprint(upper_bound(b), "s", std::setprecision(3)) : std::string(">") + sciprint(upper_bound(b-1), "s", std::setprecision(3));
+        };
+        bool        first{ true };
+
+        for(unsigned int k=0; k<nIOKind; k++) {
+            latency_summary::entry_type const& e( ls.entry[k] );
+            if( e.calls==0 )
+                continue;
+            os << (first ? "" : ", ") << detail::io_kind_human[k] << " p50 < " << fmt(e.p50) << " p99 < " << fmt(e.p99)
+               << " max < " << fmt(e.max) << " (" << e.calls << " calls)";
+            first = false;
+        }
+        return os;
+    }
+
+    std::string encode(latency_summary const& ls) {
+        std::ostringstream  oss;
+
+        for(unsigned int k=0; k<nIOKind; k++) {
+            latency_summary::entry_type const& e( ls.entry[k] );
+            if( e.calls )
+                oss << (oss.tellp()>0 ? "/" : "") << detail::io_kind_code[k] << ":" << e.calls << ":" << e.p50 << ":" << e.p99 << ":" << e.max;
+        }
+        return oss.str();
+    }
+
+    latency_summary decode(std::string const& s) {
+        latency_summary     rv;
+        std::istringstream  iss( s );
+        std::string         item;
+
+        while( std::getline(iss, item, '/') ) {
+            std::istringstream           is( item );
+            std::string                  code;
+            latency_summary::entry_type  e;
+            char                         c1, c2, c3;
+
+            ETDCASSERT(std::getline(is, code, ':') && (is >> e.calls >> c1 >> e.p50 >> c2 >> e.p99 >> c3 >> e.max) &&
+                       c1==':' && c2==':' && c3==':' && e.p50<nBucket && e.p99<nBucket && e.max<nBucket,
+                       "latency summary: invalid entry '" << item << "'");
+            auto const  k = std::find(detail::io_kind_code, detail::io_kind_code + nIOKind, code) - detail::io_kind_code;
+            ETDCASSERT(k<nIOKind, "latency summary: unknown kind '" << code << "'");
+            rv.entry[k] = e;
+        }
+        return rv;
+    }
+
+    channel_counters::channel_counters(std::string const& channel):
+        __m_channel( channel ), __m_in( 0 ), __m_out( 0 )
+    {
+        detail::registry_type&      r( detail::registry() );
+        std::lock_guard<std::mutex> lk( r.lock );
+        r.connections.insert( this );
+    }
+
+    channel_counters::~channel_counters() {
+        detail::registry_type&      r( detail::registry() );
+        std::lock_guard<std::mutex> lk( r.lock );
+        detail::inout_type&         tot( r.channels[__m_channel] );
+
+        tot.first  += __m_in.load();
+        tot.second += __m_out.load();
+        r.connections.erase( this );
+    }
+
+    void accepted(std::string const& kind) {
+        detail::registry_type&      r( detail::registry() );
+        std::lock_guard<std::mutex> lk( r.lock );
+        r.accepted[kind]++;
+    }
+
+    void connect_failed(std::string const& peer) {
+        detail::registry_type&      r( detail::registry() );
+        std::lock_guard<std::mutex> lk( r.lock );
+        r.failed[peer]++;
+    }
+
+    std::string exposition(etd_state& state) {
+        detail::registry_type&                    r( detail::registry() );
+        detail::io_totals                         io[nIOKind];
+        std::map<std::string, detail::inout_type> channels;
+        std::map<std::string, uint64_t>           accepted, failed;
+        std::map<std::string, unsigned int>       transfers{ {"send", 0}, {"receive", 0} };
+        unsigned int                              nThread;
+        std::ostringstream                        os;
+
+        // Take a snapshot of everything first
+        {
+            std::lock_guard<std::mutex> lk( r.lock );
+            for(unsigned int k=0; k<nIOKind; k++) {
+                io[k] = r.retired[k];
+                for(auto tb: r.threads[k])
+                    io[k].add( *tb );
+            }
+            channels = r.channels;
+            for(auto cc: r.connections) {
+                detail::inout_type& tot( channels[cc->__m_channel] );
+                tot.first  += cc->__m_in.load( std::memory_order_relaxed );
+                tot.second += cc->__m_out.load( std::memory_order_relaxed );
+            }
+            accepted = r.accepted;
+            failed   = r.failed;
+        }
+        {
+            std::lock_guard<std::mutex> lk( state.lock );
+            for(auto const& t: state.transfers)
+                transfers[ t.second->openMode==openmode_type::Read ? "send" : "receive" ]++;
+            nThread = state.n_threads;
+        }
+
+        os << std::setprecision(9);
+
+        detail::family(os, "etd_data_bytes", "counter", "Bytes that went over the data channels");
+        for(auto const& c: channels) {
+            const std::string  proto( detail::escape(c.first.substr(0, c.first.find('/'))) );
+            const std::string  chan( detail::escape(c.first) );
+            os << "etd_data_bytes_total{protocol=\"" << proto << "\",channel=\"" << chan << "\",direction=\"in\"} " << c.second.first << "\n"
+               << "etd_data_bytes_total{protocol=\"" << proto << "\",channel=\"" << chan << "\",direction=\"out\"} " << c.second.second << "\n";
+        }
+
+        detail::family(os, "etd_io_bytes", "counter", "Bytes read and written by the system calls on the data path");
+        for(unsigned int k=0; k<nIOKind; k++)
+            os << "etd_io_bytes_total{op=\"" << detail::io_kind_name[k] << "\"} " << io[k].bytes << "\n";
+
+        detail::family(os, "etd_io_seconds", "histogram", "Duration of the read and write system calls on the data path");
+        for(unsigned int k=0; k<nIOKind; k++) {
+            uint64_t  cumulative{ 0 };
+            for(unsigned int b=0; b<nBucket; b++) {
+                cumulative += io[k].bucket[b];
+                os << "etd_io_seconds_bucket{op=\"" << detail::io_kind_name[k] << "\",le=\"";
+                if( b<nBucket-1 )
+                    os << upper_bound(b);
+                else
+                    os << "+Inf";
+                os << "\"} " << cumulative << "\n";
+            }
+            os << "etd_io_seconds_sum{op=\"" << detail::io_kind_name[k] << "\"} " << (double)io[k].nsec/1e9 << "\n"
+               << "etd_io_seconds_count{op=\"" << detail::io_kind_name[k] << "\"} " << io[k].calls << "\n";
+        }
+
+        detail::family(os, "etd_transfers_active", "gauge", "Transfers the daemon currently has open");
+        for(auto const& t: transfers)
+            os << "etd_transfers_active{direction=\"" << t.first << "\"} " << t.second << "\n";
+
+        detail::family(os, "etd_connections_accepted", "counter", "Connections accepted on the command and data channels");
+        for(auto const& a: accepted)
+            os << "etd_connections_accepted_total{kind=\"" << detail::escape(a.first) << "\"} " << a.second << "\n";
+
+        detail::family(os, "etd_connect_failures", "counter", "Failed attempts to connect to a remote data channel");
+        for(auto const& f: failed)
+            os << "etd_connect_failures_total{peer=\"" << detail::escape(f.first) << "\"} " << f.second << "\n";
+
+        detail::family(os, "etd_buffer_pool_blocks", "gauge", "Blocks in the shared buffer pool, 0 if there is none");
+        os << "etd_buffer_pool_blocks{state=\"free\"} " << state.pool.available() << "\n"
+           << "etd_buffer_pool_blocks{state=\"used\"} " << state.pool.capacity() - state.pool.available() << "\n";
+        detail::family(os, "etd_buffer_pool_block_size_bytes", "gauge", "Size of the blocks of the buffer pool");
+        os << "etd_buffer_pool_block_size_bytes " << state.pool.blockSize() << "\n";
+        detail::family(os, "etd_buffer_pool_overflow_bytes", "gauge", "Transfer buffers currently allocated outside the exhausted buffer pool");
+        os << "etd_buffer_pool_overflow_bytes " << state.pool.overflowBytes() << "\n";
+        detail::family(os, "etd_buffer_pool_overflows", "counter", "Leases that allocated their buffers outside the exhausted buffer pool");
+        os << "etd_buffer_pool_overflows_total " << state.pool.overflowCount() << "\n";
+
+        detail::family(os, "etd_threads", "gauge", "Threads the daemon runs to serve its channels and transfers");
+        os << "etd_threads " << nThread << "\n";
+
+        os << "# EOF\n";
+        return os.str();
+    }
+} }
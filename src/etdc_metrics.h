@@ -0,0 +1,137 @@
+// Counters and histograms of the daemon, for scraping in OpenMetrics format
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef ETDC_METRICS_H
+#define ETDC_METRICS_H
+
+// Own includes
+#include <etdc_fd.h>
+
+// C++ headers
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <iostream>
+
+// Plain-old-C
+#include <sys/types.h>
+
+namespace etdc {
+
+    struct etd_state;
+
+    // The data path counts what it does in blocks of counters that have
+    // only one writer: the thread doing the system call, or, for bytes
+    // per data channel, the connection. Writers do relaxed atomic adds and
+    // never take a lock; a scrape adds up all blocks. Blocks of threads
+    // and connections that are gone are added to a running total first
+    // so counters never go back.
+    namespace metrics {
+
+        // What a system call on the data path was
+        enum class io_kind : unsigned int { DiskRead = 0, DiskWrite, NetRead, NetWrite };
+        static const unsigned int nIOKind = 4;
+
+        // Which kind a read (or write) on fd is; sockets are network, the
+        // rest counts as disk
+        io_kind kind_of(etdc_fd const& fd, bool reading);
+
+        // Durations go in log2 buckets: shorter than 1µs, 2µs, 4µs, ..
+        // 2^(nBucket-2)µs and one for anything longer. upper_bound() is
+        // in seconds, infinite for the last bucket
+        static const unsigned int nBucket = 28;
+
+        inline unsigned int bucket_of(uint64_t nsec) {
+            unsigned int b{ 0 };
+            for(uint64_t us=nsec/1000; us && b<nBucket-1; us>>=1)
+                b++;
+            return b;
+        }
+        double upper_bound(unsigned int b);
+
+        // Add a system call that took nsec nanoseconds and returned n to
+        // this thread's block
+        void record(io_kind kind, uint64_t nsec, ssize_t n);
+
+        // The durations of one transfer's system calls, by kind. All of
+        // the transfer's threads add to it, one relaxed atomic add per call
+        struct io_histogram {
+            std::atomic<uint64_t>  bucket[nIOKind][nBucket] = {};
+
+            void add(io_kind kind, uint64_t nsec) {
+                bucket[(unsigned int)kind][bucket_of(nsec)].fetch_add(1, std::memory_order_relaxed);
+            }
+        };
+
+        // What the client and the logs get to see of such a histogram:
+        // per kind the number of calls and the buckets that the median,
+        // the 99th percentile and the slowest call fall in
+        struct latency_summary {
+            struct entry_type {
+                uint64_t      calls{ 0 };
+                unsigned int  p50{ 0 }, p99{ 0 }, max{ 0 };
+            };
+            entry_type  entry[nIOKind];
+
+            latency_summary() = default;
+            explicit latency_summary(io_histogram const& h);
+
+            bool empty( void ) const;
+        };
+        // "disk read p50 < 1.02 ms p99 < 65.5 ms max < 131 ms (42 calls), net write ..."
+        std::ostream& operator<<(std::ostream& os, latency_summary const& ls);
+        // For in the send-file reply: "<kind>:<calls>:<p50>:<p99>:<max>"
+        // joined by '/', kinds without calls left out; throws if decode
+        // doesn't like what it gets
+        std::string     encode(latency_summary const& ls);
+        latency_summary decode(std::string const& s);
+
+        // The bytes that went over one data connection, labelled with the
+        // data channel (e.g. "tcp/10.0.0.1:8008") it used
+        class channel_counters {
+            public:
+                explicit channel_counters(std::string const& channel);
+                channel_counters(channel_counters const&) = delete;
+                channel_counters& operator=(channel_counters const&) = delete;
+                ~channel_counters();
+
+                void add(io_kind kind, size_t n) {
+                    (kind==io_kind::NetRead ? __m_in : __m_out).fetch_add(n, std::memory_order_relaxed);
+                }
+
+            private:
+                friend std::string exposition(etd_state& state);
+
+                const std::string      __m_channel;
+                std::atomic<uint64_t>  __m_in, __m_out;
+        };
+        using channel_counters_ptr = std::shared_ptr<channel_counters>;
+
+        // Events outside of the data path
+        void accepted(std::string const& kind);
+        void connect_failed(std::string const& peer);
+
+        // All of the above plus what the daemon's state says about
+        // transfers, the buffer pool and threads, in OpenMetrics text format
+        std::string exposition(etd_state& state);
+    }
+}
+
+#endif // ETDC_METRICS_H
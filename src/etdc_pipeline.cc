@@ -0,0 +1,663 @@
+// Implementation of the pipelined copy
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <etdc_pipeline.h>
+#include <etdc_metrics.h>
+#include <etdc_thread.h>
+#include <etdc_assert.h>
+#include <reentrant.h>
+
+// C++ headers
+#include <map>
+#include <list>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <exception>
+#include <algorithm>
+#include <functional>
+
+// Plain-old-C
+#include <errno.h>
+#include <string.h>
+
+namespace etdc {
+
+    namespace detail {
+        // A block in flight: where the bytes are and how many of them are valid
+        struct block_type {
+            unsigned char*  data;
+            size_t          n;
+        };
+
+        // Let the kernel move the bytes in chunks of at most blockSz.
+        // Returns false if it turned out the kernel couldn't do it after all
+        // and nothing was moved, such that the caller can fall back to
+        // copying through user space.
+        static bool zerocopy_n(etdc_fd& src, etdc_fd& dst, off_t todo, size_t blockSz,
+                               detail::cancelfn_type const& isCancelled, pipeline_result& rv,
+                               io_advisor* srcAdvice, io_advisor* dstAdvice, xfer_meter* meter) {
+            const off_t  nStart( rv.nDone );
+            const io_tap rdTap(src, true), wrTap(dst, false);
+
+            while( rv.nDone<todo && !isCancelled() ) {
+                const ssize_t n = timed(meter, &xfer_meter::wrWait, wrTap,
+                                        [&]( void ) { return etdc::zerocopy(src, dst, std::min((size_t)(todo - rv.nDone), blockSz)); });
+
+                if( n<=0 ) {
+                    if( n==-1 && rv.nDone==nStart && (errno==EINVAL || errno==ENOSYS || errno==EOPNOTSUPP) ) {
+                        ETDCDEBUG(4, "pipelined_copy/zero-copy not possible - " << etdc::strerror(errno) << std::endl);
+                        return false;
+                    }
+                    // Can't really tell which side failed if the kernel
+                    // moves the data
+                    if( n==0 )
+                        rv.srcOK = false;
+                    else
+                        rv.dstOK = false;
+                    rv.reason = (n==-1 ? std::string(etdc::strerror(errno)) : std::string("read() returned 0 - hung up"));
+                    break;
+                }
+                rdTap.bytes( n );
+                rv.nDone += (off_t)n;
+                count(meter, &xfer_meter::nDone, (size_t)n);
+                count(meter, &xfer_meter::nWire, (size_t)n);
+                if( srcAdvice )
+                    srcAdvice->read_done( (size_t)n );
+                if( dstAdvice )
+                    dstAdvice->write_done( (size_t)n );
+            }
+            return true;
+        }
+
+        ////////////////////////////////////////////////////////////////////
+        //            The frames of compressed_copy/decompressed_copy
+        ////////////////////////////////////////////////////////////////////
+        static const size_t   zip_framesize  = 1024*1024;
+        static const size_t   zip_headersize = 8;
+        static const uint32_t zip_compressed = 0x80000000;
+        static const unsigned zip_maxskip    = 64;
+
+        static void put_u32(unsigned char* p, uint32_t v) {
+            for(int i=3; i>=0; i--, v>>=8)
+                p[i] = (unsigned char)(v & 0xff);
+        }
+        static uint32_t get_u32(unsigned char const* p) {
+            uint32_t  v{ 0 };
+            for(int i=0; i<4; i++)
+                v = (v << 8) | p[i];
+            return v;
+        }
+
+        // A frame has two buffers of zip_framesize bytes, both with room
+        // for a frame header in front: what the reader got (file data or
+        // a frame's payload) and what the worker made of it
+        struct frame_type {
+            unsigned char*  in;
+            unsigned char*  out;
+            size_t          nData{ 0 }, nPayload{ 0 };
+            bool            packed{ false };
+            uint64_t        seq{ 0 };
+        };
+        using framelist_type = std::vector<frame_type>;
+
+        static const size_t zip_slotsize = 2*(zip_headersize + zip_framesize);
+
+        // (De)compressing is CPU bound so one thread per core, but not
+        // all of a big machine for one transfer
+        static unsigned int zip_threads( void ) {
+            return std::max(std::min(std::thread::hardware_concurrency(), 8u), 1u);
+        }
+
+        // Enough frames to keep all threads busy, from as few pool blocks
+        // as possible. If the pool's blocks are too small to hold a frame
+        // we allocate them ourselves. No frames = cancelled.
+        static framelist_type mk_frames(buffer_lease& storage, std::unique_ptr<unsigned char[]>& own, buffer_pool& pool,
+                                        size_t nBlock, unsigned int nThread, cancelfn_type const& isCancelled, unsigned int priority) {
+            const size_t                nWant( 2*nThread + 2 );
+            const size_t                perBlock( pool.blockSize()/zip_slotsize );
+            std::vector<unsigned char*> slots;
+            framelist_type              rv;
+
+            if( perBlock ) {
+                storage = pool.lease(std::max(std::min(nBlock, (nWant + perBlock - 1)/perBlock), (size_t)1), isCancelled, priority);
+                for(size_t b=0; b<storage.size(); b++)
+                    for(size_t i=0; i<perBlock && slots.size()<nWant; i++)
+                        slots.push_back( storage[b] + i*zip_slotsize );
+            } else if( !isCancelled() ) {
+                own.reset( new unsigned char[nWant * zip_slotsize] );
+                for(size_t i=0; i<nWant; i++)
+                    slots.push_back( &own[i*zip_slotsize] );
+            }
+            for(auto slot: slots) {
+                rv.push_back( frame_type{} );
+                rv.back().in  = slot + zip_headersize;
+                rv.back().out = rv.back().in + zip_framesize + zip_headersize;
+            }
+            return rv;
+        }
+
+        using readfn_type  = std::function<bool(frame_type&)>;
+        using workfn_type  = std::function<void(frame_type&)>;
+
+        // The reader fills frames until it returns false, nThread workers
+        // transform them and the writer, in the caller's thread, gets them
+        // in the order the reader produced them. It returns false to stop.
+        // An exception in any of them stops everything and is rethrown.
+        static void run_frames(framelist_type& frames, unsigned int nThread, readfn_type const& reader,
+                               workfn_type const& worker, readfn_type const& writer, cancelfn_type const& isCancelled) {
+            bounded_queue<frame_type*> emptyq( frames.size() ), workq( frames.size() ), doneq( frames.size() );
+            std::mutex                 errLock;
+            std::exception_ptr         eptr;
+            std::atomic<unsigned int>  nWorking( nThread );
+            std::list<std::thread>     threads;
+
+            const auto fail = [&]( void ) {
+                {
+                    std::lock_guard<std::mutex> lk( errLock );
+                    if( !eptr )
+                        eptr = std::current_exception();
+                }
+                emptyq.abort();
+                workq.abort();
+                doneq.abort();
+            };
+
+            for(auto& f: frames)
+                emptyq.push( &f );
+
+            threads.emplace_back( etdc::thread([&]( void ) {
+                    try {
+                        frame_type* f;
+                        for(uint64_t seq=0; !isCancelled() && emptyq.pop(f); seq++) {
+                            if( !reader(*f) )
+                                break;
+                            f->seq = seq;
+                            if( !workq.push(f) )
+                                break;
+                        }
+                    }
+                    catch( ... ) {
+                        fail();
+                    }
+                    workq.close();
+                }) );
+            for(unsigned int t=0; t<nThread; t++)
+                threads.emplace_back( etdc::thread([&]( void ) {
+                        try {
+                            frame_type* f;
+                            while( workq.pop(f) ) {
+                                worker(*f);
+                                if( !doneq.push(f) )
+                                    break;
+                            }
+                        }
+                        catch( ... ) {
+                            fail();
+                        }
+                        if( --nWorking==0 )
+                            doneq.close();
+                    }) );
+
+            try {
+                std::map<uint64_t, frame_type*> pending;
+                uint64_t                        next{ 0 };
+                frame_type*                     f;
+                bool                            stop{ false };
+
+                while( !stop && doneq.pop(f) ) {
+                    pending.emplace(f->seq, f);
+                    for(auto p = pending.begin(); !stop && p!=pending.end() && p->first==next; p = pending.begin(), next++) {
+                        frame_type* g = p->second;
+
+                        pending.erase( p );
+                        stop = (isCancelled() || !writer(*g));
+                        emptyq.push( g );
+                    }
+                }
+            }
+            catch( ... ) {
+                fail();
+            }
+            emptyq.abort();
+            workq.abort();
+            doneq.abort();
+            for(auto& t: threads)
+                t.join();
+            if( eptr )
+                std::rethrow_exception( eptr );
+        }
+    }
+
+    pipeline_result pipelined_copy(etdc_fdptr src, etdc_fdptr dst, off_t todo,
+                                   buffer_pool& pool, size_t nBlock, detail::cancelfn_type const& isCancelled,
+                                   io_advisor* srcAdvice, io_advisor* dstAdvice,
+                                   char const* prefix, size_t nPrefix, crc32c* checksum, unsigned int priority,
+                                   xfer_meter* meter) {
+        using block_type = detail::block_type;
+
+        ETDCASSERT(nBlock>0, "pipelined_copy: need at least one block");
+
+        const size_t                     blockSz( pool.blockSize() );
+        const detail::io_tap             rdTap(*src, true), wrTap(*dst, false);
+        pipeline_result                  rv;
+        off_t                            nSkip{ 0 };
+
+        nPrefix = std::min(nPrefix, (size_t)todo);
+
+        // Let the advisors know where we start and, whichever way we leave,
+        // that we're done
+        auto finish = [=]( void ) {
+            if( srcAdvice )
+                srcAdvice->finish();
+            if( dstAdvice )
+                dstAdvice->finish();
+        };
+        if( srcAdvice )
+            srcAdvice->begin();
+        if( dstAdvice )
+            dstAdvice->begin();
+
+        // If the kernel can move the bytes for us we don't need to copy
+        // them through our buffers at all. Only the prefix has to be
+        // written by hand, completely, before the kernel may take over.
+        if( !checksum && etdc::can_zerocopy(*src, *dst) ) {
+            ETDCDEBUG(4, "pipelined_copy/attempting zero-copy of " << todo - (off_t)nPrefix << " bytes" << std::endl);
+            while( rv.nDone<(off_t)nPrefix ) {
+                const ssize_t thisWrite = detail::timed(meter, &xfer_meter::wrWait, wrTap,
+                                                        [&]( void ) { return dst->write(dst->__m_fd, prefix + rv.nDone, nPrefix - (size_t)rv.nDone); });
+
+                if( thisWrite<=0 ) {
+                    rv.reason = ((thisWrite==-1) ? std::string(etdc::strerror(errno)) : std::string("write should never have returned 0"));
+                    rv.dstOK  = false;
+                    rv.nWire  = rv.nDone;
+                    finish();
+                    return rv;
+                }
+                rv.nDone += (off_t)thisWrite;
+                detail::count(meter, &xfer_meter::nDone, (size_t)thisWrite);
+                detail::count(meter, &xfer_meter::nWire, (size_t)thisWrite);
+                if( dstAdvice )
+                    dstAdvice->write_done( (size_t)thisWrite );
+            }
+            if( detail::zerocopy_n(*src, *dst, todo, blockSz, isCancelled, rv, srcAdvice, dstAdvice, meter) ) {
+                finish();
+                rv.nWire = rv.nDone;
+                return rv;
+            }
+            // Fall back to copying; the prefix is already taken care of
+            nSkip    = rv.nDone;
+            todo    -= nSkip;
+            rv.nDone = 0;
+            nPrefix  = 0;
+        }
+
+        // Only now do we need buffers. The pool takes care of alignment
+        buffer_lease              storage( pool.lease(nBlock, isCancelled, priority) );
+
+        if( storage.size()==0 ) {
+            ETDCDEBUG(4, "pipelined_copy/cancelled whilst waiting for buffers" << std::endl);
+            rv.nDone += nSkip;
+            rv.nWire  = rv.nDone;
+            rv.srcOK  = false;
+            rv.reason = "cancelled whilst waiting for buffers";
+            finish();
+            return rv;
+        }
+        nBlock = storage.size();
+
+        bounded_queue<block_type> emptyq( nBlock ), fullq( nBlock );
+
+        // Initially all blocks are up for grabs by the reader
+        for(size_t i=0; i<nBlock; i++)
+            emptyq.push( block_type{storage[i], 0} );
+
+        // The reader keeps its findings to itself; we only look at them
+        // after it's been joined
+        bool               rdOK{ true };
+        std::string        rdReason;
+        std::exception_ptr rdException, wrException;
+
+        std::thread reader = etdc::thread([&]( void ) {
+                off_t      left( todo );
+                size_t     nPre( nPrefix );
+                block_type blk;
+                try {
+                    while( left>0 && !isCancelled() && emptyq.pop(blk) ) {
+                        const size_t n = std::min((size_t)left, blockSz);
+
+                        // The first block starts with the prefix, if any
+                        blk.n = std::min(nPre, n);
+                        if( blk.n ) {
+                            ::memcpy(blk.data, prefix, blk.n);
+                            prefix += blk.n;
+                            nPre   -= blk.n;
+                        }
+
+                        // Fill the block as much as we can; a socket may
+                        // deliver less than asked for
+                        while( blk.n<n ) {
+                            const ssize_t nRead = detail::timed(meter, &xfer_meter::rdWait, rdTap,
+                                                                [&]( void ) { return src->read(src->__m_fd, blk.data + blk.n, n - blk.n); });
+
+                            if( nRead<=0 ) {
+                                rdReason = ((nRead==-1) ? std::string(etdc::strerror(errno)) : std::string("read() returned 0 - hung up"));
+                                rdOK     = false;
+                                break;
+                            }
+                            blk.n += (size_t)nRead;
+                            if( srcAdvice )
+                                srcAdvice->read_done( (size_t)nRead );
+                        }
+                        // Whatever we did manage to read must be passed on
+                        left -= (off_t)blk.n;
+                        if( checksum )
+                            checksum->update(blk.data, blk.n);
+                        if( (blk.n>0 && !fullq.push(blk)) || !rdOK )
+                            break;
+                    }
+                }
+                catch( ... ) {
+                    rdException = std::current_exception();
+                }
+                // Let the writer know there's nothing coming after this
+                fullq.close();
+            });
+
+        try {
+            block_type blk;
+
+            while( fullq.pop(blk) && !isCancelled() ) {
+                size_t nWritten{ 0 };
+
+                // Keep on writing untill all bytes that were read are actually written
+                while( nWritten<blk.n ) {
+                    const ssize_t thisWrite = detail::timed(meter, &xfer_meter::wrWait, wrTap,
+                                                            [&]( void ) { return dst->write(dst->__m_fd, blk.data + nWritten, blk.n - nWritten); });
+
+                    if( thisWrite<=0 ) {
+                        rv.reason = ((thisWrite==-1) ? std::string(etdc::strerror(errno)) : std::string("write should never have returned 0"));
+                        rv.dstOK  = false;
+                        break;
+                    }
+                    nWritten += (size_t)thisWrite;
+                    detail::count(meter, &xfer_meter::nDone, (size_t)thisWrite);
+                    detail::count(meter, &xfer_meter::nWire, (size_t)thisWrite);
+                    if( dstAdvice )
+                        dstAdvice->write_done( (size_t)thisWrite );
+                }
+                rv.nDone += (off_t)nWritten;
+                if( !rv.dstOK )
+                    break;
+                // Hand the block back to the reader
+                emptyq.push( blk );
+            }
+        }
+        catch( ... ) {
+            wrException = std::current_exception();
+        }
+        // However we got here, the reader must not stay blocked on us
+        emptyq.abort();
+        fullq.abort();
+        reader.join();
+        finish();
+
+        if( wrException )
+            std::rethrow_exception( wrException );
+        if( rdException )
+            std::rethrow_exception( rdException );
+
+        rv.nDone += nSkip;
+        rv.nWire  = rv.nDone;
+
+        // Report a read failure only if the write side didn't fail first
+        if( !rdOK ) {
+            rv.srcOK = false;
+            if( rv.dstOK )
+                rv.reason = rdReason;
+        }
+        return rv;
+    }
+
+    pipeline_result compressed_copy(etdc_fdptr src, etdc_fdptr dst, off_t todo, codec const& zip,
+                                    buffer_pool& pool, size_t nBlock, detail::cancelfn_type const& isCancelled,
+                                    io_advisor* srcAdvice, crc32c* checksum, unsigned int priority, xfer_meter* meter) {
+        using frame_type = detail::frame_type;
+
+        const unsigned int               nThread( detail::zip_threads() );
+        const detail::io_tap             rdTap(*src, true), wrTap(*dst, false);
+        pipeline_result                  rv;
+        buffer_lease                     storage;
+        std::unique_ptr<unsigned char[]> own;
+        detail::framelist_type           frames( detail::mk_frames(storage, own, pool, nBlock, nThread, isCancelled, priority) );
+
+        if( frames.empty() ) {
+            rv.srcOK  = false;
+            rv.reason = "cancelled whilst waiting for buffers";
+            return rv;
+        }
+        if( srcAdvice )
+            srcAdvice->begin();
+
+        // Only the reader touches these
+        off_t        left( todo );
+        bool         rdOK{ true };
+        std::string  rdReason;
+        // Shared by the workers: which frames to try to compress
+        zip_backoff  backOff( detail::zip_maxskip );
+
+        const auto reader = [&](frame_type& f) {
+            if( left==0 || !rdOK )
+                return false;
+            const size_t n( (size_t)std::min(left, (off_t)detail::zip_framesize) );
+
+            for(f.nData=0; f.nData<n; ) {
+                const ssize_t nRead = detail::timed(meter, &xfer_meter::rdWait, rdTap,
+                                                    [&]( void ) { return src->read(src->__m_fd, f.in + f.nData, n - f.nData); });
+
+                if( nRead<=0 ) {
+                    rdReason = ((nRead==-1) ? std::string(etdc::strerror(errno)) : std::string("read() returned 0 - hung up"));
+                    rdOK     = false;
+                    break;
+                }
+                f.nData += (size_t)nRead;
+                if( srcAdvice )
+                    srcAdvice->read_done( (size_t)nRead );
+            }
+            left -= (off_t)f.nData;
+            if( checksum )
+                checksum->update(f.in, f.nData);
+            return f.nData>0;
+        };
+        const auto worker = [&](frame_type& f) {
+            const bool  attempt( backOff.attempt() );
+
+            f.nPayload = (attempt ? zip.compress(f.in, f.nData, f.out, f.nData - f.nData/64) : 0);
+            f.packed   = (f.nPayload>0);
+            if( attempt )
+                backOff.result( f.packed );
+            if( !f.packed )
+                f.nPayload = f.nData;
+            unsigned char* hdr( (f.packed ? f.out : f.in) - detail::zip_headersize );
+            detail::put_u32(hdr, (uint32_t)f.nPayload | (f.packed ? detail::zip_compressed : 0));
+            detail::put_u32(hdr + 4, (uint32_t)f.nData);
+        };
+        const auto writer = [&](frame_type& f) {
+            unsigned char const* p( (f.packed ? f.out : f.in) - detail::zip_headersize );
+            size_t               n( detail::zip_headersize + f.nPayload );
+
+            while( n ) {
+                const ssize_t nWritten = detail::timed(meter, &xfer_meter::wrWait, wrTap, [&]( void ) { return dst->write(dst->__m_fd, p, n); });
+
+                if( nWritten<=0 ) {
+                    rv.reason = ((nWritten==-1) ? std::string(etdc::strerror(errno)) : std::string("write should never have returned 0"));
+                    rv.dstOK  = false;
+                    return false;
+                }
+                p        += nWritten;
+                n        -= (size_t)nWritten;
+                rv.nWire += (off_t)nWritten;
+                detail::count(meter, &xfer_meter::nWire, (size_t)nWritten);
+            }
+            rv.nDone += (off_t)f.nData;
+            detail::count(meter, &xfer_meter::nDone, f.nData);
+            return true;
+        };
+
+        try {
+            detail::run_frames(frames, nThread, reader, worker, writer, isCancelled);
+        }
+        catch( ... ) {
+            if( srcAdvice )
+                srcAdvice->finish();
+            throw;
+        }
+        if( srcAdvice )
+            srcAdvice->finish();
+        ETDCDEBUG(4, "compressed_copy/" << rv.nDone << " bytes as " << rv.nWire << " over the wire [" << zip.name() << ", " << nThread << " threads]" << std::endl);
+
+        if( !rdOK ) {
+            rv.srcOK = false;
+            if( rv.dstOK )
+                rv.reason = rdReason;
+        }
+        return rv;
+    }
+
+    pipeline_result decompressed_copy(etdc_fdptr src, etdc_fdptr dst, off_t todo, codec const& zip,
+                                      buffer_pool& pool, size_t nBlock, detail::cancelfn_type const& isCancelled,
+                                      io_advisor* dstAdvice, char const* prefix, size_t nPrefix, crc32c* checksum,
+                                      unsigned int priority, xfer_meter* meter) {
+        using frame_type = detail::frame_type;
+
+        const unsigned int               nThread( detail::zip_threads() );
+        const detail::io_tap             rdTap(*src, true), wrTap(*dst, false);
+        pipeline_result                  rv;
+        buffer_lease                     storage;
+        std::unique_ptr<unsigned char[]> own;
+        detail::framelist_type           frames( detail::mk_frames(storage, own, pool, nBlock, nThread, isCancelled, priority) );
+
+        if( frames.empty() ) {
+            rv.srcOK  = false;
+            rv.reason = "cancelled whilst waiting for buffers";
+            return rv;
+        }
+        if( dstAdvice )
+            dstAdvice->begin();
+
+        // Only the reader touches these
+        off_t        left( todo ), nWire{ 0 };
+        bool         rdOK{ true };
+        std::string  rdReason;
+
+        // Exactly n bytes, the prefix first. Never more: whatever follows
+        // the frames is not ours
+        const auto get = [&](unsigned char* p, size_t n) {
+            const size_t m( std::min(n, nPrefix) );
+
+            ::memcpy(p, prefix, m);
+            prefix  += m;
+            nPrefix -= m;
+            for(size_t got=m; got<n; ) {
+                const ssize_t nRead = detail::timed(meter, &xfer_meter::rdWait, rdTap, [&]( void ) { return src->read(src->__m_fd, p + got, n - got); });
+
+                if( nRead<=0 ) {
+                    rdReason = ((nRead==-1) ? std::string(etdc::strerror(errno)) : std::string("read() returned 0 - hung up"));
+                    rdOK     = false;
+                    return false;
+                }
+                got += (size_t)nRead;
+            }
+            nWire += (off_t)n;
+            detail::count(meter, &xfer_meter::nWire, n);
+            return true;
+        };
+        const auto reader = [&](frame_type& f) {
+            unsigned char hdr[ detail::zip_headersize ];
+
+            if( left==0 || !rdOK || !get(hdr, sizeof(hdr)) )
+                return false;
+            const uint32_t w( detail::get_u32(hdr) );
+
+            f.packed   = ((w & detail::zip_compressed)!=0);
+            f.nPayload = (w & ~detail::zip_compressed);
+            f.nData    = detail::get_u32(hdr + 4);
+            if( f.nData==0 || f.nData>detail::zip_framesize || (off_t)f.nData>left ||
+                f.nPayload>detail::zip_framesize || (!f.packed && f.nPayload!=f.nData) ) {
+                rdReason = "invalid frame header - " + zip.name() + " payload " + std::to_string(f.nPayload) + " for " + std::to_string(f.nData) + " bytes";
+                rdOK     = false;
+                return false;
+            }
+            if( !get(f.in, f.nPayload) )
+                return false;
+            left -= (off_t)f.nData;
+            return true;
+        };
+        const auto worker = [&](frame_type& f) {
+            if( f.packed ) {
+                ETDCASSERT(zip.decompress(f.in, f.nPayload, f.out, f.nData)==f.nData,
+                           "decompressed_copy/" << zip.name() << " frame decompressed to a different size than announced");
+            }
+        };
+        const auto writer = [&](frame_type& f) {
+            unsigned char const* p( f.packed ? f.out : f.in );
+
+            if( checksum )
+                checksum->update(p, f.nData);
+            for(size_t n=f.nData; n; ) {
+                const ssize_t nWritten = detail::timed(meter, &xfer_meter::wrWait, wrTap, [&]( void ) { return dst->write(dst->__m_fd, p, n); });
+
+                if( nWritten<=0 ) {
+                    rv.reason = ((nWritten==-1) ? std::string(etdc::strerror(errno)) : std::string("write should never have returned 0"));
+                    rv.dstOK  = false;
+                    return false;
+                }
+                p        += nWritten;
+                n        -= (size_t)nWritten;
+                rv.nDone += (off_t)nWritten;
+                detail::count(meter, &xfer_meter::nDone, (size_t)nWritten);
+                if( dstAdvice )
+                    dstAdvice->write_done( (size_t)nWritten );
+            }
+            return true;
+        };
+
+        try {
+            detail::run_frames(frames, nThread, reader, worker, writer, isCancelled);
+        }
+        catch( ... ) {
+            if( dstAdvice )
+                dstAdvice->finish();
+            throw;
+        }
+        if( dstAdvice )
+            dstAdvice->finish();
+        rv.nWire = nWire;
+        ETDCDEBUG(4, "decompressed_copy/" << rv.nDone << " bytes from " << rv.nWire << " over the wire [" << zip.name() << ", " << nThread << " threads]" << std::endl);
+
+        if( !rdOK ) {
+            rv.srcOK = false;
+            if( rv.dstOK )
+                rv.reason = rdReason;
+        }
+        return rv;
+    }
+}
@@ -0,0 +1,230 @@
+// Overlap reading from one etdc_fd with writing to another
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef ETDC_PIPELINE_H
+#define ETDC_PIPELINE_H
+
+// Own includes
+#include <etdc_fd.h>
+#include <etdc_ioadvice.h>
+#include <etdc_bufferpool.h>
+#include <etdc_checksum.h>
+#include <etdc_codec.h>
+#include <etdc_metrics.h>
+
+// C++ headers
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <condition_variable>
+
+// Plain-old-C
+#include <sys/types.h>
+
+namespace etdc {
+
+    // A bounded, blocking FIFO. Producers block when it's full, consumers
+    // block when it's empty.
+    //   close(): nothing can be pushed anymore but consumers may still
+    //            drain whatever was left in the queue
+    //   abort(): both push() and pop() fail immediately, wakes up everyone
+    template <typename T>
+    class bounded_queue {
+        public:
+            explicit bounded_queue(size_t capacity):
+                __m_capacity( capacity ), __m_closed( false ), __m_aborted( false )
+            {}
+
+            // Returns false if the element could not be added
+            bool push(T const& t) {
+                std::unique_lock<std::mutex> lk( __m_mutex );
+                __m_condition.wait(lk, [&]( void ) { return __m_closed || __m_aborted || __m_queue.size()<__m_capacity; });
+                if( __m_closed || __m_aborted )
+                    return false;
+                __m_queue.push_back( t );
+                __m_condition.notify_all();
+                return true;
+            }
+
+            // Returns false if there was nothing (more) to be had
+            bool pop(T& t) {
+                std::unique_lock<std::mutex> lk( __m_mutex );
+                __m_condition.wait(lk, [&]( void ) { return __m_closed || __m_aborted || !__m_queue.empty(); });
+                if( __m_aborted || __m_queue.empty() )
+                    return false;
+                t = __m_queue.front();
+                __m_queue.pop_front();
+                __m_condition.notify_all();
+                return true;
+            }
+
+            void close( void ) {
+                std::lock_guard<std::mutex> lk( __m_mutex );
+                __m_closed = true;
+                __m_condition.notify_all();
+            }
+
+            void abort( void ) {
+                std::lock_guard<std::mutex> lk( __m_mutex );
+                __m_aborted = true;
+                __m_condition.notify_all();
+            }
+
+        private:
+            const size_t            __m_capacity;
+            bool                    __m_closed, __m_aborted;
+            std::deque<T>           __m_queue;
+            std::mutex              __m_mutex;
+            std::condition_variable __m_condition;
+    };
+
+    // What came out of a pipelined copy.
+    //   nDone   = amount of bytes succesfully written to the destination
+    //   nWire   = amount of bytes that went over the network for that;
+    //             only different from nDone if they went through a codec
+    //   srcOK   = false if reading from the source failed
+    //   dstOK   = false if writing to the destination failed
+    //   reason  = if either of the above is false, this says why
+    struct pipeline_result {
+        off_t        nDone{ 0 };
+        off_t        nWire{ 0 };
+        bool         srcOK{ true }, dstOK{ true };
+        std::string  reason{};
+    };
+
+    // Live counters of the copies of one transfer, to be looked at from
+    // another thread whilst the data moves. The data loops only do
+    // relaxed atomic adds, once per system call; no locks.
+    //   nDone, nWire:   as in pipeline_result, summed over all copies
+    //   rdWait, wrWait: nanoseconds spent in src's read resp. dst's write;
+    //                   with zero-copy the kernel's time counts as writing
+    //   latency:        how long each of those system calls took
+    struct xfer_meter {
+        std::atomic<uint64_t>  nDone{ 0 }, nWire{ 0 }, rdWait{ 0 }, wrWait{ 0 };
+        metrics::io_histogram  latency;
+    };
+
+    namespace detail {
+        // What the daemon's metrics should know about the system calls on
+        // one side of a copy: disk or network and, for a data connection,
+        // where to count its bytes (see etdc_metrics.h). Without an fd
+        // only the kind is known, e.g. for a plain file descriptor.
+        struct io_tap {
+            io_tap(etdc_fd const& fd, bool reading):
+                kind( metrics::kind_of(fd, reading) ), counters( fd.__m_counters )
+            {}
+            explicit io_tap(metrics::io_kind k):
+                kind( k ), counters()
+            {}
+
+            void bytes(ssize_t n) const {
+                if( n>0 && counters )
+                    counters->add(kind, (size_t)n);
+            }
+
+            const metrics::io_kind              kind;
+            const metrics::channel_counters_ptr counters;
+        };
+
+        // Do a system call on one side of a copy, add the time it took to
+        // the meter's counter (if not nullptr) and histogram, if there is
+        // a meter, and tell the metrics
+        template <typename F>
+        ssize_t timed(xfer_meter* meter, std::atomic<uint64_t> xfer_meter::* counter, io_tap const& tap, F const& f) {
+            const std::chrono::steady_clock::time_point start( std::chrono::steady_clock::now() );
+            const ssize_t                               rv( f() );
+            const uint64_t                              dt( (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() );
+
+            if( meter ) {
+                if( counter )
+                    (meter->*counter).fetch_add( dt, std::memory_order_relaxed );
+                meter->latency.add( tap.kind, dt );
+            }
+            metrics::record(tap.kind, dt, rv);
+            tap.bytes( rv );
+            return rv;
+        }
+        inline void count(xfer_meter* meter, std::atomic<uint64_t> xfer_meter::* counter, size_t n) {
+            if( meter )
+                (meter->*counter).fetch_add( n, std::memory_order_relaxed );
+        }
+    }
+
+    // Copy 'todo' bytes from src to dst. A separate reader thread fills
+    // blocks of (at most) pool.blockSize() bytes from src and passes them
+    // on to the caller's thread, which writes them to dst, through a ring
+    // of nBlock buffers leased from the pool. This way reading block N+1
+    // overlaps with writing block N and the throughput approaches
+    // min(read, write) in stead of the harmonic mean of the two, which is
+    // what a serial read/write loop gets you.
+    // Both sides check isCancelled() before each block.
+    // If the combination of src and dst supports zero-copy (see
+    // etdc_fd.h) the kernel moves the bytes and no buffers are used.
+    // The pool may hand out fewer than nBlock buffers, if it is smaller
+    // than that, and we may have to wait for them if other transfers hold
+    // them; if the transfer is cancelled whilst waiting nothing is copied.
+    // If nPrefix>0 the first nPrefix of the 'todo' bytes are taken from
+    // 'prefix' rather than read from src - e.g. the data that came in with
+    // a command - such that all blocks but the last remain full sized.
+    // The advisors, if given, are kept informed of the progress on src
+    // resp. dst (see etdc_ioadvice.h).
+    // If a checksum is given, all bytes that were read (including the
+    // prefix) are added to it by the reader thread. The kernel can't do
+    // that for us so then zero-copy is not attempted.
+    // The buffers are leased with the given priority (see etdc_bufferpool.h).
+    // The progress is added to the meter, if there is one.
+    pipeline_result pipelined_copy(etdc_fdptr src, etdc_fdptr dst, off_t todo,
+                                   buffer_pool& pool, size_t nBlock, detail::cancelfn_type const& isCancelled,
+                                   io_advisor* srcAdvice = nullptr, io_advisor* dstAdvice = nullptr,
+                                   char const* prefix = nullptr, size_t nPrefix = 0, crc32c* checksum = nullptr,
+                                   unsigned int priority = 0, xfer_meter* meter = nullptr);
+
+    // The same, but with the network side going through a codec (see
+    // etdc_codec.h). The data travels in frames of at most 1MiB:
+    //      u32 payload size (| 0x80000000 if compressed), u32 data size
+    //      <payload>
+    // big endian. A frame that doesn't get at least 1/64th smaller is sent
+    // as-is and after such a frame the next 1, 2, 4, .., 64 frames are sent
+    // as-is without even trying, until one compresses again; data that
+    // doesn't compress costs next to nothing.
+    // A reader thread feeds the frames to a number of threads that
+    // (de)compress them in parallel, the caller's thread writes them in
+    // the original order. The frame buffers are carved out of blocks
+    // from the pool.
+    //   compressed_copy:   src is the file, dst the network
+    //   decompressed_copy: src is the network, dst the file. The frames
+    //                      start with the nPrefix bytes at prefix; on
+    //                      return nWire says how many of prefix + src
+    //                      belonged to them
+    // nDone counts the bytes of the file, nWire those on the network. The
+    // checksum, if given, is of the file's bytes.
+    pipeline_result compressed_copy(etdc_fdptr src, etdc_fdptr dst, off_t todo, codec const& zip,
+                                    buffer_pool& pool, size_t nBlock, detail::cancelfn_type const& isCancelled,
+                                    io_advisor* srcAdvice = nullptr, crc32c* checksum = nullptr, unsigned int priority = 0,
+                                    xfer_meter* meter = nullptr);
+    pipeline_result decompressed_copy(etdc_fdptr src, etdc_fdptr dst, off_t todo, codec const& zip,
+                                      buffer_pool& pool, size_t nBlock, detail::cancelfn_type const& isCancelled,
+                                      io_advisor* dstAdvice = nullptr, char const* prefix = nullptr, size_t nPrefix = 0,
+                                      crc32c* checksum = nullptr, unsigned int priority = 0, xfer_meter* meter = nullptr);
+}
+
+#endif // ETDC_PIPELINE_H
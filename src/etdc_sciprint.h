@@ -112,6 +112,7 @@
 #include <sstream>
 #include <iomanip>
 #include <locale>
+#include <memory>
 #include <functional>
 #include <type_traits>
 
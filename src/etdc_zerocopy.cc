@@ -0,0 +1,124 @@
+// Move data between file descriptors without copying it through user space
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+
+// sendfile(2) and splice(2) are Linux-only and splice(2) is only declared
+// if _GNU_SOURCE is defined, which the Makefile explicitly undefines. So
+// in this translation unit - and only here - we ask for the GNU extensions
+// before any system header gets a chance to look at the feature macros.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <etdc_fd.h>
+
+// Plain-old-C
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+namespace etdc {
+
+#if defined(__linux__) && defined(SPLICE_F_MOVE)
+    bool can_zerocopy(etdc_fd const& src, etdc_fd const& dst) {
+        if( src.__m_fd<0 || dst.__m_fd<0 )
+            return false;
+        if( src.__m_zckind==zerocopy_kind::File && dst.__m_zckind==zerocopy_kind::Socket )
+            return true;
+        if( src.__m_zckind==zerocopy_kind::Socket && dst.__m_zckind==zerocopy_kind::File ) {
+            // splice(2) refuses to write into a file opened with O_APPEND
+            // (that's what Resume mode does)
+            const int flags = ::fcntl(dst.__m_fd, F_GETFL);
+            return flags!=-1 && (flags & O_APPEND)==0;
+        }
+        return false;
+    }
+
+    ssize_t zerocopy(etdc_fd& src, etdc_fd& dst, size_t n) {
+        // file -> socket is easy, sendfile(2) does all the work. Passing a
+        // nullptr as offset makes it read from - and update - the current
+        // file offset, just like read(2) would
+        if( src.__m_zckind==zerocopy_kind::File && dst.__m_zckind==zerocopy_kind::Socket )
+            return ::sendfile(dst.__m_fd, src.__m_fd, nullptr, n);
+
+        if( !(src.__m_zckind==zerocopy_kind::Socket && dst.__m_zckind==zerocopy_kind::File) ) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        // socket -> file must go through a pipe. We keep on moving bytes
+        // untill n have been moved or the socket has nothing more to give
+        int     pipefd[2];
+        int     err{ 0 };
+        ssize_t moved{ 0 };
+
+        if( ::pipe(pipefd)==-1 )
+            return -1;
+        // Bigger pipe = fewer system calls. It's not an error if we're not
+        // allowed to grow it
+        (void)::fcntl(pipefd[1], F_SETPIPE_SZ, 1024*1024);
+
+        while( (size_t)moved<n ) {
+            const ssize_t nIn = ::splice(src.__m_fd, nullptr, pipefd[1], nullptr, n - (size_t)moved, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+            if( nIn<=0 ) {
+                // Only report an error if nothing was moved at all; the
+                // next call will run into the same error anyway
+                if( nIn==-1 && moved==0 )
+                    err = errno;
+                break;
+            }
+            // Everything that went into the pipe must come out at the
+            // other end or else those bytes are lost
+            for(ssize_t nOut=0; nOut<nIn && err==0; ) {
+                const ssize_t thisOut = ::splice(pipefd[0], nullptr, dst.__m_fd, nullptr, (size_t)(nIn - nOut), SPLICE_F_MOVE | SPLICE_F_MORE);
+
+                if( thisOut<=0 )
+                    err = (thisOut==-1 ? errno : EIO);
+                else
+                    nOut += thisOut;
+            }
+            if( err )
+                break;
+            moved += nIn;
+        }
+        ::close(pipefd[0]);
+        ::close(pipefd[1]);
+
+        if( err ) {
+            errno = err;
+            return -1;
+        }
+        return moved;
+    }
+#else
+    // Not supported on this system
+    bool can_zerocopy(etdc_fd const&, etdc_fd const&) {
+        return false;
+    }
+
+    ssize_t zerocopy(etdc_fd&, etdc_fd&, size_t) {
+        errno = ENOSYS;
+        return -1;
+    }
+#endif
+}
@@ -0,0 +1,860 @@
+// Checks of etd + etc behaviour that can't be seen from their output
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+//
+// A transfer that arrives intact may still have taken the wrong route:
+// through the page cache whilst --direct-io was asked for, say. Each test
+// below sets up a daemon on the loopback interface (etdc_loopback.h),
+// transfers files to/from it through an ETDProxy, just like etc does, and
+// checks what happened on the way. A test that can't be done here (e.g.
+// the file system doesn't do O_DIRECT) is skipped. Any failure makes the
+// exit status non-zero.
+
+// mincore(2) and O_DIRECT need _GNU_SOURCE, which the Makefile undefines
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include <version.h>
+#include <etdc_fd.h>
+#include <reentrant.h>
+#include <etdc_debug.h>
+#include <etdc_assert.h>
+#include <etdc_thread.h>
+#include <etdc_signal.h>
+#include <etdc_etd_state.h>
+#include <etdc_etdserver.h>
+#include <etdc_loopback.h>
+#include <etdc_metrics.h>
+#include <etdc_checksum.h>
+#include <etdc_codec.h>
+#include <argparse.h>
+
+// C++ standard headers
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <string>
+#include <vector>
+#include <iomanip>
+#include <sstream>
+#include <iostream>
+#include <exception>
+#include <stdexcept>
+#include <algorithm>
+#include <functional>
+
+// Plain-old-C
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+namespace AP = argparse;
+
+// Thrown by a test that can't be done in this environment
+struct test_skipped:
+    public std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+struct test_env {
+    std::string  dir;       // where files may be created
+    size_t       bufSize;
+};
+using test_fn = std::function<void(test_env const&)>;
+
+struct test_type {
+    std::string  name;
+    test_fn      run;
+};
+
+// A directory of our own that's gone when we're done
+class scratch_dir {
+    public:
+        explicit scratch_dir(std::string const& parent) {
+            std::string  tmpl( parent + "/etdtest.XXXXXX" );
+            ETDCSYSCALL(::mkdtemp(&tmpl[0])!=nullptr, "failed to create directory in " << parent << " - " << etdc::strerror(errno));
+            __m_path = tmpl;
+        }
+        ~scratch_dir() {
+            for(auto const& f: __m_files)
+                ::unlink(f.c_str());
+            ::rmdir(__m_path.c_str());
+        }
+        scratch_dir(scratch_dir const&) = delete;
+        scratch_dir& operator=(scratch_dir const&) = delete;
+
+        // Path of a file in here, removed with the directory
+        std::string file(std::string const& name) {
+            __m_files.push_back( __m_path + "/" + name );
+            return __m_files.back();
+        }
+
+    private:
+        std::string             __m_path;
+        std::list<std::string>  __m_files;
+};
+
+// 'n' bytes that aren't all the same
+static void write_file(std::string const& path, off_t n) {
+    std::vector<unsigned char>  buf( 1024*1024 );
+    uint32_t                    x{ 42 };
+    int                         fd;
+
+    ETDCSYSCALL((fd=::open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644))!=-1, "failed to create " << path << " - " << etdc::strerror(errno));
+    while( n>0 ) {
+        const size_t  sz = (size_t)std::min(n, (off_t)buf.size());
+        for(auto& b: buf)
+            b = (unsigned char)((x = x*1664525u + 1013904223u) >> 24);
+        ETDCSYSCALL(::write(fd, buf.data(), sz)==(ssize_t)sz, "failed to write " << path << " - " << etdc::strerror(errno));
+        n -= (off_t)sz;
+    }
+    ETDCSYSCALL(::fsync(fd)==0, "failed to fsync " << path << " - " << etdc::strerror(errno));
+    ::close(fd);
+}
+
+static bool same_content(std::string const& a, std::string const& b) {
+    std::unique_ptr<FILE, int(*)(FILE*)>  fa( ::fopen(a.c_str(), "r"), ::fclose ), fb( ::fopen(b.c_str(), "r"), ::fclose );
+    std::vector<char>                     ba( 1024*1024 ), bb( 1024*1024 );
+
+    ETDCASSERT(fa && fb, "failed to open " << a << " or " << b << " - " << etdc::strerror(errno));
+    while( true ) {
+        const size_t  na = ::fread(ba.data(), 1, ba.size(), fa.get());
+        const size_t  nb = ::fread(bb.data(), 1, bb.size(), fb.get());
+        if( na!=nb || ::memcmp(ba.data(), bb.data(), na)!=0 )
+            return false;
+        if( na==0 )
+            return true;
+    }
+}
+
+// Replace the contents of path with those of buf
+static void write_bytes(std::string const& path, std::vector<char> const& buf) {
+    std::unique_ptr<FILE, int(*)(FILE*)>  f( ::fopen(path.c_str(), "w"), ::fclose );
+
+    ETDCASSERT(f, "failed to create " << path << " - " << etdc::strerror(errno));
+    ETDCASSERT(::fwrite(buf.data(), 1, buf.size(), f.get())==buf.size(), "failed to write " << path);
+}
+
+// The CRC32C of the whole file, computed here
+static uint32_t file_crc(std::string const& path) {
+    std::unique_ptr<FILE, int(*)(FILE*)>  f( ::fopen(path.c_str(), "r"), ::fclose );
+    std::vector<char>                     buf( 1024*1024 );
+    etdc::crc32c                          crc;
+    size_t                                n;
+
+    ETDCASSERT(f, "failed to open " << path << " - " << etdc::strerror(errno));
+    while( (n=::fread(buf.data(), 1, buf.size(), f.get()))>0 )
+        crc.update(buf.data(), n);
+    return crc.value();
+}
+
+// The proxy to a loopback daemon's command channel
+static etdc::etd_server_ptr mk_remote(etdc::loopback_daemon& daemon) {
+    return ::mk_etdproxy(etdc::protocol_type(daemon.cmdProto()), etdc::host_type("127.0.0.1"), daemon.cmdPort(),
+                         etdc::numretry_type{2}, etdc::retrydelay_type{std::chrono::duration<float>(0.1)});
+}
+
+// A client, like etc, of a loopback daemon
+struct loopback_client {
+    loopback_client(etdc::loopback_daemon& daemon, size_t bufSize):
+        remote( mk_remote(daemon) )
+    {
+        state.bufSize = bufSize;
+        state.pool.configure(bufSize, 0, etdc::buffer_pool::backing_type::Normal);
+        local = ::mk_etdserver(std::ref(state));
+    }
+
+    // Push local file src to dst on the daemon or pull src on the daemon
+    // to local file dst. Like etc, what the destination already has (see
+    // 'mode') is not transferred again
+    etdc::xfer_result copy(bool push, std::string const& src, std::string const& dst, etdc::openmode_type mode,
+                           etdc::xfer_options const& opts) {
+        etdc::etd_server_ptr  srcSrv( push ? local : remote ), dstSrv( push ? remote : local );
+        const auto            dstResult( dstSrv->requestFileWrite(dst, mode) );
+        const auto            srcResult( srcSrv->requestFileRead(src, etdc::get_filepos(dstResult)) );
+        const auto            rv( push ? local->sendFile(etdc::get_uuid(srcResult), etdc::get_uuid(dstResult), etdc::get_filepos(srcResult),
+                                                         remote->dataChannelAddr(), opts) :
+                                         local->getFile(etdc::get_uuid(srcResult), etdc::get_uuid(dstResult), etdc::get_filepos(srcResult),
+                                                        remote->dataChannelAddr(), opts) );
+        dstSrv->removeUUID( etdc::get_uuid(dstResult) );
+        srcSrv->removeUUID( etdc::get_uuid(srcResult) );
+        return rv;
+    }
+
+    etdc::etd_state       state;
+    etdc::etd_server_ptr  local, remote;
+};
+
+#if defined(__linux__) && defined(O_DIRECT)
+// How many of the file's pages are in the page cache
+static size_t resident_pages(std::string const& path) {
+    const size_t  pgSz = (size_t)::sysconf(_SC_PAGESIZE);
+    struct stat   st;
+    int           fd;
+
+    ETDCSYSCALL((fd=::open(path.c_str(), O_RDONLY))!=-1, "failed to open " << path << " - " << etdc::strerror(errno));
+    std::unique_ptr<int, void(*)(int*)>  closer( &fd, [](int* p) { ::close(*p); } );
+
+    ETDCSYSCALL(::fstat(fd, &st)==0, "failed to stat " << path << " - " << etdc::strerror(errno));
+    if( st.st_size==0 )
+        return 0;
+
+    std::vector<unsigned char>  vec( ((size_t)st.st_size + pgSz - 1)/pgSz );
+    void*                       addr = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    ETDCSYSCALL(addr!=MAP_FAILED, "failed to mmap " << path << " - " << etdc::strerror(errno));
+    const int  rv = ::mincore(addr, (size_t)st.st_size, vec.data());
+    ::munmap(addr, (size_t)st.st_size);
+    ETDCSYSCALL(rv==0, "mincore " << path << " - " << etdc::strerror(errno));
+    return (size_t)std::count_if(vec.begin(), vec.end(), [](unsigned char c) { return (c & 1)!=0; });
+}
+
+static void evict(std::string const& path) {
+    int  fd;
+    ETDCSYSCALL((fd=::open(path.c_str(), O_RDONLY))!=-1, "failed to open " << path << " - " << etdc::strerror(errno));
+    (void)::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+}
+
+// With --direct-io on both ends a push over TCP must not go through the
+// page cache (sendfile(2)/splice(2) always do): neither the source nor
+// the destination may end up in it, save for the last, unaligned, block
+static void test_direct_io_tcp(test_env const& env) {
+    scratch_dir  scratch( env.dir );
+    const off_t  fileSz( 16*(off_t)env.bufSize + 1000 );
+    const size_t pgSz( (size_t)::sysconf(_SC_PAGESIZE) );
+    const auto   src( scratch.file("src") ), dst( scratch.file("dst") );
+
+    {
+        const auto probe( scratch.file("probe") );
+        const int  fd = ::open(probe.c_str(), O_WRONLY|O_CREAT|O_DIRECT, 0644);
+        if( fd==-1 )
+            throw test_skipped(env.dir + " can't do O_DIRECT - " + etdc::strerror(errno));
+        ::close(fd);
+    }
+    write_file(src, fileSz);
+    evict(src);
+    if( resident_pages(src)>0 )
+        throw test_skipped("can't get " + src + " out of the page cache");
+
+    // Both ends do direct I/O and leave the page cache alone otherwise
+    etdc::etd_state       localState;
+    etdc::loopback_daemon daemon("tcp", "127.0.0.1", env.bufSize);
+
+    localState.bufSize = env.bufSize;
+    localState.pool.configure(env.bufSize, 0, etdc::buffer_pool::backing_type::Normal);
+    for(auto st: {&localState, &daemon.state()}) {
+        st->directIO = true;
+        st->ioWindow = 0;
+    }
+
+    etdc::etd_server_ptr  local( ::mk_etdserver(std::ref(localState)) );
+    etdc::etd_server_ptr  remote( mk_remote(daemon) );
+    const auto            srcResult( local->requestFileRead(src, 0) );
+    const auto            dstResult( remote->requestFileWrite(dst, etdc::openmode_type::New) );
+    const auto            rv( local->sendFile(etdc::get_uuid(srcResult), etdc::get_uuid(dstResult), etdc::get_filepos(srcResult),
+                                              remote->dataChannelAddr(), etdc::xfer_options{}) );
+    remote->removeUUID( etdc::get_uuid(dstResult) );
+    local->removeUUID( etdc::get_uuid(srcResult) );
+
+    ETDCASSERT(rv.__m_Finished && rv.__m_BytesTransferred==fileSz, "transfer failed - " << rv.__m_Reason);
+
+    // The tail of 1000 bytes can't be done with O_DIRECT; leave the
+    // kernel some room around that
+    const size_t nTail( 4 );
+    const size_t nPage( ((size_t)fileSz + pgSz - 1)/pgSz );
+    const size_t nSrc( resident_pages(src) ), nDst( resident_pages(dst) );
+
+    ETDCASSERT(nSrc<=nTail, "source went through the page cache: " << nSrc << " of " << nPage << " pages resident");
+    ETDCASSERT(nDst<=nTail, "destination went through the page cache: " << nDst << " of " << nPage << " pages resident");
+    ETDCASSERT(same_content(src, dst), "destination differs from source");
+}
+#else
+static void test_direct_io_tcp(test_env const&) {
+    throw test_skipped("no O_DIRECT or mincore(2) on this system");
+}
+#endif
+
+// The daemon's etd_data_bytes_total{direction="in"}, summed over all
+// channels
+static uint64_t data_bytes_in(etdc::etd_state& state) {
+    static const std::string  family( "etd_data_bytes_total{" );
+    std::istringstream        iss( etdc::metrics::exposition(state) );
+    std::string               line;
+    uint64_t                  rv{ 0 };
+
+    while( std::getline(iss, line) )
+        if( line.compare(0, family.size(), family)==0 && line.find("direction=\"in\"")!=std::string::npos )
+            rv += std::stoull( line.substr(line.rfind(' ') + 1) );
+    return rv;
+}
+
+// Talk to the daemon's data channel ourselves: send the header and then
+// nSend bytes from src - zeroes if src is empty - starting at offset,
+// such that the header and the first block go in one write, which etc
+// doesn't do, followed by the trailer (e.g. a digest). If wait, returns
+// the daemon's ACK, otherwise just hangs up
+static char raw_send(etdc::loopback_daemon& daemon, std::string hdr, std::string const& src, off_t offset,
+                     size_t nSend, size_t bufSize, bool wait = true, std::string const& trailer = std::string()) {
+    const auto            dataAddr( daemon.state().dataaddrs.front() );
+    etdc::etdc_fdptr      conn( mk_client(get_protocol(dataAddr), get_host(dataAddr), get_port(dataAddr),
+                                          etdc::blocking_type{true}) );
+    std::unique_ptr<FILE, int(*)(FILE*)>  fsrc( src.empty() ? nullptr : ::fopen(src.c_str(), "r"), ::fclose );
+    const size_t          hdrSz( hdr.size() );
+    char                  ack( 'n' );
+
+    ETDCASSERT(src.empty() || fsrc, "failed to open " << src << " - " << etdc::strerror(errno));
+    ETDCASSERT(!fsrc || ::fseeko(fsrc.get(), offset, SEEK_SET)==0, "failed to seek in " << src);
+    hdr.resize( hdrSz + bufSize, '\0' );
+    // the header only goes with the first block
+    for(size_t first = hdrSz; nSend>0; first = 0) {
+        const size_t n = std::min(nSend, bufSize);
+        char const*  p = hdr.data() + hdrSz - first;
+
+        if( fsrc )
+            ETDCASSERT(::fread(&hdr[hdrSz], 1, n, fsrc.get())==n, "failed to read " << src);
+        for(size_t left = first + n; left>0; ) {
+            const ssize_t w = conn->write(conn->__m_fd, p, left);
+            ETDCSYSCALL(w>0, "failed to write to data channel - " << etdc::strerror(errno));
+            p    += w;
+            left -= (size_t)w;
+        }
+        nSend -= n;
+    }
+    ETDCSYSCALL(trailer.empty() || conn->write(conn->__m_fd, trailer.data(), trailer.size())==(ssize_t)trailer.size(),
+                "failed to write trailer to data channel - " << etdc::strerror(errno));
+    if( wait )
+        conn->read(conn->__m_fd, &ack, 1);
+    close_shared(*conn);
+    return ack;
+}
+
+// The whole of src to dst on the daemon, see raw_send()
+static char raw_push(etdc::loopback_daemon& daemon, std::string const& src, std::string const& dst,
+                     size_t fileSz, size_t bufSize) {
+    etdc::etd_server_ptr  remote( mk_remote(daemon) );
+    const auto            dstResult( remote->requestFileWrite(dst, etdc::openmode_type::OverWrite) );
+    const char            ack( raw_send(daemon, "{ uuid:" + etdc::get_uuid(dstResult) + ", sz:" + etdc::repr(fileSz) + "}",
+                                        src, 0, fileSz, bufSize) );
+
+    remote->removeUUID( etdc::get_uuid(dstResult) );
+    return ack;
+}
+
+// Every byte the daemon receives must be counted, also the ones that
+// arrive in the same read as the data channel header
+static void test_metrics_bytes(test_env const& env) {
+    const size_t          fileSz( 100*1000*1000 + 7 );
+    etdc::loopback_daemon daemon("tcp", "127.0.0.1", env.bufSize);
+    const uint64_t        before( data_bytes_in(daemon.state()) );
+
+    ETDCASSERT(raw_push(daemon, "", "/dev/null", fileSz, env.bufSize)=='y', "daemon did not acknowledge the transfer");
+
+    const uint64_t        counted( data_bytes_in(daemon.state()) - before );
+    ETDCASSERT(counted==(uint64_t)fileSz, "etd_data_bytes_total counted " << counted << " of " << fileSz << " bytes received");
+}
+
+// The bytes that came with the header are written to the file by hand,
+// after which the kernel may move the rest (splice(2)); nothing may get
+// lost or written twice in between
+static void test_prefix_zerocopy(test_env const& env) {
+    scratch_dir           scratch( env.dir );
+    const off_t           fileSz( 8*(off_t)env.bufSize + 4321 );
+    const auto            src( scratch.file("src") ), dst( scratch.file("dst") );
+    etdc::loopback_daemon daemon("tcp", "127.0.0.1", env.bufSize);
+
+    write_file(src, fileSz);
+    ETDCASSERT(raw_push(daemon, src, dst, (size_t)fileSz, env.bufSize)=='y', "daemon did not acknowledge the transfer");
+    ETDCASSERT(same_content(src, dst), "destination differs from source");
+}
+
+// Push and pull split over three data connections (--streams 3), then
+// over two data channels at the same time (--multipath)
+static void test_streams(test_env const& env) {
+    scratch_dir   scratch( env.dir );
+    const off_t   fileSz( 8*(off_t)env.bufSize + 12345 );
+    const auto    src( scratch.file("src") );
+
+    write_file(src, fileSz);
+    for(auto multiPath: {false, true}) {
+        etdc::loopback_daemon daemon("tcp", "127.0.0.1", env.bufSize, multiPath ? 2 : 1);
+        loopback_client       client(daemon, env.bufSize);
+        etdc::xfer_options    opts;
+
+        opts.nStreams  = (multiPath ? 2 : 3);
+        opts.multiPath = multiPath;
+        for(auto push: {true, false}) {
+            const std::string  what( std::string(multiPath ? "multipath " : "striped ") + (push ? "push" : "pull") );
+            const auto         dst( scratch.file(what) );
+            const auto         rv( client.copy(push, src, dst, etdc::openmode_type::New, opts) );
+
+            ETDCASSERT(rv.__m_Finished && rv.__m_BytesTransferred==fileSz, what << " failed - " << rv.__m_Reason);
+            ETDCASSERT(same_content(src, dst), what << ": destination differs from source");
+        }
+    }
+}
+
+// With --checksum the digest in the result must be the CRC32C of the file,
+// also when the stripes' CRCs had to be combined. A recipient that
+// computes a different CRC than the sender's must fail the transfer and
+// keep none of it for resuming
+static void test_crc32c(test_env const& env) {
+    scratch_dir           scratch( env.dir );
+    const off_t           fileSz( 8*(off_t)env.bufSize + 54321 );
+    const auto            src( scratch.file("src") );
+    etdc::loopback_daemon daemon("tcp", "127.0.0.1", env.bufSize);
+    loopback_client       client(daemon, env.bufSize);
+
+    write_file(src, fileSz);
+    const std::string     digest( etdc::crc32c_digest(file_crc(src)) );
+
+    for(auto nStreams: {1u, 3u}) {
+        etdc::xfer_options  opts;
+
+        opts.nStreams = nStreams;
+        opts.checksum = true;
+        for(auto push: {true, false}) {
+            const std::string  what( etdc::repr(nStreams) + " stream(s) " + (push ? "push" : "pull") );
+            const auto         dst( scratch.file(what) );
+            const auto         rv( client.copy(push, src, dst, etdc::openmode_type::New, opts) );
+
+            ETDCASSERT(rv.__m_Finished && rv.__m_BytesTransferred==fileSz, what << " failed - " << rv.__m_Reason);
+            ETDCASSERT(rv.__m_Digest==digest, what << ": digest " << rv.__m_Digest << " != " << digest);
+            ETDCASSERT(same_content(src, dst), what << ": destination differs from source");
+        }
+    }
+
+    // Send the file ourselves, once with the right digest and once with
+    // one that's off by one
+    for(auto good: {true, false}) {
+        const auto   dst( scratch.file(good ? "good" : "bad") );
+        const auto   dstResult( client.remote->requestFileWrite(dst, etdc::openmode_type::New) );
+        const auto   uuid( etdc::get_uuid(dstResult) );
+        char         sum[9];
+        struct stat  st;
+
+        ::snprintf(sum, sizeof(sum), "%08x", file_crc(src) + (good ? 0 : 1));
+        const char   ack( raw_send(daemon, "{ uuid:" + uuid + ", sz:" + etdc::repr(fileSz) + ", sum:" + etdc::crc32c::name + "}",
+                                   src, 0, (size_t)fileSz, env.bufSize, true, sum) );
+        client.remote->removeUUID( uuid );
+
+        ETDCASSERT(ack==(good ? 'y' : 'n'), "daemon answered '" << ack << "' to a " << (good ? "matching" : "mismatching") << " digest");
+        ETDCSYSCALL(::stat(dst.c_str(), &st)==0, "failed to stat " << dst << " - " << etdc::strerror(errno));
+        ETDCASSERT(st.st_size==(good ? fileSz : 0), dst << " is " << st.st_size << " bytes after a " << (good ? "matching" : "mismatching") << " digest");
+    }
+}
+
+// A destination to resume that has one byte wrong must be rolled back to
+// before that byte, after which the resumed transfer must end with the
+// same file as the source
+static void test_verify_resume(test_env const& env) {
+    scratch_dir           scratch( env.dir );
+    const off_t           fileSz( 9*1024*1024 + 333 ), have( 7*1024*1024 + 77 ), bad( 5*1024*1024 + 4321 );
+    const auto            src( scratch.file("src") ), dst( scratch.file("dst") );
+    etdc::loopback_daemon daemon("tcp", "127.0.0.1", env.bufSize);
+    loopback_client       client(daemon, env.bufSize);
+
+    write_file(src, fileSz);
+    {
+        std::vector<char>                     buf( (size_t)have );
+        std::unique_ptr<FILE, int(*)(FILE*)>  fsrc( ::fopen(src.c_str(), "r"), ::fclose ), fdst( ::fopen(dst.c_str(), "w"), ::fclose );
+
+        ETDCASSERT(fsrc && fdst, "failed to open " << src << " or " << dst << " - " << etdc::strerror(errno));
+        ETDCASSERT(::fread(buf.data(), 1, buf.size(), fsrc.get())==buf.size(), "failed to read " << src);
+        buf[ (size_t)bad ] ^= 0x5a;
+        ETDCASSERT(::fwrite(buf.data(), 1, buf.size(), fdst.get())==buf.size(), "failed to write " << dst);
+    }
+
+    // What etc --verify-resume does
+    const auto    dstResult( client.remote->requestFileWrite(dst, etdc::openmode_type::Resume) );
+    const auto    dstUUID( etdc::get_uuid(dstResult) );
+    auto          srcResult( client.local->requestFileRead(src, etdc::get_filepos(dstResult)) );
+
+    ETDCASSERT(etdc::get_filepos(dstResult)==have, "daemon wants to resume @" << etdc::get_filepos(dstResult) << ", not @" << have);
+    const off_t   nGood( etdc::verify_resume(client.local, etdc::get_uuid(srcResult), client.remote, dstUUID, have, 4*1024*1024, 4) );
+
+    ETDCASSERT(nGood<=bad, "verify_resume keeps " << nGood << " bytes, beyond the corrupted byte @" << bad);
+    client.remote->rollback(dstUUID, nGood);
+    client.local->removeUUID( etdc::get_uuid(srcResult) );
+    srcResult = client.local->requestFileRead(src, nGood);
+
+    const auto    rv( client.local->sendFile(etdc::get_uuid(srcResult), dstUUID, etdc::get_filepos(srcResult),
+                                             client.remote->dataChannelAddr(), etdc::xfer_options()) );
+    client.remote->removeUUID( dstUUID );
+    client.local->removeUUID( etdc::get_uuid(srcResult) );
+
+    ETDCASSERT(rv.__m_Finished && rv.__m_BytesTransferred==fileSz - nGood, "resume failed or moved " << rv.__m_BytesTransferred << " bytes - " << rv.__m_Reason);
+    ETDCASSERT(same_content(src, dst), "destination differs from source");
+}
+
+// A delta transfer must end with the source's version of the file,
+// whatever the destination had: nothing, the same, some bytes changed,
+// more or less of it. Only what the destination didn't have may go over
+// the wire, and the daemon's metrics must see it when it receives
+static void test_delta(test_env const& env) {
+    scratch_dir           scratch( env.dir );
+    const off_t           fileSz( 6*1024*1024 + 789 );
+    const auto            base( scratch.file("base") );
+    etdc::loopback_daemon daemon("tcp", "127.0.0.1", env.bufSize);
+    loopback_client       client(daemon, env.bufSize);
+    etdc::xfer_options    opts;
+    std::vector<char>     data( (size_t)fileSz );
+
+    write_file(base, fileSz);
+    {
+        std::unique_ptr<FILE, int(*)(FILE*)>  f( ::fopen(base.c_str(), "r"), ::fclose );
+        ETDCASSERT(f && ::fread(data.data(), 1, data.size(), f.get())==data.size(), "failed to read " << base);
+    }
+
+    // The versions the source goes through
+    std::list<std::pair<std::string, std::vector<char>>>  versions{ {"new", data}, {"unchanged", data} };
+
+    for(size_t i: {(size_t)1000, data.size()/3, data.size()/2 + 4321, data.size() - 1})
+        data[i] ^= 0x5a;
+    versions.emplace_back("modified", data);
+    data.insert(data.begin() + (off_t)data.size()/4, 1024*1024 + 17, 'x');
+    versions.emplace_back("grown", data);
+    data.erase(data.begin() + (off_t)data.size()/2, data.end() - 3000);
+    versions.emplace_back("shrunk", data);
+
+    opts.delta = true;
+    for(auto push: {true, false}) {
+        const auto  src( scratch.file(std::string(push ? "push" : "pull") + " src") );
+        const auto  dst( scratch.file(std::string(push ? "push" : "pull") + " dst") );
+
+        for(auto const& v: versions) {
+            const std::string  what( v.first + (push ? " push" : " pull") );
+
+            write_bytes(src, v.second);
+            const uint64_t     before( data_bytes_in(daemon.state()) );
+            const auto         rv( client.copy(push, src, dst, etdc::openmode_type::Delta, opts) );
+            const uint64_t     counted( data_bytes_in(daemon.state()) - before );
+
+            ETDCASSERT(rv.__m_Finished && rv.__m_BytesTransferred==(off_t)v.second.size(), what << " failed - " << rv.__m_Reason);
+            ETDCASSERT(same_content(src, dst), what << ": destination differs from source");
+            ETDCASSERT(!rv.__m_Latency.empty(), what << ": no latencies measured");
+            if( v.first=="new" )
+                ETDCASSERT(rv.__m_WireBytes==rv.__m_BytesTransferred, what << ": sent " << rv.__m_WireBytes << " literal bytes");
+            if( v.first=="unchanged" )
+                ETDCASSERT(rv.__m_WireBytes<(off_t)v.second.size()/100, what << ": sent " << rv.__m_WireBytes << " literal bytes");
+            // Pushed: the daemon gets the literals. Pulled: the signatures
+            if( push ) {
+                ETDCASSERT(counted>=(uint64_t)rv.__m_WireBytes, what << ": etd_data_bytes_total counted " << counted << " bytes in for " <<
+                                                                rv.__m_WireBytes << " literal bytes");
+            } else {
+                ETDCASSERT(counted>0, what << ": etd_data_bytes_total did not count the signatures");
+            }
+        }
+    }
+}
+
+// n bytes of text that compresses, but not to nothing
+static std::vector<char> text_bytes(size_t n) {
+    std::vector<char>  rv;
+    char               line[64];
+
+    for(unsigned int i=0; rv.size()<n; i++) {
+        const int  m = ::snprintf(line, sizeof(line), "line %08u of a file that compresses quite well\n", i*i);
+        rv.insert(rv.end(), line, line + m);
+    }
+    rv.resize( n );
+    return rv;
+}
+
+// n bytes that don't compress
+static std::vector<char> random_bytes(size_t n) {
+    std::vector<char>  rv( n );
+    uint32_t           x{ 4711 };
+
+    for(auto& c: rv)
+        c = (char)((x = x*1664525u + 1013904223u) >> 24);
+    return rv;
+}
+
+// --compress lz4 must deliver the file, whether or not it compresses, and
+// send fewer bytes over the wire if it does. A stream of frames that
+// doesn't decompress must not be acknowledged
+static void test_compress(test_env const& env) {
+    scratch_dir           scratch( env.dir );
+    const auto            src( scratch.file("src") ), bad( scratch.file("bad") );
+    etdc::loopback_daemon daemon("tcp", "127.0.0.1", env.bufSize);
+    loopback_client       client(daemon, env.bufSize);
+    etdc::xfer_options    opts;
+    std::vector<char>     data( text_bytes(5*1024*1024 + 99) );
+    const std::vector<char>  noise( random_bytes(3*1024*1024 + 11) );
+
+    data.insert(data.begin() + 2*1024*1024, noise.begin(), noise.end());
+    write_bytes(src, data);
+    opts.compress = "lz4";
+    for(auto push: {true, false}) {
+        const std::string  what( push ? "push" : "pull" );
+        const auto         dst( scratch.file(what) );
+        const auto         rv( client.copy(push, src, dst, etdc::openmode_type::New, opts) );
+
+        ETDCASSERT(rv.__m_Finished && rv.__m_BytesTransferred==(off_t)data.size(), what << " failed - " << rv.__m_Reason);
+        ETDCASSERT(same_content(src, dst), what << ": destination differs from source");
+        ETDCASSERT(rv.__m_WireBytes>(off_t)noise.size() && rv.__m_WireBytes<(off_t)data.size(),
+                   what << ": " << rv.__m_WireBytes << " bytes over the wire for " << data.size());
+    }
+
+    // A frame of 1000 bytes compressed to 100 bytes of rubbish
+    std::vector<char>  frame{ '\x80', 0, 0, 100, 0, 0, 0x03, '\xe8' };
+    const auto         rubbish( random_bytes(100) );
+
+    frame.insert(frame.end(), rubbish.begin(), rubbish.end());
+    write_bytes(bad, frame);
+
+    const auto  dstResult( client.remote->requestFileWrite(scratch.file("dst"), etdc::openmode_type::New) );
+    const char  ack( raw_send(daemon, "{ uuid:" + etdc::get_uuid(dstResult) + ", sz:1000, zip:lz4}", bad, 0, frame.size(), env.bufSize) );
+
+    client.remote->removeUUID( etdc::get_uuid(dstResult) );
+    ETDCASSERT(ack!='y', "daemon acknowledged a frame that does not decompress");
+}
+
+// What a decompress() makes of the input, SIZE_MAX if it threw
+static size_t decompressed_size(etdc::codec const& zip, std::vector<unsigned char> const& in, size_t n, size_t cap) {
+    std::vector<unsigned char>  out( cap + 16 );
+    try {
+        return zip.decompress(in.data(), n, out.data(), cap);
+    }
+    catch( std::exception const& ) {
+        return SIZE_MAX;
+    }
+}
+
+// The codecs on their own: frames of the maximum size (1MiB) that do and
+// don't compress, the back-off after frames that don't and input to the
+// decompressor that's broken in various ways
+static void test_codec(test_env const&) {
+    const size_t               frameSz( 1024*1024 );
+    std::vector<unsigned char> out( 2*frameSz ), back( frameSz + 16 );
+
+    for(auto const& name: etdc::codec_names()) {
+        etdc::codec const*  zip( etdc::find_codec(name) );
+        ETDCASSERT(zip, "codec " << name << " is listed but can't be found");
+
+        const auto  text( text_bytes(frameSz) ), noise( random_bytes(frameSz) );
+        const std::vector<char>  zeroes( frameSz, '\0' );
+
+        // What compressed_copy() asks for: at least 1/64th smaller
+        const auto  roundtrip = [&](std::vector<char> const& in, size_t cap) {
+            unsigned char const* p( reinterpret_cast<unsigned char const*>(in.data()) );
+            const size_t         n( zip->compress(p, in.size(), out.data(), cap) );
+
+            if( n>0 )
+                ETDCASSERT(zip->decompress(out.data(), n, back.data(), frameSz)==in.size() && ::memcmp(back.data(), p, in.size())==0,
+                           name << ": a frame of " << in.size() << " bytes compressed to " << n << " did not decompress to the same");
+            return n;
+        };
+        ETDCASSERT(roundtrip(noise, frameSz - frameSz/64)==0, name << ": random data compressed by 1/64th");
+        ETDCASSERT(roundtrip(noise, out.size())>0, name << ": random data did not fit in twice its size");
+        ETDCASSERT(roundtrip(text, frameSz - frameSz/64)>0, name << ": text did not compress");
+        ETDCASSERT(roundtrip(zeroes, frameSz - frameSz/64)>0, name << ": zeroes did not compress");
+
+        // Input that's cut short may throw or decompress to fewer bytes,
+        // never to all of them. Input with a byte flipped may decompress
+        // to anything, as long as it stays within the buffer
+        const size_t               n( zip->compress(reinterpret_cast<unsigned char const*>(text.data()), frameSz, out.data(), out.size()) );
+        std::vector<unsigned char> packed( out.begin(), out.begin() + (off_t)n );
+
+        ETDCASSERT(decompressed_size(*zip, packed, n, frameSz)==frameSz, name << ": did not decompress");
+        ETDCASSERT(decompressed_size(*zip, packed, n, frameSz - 1)==SIZE_MAX, name << ": decompressed into too small a buffer");
+        for(auto m: {n/2, n - 1, (size_t)1, (size_t)0})
+            ETDCASSERT(decompressed_size(*zip, packed, m, frameSz)!=frameSz, name << ": decompressed " << m << " of " << n << " bytes to all of it");
+        for(size_t i=0; i<n; i+=n/16) {
+            std::vector<unsigned char>  broken( packed );
+            broken[i] ^= 0xff;
+            const size_t  sz( decompressed_size(*zip, broken, n, frameSz) );
+            ETDCASSERT(sz==SIZE_MAX || sz<=frameSz, name << ": flipping byte " << i << " decompressed to " << sz << " bytes");
+        }
+    }
+    // lz4 specifics: a match before the start, literals that run out
+    etdc::codec const*  lz4( etdc::find_codec("lz4") );
+    ETDCASSERT(lz4, "there is no lz4 codec");
+    ETDCASSERT(decompressed_size(*lz4, {0x00, 0x10, 0x00}, 3, frameSz)==SIZE_MAX, "lz4: accepted a match before the start");
+    ETDCASSERT(decompressed_size(*lz4, {0xf0, 0xff, 0xff}, 3, frameSz)==SIZE_MAX, "lz4: accepted a truncated literal length");
+    ETDCASSERT(decompressed_size(*lz4, {0x50, 'a', 'b'}, 3, frameSz)==SIZE_MAX, "lz4: accepted literals past the end");
+
+    // After each frame that doesn't compress, twice as many are not tried
+    // up to the maximum; one that compresses ends that
+    etdc::zip_backoff   backOff( 64 );
+    for(unsigned int expect: {1u, 2u, 4u, 8u, 16u, 32u, 64u, 64u}) {
+        ETDCASSERT(backOff.attempt(), "back-off: not trying after " << expect/2 << " skipped frames");
+        backOff.result( false );
+        for(unsigned int i=0; i<expect; i++)
+            ETDCASSERT(!backOff.attempt(), "back-off: trying after " << i << " in stead of " << expect << " frames");
+    }
+    ETDCASSERT(backOff.attempt(), "back-off: not trying after the maximum");
+    backOff.result( true );
+    ETDCASSERT(backOff.attempt(), "back-off: not trying after a frame that compressed");
+}
+
+// Wait for the daemon to be done with all stripes of a transfer
+static void wait_stripes(etdc::loopback_daemon& daemon, etdc::uuid_type const& uuid) {
+    for(unsigned int i=0; i<1000; i++) {
+        {
+            etdc::scoped_lock  lk( daemon.state().lock );
+            auto               ptr = daemon.state().transfers.find( uuid );
+
+            ETDCASSERT(ptr!=daemon.state().transfers.end(), "transfer " << uuid << " is gone");
+            std::lock_guard<std::mutex>  slk( ptr->second->stripe_lock );
+            if( ptr->second->nStripe==0 )
+                return;
+        }
+        std::this_thread::sleep_for( std::chrono::milliseconds(10) );
+    }
+    throw std::runtime_error("stripes of " + uuid + " did not finish");
+}
+
+// A stripe that breaks off leaves a hole. When the transfer is removed
+// the file must be cut off there, so that resuming by file size doesn't
+// skip it, and a striped resume must then complete the file
+static void test_stripe_hole(test_env const& env) {
+    scratch_dir           scratch( env.dir );
+    const size_t          stripeSz( 2*env.bufSize + 1000 );
+    const off_t           fileSz( 3*(off_t)stripeSz );
+    const auto            src( scratch.file("src") ), dst( scratch.file("dst") );
+    etdc::loopback_daemon daemon("tcp", "127.0.0.1", env.bufSize);
+    loopback_client       client(daemon, env.bufSize);
+
+    write_file(src, fileSz);
+    {
+        const auto  dstResult( client.remote->requestFileWrite(dst, etdc::openmode_type::New) );
+        const auto  uuid( etdc::get_uuid(dstResult) );
+
+        for(size_t i=0; i<3; i++) {
+            const off_t        offset( (off_t)(i*stripeSz) );
+            const std::string  hdr( "{ uuid:" + uuid + ", sz:" + etdc::repr(stripeSz) + ", offset:" + etdc::repr(offset) + "}" );
+
+            // The middle one hangs up half way
+            if( i==1 )
+                raw_send(daemon, hdr, src, offset, stripeSz/2, env.bufSize, false);
+            else
+                ETDCASSERT(raw_send(daemon, hdr, src, offset, stripeSz, env.bufSize)=='y', "stripe #" << i << " not acknowledged");
+        }
+        wait_stripes(daemon, uuid);
+        client.remote->removeUUID( uuid );
+    }
+
+    struct stat  st;
+    const off_t  hole( (off_t)(stripeSz + stripeSz/2) );
+
+    ETDCSYSCALL(::stat(dst.c_str(), &st)==0, "failed to stat " << dst << " - " << etdc::strerror(errno));
+    ETDCASSERT(st.st_size==hole, dst << " is " << st.st_size << " bytes, expected it cut off at the hole @" << hole);
+
+    etdc::xfer_options  opts;
+    opts.nStreams = 3;
+    const auto          rv( client.copy(true, src, dst, etdc::openmode_type::Resume, opts) );
+
+    ETDCASSERT(rv.__m_Finished && rv.__m_BytesTransferred==fileSz - hole, "resume failed or moved " << rv.__m_BytesTransferred << " bytes - " << rv.__m_Reason);
+    ETDCASSERT(same_content(src, dst), "destination differs from source");
+}
+
+// /dev/zero:<size>[unit] must be recognized exactly as the std::regex
+// "^/dev/zero:([0-9]+)(([kMGT])(i?)B)?$" that it replaced did
+static void test_devzero_names(test_env const&) {
+    const std::list<std::pair<std::string, size_t>>  good{
+        {"/dev/zero:0", 0}, {"/dev/zero:12345", 12345}, {"/dev/zero:3kB", 3*1024},
+        {"/dev/zero:3kiB", 3000}, {"/dev/zero:2MB", 2*1024*1024}, {"/dev/zero:2GiB", 2000000000},
+        {"/dev/zero:1TB", 1024ull*1024*1024*1024}
+    };
+    const std::list<std::string>  bad{
+        "/dev/zero", "/dev/zero:", "/dev/zero:k", "/dev/zero:12B", "/dev/zero:12k", "/dev/zero:12kiBB",
+        "/dev/zero:12Ki", "/dev/zero:12PB", "/dev/zero:1 ", "/dev/zero:-1", "/dev/null", "/dev/zero:12xB"
+    };
+    for(auto const& g: good) {
+        size_t  sz{ 42 };
+        ETDCASSERT(etdc::is_devzero(g.first, &sz) && sz==g.second, g.first << " not recognized or size " << sz << " != " << g.second);
+    }
+    for(auto const& b: bad)
+        ETDCASSERT(!etdc::is_devzero(b), b << " should not have been recognized");
+}
+
+int main(int argc, char const*const*const argv) {
+    etdc::BlockAll            ba;
+    int                       message_level{ -1 };
+    std::vector<std::string>  only;
+    test_env                  env{ ".", 4*1024*1024 };
+
+    const std::list<test_type>  tests{
+        {"direct-io-tcp", test_direct_io_tcp},
+        {"metrics-bytes", test_metrics_bytes},
+        {"prefix-zerocopy", test_prefix_zerocopy},
+        {"streams", test_streams},
+        {"crc32c", test_crc32c},
+        {"verify-resume", test_verify_resume},
+        {"delta", test_delta},
+        {"compress", test_compress},
+        {"codec", test_codec},
+        {"stripe-hole", test_stripe_hole},
+        {"devzero-names", test_devzero_names}
+    };
+
+    AP::ArgumentParser     cmd( AP::version( buildinfo() ),
+                                AP::docstring("Checks of the etransfer daemon and client in one process that "
+                                              "go beyond 'the file arrived intact'. Exits non-zero if any test fails.") );
+
+    cmd.add( AP::long_name("help"), AP::print_help(),
+             AP::docstring("Print full help and exit successfully") );
+    cmd.add( AP::short_name('h'), AP::print_usage(),
+             AP::docstring("Print short usage and exit successfully") );
+    cmd.add( AP::long_name("version"), AP::print_version(),
+             AP::docstring("Print version and exit successfully") );
+    cmd.add( AP::store_into(message_level), AP::short_name('m'),
+             AP::maximum_value(5), AP::minimum_value(-1), AP::at_most(1),
+             AP::docstring(std::string("Message level - higher = more output. Default: ")+etdc::repr(message_level)) );
+    cmd.add( AP::store_into(env.dir), AP::long_name("dir"), AP::at_most(1),
+             AP::docstring("Create test files in a new directory under this one; it should be on a real disk. Default: "+env.dir) );
+    cmd.add( AP::collect_into(only), AP::long_name("test"),
+             AP::docstring("Only run this test. May be given multiple times. Default: all") );
+    cmd.parse(argc, argv);
+
+    etdc::dbglev_fn( message_level );
+
+    // The main thread runs the client, which gets kicked out of blocking
+    // calls by the same signal as the daemon
+    etdc::UnBlock    s({etdc::loopbackKillSignal});
+    etdc::install_handler(etdc::loopback_signal_handler, {etdc::loopbackKillSignal});
+
+    unsigned int  nFail{ 0 };
+    for(auto const& t: tests) {
+        if( !only.empty() && std::find(only.begin(), only.end(), t.name)==only.end() )
+            continue;
+        std::cout << std::left << std::setw(24) << t.name << std::flush;
+        try {
+            t.run( env );
+            std::cout << "ok" << std::endl;
+        }
+        catch( test_skipped const& e ) {
+            std::cout << "skipped - " << e.what() << std::endl;
+        }
+        catch( std::exception const& e ) {
+            std::cout << "FAILED - " << e.what() << std::endl;
+            nFail++;
+        }
+    }
+    return nFail ? 1 : 0;
+}
@@ -0,0 +1,671 @@
+// Userspace WAN emulator: relay UDP and TCP with delay, loss and a bottleneck
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+//
+// Forwards UDP datagrams and TCP connections from a local address to a
+// target, like "ssh -L" does, and on the way pretends to be a long fat
+// network. Each direction of a relay is one emulated link:
+//
+//   * a bottleneck: a token bucket at --rate with --bucket bytes of burst
+//     and a drop-tail queue of --queue bytes behind it
+//   * random loss and Gilbert-Elliott style bursts of loss
+//   * one-way delay plus uniformly distributed jitter. Jitter does not
+//     reorder: a datagram never overtakes its predecessor, unless
+//     --reorder held that one back on purpose. UDT takes reordering for
+//     loss so mixing the two would make it hard to tell what's what
+//
+// A byte stream can't lose or reorder bytes so TCP connections only see
+// the delay, jitter and the bottleneck; the
+// relay's buffer takes the place of what's in flight on the path such that
+// TCP's window still matters. For the kernel's own loss recovery on a
+// lossy path, netem(8) is the tool.
+//
+// All UDP clients of a relay share its links; each gets its own socket
+// towards the target, which is what the target replies to. This is what
+// UDT needs. etd's --advertise can make clients use the relay's address
+// for the data channels.
+#include <version.h>
+#include <etdc_fd.h>
+#include <etdc_debug.h>
+#include <etdc_assert.h>
+#include <etdc_thread.h>
+#include <etdc_signal.h>
+#include <etdc_resolve.h>
+#include <etdc_sciprint.h>
+#include <argparse.h>
+
+// C++ standard headers
+#include <map>
+#include <list>
+#include <deque>
+#include <mutex>
+#include <queue>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+// Plain-old-C
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+using namespace std;
+namespace AP = argparse;
+
+using clock_type = std::chrono::steady_clock;
+
+// What the emulated path does to the traffic in one direction
+struct impairment_type {
+    double   delay{ 0 }, jitter{ 0 };       // seconds
+    double   loss{ 0 };                     // chance per datagram
+    double   burstStart{ 0 };               // chance that a loss burst starts
+    double   burstLength{ 10 };             // mean number of datagrams in a burst
+    double   reorder{ 0 };                  // chance that a datagram is held back
+    double   reorderDelay{ 1e-3 };          // by this many seconds
+    double   rate{ 0 };                     // bytes per second, 0 = no bottleneck
+    double   bucket{ 0 }, queue{ 0 };       // bytes
+};
+
+// One direction of a relay. All packets (or chunks of a byte stream) go
+// through admit() which decides if and when they arrive at the other end.
+class link_type {
+    public:
+        link_type(std::string const& name, impairment_type const& imp, uint64_t seed):
+            __m_name( name ), __m_imp( imp ), __m_rng( seed ), __m_bad( false ),
+            __m_tokens( imp.bucket ), __m_lastFill( clock_type::now() ), __m_lastRelease{},
+            __m_nPkt( 0 ), __m_nByte( 0 ), __m_nLost( 0 ), __m_nQueueDrop( 0 ), __m_nReordered( 0 )
+        {}
+        link_type(link_type const&) = delete;
+        link_type& operator=(link_type const&) = delete;
+
+        // Returns false if the n bytes that arrived 'now' are dropped,
+        // otherwise sets release to when they come out at the other end.
+        // Byte streams (stream==true) are never dropped nor reordered; they
+        // wait for the bottleneck in stead.
+        bool admit(size_t n, bool stream, clock_type::time_point const& now, clock_type::time_point& release) {
+            std::lock_guard<std::mutex>  lk( __m_lock );
+
+            __m_nPkt++;
+            __m_nByte += n;
+            if( !stream ) {
+                // In a burst every datagram is lost and the burst ends
+                // with a chance of 1/burstLength after each of them
+                if( __m_bad || (__m_imp.burstStart>0 && this->uniform()<__m_imp.burstStart) ) {
+                    __m_bad = (this->uniform() >= 1.0/__m_imp.burstLength);
+                    __m_nLost++;
+                    return false;
+                }
+                if( __m_imp.loss>0 && this->uniform()<__m_imp.loss ) {
+                    __m_nLost++;
+                    return false;
+                }
+            }
+
+            // The bottleneck. Tokens below zero are the bytes waiting in
+            // the queue; they leave at the link rate
+            clock_type::time_point departure( now );
+            if( __m_imp.rate>0 ) {
+                __m_tokens   = std::min(__m_imp.bucket, __m_tokens + __m_imp.rate * std::chrono::duration<double>(now - __m_lastFill).count());
+                __m_lastFill = now;
+                if( !stream && __m_tokens - (double)n < -__m_imp.queue ) {
+                    __m_nQueueDrop++;
+                    return false;
+                }
+                __m_tokens -= (double)n;
+                if( __m_tokens<0 )
+                    departure += std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(-__m_tokens/__m_imp.rate));
+            }
+
+            const double delay = std::max(__m_imp.delay + __m_imp.jitter * (2.0*this->uniform() - 1.0), 0.0);
+            release = std::max(departure + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(delay)),
+                               __m_lastRelease);
+            if( !stream && __m_imp.reorder>0 && this->uniform()<__m_imp.reorder ) {
+                // Held back ones don't hold up the ones behind them
+                release += std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(__m_imp.reorderDelay));
+                __m_nReordered++;
+            } else
+                __m_lastRelease = release;
+            return true;
+        }
+
+        void report(std::ostream& os) const {
+            std::lock_guard<std::mutex>  lk( __m_lock );
+            os << __m_name << ": " << __m_nPkt << " packets " << etdc::sciprint((double)__m_nByte, "B", std::setprecision(4))
+               << ", lost " << __m_nLost << ", queue drops " << __m_nQueueDrop << ", held back " << __m_nReordered;
+        }
+
+    private:
+        double uniform( void ) {
+            return std::uniform_real_distribution<double>(0.0, 1.0)(__m_rng);
+        }
+
+        const std::string       __m_name;
+        const impairment_type   __m_imp;
+        mutable std::mutex      __m_lock;
+        std::mt19937_64         __m_rng;
+        bool                    __m_bad;
+        double                  __m_tokens;
+        clock_type::time_point  __m_lastFill, __m_lastRelease;
+        uint64_t                __m_nPkt, __m_nByte, __m_nLost, __m_nQueueDrop, __m_nReordered;
+};
+using link_ptr = std::shared_ptr<link_type>;
+
+
+// Sends datagrams when their time has come, in order of release time
+class scheduler_type {
+    public:
+        struct packet_type {
+            clock_type::time_point   release;
+            uint64_t                 seqNr;
+            int                      fd;
+            struct sockaddr_storage  to;
+            socklen_t                toLen;   // 0 = fd is connected
+            std::vector<char>        data;
+        };
+
+        scheduler_type():
+            __m_seqNr( 0 ), __m_thread( etdc::thread(&scheduler_type::run, this) )
+        { __m_thread.detach(); }
+        scheduler_type(scheduler_type const&) = delete;
+        scheduler_type& operator=(scheduler_type const&) = delete;
+
+        void push(packet_type&& p) {
+            {
+                std::lock_guard<std::mutex>  lk( __m_lock );
+                p.seqNr = __m_seqNr++;
+                __m_queue.push( std::move(p) );
+            }
+            __m_condition.notify_one();
+        }
+
+    private:
+        struct later {
+            bool operator()(packet_type const& l, packet_type const& r) const {
+                return l.release>r.release || (l.release==r.release && l.seqNr>r.seqNr);
+            }
+        };
+
+        void run( void ) {
+            std::unique_lock<std::mutex>  lk( __m_lock );
+            while( true ) {
+                if( __m_queue.empty() ) {
+                    __m_condition.wait(lk);
+                    continue;
+                }
+                const clock_type::time_point  release( __m_queue.top().release );
+                if( clock_type::now()<release ) {
+                    __m_condition.wait_until(lk, release);
+                    continue;
+                }
+                // Errors (e.g. no-one listening on the other end) are what
+                // a network does too: the datagram is gone
+                packet_type const&  p( __m_queue.top() );
+                if( p.toLen )
+                    ::sendto(p.fd, p.data.data(), p.data.size(), 0, (struct sockaddr const*)&p.to, p.toLen);
+                else
+                    ::send(p.fd, p.data.data(), p.data.size(), 0);
+                __m_queue.pop();
+            }
+        }
+
+        uint64_t                                                               __m_seqNr;
+        std::mutex                                                             __m_lock;
+        std::condition_variable                                                __m_condition;
+        std::priority_queue<packet_type, std::vector<packet_type>, later>      __m_queue;
+        std::thread                                                            __m_thread;
+};
+
+
+// "[bind:]port:host:hostport", host and bind address may be [IPv6]
+struct forward_type {
+    std::string  spec;
+    std::string  bindHost, bindPort, host, port;
+};
+
+static const std::regex rxForward(
+    "^(([-a-zA-Z0-9_\\.]+|\\[[:0-9a-fA-F]+\\]):)?([0-9]+):([-a-zA-Z0-9_\\.]+|\\[[:0-9a-fA-F]+\\]):([0-9]+)$");
+//    12                                         3       4                                       5
+
+static forward_type mk_forward(std::string const& s) {
+    static const std::regex rxBracket("^\\[(.*)\\]$");
+    std::smatch             fields;
+    forward_type            rv;
+
+    ETDCASSERT(std::regex_match(s, fields, rxForward), "Invalid forward '" << s << "' [expect [bind:]port:host:hostport]");
+    rv.spec     = s;
+    rv.bindHost = fields[2].length() ? std::regex_replace(fields[2].str(), rxBracket, "$1") : std::string("127.0.0.1");
+    rv.bindPort = fields[3].str();
+    rv.host     = std::regex_replace(fields[4].str(), rxBracket, "$1");
+    rv.port     = fields[5].str();
+    return rv;
+}
+
+static socklen_t resolve(std::string const& host, std::string const& port, int socktype, struct sockaddr_storage& ss) {
+    struct addrinfo  hints;
+
+    ::memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = socktype;
+    hints.ai_flags    = AI_NUMERICSERV;
+
+    const etdc::detail::addrinfo_ptr  ai( etdc::detail::getaddrinfo(host.c_str(), port.c_str(), &hints) );
+    ETDCASSERT(ai && ai->ai_addrlen<=sizeof(ss), "Failed to resolve " << host << ":" << port);
+    ::memcpy(&ss, ai->ai_addr, ai->ai_addrlen);
+    return ai->ai_addrlen;
+}
+
+static int mk_socket(struct sockaddr_storage const& ss, int socktype) {
+    const int  fd = ::socket(ss.ss_family, socktype, 0);
+    const int  one{ 1 }, bufSize{ 32*1024*1024 };
+
+    ETDCSYSCALL(fd>=0, "socket() fails - " << ::strerror(errno));
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    // Like etd does for UDT: big socket buffers or we lose packets that
+    // the path didn't
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufSize, sizeof(bufSize));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufSize, sizeof(bufSize));
+    return fd;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+//
+//  UDP: one thread polls the listening socket and the sockets towards the
+//  target and hands what it reads to the scheduler
+//
+////////////////////////////////////////////////////////////////////////////
+static void udp_relay(forward_type const& fwd, link_ptr up, link_ptr down) {
+    // Clients that were quiet this long are forgotten
+    static const std::chrono::seconds  idleTime( 120 );
+
+    struct session_type {
+        int                      fd;
+        struct sockaddr_storage  client;
+        socklen_t                clientLen;
+        clock_type::time_point   lastSeen;
+    };
+    struct sockaddr_storage             local, target;
+    const socklen_t                     localLen  = resolve(fwd.bindHost, fwd.bindPort, SOCK_DGRAM, local);
+    const socklen_t                     targetLen = resolve(fwd.host, fwd.port, SOCK_DGRAM, target);
+    const int                           lfd = mk_socket(local, SOCK_DGRAM);
+    std::map<std::string, session_type> sessions;
+    scheduler_type                      scheduler;
+    std::vector<char>                   buf( 65536 );
+
+    ETDCSYSCALL(::bind(lfd, (struct sockaddr const*)&local, localLen)==0, "udp " << fwd.spec << " bind fails - " << ::strerror(errno));
+
+    while( true ) {
+        std::vector<struct pollfd>   pfds{ {lfd, POLLIN, 0} };
+        std::vector<session_type*>   owner{ nullptr };
+
+        for(auto& s: sessions) {
+            pfds.push_back( {s.second.fd, POLLIN, 0} );
+            owner.push_back( &s.second );
+        }
+        const int  r = ::poll(&pfds[0], pfds.size(), 1000);
+        ETDCSYSCALL(r>=0 || errno==EINTR, "udp " << fwd.spec << " poll fails - " << ::strerror(errno));
+
+        const clock_type::time_point  now( clock_type::now() );
+        for(size_t i=0; r>0 && i<pfds.size(); i++) {
+            if( (pfds[i].revents & POLLIN)==0 )
+                continue;
+
+            scheduler_type::packet_type  p;
+            struct sockaddr_storage      from;
+            socklen_t                    fromLen( sizeof(from) );
+            const ssize_t                n = ::recvfrom(pfds[i].fd, &buf[0], buf.size(), 0, (struct sockaddr*)&from, &fromLen);
+
+            if( n<0 )
+                continue;
+            if( owner[i]==nullptr ) {
+                // From a client; towards the target over its own socket
+                const std::string  key( (char const*)&from, fromLen );
+                auto               s = sessions.find( key );
+
+                if( s==sessions.end() ) {
+                    session_type  ns{ mk_socket(target, SOCK_DGRAM), from, fromLen, now };
+                    ETDCSYSCALL(::connect(ns.fd, (struct sockaddr const*)&target, targetLen)==0,
+                                "udp " << fwd.spec << " connect fails - " << ::strerror(errno));
+                    s = sessions.emplace(key, ns).first;
+                    ETDCDEBUG(2, "udp " << fwd.spec << ": new client, " << sessions.size() << " now" << endl);
+                }
+                s->second.lastSeen = now;
+                if( !up->admit((size_t)n, false, now, p.release) )
+                    continue;
+                p.fd    = s->second.fd;
+                p.toLen = 0;
+            } else {
+                // From the target, back to the client
+                owner[i]->lastSeen = now;
+                if( !down->admit((size_t)n, false, now, p.release) )
+                    continue;
+                p.fd    = lfd;
+                p.to    = owner[i]->client;
+                p.toLen = owner[i]->clientLen;
+            }
+            p.data.assign(buf.begin(), buf.begin() + n);
+            scheduler.push( std::move(p) );
+        }
+
+        for(auto s=sessions.begin(); s!=sessions.end(); ) {
+            if( now - s->second.lastSeen > idleTime ) {
+                ::close( s->second.fd );
+                s = sessions.erase( s );
+            } else
+                s++;
+        }
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+//
+//  TCP: per connection and direction a reader that stamps what it reads
+//  with a release time and a writer that writes it out when the time comes
+//
+////////////////////////////////////////////////////////////////////////////
+class tcp_pipe {
+    public:
+        // At most 'limit' bytes are held; the reader stops reading (and the
+        // sender's window fills up) if there are more
+        tcp_pipe(int src, int dst, link_ptr link, size_t limit):
+            __m_src( src ), __m_dst( dst ), __m_link( link ), __m_limit( limit ), __m_nQueued( 0 ), __m_eof( false )
+        {}
+
+        void reader( void ) {
+            std::vector<char>  buf( 64*1024 );
+
+            while( true ) {
+                const ssize_t n = ::read(__m_src, &buf[0], buf.size());
+                std::unique_lock<std::mutex>  lk( __m_lock );
+
+                if( n<=0 ) {
+                    __m_eof = true;
+                    __m_condition.notify_all();
+                    return;
+                }
+                clock_type::time_point  release;
+                __m_link->admit((size_t)n, true, clock_type::now(), release);
+                __m_chunks.emplace_back(release, std::vector<char>(buf.begin(), buf.begin() + n));
+                __m_nQueued += (size_t)n;
+                __m_condition.notify_all();
+                __m_condition.wait(lk, [this]( void ) { return __m_nQueued<__m_limit || __m_eof; });
+            }
+        }
+
+        void writer( void ) {
+            std::unique_lock<std::mutex>  lk( __m_lock );
+
+            while( true ) {
+                __m_condition.wait(lk, [this]( void ) { return !__m_chunks.empty() || __m_eof; });
+                if( __m_chunks.empty() )
+                    break;
+                const clock_type::time_point  release( __m_chunks.front().first );
+                if( clock_type::now()<release ) {
+                    __m_condition.wait_until(lk, release);
+                    continue;
+                }
+                std::vector<char>  chunk( std::move(__m_chunks.front().second) );
+                __m_chunks.pop_front();
+                lk.unlock();
+
+                size_t  done{ 0 };
+                while( done<chunk.size() ) {
+                    const ssize_t n = ::write(__m_dst, &chunk[done], chunk.size() - done);
+                    if( n<=0 )
+                        break;
+                    done += (size_t)n;
+                }
+                lk.lock();
+                __m_nQueued -= chunk.size();
+                __m_condition.notify_all();
+                if( done<chunk.size() ) {
+                    // The other end is gone; so is this direction
+                    __m_eof = true;
+                    __m_chunks.clear();
+                    ::shutdown(__m_src, SHUT_RD);
+                    __m_condition.notify_all();
+                    break;
+                }
+            }
+            ::shutdown(__m_dst, SHUT_WR);
+        }
+
+    private:
+        const int                   __m_src, __m_dst;
+        link_ptr                    __m_link;
+        const size_t                __m_limit;
+        size_t                      __m_nQueued;
+        bool                        __m_eof;
+        std::mutex                  __m_lock;
+        std::condition_variable     __m_condition;
+        std::deque<std::pair<clock_type::time_point, std::vector<char>>>  __m_chunks;
+};
+
+// Closes both ends when the last of the four threads of a connection is done
+struct tcp_connection {
+    tcp_connection(int c, int s, link_ptr up, link_ptr down, size_t limit):
+        client( c ), server( s ), toServer( c, s, up, limit ), toClient( s, c, down, limit )
+    {}
+    ~tcp_connection() {
+        ::close( client );
+        ::close( server );
+    }
+    const int  client, server;
+    tcp_pipe   toServer, toClient;
+};
+
+static void tcp_relay(forward_type const& fwd, link_ptr up, link_ptr down, size_t limit) {
+    struct sockaddr_storage  local, target;
+    const socklen_t          localLen  = resolve(fwd.bindHost, fwd.bindPort, SOCK_STREAM, local);
+    const socklen_t          targetLen = resolve(fwd.host, fwd.port, SOCK_STREAM, target);
+    const int                lfd = mk_socket(local, SOCK_STREAM);
+    const int                one{ 1 };
+
+    ETDCSYSCALL(::bind(lfd, (struct sockaddr const*)&local, localLen)==0, "tcp " << fwd.spec << " bind fails - " << ::strerror(errno));
+    ETDCSYSCALL(::listen(lfd, 16)==0, "tcp " << fwd.spec << " listen fails - " << ::strerror(errno));
+
+    while( true ) {
+        const int  cfd = ::accept(lfd, nullptr, nullptr);
+        if( cfd<0 )
+            continue;
+
+        const int  sfd = mk_socket(target, SOCK_STREAM);
+        if( ::connect(sfd, (struct sockaddr const*)&target, targetLen)!=0 ) {
+            ETDCDEBUG(0, "tcp " << fwd.spec << ": connect to target fails - " << ::strerror(errno) << endl);
+            ::close( cfd );
+            ::close( sfd );
+            continue;
+        }
+        ETDCDEBUG(2, "tcp " << fwd.spec << ": new connection" << endl);
+        ::setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        ::setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        auto  conn = std::make_shared<tcp_connection>(cfd, sfd, up, down, limit);
+        etdc::thread([conn]( void ) { conn->toServer.reader(); }).detach();
+        etdc::thread([conn]( void ) { conn->toServer.writer(); }).detach();
+        etdc::thread([conn]( void ) { conn->toClient.reader(); }).detach();
+        etdc::thread([conn]( void ) { conn->toClient.writer(); }).detach();
+    }
+}
+
+
+int main(int argc, char const*const*const argv) {
+    etdc::BlockAll            ba;
+    int                       message_level{ 0 };
+    std::vector<std::string>  udpForwards, tcpForwards;
+    double                    delay{ 0 }, jitter{ 0 }, loss{ 0 }, burstLoss{ 0 }, burstLength{ 10 };
+    double                    reorder{ 0 }, reorderDelay{ 1 }, report{ 0 };
+    etdc::max_bw_type         rate{ 0 };
+    size_t                    bucket{ 0 }, queue{ 0 };
+    uint64_t                  seed{ 1 };
+
+    AP::ArgumentParser     cmd( AP::version( buildinfo() ),
+                                AP::docstring("Relay UDP datagrams and TCP connections through an emulated wide area network path "
+                                              "with delay, jitter, loss, reordering and a bottleneck. The settings apply to both "
+                                              "directions of each relay independently, so the round trip time is twice --delay."),
+                                AP::docstring("Forwards are given like ssh -L: [bind:]port:host:hostport, the bind address defaults "
+                                              "to 127.0.0.1. IPv6 addresses go in []'s.") );
+
+    cmd.add( AP::long_name("help"), AP::print_help(),
+             AP::docstring("Print full help and exit successfully") );
+    cmd.add( AP::short_name('h'), AP::print_usage(),
+             AP::docstring("Print short usage and exit successfully") );
+    cmd.add( AP::long_name("version"), AP::print_version(),
+             AP::docstring("Print version and exit successfully") );
+    cmd.add( AP::store_into(message_level), AP::short_name('m'),
+             AP::maximum_value(5), AP::minimum_value(-1), AP::at_most(1),
+             AP::docstring(std::string("Message level - higher = more output. Default: ")+etdc::repr(message_level)) );
+    cmd.add( AP::collect_into(udpForwards), AP::long_name("udp"), AP::match(rxForward),
+             AP::docstring("Relay UDP datagrams (e.g. a UDT data channel). May be given multiple times") );
+    cmd.add( AP::collect_into(tcpForwards), AP::long_name("tcp"), AP::match(rxForward),
+             AP::docstring("Relay TCP connections. May be given multiple times") );
+    cmd.add( AP::store_into(delay), AP::long_name("delay"), AP::at_most(1),
+             AP::constrain([](double v) { return v>=0; }, "delay should be >= 0"),
+             AP::docstring("One-way delay in milliseconds. Default: 0") );
+    cmd.add( AP::store_into(jitter), AP::long_name("jitter"), AP::at_most(1),
+             AP::constrain([](double v) { return v>=0; }, "jitter should be >= 0"),
+             AP::docstring("Add a uniformly distributed -jitter .. +jitter milliseconds to the delay. Default: 0") );
+    cmd.add( AP::store_into(loss), AP::long_name("loss"), AP::at_most(1),
+             AP::constrain([](double v) { return v>=0 && v<=100; }, "0 .. 100%"),
+             AP::docstring("Lose this percentage of UDP datagrams at random. Default: 0") );
+    cmd.add( AP::store_into(burstLoss), AP::long_name("burst-loss"), AP::at_most(1),
+             AP::constrain([](double v) { return v>=0 && v<=100; }, "0 .. 100%"),
+             AP::docstring("Chance in percent, per UDP datagram, that a burst of losses starts. Default: 0") );
+    cmd.add( AP::store_into(burstLength), AP::long_name("burst-length"), AP::at_most(1),
+             AP::constrain([](double v) { return v>=1; }, "burst length should be >= 1"),
+             AP::docstring(std::string("Mean number of datagrams lost in a burst. Default: ")+etdc::repr(burstLength)) );
+    cmd.add( AP::store_into(reorder), AP::long_name("reorder"), AP::at_most(1),
+             AP::constrain([](double v) { return v>=0 && v<=100; }, "0 .. 100%"),
+             AP::docstring("Hold back this percentage of UDP datagrams by --reorder-delay such that later ones overtake them. Default: 0") );
+    cmd.add( AP::store_into(reorderDelay), AP::long_name("reorder-delay"), AP::at_most(1),
+             AP::constrain([](double v) { return v>=0; }, "reorder delay should be >= 0"),
+             AP::docstring(std::string("Milliseconds that datagrams are held back for. Default: ")+etdc::repr(reorderDelay)) );
+    cmd.add( AP::store_into(rate), AP::long_name("rate"), AP::at_most(1),
+             AP::convert([](std::string const& s) { return max_bw(s); }),
+             AP::constrain([](etdc::max_bw_type const& v) { return untag(v)>=0; }, "rate should be >= 0"),
+             AP::docstring("Bottleneck rate, in bytes per second or e.g. 1Gbps. Default: 0, no bottleneck") );
+    cmd.add( AP::store_into(bucket), AP::long_name("bucket"), AP::at_most(1),
+             AP::docstring("Bytes that may pass the bottleneck at once. Default: one millisecond worth at --rate, at least 64kB") );
+    cmd.add( AP::store_into(queue), AP::long_name("queue"), AP::at_most(1),
+             AP::docstring("Bytes that can wait for the bottleneck before UDP datagrams are dropped. Default: one round trip "
+                           "worth at --rate, at least 64kB") );
+    cmd.add( AP::store_into(seed), AP::long_name("seed"), AP::at_most(1),
+             AP::docstring(std::string("Seed of the random numbers, for repeatable runs. Default: ")+etdc::repr(seed)) );
+    cmd.add( AP::store_into(report), AP::long_name("report"), AP::at_most(1),
+             AP::constrain([](double v) { return v>=0; }, "report interval should be >= 0"),
+             AP::docstring("Print the counters every this many seconds; they are always printed on exit. Default: 0, don't") );
+    cmd.parse(argc, argv);
+
+    etdc::dbglev_fn( message_level );
+    ETDCASSERT(!udpForwards.empty() || !tcpForwards.empty(), "Nothing to relay; give at least one --udp or --tcp");
+
+    impairment_type  imp;
+    imp.delay        = delay/1e3;
+    imp.jitter       = jitter/1e3;
+    imp.loss         = loss/100.0;
+    imp.burstStart   = burstLoss/100.0;
+    imp.burstLength  = burstLength;
+    imp.reorder      = reorder/100.0;
+    imp.reorderDelay = reorderDelay/1e3;
+    imp.rate         = (double)untag(rate);
+    imp.bucket       = bucket ? (double)bucket : std::max(64.0*1024, imp.rate*1e-3);
+    imp.queue        = queue ? (double)queue : std::max(64.0*1024, imp.rate*2*imp.delay);
+
+    // TCP relays hold what would be in flight plus the queue
+    const size_t  tcpLimit = (imp.rate>0 ? (size_t)std::max(256.0*1024, imp.rate*(imp.delay + imp.jitter) + imp.queue + imp.bucket) :
+                                           (size_t)64*1024*1024);
+
+    std::list<link_ptr>  links;
+    uint64_t             linkSeed{ seed };
+    const auto           mk_link = [&](std::string const& name) {
+                                        links.push_back( std::make_shared<link_type>(name, imp, linkSeed++) );
+                                        return links.back();
+                                   };
+    // Set up all of them before relaying anything such that a bad forward
+    // doesn't leave the others running
+    std::vector<forward_type>  udps, tcps;
+    std::transform(udpForwards.begin(), udpForwards.end(), std::back_inserter(udps), mk_forward);
+    std::transform(tcpForwards.begin(), tcpForwards.end(), std::back_inserter(tcps), mk_forward);
+
+    for(auto const& f: udps) {
+        auto up   = mk_link("udp " + f.spec + " up");
+        auto down = mk_link("udp " + f.spec + " down");
+        etdc::thread([=]( void ) {
+                        try { udp_relay(f, up, down); }
+                        catch( std::exception const& e ) { ETDCDEBUG(-1, e.what() << endl); ::_exit(1); }
+                     }).detach();
+    }
+    for(auto const& f: tcps) {
+        auto up   = mk_link("tcp " + f.spec + " up");
+        auto down = mk_link("tcp " + f.spec + " down");
+        etdc::thread([=]( void ) {
+                        try { tcp_relay(f, up, down, tcpLimit); }
+                        catch( std::exception const& e ) { ETDCDEBUG(-1, e.what() << endl); ::_exit(1); }
+                     }).detach();
+    }
+
+    // Wait for ^C et al, printing the counters every now and then
+    sigset_t  sset;
+    sigemptyset(&sset);
+    for(auto s: {SIGHUP, SIGINT, SIGTERM})
+        sigaddset(&sset, s);
+
+    const auto  print = [&]( void ) {
+                            std::ostringstream  oss;
+                            for(auto const& l: links) {
+                                l->report( oss );
+                                oss << std::endl;
+                            }
+                            std::cout << oss.str() << std::flush;
+                        };
+    while( true ) {
+        int  received;
+        if( report>0 ) {
+            struct timespec  ts{ (time_t)report, (long)((report - (double)(time_t)report)*1e9) };
+            received = ::sigtimedwait(&sset, nullptr, &ts);
+            if( received<0 ) {
+                print();
+                continue;
+            }
+        } else
+            ::sigwait(&sset, &received);
+        ETDCDEBUG(1, "etdwan: terminating because of signal#" << received << endl);
+        break;
+    }
+    print();
+    // The relay threads are blocked in system calls; don't wait for them
+    ::_exit( 0 );
+}
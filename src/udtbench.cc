@@ -0,0 +1,318 @@
+// Microbenchmarks of the UDT library internals ("make bench")
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+//
+// Each benchmark repeats a batch of operations on one of the data
+// structures that every UDT packet goes through until enough time has
+// passed and reports the time per operation and the number of packets
+// per second that that would allow. Nothing goes over the network: this
+// is about the CPU that the library's bookkeeping costs.
+//
+//  Usage: udtbench [seconds per benchmark, default 1]
+#include <etdc_sciprint.h>
+
+// UDT internals
+#include <common.h>
+#include <packet.h>
+#include <buffer.h>
+#include <list.h>
+#include <queue.h>
+#include <core.h>
+
+// C++ headers
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <utility>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+// Plain-old-C
+#include <stdlib.h>
+#include <pthread.h>
+
+using namespace std;
+
+// Where the packets come from
+static const int  mss     = 1500;
+static const int  payload = mss - 28 - CPacket::m_iPktHdrSize;
+// Packets per batch; about what a window's worth of ACK covers
+static const int  nBatch  = 64;
+// The sequence number window the loss lists are sized for
+static const int  window  = 8192;
+
+// Keep the compiler from optimizing away what we compute
+static volatile int64_t sink;
+
+struct result_type {
+    std::string  name;
+    uint64_t     nOp;
+    double       seconds;
+};
+
+// Call batch() - which does nOp operations - until minTime has passed
+template <typename F>
+static result_type measure(std::string const& name, double minTime, uint64_t nOp, F batch) {
+    using clock_type = std::chrono::steady_clock;
+    const clock_type::time_point  start( clock_type::now() );
+    result_type                   rv{ name, 0, 0.0 };
+
+    do {
+        for(unsigned int i=0; i<16; i++)
+            batch();
+        rv.nOp    += 16*nOp;
+        rv.seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+    } while( rv.seconds<minTime );
+    return rv;
+}
+
+// A repeatable loss pattern for one window of sequence numbers, as
+// (first, last) offsets of lost ranges
+using losslist_type = std::vector<std::pair<int32_t, int32_t>>;
+
+static losslist_type random_loss(double p) {
+    losslist_type  rv;
+    uint32_t       state{ 42 };
+
+    for(int32_t off=0; off<window; off++) {
+        state = state*1664525 + 1013904223;
+        if( (double)(state>>8)/(double)(1<<24)<p )
+            rv.emplace_back(off, off);
+    }
+    return rv;
+}
+
+static losslist_type burst_loss(int32_t every, int32_t length) {
+    losslist_type  rv;
+    for(int32_t off=every/2; off+length<window; off+=every)
+        rv.emplace_back(off, off + length - 1);
+    return rv;
+}
+
+// Has the access to the UDT classes' insides that the benchmarks need
+class CUDTBench {
+    public:
+        // A UDT instance that is never connected, only scheduled
+        static CUDT* mk_udt( void ) {
+            CUDT*  u = new CUDT();
+            u->open();
+            return u;
+        }
+        static void rm_udt(CUDT* u) {
+            delete u;
+        }
+
+        // The sender's list of sockets, ordered by when they may send
+        // next: take the first, give it a new time
+        static result_type sndulist(double minTime, int nSocket) {
+            CSndUList        list;
+            CTimer           timer;
+            pthread_mutex_t  windowLock;
+            pthread_cond_t   windowCond;
+            vector<CUDT*>    udts;
+
+            pthread_mutex_init(&windowLock, NULL);
+            pthread_cond_init(&windowCond, NULL);
+            list.m_pTimer      = &timer;
+            list.m_pWindowLock = &windowLock;
+            list.m_pWindowCond = &windowCond;
+
+            for(int i=0; i<nSocket; i++) {
+                udts.push_back( mk_udt() );
+                list.insert(1 + i, udts.back());
+            }
+            // Sockets that send at different rates
+            const result_type rv = measure("CSndUList reschedule (" + to_string(nSocket) + " sockets)", minTime, nBatch, [&]( void ) {
+                for(int i=0; i<nBatch; i++) {
+                    const uint64_t ts = list.getNextProcTime();
+                    CUDT* const    u  = list.m_pHeap[0]->m_pUDT;
+
+                    list.remove(u);
+                    list.insert((int64_t)ts + 10 + (int64_t)(reinterpret_cast<uintptr_t>(u)>>4) % 97, u);
+                }
+            });
+            for(auto u: udts) {
+                list.remove(u);
+                rm_udt(u);
+            }
+            pthread_cond_destroy(&windowCond);
+            pthread_mutex_destroy(&windowLock);
+            return rv;
+        }
+};
+
+static result_type snd_buffer(double minTime) {
+    CSndBuffer     buf(32, mss - 28);
+    vector<char>   data(nBatch * payload, 'x');
+    char*          p;
+    int32_t        msgno;
+
+    return measure("CSndBuffer addBuffer+readData+ackData", minTime, nBatch, [&]( void ) {
+        buf.addBuffer(&data[0], (int)data.size());
+        for(int i=0; i<nBatch; i++)
+            sink += buf.readData(&p, msgno);
+        buf.ackData(nBatch);
+    });
+}
+
+static result_type rcv_buffer(double minTime) {
+    CUnitQueue     units;
+    vector<char>   data(nBatch * payload);
+
+    units.init(2*nBatch, payload + CPacket::m_iPktHdrSize, AF_INET);
+    CRcvBuffer     buf(&units, 8192);
+
+    return measure("CRcvBuffer addData+ackData+readBuffer", minTime, nBatch, [&]( void ) {
+        for(int i=0; i<nBatch; i++) {
+            CUnit* const u = units.getNextAvailUnit();
+            u->m_Packet.setLength(payload);
+            buf.addData(u, i);
+        }
+        buf.ackData(nBatch);
+        sink += buf.readBuffer(&data[0], (int)data.size());
+    });
+}
+
+// The sender gets the losses from NAKs, retransmits them one by one
+// and forgets about everything up to the ACK
+static result_type snd_losslist(double minTime, std::string const& what, losslist_type const& losses) {
+    CSndLossList   list(2*window);
+    int32_t        base{ 0 };
+    uint64_t       nLost{ 0 };
+
+    for(auto const& l: losses)
+        nLost += l.second - l.first + 1;
+    return measure("CSndLossList insert+getLostSeq+remove (" + what + ")", minTime, 2*nLost + 1, [&]( void ) {
+        for(auto const& l: losses)
+            list.insert(CSeqNo::incseq(base, l.first), CSeqNo::incseq(base, l.second));
+        for(int32_t seq = list.getLostSeq(); seq>=0; seq = list.getLostSeq())
+            sink += seq;
+        base = CSeqNo::incseq(base, window);
+        list.remove(CSeqNo::decseq(base));
+    });
+}
+
+// The receiver notes the gaps it sees and removes them as the
+// retransmissions come in, newest loss first
+static result_type rcv_losslist(double minTime, std::string const& what, losslist_type const& losses) {
+    CRcvLossList   list(2*window);
+    int32_t        base{ 0 };
+    uint64_t       nLost{ 0 };
+
+    for(auto const& l: losses)
+        nLost += l.second - l.first + 1;
+    return measure("CRcvLossList insert+remove (" + what + ")", minTime, losses.size() + nLost, [&]( void ) {
+        for(auto const& l: losses)
+            list.insert(CSeqNo::incseq(base, l.first), CSeqNo::incseq(base, l.second));
+        for(auto l = losses.rbegin(); l!=losses.rend(); l++)
+            for(int32_t off = l->first; off<=l->second; off++)
+                sink += list.remove(CSeqNo::incseq(base, off));
+        base = CSeqNo::incseq(base, window);
+    });
+}
+
+static result_type packet_data(double minTime) {
+    CPacket        pkt;
+    vector<char>   data(payload);
+
+    return measure("CPacket data header fill+decode", minTime, nBatch, [&]( void ) {
+        for(int i=0; i<nBatch; i++) {
+            pkt.m_iSeqNo     = i;
+            pkt.m_iMsgNo     = (i & 0x1FFFFFFF) | (3 << 30);
+            pkt.m_iTimeStamp = i*10;
+            pkt.m_iID        = 42;
+            pkt.m_pcData     = &data[0];
+            pkt.setLength(payload);
+            sink += pkt.getFlag() + pkt.getMsgSeq() + pkt.getMsgBoundary() + pkt.getLength();
+        }
+    });
+}
+
+static result_type packet_control(double minTime) {
+    CPacket        pkt;
+    int32_t        ack[6] = { 1, 2, 3, 4, 5, 6 };
+    int32_t        ackno{ 0 };
+
+    return measure("CPacket pack(ACK)+decode", minTime, nBatch, [&]( void ) {
+        for(int i=0; i<nBatch; i++) {
+            ackno = i;
+            pkt.pack(2, &ackno, ack, sizeof(ack));
+            sink += pkt.getType() + pkt.getAckSeqNo() + pkt.getLength();
+        }
+    });
+}
+
+// Every packet that arrives is looked up by socket id; ids are handed out
+// counting down from a random start
+static result_type hash_lookup(double minTime, int nSocket) {
+    CHash            hash;
+    vector<int32_t>  ids;
+    vector<char>     dummies(nSocket);
+
+    hash.init(1024);
+    for(int i=0; i<nSocket; i++) {
+        ids.push_back( 123456789 - i );
+        hash.insert(ids.back(), reinterpret_cast<CUDT*>(&dummies[i]));
+    }
+    size_t  n{ 0 };
+    return measure("CHash lookup (" + to_string(nSocket) + " sockets)", minTime, nBatch, [&]( void ) {
+        for(int i=0; i<nBatch; i++, n++)
+            sink += (hash.lookup(ids[n % ids.size()])!=NULL);
+    });
+}
+
+int main(int argc, char const*const*const argv) {
+    const double         minTime( argc>1 ? ::atof(argv[1]) : 1.0 );
+    vector<result_type>  results;
+
+    if( minTime<=0 ) {
+        cerr << "Usage: " << argv[0] << " [seconds per benchmark, default 1]" << endl;
+        return 1;
+    }
+    CUDT::startup();
+
+    const losslist_type  random1( random_loss(0.01) ), bursts( burst_loss(1000, 32) );
+
+    results.push_back( snd_buffer(minTime) );
+    results.push_back( rcv_buffer(minTime) );
+    results.push_back( snd_losslist(minTime, "1% random", random1) );
+    results.push_back( snd_losslist(minTime, "bursts of 32", bursts) );
+    results.push_back( rcv_losslist(minTime, "1% random", random1) );
+    results.push_back( rcv_losslist(minTime, "bursts of 32", bursts) );
+    results.push_back( packet_data(minTime) );
+    results.push_back( packet_control(minTime) );
+    results.push_back( hash_lookup(minTime, 16) );
+    results.push_back( hash_lookup(minTime, 4096) );
+    results.push_back( CUDTBench::sndulist(minTime, 16) );
+    results.push_back( CUDTBench::sndulist(minTime, 1024) );
+
+    size_t  w{ 9 };
+    for(auto const& r: results)
+        w = std::max(w, r.name.size());
+    cout << left << setw(w) << "benchmark" << right << setw(14) << "ops" << setw(12) << "ns/op" << setw(16) << "packets/s" << endl;
+    for(auto const& r: results)
+        cout << left << setw(w) << r.name << right << setw(14) << r.nOp
+             << setw(12) << fixed << setprecision(2) << 1e9*r.seconds/r.nOp
+             << setw(16) << etdc::sciprint(r.nOp/r.seconds, "", std::setprecision(3)) << endl;
+    CUDT::cleanup();
+    return 0;
+}